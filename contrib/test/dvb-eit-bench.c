@@ -0,0 +1,410 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Benchmark of the libdvbv5 EIT parser
+ *
+ * Parses EIT sections with dvb_table_eit_init(), which converts the event
+ * names and descriptions to the output charset. The sections are either
+ * read from a file, which may be a recorded MPEG-TS (EIT is taken from
+ * PID 0x12) or raw sections one after another, or generated with event
+ * strings in a mix of the charsets used by EN 300 468.
+ *
+ * The number of sections and events parsed per second is reported. With -a,
+ * the sections are parsed into an arena that is reset every COUNT sections,
+ * as an EPG harvester would do once a schedule is stored. With -e, the
+ * sections are fed to the EPG collector, which only parses the first
+ * iteration, as the others are repetitions of the same sections.
+ *
+ *  Example:
+ *             ./dvb-eit-bench -n 10 recording.ts
+ */
+
+#include <config.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/dvb-arena.h>
+#include <libdvbv5/dvb-epg.h>
+#include <libdvbv5/dvb-scan.h>
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/eit.h>
+
+#define TS_SIZE		188
+#define EIT_PID		0x12
+#define MAX_SECTION	4096
+
+struct section {
+	unsigned len;
+	uint8_t buf[MAX_SECTION];
+};
+
+static struct section *sections;
+static unsigned n_sections, max_sections;
+
+static void add_section(const uint8_t *buf, unsigned len)
+{
+	if (len < 3 + 4 || len > MAX_SECTION)
+		return;
+	if (buf[0] < 0x4e || buf[0] > 0x6f)
+		return;
+
+	if (n_sections == max_sections) {
+		max_sections = max_sections ? max_sections * 2 : 1024;
+		sections = realloc(sections, max_sections * sizeof(*sections));
+		if (!sections) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	sections[n_sections].len = len;
+	memcpy(sections[n_sections].buf, buf, len);
+	n_sections++;
+}
+
+static void read_sections(const uint8_t *buf, size_t size)
+{
+	size_t pos = 0;
+
+	while (pos + 3 <= size) {
+		unsigned len = 3 + (((buf[pos + 1] & 0x0f) << 8) | buf[pos + 2]);
+
+		if (buf[pos] == 0xff || pos + len > size)
+			break;
+		add_section(buf + pos, len);
+		pos += len;
+	}
+}
+
+/*
+ * The payload between two packets that start a section is collected and
+ * split into sections. Continuity counters aren't checked; a section with
+ * missing packets is dropped by dvb_table_eit_init() or parsed as garbage,
+ * which is fine for a benchmark.
+ */
+static void read_ts(const uint8_t *buf, size_t size)
+{
+	uint8_t sect[MAX_SECTION + TS_SIZE];
+	unsigned have = 0;
+	bool sync = false;
+	size_t pos;
+
+	for (pos = 0; pos + TS_SIZE <= size; pos += TS_SIZE) {
+		const uint8_t *p = buf + pos;
+		const uint8_t *payload = p + 4;
+		unsigned pid = ((p[1] & 0x1f) << 8) | p[2];
+		unsigned plen;
+
+		if (p[0] != 0x47 || pid != EIT_PID || !(p[3] & 0x10))
+			continue;
+		if (p[3] & 0x20)
+			payload += 1 + p[4];
+		if (payload >= p + TS_SIZE)
+			continue;
+		plen = p + TS_SIZE - payload;
+
+		if (p[1] & 0x40) {
+			unsigned pointer = payload[0];
+
+			if (pointer >= plen)
+				continue;
+			/* end of the previous section */
+			if (sync && have + pointer <= sizeof(sect)) {
+				memcpy(sect + have, payload + 1, pointer);
+				read_sections(sect, have + pointer);
+			}
+			payload += 1 + pointer;
+			plen -= 1 + pointer;
+			have = 0;
+			sync = true;
+		} else if (!sync) {
+			continue;
+		}
+
+		if (have + plen > sizeof(sect)) {
+			sync = false;
+			continue;
+		}
+		memcpy(sect + have, payload, plen);
+		have += plen;
+	}
+
+	if (sync)
+		read_sections(sect, have);
+}
+
+/* Strings in the charsets selected by the first bytes, see EN 300 468 annex A */
+static const struct {
+	uint8_t prefix[3];
+	unsigned prefix_len;
+	const char *text;
+} strings[] = {
+	{ { }, 0, "Nachrichten \xfc" "ber das Wetter und den Verkehr" },
+	{ { 0x05 }, 1, "Haberler ve hava durumu \xfe\xf0\xdd" },
+	{ { 0x10, 0x00, 0x02 }, 3, "Zpr\xe1vy a po\xe8\xed" "as\xed" },
+	{ { 0x10, 0x00, 0x0f }, 3, "Le journal de 20 heures, \xa4 et m\xe9t\xe9o" },
+	{ { 0x01 }, 1, "\xbd\xde\xd2\xde\xe1\xe2\xd8 \xd8 \xdf\xde\xd3\xde\xd4\xd0" },
+	{ { 0x15 }, 1, "Noticias y el tiempo \xc3\xb1" },
+	{ { 0x00 }, 1, "Sport \xa4 News" },
+};
+
+#define N_STRINGS (sizeof(strings) / sizeof(strings[0]))
+
+static unsigned put_string(uint8_t *p, unsigned i)
+{
+	unsigned len = strlen(strings[i].text);
+
+	memcpy(p, strings[i].prefix, strings[i].prefix_len);
+	memcpy(p + strings[i].prefix_len, strings[i].text, len);
+
+	return strings[i].prefix_len + len;
+}
+
+static void generate_sections(unsigned count)
+{
+	uint8_t buf[MAX_SECTION];
+	unsigned s, e, n = 0;
+
+	for (s = 0; s < count; s++) {
+		uint8_t *p = buf + 14;
+		uint32_t crc;
+		unsigned len;
+
+		for (e = 0; e < 8; e++) {
+			uint8_t *event = p, *desc;
+			unsigned desc_len;
+
+			/* event_id, start time, duration */
+			event[0] = e >> 8;
+			event[1] = e;
+			memcpy(event + 2, "\xe3\x2e\x20\x00\x00", 5);
+			memcpy(event + 7, "\x00\x30\x00", 3);
+			p = event + 12;
+
+			/* short event descriptor: name and text */
+			desc = p;
+			p[0] = 0x4d;
+			memcpy(p + 2, "eng", 3);
+			p += 5;
+			p[0] = put_string(p + 1, n++ % N_STRINGS);
+			p += 1 + p[0];
+			p[0] = put_string(p + 1, n++ % N_STRINGS);
+			p += 1 + p[0];
+			desc[1] = p - desc - 2;
+
+			/* extended event descriptor: one item and text */
+			desc = p;
+			p[0] = 0x4e;
+			p[2] = 0x00;
+			memcpy(p + 3, "eng", 3);
+			p += 7;
+			p[0] = put_string(p + 1, n++ % N_STRINGS);
+			p += 1 + p[0];
+			p[0] = put_string(p + 1, n++ % N_STRINGS);
+			p += 1 + p[0];
+			desc[6] = p - desc - 7;
+			p[0] = put_string(p + 1, n++ % N_STRINGS);
+			p += 1 + p[0];
+			desc[1] = p - desc - 2;
+
+			/* running, descriptors_loop_length */
+			desc_len = p - (event + 12);
+			event[10] = 0x80 | (desc_len >> 8);
+			event[11] = desc_len;
+		}
+
+		len = p - buf + 4;
+		buf[0] = 0x50;
+		buf[1] = 0xf0 | ((len - 3) >> 8);
+		buf[2] = len - 3;
+		buf[3] = s >> 16;
+		buf[4] = s >> 8;
+		buf[5] = 0xc1;
+		buf[6] = s;
+		buf[7] = 0xff;
+		memcpy(buf + 8, "\x00\x01\x00\x01", 4);
+		buf[12] = 0xff;
+		buf[13] = 0x50;
+
+		crc = dvb_crc32(buf, len - 4, 0xffffffff);
+		p[0] = crc >> 24;
+		p[1] = crc >> 16;
+		p[2] = crc >> 8;
+		p[3] = crc;
+
+		add_section(buf, len);
+	}
+}
+
+static void epg_change(enum dvb_epg_change_type type,
+		       const struct dvb_epg_section *sect, void *priv)
+{
+	unsigned long *changes = priv;
+
+	(*changes)++;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: dvb-eit-bench [options] [file]\n"
+		"  -a COUNT    parse into an arena, reset every COUNT sections\n"
+		"  -c CHARSET  output charset (default utf-8)\n"
+		"  -e          feed the sections to the EPG collector\n"
+		"  -g COUNT    number of sections to generate if no file is given (default 10000)\n"
+		"  -n COUNT    number of times all sections are parsed (default 10)\n"
+		"  file        MPEG-TS or raw EIT sections\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned iterations = 10, generate = 10000, arena_sections = 0;
+	unsigned long events = 0, descs = 0, changes = 0;
+	const char *charset = "utf-8";
+	struct dvb_v5_fe_parms *parms;
+	struct dvb_arena *arena = NULL;
+	struct dvb_epg *epg = NULL;
+	size_t arena_used = 0;
+	struct timespec start, end;
+	unsigned i, it;
+	double secs;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:c:eg:n:h")) != -1) {
+		switch (opt) {
+		case 'a':
+			arena_sections = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			charset = optarg;
+			break;
+		case 'e':
+			epg = (void *)1;
+			break;
+		case 'g':
+			generate = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind < argc) {
+		FILE *f = fopen(argv[optind], "rb");
+		size_t size = 0, alloc = 0, n;
+		uint8_t *buf = NULL;
+
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+		do {
+			if (size == alloc) {
+				alloc = alloc ? alloc * 2 : 1 << 20;
+				buf = realloc(buf, alloc);
+				if (!buf) {
+					perror("realloc");
+					return 1;
+				}
+			}
+			n = fread(buf + size, 1, alloc - size, f);
+			size += n;
+		} while (n);
+		fclose(f);
+
+		if (size >= 2 * TS_SIZE && buf[0] == 0x47 && buf[TS_SIZE] == 0x47)
+			read_ts(buf, size);
+		else
+			read_sections(buf, size);
+		free(buf);
+	} else {
+		generate_sections(generate);
+	}
+
+	if (!n_sections || !iterations) {
+		fprintf(stderr, "no EIT sections found\n");
+		return 1;
+	}
+
+	parms = dvb_fe_dummy();
+	if (!parms)
+		return 1;
+	parms->output_charset = (char *)charset;
+
+	if (epg) {
+		epg = dvb_epg_alloc(parms, 1, epg_change, &changes);
+		if (!epg) {
+			perror("dvb_epg_alloc");
+			return 1;
+		}
+	}
+
+	if (arena_sections) {
+		arena = dvb_arena_alloc(0);
+		if (!arena) {
+			perror("dvb_arena_alloc");
+			return 1;
+		}
+		dvb_fe_set_arena(parms, arena);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (it = 0; it < iterations; it++) {
+		for (i = 0; i < n_sections; i++) {
+			struct dvb_table_eit *eit = NULL;
+
+			if (epg) {
+				dvb_epg_parse_section(epg, sections[i].buf,
+						      sections[i].len);
+				continue;
+			}
+			dvb_table_eit_init(parms, sections[i].buf,
+					   sections[i].len - DVB_CRC_SIZE, &eit);
+			if (eit && !it) {
+				dvb_eit_event_foreach(event, eit) {
+					events++;
+					dvb_desc_foreach(desc, event)
+						descs++;
+				}
+			}
+			if (!arena) {
+				if (eit)
+					dvb_table_eit_free(eit);
+			} else if ((i + 1) % arena_sections == 0 ||
+				   i + 1 == n_sections) {
+				if (dvb_arena_used(arena) > arena_used)
+					arena_used = dvb_arena_used(arena);
+				dvb_arena_reset(arena);
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%u sections, %lu events, %lu descriptors, parsed %u times\n",
+	       n_sections, events, descs, iterations);
+	printf("%.0f sections/s, %.0f events/s, %.2f us per section\n",
+	       n_sections * (double)iterations / secs,
+	       events * (double)iterations / secs,
+	       secs * 1e6 / ((double)n_sections * iterations));
+
+	if (epg)
+		printf("epg: %lu changes reported\n", changes);
+	if (arena)
+		printf("arena: up to %zu bytes for %u sections\n",
+		       arena_used, arena_sections);
+
+	dvb_fe_close(parms);
+	dvb_epg_free(epg);
+	dvb_arena_free(arena);
+	free(sections);
+	return 0;
+}
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Round-trip test of the userspace IR decoder
+ *
+ * Encodes random scancodes for every protocol ir-encode.c can encode, adds
+ * jitter of up to 10% (at most 150us) to each pulse and space and checks
+ * that the decoder reports each message exactly once, with the right
+ * protocol and scancode.
+ *
+ *  Example:
+ *             ./ir-decode-test -n 2000 -s 1
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <linux/lirc.h>
+
+#include "ir-encode.h"
+#include "ir-decode.h"
+
+/* Longer than the sharp echo message window, so messages don't interact */
+#define GAP_SPACE	200000
+#define MAX_JITTER	150
+
+struct expect {
+	enum rc_proto proto;
+	unsigned scancode;
+	unsigned good;
+	unsigned bad;
+	bool verbose;
+};
+
+static void decoded(void *priv, const struct ir_scancode *sc)
+{
+	struct expect *e = priv;
+
+	if (sc->proto == e->proto && sc->scancode == e->scancode && !sc->repeat) {
+		e->good++;
+		return;
+	}
+	e->bad++;
+	if (e->verbose)
+		printf("\t%s:0x%x: decoded %s:0x%x%s\n",
+		       protocol_name(e->proto), e->scancode,
+		       protocol_name(sc->proto), sc->scancode,
+		       sc->repeat ? " (repeat)" : "");
+}
+
+/*
+ * Random scancode that protocol_scancode_valid() leaves alone, e.g. a necx
+ * scancode that can't be sent as nec.
+ */
+static unsigned random_scancode(enum rc_proto proto)
+{
+	unsigned mask = protocol_scancode_mask(proto);
+
+	for (;;) {
+		unsigned s = ((unsigned)rand() << 16 ^ rand()) & mask;
+
+		switch (proto) {
+		case RC_PROTO_NECX:
+			if (s <= 0xffff || !(((s >> 16) ^ ~(s >> 8)) & 0xff))
+				continue;
+			break;
+		case RC_PROTO_NEC32:
+			if (s <= 0xffffff || !(((s >> 8) ^ ~s) & 0xff))
+				continue;
+			break;
+		case RC_PROTO_RC6_6A_32:
+			if ((s & 0xffff0000) == 0x800f0000)
+				continue;
+			break;
+		case RC_PROTO_RC6_MCE:
+			s = 0x800f0000 | (s & 0xffff);
+			break;
+		default:
+			break;
+		}
+		return s;
+	}
+}
+
+static unsigned jitter(unsigned d)
+{
+	int j = (int)d * (rand() % 21 - 10) / 100;
+
+	if (j > MAX_JITTER)
+		j = MAX_JITTER;
+	if (j < -MAX_JITTER)
+		j = -MAX_JITTER;
+	return d + j;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n count] [-s seed] [-v]\n"
+		"  -n is the number of messages per protocol (default 2000)\n"
+		"  -v shows the messages that were not decoded correctly\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned buf[1024];
+	unsigned count = 2000, seed = 1;
+	unsigned total = 0, failed = 0;
+	struct expect e = {};
+	struct ir_decoder *dec;
+	int p, c;
+
+	while ((c = getopt(argc, argv, "n:s:v")) != -1) {
+		switch (c) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			e.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	srand(seed);
+	dec = ir_decode_alloc(decoded, &e);
+	if (!dec) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (p = 0; p <= RC_PROTO_MAX; p++) {
+		enum rc_proto proto = p;
+		unsigned errors = 0;
+		unsigned i, j, n;
+
+		if (!protocol_encoder_available(proto))
+			continue;
+
+		for (i = 0; i < count; i++) {
+			e.proto = proto;
+			e.scancode = random_scancode(proto);
+			protocol_scancode_valid(&e.proto, &e.scancode);
+			e.good = e.bad = 0;
+
+			n = protocol_encode(e.proto, e.scancode, buf);
+			for (j = 0; j < n; j++)
+				ir_decode_add(dec, !(j & 1), jitter(buf[j]));
+			ir_decode_add(dec, false, GAP_SPACE);
+			ir_decode_flush(dec);
+
+			if (e.good != 1 || e.bad) {
+				if (e.verbose && !e.good)
+					printf("\t%s:0x%x: not decoded\n",
+					       protocol_name(e.proto), e.scancode);
+				errors++;
+			}
+		}
+		printf("%-12s %u/%u\n", protocol_name(proto), count - errors, count);
+		total += count;
+		failed += errors;
+	}
+	ir_decode_free(dec);
+
+	printf("\n%u/%u messages decoded correctly\n", total - failed, total);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1 @@
+../../utils/common/ir-decode.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../utils/common/ir-encode.c
\ No newline at end of file
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Benchmark of the test pattern generator
+ *
+ * Generates frames for every pixel format supported by tpg_s_fourcc(),
+ * single-threaded, line-parallel using a tpg_pool and from a tpg_cache,
+ * reports the achieved frame rates and verifies that all three produce
+ * identical frames.
+ *
+ *  Example:
+ *             ./tpg-bench -w 3840 -h 2160 -t 8
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "v4l2-tpg.h"
+
+struct bench_fmt {
+	u32 fourcc;
+	const char *name;
+};
+
+static const struct bench_fmt formats[] = {
+#include "tpg-bench-formats.h"
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned frame_size(const struct tpg_data *tpg)
+{
+	unsigned size = 0;
+	unsigned p;
+
+	for (p = 0; p < tpg_g_planes(tpg); p++)
+		size += tpg_calc_plane_size(tpg, p);
+	return size;
+}
+
+static double bench(struct tpg_data *tpg, struct tpg_pool *pool,
+		    struct tpg_cache *cache, u8 *buf, unsigned frames)
+{
+	double start = now();
+	unsigned i, p;
+
+	for (i = 0; i < frames; i++) {
+		unsigned offset = 0;
+
+		for (p = 0; p < tpg_g_buffers(tpg); p++) {
+			tpg_fillbuffer_cached(tpg, cache, pool, 0, p, buf + offset);
+			offset += tpg_calc_plane_size(tpg, p);
+		}
+	}
+	return frames / (now() - start);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-w width] [-h height] [-f field] [-t threads] [-n frames] [-p pattern]\n"
+		"  -f is the numerical V4L2_FIELD_* value (default V4L2_FIELD_NONE)\n"
+		"  -t 0 uses one thread per online CPU (default)\n"
+		"  the size is rounded down to the subsampling of each format\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned width = 1920, height = 1080;
+	unsigned field = V4L2_FIELD_NONE;
+	unsigned threads = 0, frames = 30, pattern = TPG_PAT_75_COLORBAR;
+	struct tpg_pool *pool;
+	unsigned failed = 0;
+	unsigned i;
+	int c;
+
+	while ((c = getopt(argc, argv, "w:h:f:t:n:p:")) != -1) {
+		switch (c) {
+		case 'w':
+			width = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			height = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			field = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pattern = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!width || !height || !frames || pattern >= TPG_PAT_NOISE ||
+	    field == V4L2_FIELD_ANY || field == V4L2_FIELD_ALTERNATE ||
+	    field > V4L2_FIELD_INTERLACED_BT) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	pool = tpg_pool_alloc(threads);
+	if (!pool) {
+		fprintf(stderr, "could not create thread pool\n");
+		return 1;
+	}
+	printf("%ux%u, %u frames per format, %u threads\n\n",
+	       width, height, frames, tpg_pool_g_threads(pool));
+	printf("%-8s %-40s %10s %10s %8s %10s\n", "fourcc", "format",
+	       "1 thr fps", "N thr fps", "speedup", "cache fps");
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		const struct bench_fmt *fmt = &formats[i];
+		struct tpg_data tpg;
+		struct tpg_cache *cache;
+		double fps_st, fps_mt, fps_cache;
+		u8 *ref, *buf, *cached;
+		unsigned size, w, h, hdiv = 2, vdiv = 1, p;
+
+		tpg_init(&tpg, width, height);
+		if (tpg_alloc(&tpg, width))
+			break;
+		if (!tpg_s_fourcc(&tpg, fmt->fourcc)) {
+			tpg_free(&tpg);
+			continue;
+		}
+		/*
+		 * Like vivid, round the size to the subsampling of the
+		 * format. With V4L2_FIELD_TOP/BOTTOM, the buffer has half
+		 * of the lines.
+		 */
+		for (p = 0; p < tpg.planes; p++) {
+			if (tpg.hdownsampling[p] > hdiv)
+				hdiv = tpg.hdownsampling[p];
+			if (tpg.vdownsampling[p] > vdiv)
+				vdiv = tpg.vdownsampling[p];
+		}
+		if (V4L2_FIELD_HAS_T_OR_B(field))
+			vdiv *= 2;
+		w = width - width % hdiv;
+		h = height - height % vdiv;
+		if (!w || !h) {
+			tpg_free(&tpg);
+			continue;
+		}
+		/* This also sets crop, compose and bytesperline */
+		tpg_reset_source(&tpg, w, h, field);
+		tpg_s_field(&tpg, field, false);
+		tpg_s_pattern(&tpg, pattern);
+
+		size = frame_size(&tpg);
+		ref = calloc(1, size);
+		buf = calloc(1, size);
+		cached = calloc(1, size);
+		cache = tpg_cache_alloc();
+		if (!ref || !buf || !cached || !cache) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+
+		fps_st = bench(&tpg, NULL, NULL, ref, frames);
+		fps_mt = bench(&tpg, pool, NULL, buf, frames);
+		fps_cache = bench(&tpg, NULL, cache, cached, frames);
+		printf("%-8.4s %-40s %10.1f %10.1f %7.2fx %10.1f", (const char *)&fmt->fourcc,
+		       fmt->name, fps_st, fps_mt, fps_mt / fps_st, fps_cache);
+		if (memcmp(ref, buf, size) || memcmp(ref, cached, size)) {
+			printf("  MISMATCH");
+			failed++;
+		}
+		printf("\n");
+		free(ref);
+		free(buf);
+		free(cached);
+		tpg_cache_free(cache);
+		tpg_free(&tpg);
+	}
+	tpg_pool_free(pool);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1 @@
+../../utils/common/v4l2-tpg-colors.c
\ No newline at end of file
@@ -0,0 +1,435 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Benchmark of the libv4lconvert conversions
+ *
+ * Uses a fake capture device that offers a single source format, generates
+ * frames in that format with the test pattern generator and then converts
+ * them to every destination format that v4lconvert_enum_fmt() emulates.
+ * This is done for every source format the TPG can produce (plus JPEG and
+ * MJPEG, which are compressed from an RGB24 test pattern if libjpeg is
+ * available) and for a few resolutions.
+ *
+ * For each conversion the throughput in MPix/s, the CPU cycles per pixel
+ * (if perf events are available) and the number of heap allocations per
+ * frame are reported. The allocations are only counted after a warm-up
+ * conversion, so in the steady state this should be 0.
+ *
+ *  Example:
+ *             ./v4lconvert-bench -s 1920x1080 -S YUYV
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#include "libv4lconvert.h"
+#include "libv4l-plugin.h"
+#include "v4l2-tpg.h"
+
+struct bench_fmt {
+	u32 fourcc;
+	const char *name;
+};
+
+static const struct bench_fmt formats[] = {
+#include "tpg-bench-formats.h"
+};
+
+static const unsigned default_sizes[][2] = {
+	{ 320, 240 },
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+};
+
+#define MAX_SIZES 16
+
+/*
+ * Count heap allocations by wrapping the glibc allocator. Only calls
+ * made while 'counting' is set are counted.
+ */
+static bool counting;
+static unsigned long allocs;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	if (counting)
+		allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (counting)
+		allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (counting)
+		allocs++;
+	return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNT 1
+#endif
+
+/* A capture device that just offers one pixel format */
+struct fake_dev {
+	u32 fourcc;
+};
+
+static int fake_ioctl(void *dev_ops_priv, int fd, unsigned long request, void *arg)
+{
+	struct fake_dev *dev = dev_ops_priv;
+
+	switch (request) {
+	case VIDIOC_ENUM_FMT: {
+		struct v4l2_fmtdesc *fmt = arg;
+
+		if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || fmt->index)
+			break;
+		fmt->flags = 0;
+		fmt->pixelformat = dev->fourcc;
+		snprintf((char *)fmt->description, sizeof(fmt->description),
+			 "%.4s", (char *)&dev->fourcc);
+		return 0;
+	}
+	case VIDIOC_QUERYCAP: {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "v4lconvert-bench");
+		strcpy((char *)cap->card, "v4lconvert-bench");
+		strcpy((char *)cap->bus_info, "platform:v4lconvert-bench");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+	default:
+		break;
+	}
+	errno = ENOTTY;
+	return -1;
+}
+
+static const struct libv4l_dev_ops fake_dev_ops = {
+	.ioctl = fake_ioctl,
+};
+
+static int perf_fd = -1;
+
+static void perf_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static unsigned long long perf_cycles(void)
+{
+	unsigned long long cycles = 0;
+
+	if (perf_fd >= 0 && read(perf_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+		cycles = 0;
+	return cycles;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static u32 parse_fourcc(const char *s)
+{
+	char fcc[4] = { ' ', ' ', ' ', ' ' };
+
+	memcpy(fcc, s, strnlen(s, 4));
+	return v4l2_fourcc(fcc[0], fcc[1], fcc[2], fcc[3]);
+}
+
+static const char *fcc2s(u32 fourcc, char *s)
+{
+	s[0] = fourcc & 0x7f;
+	s[1] = (fourcc >> 8) & 0x7f;
+	s[2] = (fourcc >> 16) & 0x7f;
+	s[3] = (fourcc >> 24) & 0x7f;
+	strcpy(s + 4, (fourcc & (1U << 31)) ? "-BE" : "");
+	return s;
+}
+
+static u8 *gen_tpg(u32 fourcc, unsigned width, unsigned height,
+		   struct v4l2_format *fmt)
+{
+	struct tpg_data tpg;
+	unsigned size = 0;
+	unsigned p;
+	u8 *buf = NULL;
+
+	tpg_init(&tpg, width, height);
+	if (tpg_alloc(&tpg, width))
+		return NULL;
+	if (!tpg_s_fourcc(&tpg, fourcc) || tpg_g_buffers(&tpg) > 1)
+		goto done;
+	tpg_reset_source(&tpg, width, height, V4L2_FIELD_NONE);
+	tpg_s_pattern(&tpg, TPG_PAT_75_COLORBAR);
+
+	for (p = 0; p < tpg_g_planes(&tpg); p++)
+		size += tpg_calc_plane_size(&tpg, p);
+	buf = malloc(size);
+	if (!buf)
+		goto done;
+	tpg_fillbuffer(&tpg, 0, 0, buf);
+
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
+	fmt->fmt.pix.pixelformat = fourcc;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.bytesperline = tpg_g_bytesperline(&tpg, 0);
+	fmt->fmt.pix.sizeimage = size;
+done:
+	tpg_free(&tpg);
+	return buf;
+}
+
+#ifdef HAVE_JPEG
+static u8 *gen_jpeg(u32 fourcc, unsigned width, unsigned height,
+		    struct v4l2_format *fmt)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	struct v4l2_format rgb_fmt;
+	unsigned char *jpeg = NULL;
+	unsigned long jpeg_size = 0;
+	u8 *rgb;
+
+	rgb = gen_tpg(V4L2_PIX_FMT_RGB24, width, height, &rgb_fmt);
+	if (!rgb)
+		return NULL;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &jpeg, &jpeg_size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 90, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		JSAMPROW row = rgb + cinfo.next_scanline * rgb_fmt.fmt.pix.bytesperline;
+
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(rgb);
+
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
+	fmt->fmt.pix.pixelformat = fourcc;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.sizeimage = jpeg_size;
+	return jpeg;
+}
+#endif
+
+static u8 *gen_frame(u32 fourcc, unsigned width, unsigned height,
+		     struct v4l2_format *fmt)
+{
+	if (fourcc == V4L2_PIX_FMT_JPEG || fourcc == V4L2_PIX_FMT_MJPEG) {
+#ifdef HAVE_JPEG
+		return gen_jpeg(fourcc, width, height, fmt);
+#else
+		return NULL;
+#endif
+	}
+	return gen_tpg(fourcc, width, height, fmt);
+}
+
+static void bench_src(const struct bench_fmt *src, unsigned width, unsigned height,
+		      unsigned frames, u32 dst_filter, unsigned *convs)
+{
+	struct fake_dev dev = { src->fourcc };
+	struct v4lconvert_data *data;
+	struct v4l2_format src_fmt;
+	struct v4l2_fmtdesc desc;
+	u8 *src_buf;
+
+	src_buf = gen_frame(src->fourcc, width, height, &src_fmt);
+	if (!src_buf)
+		return;
+
+	data = v4lconvert_create_with_dev_ops(-1, &dev, &fake_dev_ops);
+	if (!data) {
+		free(src_buf);
+		return;
+	}
+
+	memset(&desc, 0, sizeof(desc));
+	desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	for (desc.index = 0; !v4lconvert_enum_fmt(data, &desc); desc.index++) {
+		struct v4l2_format dst_fmt;
+		char src_fcc[8], dst_fcc[8];
+		unsigned long long cycles;
+		unsigned long n_allocs;
+		double start, elapsed;
+		u8 *dst_buf;
+		unsigned i;
+		int ret;
+
+		if (!(desc.flags & V4L2_FMT_FLAG_EMULATED))
+			continue;
+		if (dst_filter && desc.pixelformat != dst_filter)
+			continue;
+
+		dst_fmt = src_fmt;
+		dst_fmt.fmt.pix.pixelformat = desc.pixelformat;
+		v4lconvert_fixup_fmt(&dst_fmt);
+		dst_buf = malloc(dst_fmt.fmt.pix.sizeimage);
+		if (!dst_buf)
+			break;
+
+		/* Warm-up, this also allocates the intermediate buffers */
+		ret = v4lconvert_convert(data, &src_fmt, &dst_fmt,
+					 src_buf, src_fmt.fmt.pix.sizeimage,
+					 dst_buf, dst_fmt.fmt.pix.sizeimage);
+		if (ret < 0) {
+			free(dst_buf);
+			continue;
+		}
+
+		allocs = 0;
+		counting = true;
+		cycles = perf_cycles();
+		start = now();
+		for (i = 0; i < frames; i++)
+			v4lconvert_convert(data, &src_fmt, &dst_fmt,
+					   src_buf, src_fmt.fmt.pix.sizeimage,
+					   dst_buf, dst_fmt.fmt.pix.sizeimage);
+		elapsed = now() - start;
+		cycles = perf_cycles() - cycles;
+		counting = false;
+		n_allocs = allocs;
+
+		printf("%-7s -> %-4s %-40s %9.1f", fcc2s(src->fourcc, src_fcc),
+		       fcc2s(desc.pixelformat, dst_fcc), src->name,
+		       (double)width * height * frames / elapsed / 1e6);
+		if (perf_fd >= 0)
+			printf(" %8.2f", (double)cycles / ((double)width * height * frames));
+		else
+			printf(" %8s", "-");
+#ifdef HAVE_ALLOC_COUNT
+		printf(" %8.2f\n", (double)n_allocs / frames);
+#else
+		printf(" %8s\n", "-");
+#endif
+		(*convs)++;
+		free(dst_buf);
+	}
+	v4lconvert_destroy(data);
+	free(src_buf);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s WxH] [-n frames] [-S src-fourcc] [-D dst-fourcc]\n"
+		"  -s can be given multiple times, the default is 320x240, 640x480,\n"
+		"     1280x720 and 1920x1080\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned sizes[MAX_SIZES][2];
+	unsigned num_sizes = 0;
+	unsigned frames = 20;
+	u32 src_filter = 0, dst_filter = 0;
+	unsigned convs = 0;
+	unsigned s, i;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:n:S:D:")) != -1) {
+		switch (c) {
+		case 's':
+			if (num_sizes == MAX_SIZES ||
+			    sscanf(optarg, "%ux%u", &sizes[num_sizes][0],
+				   &sizes[num_sizes][1]) != 2 ||
+			    !sizes[num_sizes][0] || !sizes[num_sizes][1]) {
+				usage(argv[0]);
+				return 1;
+			}
+			num_sizes++;
+			break;
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			src_filter = parse_fourcc(optarg);
+			break;
+		case 'D':
+			dst_filter = parse_fourcc(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!frames) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!num_sizes) {
+		num_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+		memcpy(sizes, default_sizes, sizeof(default_sizes));
+	}
+
+	/* Don't let libv4lcontrol add software processing controls */
+	setenv("LIBV4LCONTROL_CONTROLS", "0", 1);
+	perf_open();
+
+	for (s = 0; s < num_sizes; s++) {
+		printf("%ux%u, %u frames per conversion\n\n", sizes[s][0], sizes[s][1], frames);
+		printf("%-15s %-40s %9s %8s %8s\n", "conversion", "source format",
+		       "MPix/s", "cyc/pix", "allocs");
+		for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+			if (src_filter && formats[i].fourcc != src_filter)
+				continue;
+			bench_src(&formats[i], sizes[s][0], sizes[s][1], frames,
+				  dst_filter, &convs);
+		}
+		printf("\n");
+	}
+	if (perf_fd >= 0)
+		close(perf_fd);
+	return convs ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-arena.h
+ * @ingroup dvb_table
+ * @brief Provides an arena allocator for the MPEG-TS table parsers
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_ARENA_H
+#define _DVB_ARENA_H
+
+#include <stddef.h>
+
+#include <libdvbv5/dvb-fe.h>
+
+/**
+ * @struct dvb_arena
+ * @ingroup dvb_table
+ * @brief Opaque arena used to store parsed tables
+ *
+ * @details While an arena is attached to a struct dvb_v5_fe_parms with
+ * dvb_fe_set_arena(), the table parsers (dvb_table_*_init(),
+ * atsc_table_*_init() and dvb_desc_parse()) take all the memory for the
+ * tables, their descriptors and their strings from the arena, instead of
+ * allocating every element with malloc().
+ *
+ * Tables parsed that way must not be freed with the dvb_table_*_free()
+ * functions. They stay valid until the arena is reset with
+ * dvb_arena_reset() or freed with dvb_arena_free(), which release all of
+ * them at once. dvb_get_ts_tables() doesn't use the arena, as its tables
+ * are freed with dvb_scan_free_handler_table().
+ *
+ * An arena is not thread safe: it should be attached to a single
+ * struct dvb_v5_fe_parms at a time.
+ */
+struct dvb_arena;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates an arena
+ * @ingroup dvb_table
+ *
+ * @param chunk_size	Size of the memory blocks the arena takes from the
+ *			system. If zero, a default of 64 KiB is used. Bigger
+ *			blocks are allocated when needed.
+ *
+ * @return Returns a pointer to the arena, or NULL if no memory.
+ */
+struct dvb_arena *dvb_arena_alloc(size_t chunk_size);
+
+/**
+ * @brief Releases all tables parsed into an arena
+ * @ingroup dvb_table
+ *
+ * @param arena		Arena to reset
+ *
+ * @details The memory blocks are kept by the arena and reused by the
+ * next tables, so a reset doesn't call free().
+ */
+void dvb_arena_reset(struct dvb_arena *arena);
+
+/**
+ * @brief Frees an arena and all tables parsed into it
+ * @ingroup dvb_table
+ *
+ * @param arena		Arena to free. The arena should not be attached to
+ *			any struct dvb_v5_fe_parms anymore.
+ */
+void dvb_arena_free(struct dvb_arena *arena);
+
+/**
+ * @brief Returns the number of bytes used by the tables parsed into an arena
+ * @ingroup dvb_table
+ *
+ * @param arena		Arena to check
+ */
+size_t dvb_arena_used(const struct dvb_arena *arena);
+
+/**
+ * @brief Attaches an arena to the table parsers
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer
+ * @param arena		Arena where the tables will be parsed into, or NULL
+ *			to allocate the tables with malloc() again
+ *
+ * @return Returns the arena that was previously attached, if any.
+ */
+struct dvb_arena *dvb_fe_set_arena(struct dvb_v5_fe_parms *parms,
+				   struct dvb_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
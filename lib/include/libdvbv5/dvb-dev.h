@@ -95,6 +95,41 @@ struct dvb_dev_list {
 	char *serial;
 };
 
+/**
+ * @def DVB_DEV_STREAM_COUNT
+ *	@brief Default number of buffers used by dvb_dev_stream_start()
+ * @ingroup dvb_device
+ * @def DVB_DEV_STREAM_SIZE
+ *	@brief Default size of the buffers used by dvb_dev_stream_start().
+ *	It is a multiple of both the TS packet size and of the page size.
+ *	The Kernel accepts buffers up to 188 * 4096 bytes.
+ * @ingroup dvb_device
+ */
+#define DVB_DEV_STREAM_COUNT	32
+#define DVB_DEV_STREAM_SIZE	(188 * 1024)
+
+/**
+ * @struct dvb_dev_buffer
+ *	@brief Buffer filled by a demux or dvr, as returned by
+ *	dvb_dev_stream_get()
+ * @ingroup dvb_device
+ *
+ * @param data		filtered data
+ * @param len		number of bytes at data
+ * @param index		number of the buffer
+ * @param flags		flags reported by the Kernel, as defined by
+ *			enum dmx_buffer_flags. Always zero when the buffers
+ *			are filled by read()
+ * @param count		sequence number of the buffer
+ */
+struct dvb_dev_buffer {
+	const void *data;
+	size_t len;
+	unsigned index;
+	uint32_t flags;
+	uint32_t count;
+};
+
 /**
  * @enum dvb_dev_change_type
  *	@brief Describes the type of change to be notifier_delay
@@ -339,6 +374,67 @@ int dvb_dev_get_fd(struct dvb_open_descriptor *open_dev);
 ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count);
 
+/**
+ * @brief Starts streaming from a dvb demux or dvr via a set of buffers
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param count		number of buffers. Zero means DVB_DEV_STREAM_COUNT
+ * @param size		size of each buffer. Zero means DVB_DEV_STREAM_SIZE
+ *
+ * If the Kernel supports it, the demux buffers are memory-mapped
+ * (DMX_REQBUFS, DMX_QUERYBUF and mmap()), and the data is handed to the
+ * application without being copied to userspace. Otherwise, or for remote
+ * devices, the buffers are allocated by the library and filled with read().
+ *
+ * The Kernel only hands a mapped buffer to the application after filling
+ * it. So, the size should be small enough for a buffer to be filled in
+ * a fraction of a second at the bitrate of the stream. When streaming
+ * stops, the data at the buffer that was being filled is lost.
+ *
+ * The buffers are released when the device is closed.
+ *
+ * @return Returns the number of buffers mapped from the Kernel, zero if
+ * they'll be filled by read(), or a negative value on error.
+ *
+ * @note valid only for DVB_DEVICE_DEMUX or DVB_DEVICE_DVR. As the data
+ * of several reads can be merged on a buffer, it should not be used with
+ * section filters.
+ */
+int dvb_dev_stream_start(struct dvb_open_descriptor *open_dev,
+			 unsigned count, unsigned size);
+
+/**
+ * @brief Waits for a buffer filled by the demux or dvr
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param buf		filled with the buffer data
+ *
+ * The buffer belongs to the application until it is given back with
+ * dvb_dev_stream_put(). The buffers can be given back on any order, and
+ * from another thread.
+ *
+ * @return Returns zero on success, or a negative value on error. Like
+ * on dvb_dev_read(), -EOVERFLOW means that the Kernel buffer overflowed.
+ * -ENOBUFS means that all buffers are with the application. -EINTR means
+ * that a signal arrived while waiting for a mapped buffer.
+ */
+int dvb_dev_stream_get(struct dvb_open_descriptor *open_dev,
+		       struct dvb_dev_buffer *buf);
+
+/**
+ * @brief Gives back a buffer returned by dvb_dev_stream_get()
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param buf		buffer to give back
+ *
+ * @return Returns zero on success, or a negative value on error.
+ */
+int dvb_dev_stream_put(struct dvb_open_descriptor *open_dev,
+		       struct dvb_dev_buffer *buf);
+
 /**
  * @brief Stops the demux filter for a given file descriptor
  * @ingroup dvb_device
@@ -474,6 +570,58 @@ struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
 					unsigned other_nit,
 					unsigned timeout_multiply);
 
+struct dvb_fe_monitor_sample;
+
+/**
+ * @brief Starts sampling the statistics of the opened frontend
+ * @ingroup dvb_device
+ *
+ * @param dvb		pointer to struct dvb_device
+ * @param period	sampling period, in milliseconds
+ * @param cmds		statistics to be sampled, as in dvb_fe_monitor_add()
+ * @param n_cmds	number of elements at cmds
+ * @param history	number of samples kept for each statistic and layer
+ *
+ * @details The frontend is sampled by a thread, on the machine where the
+ * device is, so a remote client can retrieve a whole time series with a
+ * single dvb_dev_fe_monitor_get() call. A previous monitor is stopped.
+ *
+ * @return Returns zero on success, or a negative value on error.
+ */
+int dvb_dev_fe_monitor_start(struct dvb_device *dvb, unsigned period,
+			     const uint32_t *cmds, unsigned n_cmds,
+			     unsigned history);
+
+/**
+ * @brief Retrieves the samples taken by the frontend monitor
+ * @ingroup dvb_device
+ *
+ * @param dvb		pointer to struct dvb_device
+ * @param cmd		statistic, as in dvb_fe_monitor_get_samples()
+ * @param layer		layer of the statistic
+ * @param samples	array where the samples will be stored, from the
+ *			oldest to the newest
+ * @param max		number of elements at samples
+ *
+ * @return Returns the number of samples stored, or a negative value on error.
+ */
+int dvb_dev_fe_monitor_get(struct dvb_device *dvb, uint32_t cmd,
+			   unsigned layer,
+			   struct dvb_fe_monitor_sample *samples,
+			   unsigned max);
+
+/**
+ * @brief Stops the frontend monitor
+ * @ingroup dvb_device
+ *
+ * @param dvb		pointer to struct dvb_device
+ *
+ * @details The monitor is also stopped when the frontend is closed.
+ *
+ * @return Returns zero on success, or a negative value on error.
+ */
+int dvb_dev_fe_monitor_stop(struct dvb_device *dvb);
+
 /* From dvb-dev-remote.c */
 
 #ifdef HAVE_DVBV5_REMOTE
@@ -0,0 +1,215 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-epg.h
+ * @ingroup dvb_table
+ * @brief Provides a collector that keeps an EPG up to date from the EIT
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_EPG_H
+#define _DVB_EPG_H
+
+#include <stdint.h>
+#include <unistd.h> /* size_t */
+
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/eit.h>
+
+/**
+ * @def DVB_EPG_PID
+ *	@brief Program ID where the EIT is transmitted
+ * @ingroup dvb_table
+ */
+#define DVB_EPG_PID	0x12
+
+/**
+ * @enum dvb_epg_change_type
+ *	@brief Describes the type of change reported by the EPG collector
+ * @ingroup dvb_table
+ *
+ * @param DVB_EPG_SECTION_NEW		A section was received for the first
+ *					time since the sub-table version
+ *					changed
+ * @param DVB_EPG_SECTION_CHANGE	The contents of a section changed
+ *					without a new sub-table version
+ * @param DVB_EPG_SECTION_REMOVE	A new sub-table version was received,
+ *					so a section of the old version is
+ *					no longer valid
+ * @param DVB_EPG_TABLE_COMPLETE	All sections of a sub-table version
+ *					were received
+ */
+enum dvb_epg_change_type {
+	DVB_EPG_SECTION_NEW,
+	DVB_EPG_SECTION_CHANGE,
+	DVB_EPG_SECTION_REMOVE,
+	DVB_EPG_TABLE_COMPLETE,
+};
+
+/**
+ * @struct dvb_epg_section
+ *	@brief EIT section reported by the EPG collector
+ * @ingroup dvb_table
+ *
+ * @param network_id	original network ID
+ * @param transport_id	transport stream ID
+ * @param service_id	service ID
+ * @param table_id	table ID: 0x4e/0x4f for present/following, or
+ *			0x50 to 0x6f for the schedule
+ * @param version	version of the sub-table
+ * @param section	section number. Not used for DVB_EPG_TABLE_COMPLETE
+ * @param eit		parsed section, for DVB_EPG_SECTION_NEW and
+ *			DVB_EPG_SECTION_CHANGE. NULL otherwise.
+ *
+ * A sub-table is identified by the network, transport, service and table
+ * IDs. The eit struct is only valid during the callback: a copy should be
+ * made of the events that need to be kept.
+ */
+struct dvb_epg_section {
+	uint16_t network_id;
+	uint16_t transport_id;
+	uint16_t service_id;
+	uint8_t table_id;
+	uint8_t version;
+	uint8_t section;
+	const struct dvb_table_eit *eit;
+};
+
+/**
+ * @brief Describes a callback for the EPG collector
+ * @ingroup dvb_table
+ *
+ * @param type		type of change, as defined by enum dvb_epg_change_type
+ * @param sect		sub-table and section that changed
+ * @param priv		private data given to dvb_epg_alloc()
+ */
+typedef void (*dvb_epg_change_t)(enum dvb_epg_change_type type,
+				 const struct dvb_epg_section *sect,
+				 void *priv);
+
+/**
+ * @struct dvb_epg
+ * @ingroup dvb_table
+ * @brief Opaque struct with the state of the EPG collector
+ *
+ * @details The collector keeps the version and the CRC of every section
+ * of every EIT sub-table it has seen. A section is only parsed when it is
+ * new or its version or CRC changed, so the repetitions of the EIT, which
+ * are most of what is received, cost a hash lookup.
+ *
+ * Schedule sub-tables are considered complete according to the segment
+ * structure of EN 300 468: each segment of 8 sections up to last_section
+ * is complete once its sections up to segment_last_section were received.
+ */
+struct dvb_epg;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates an EPG collector
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer, used for logging
+ *			and charset conversion
+ * @param other		If not zero, the EIT of other transport streams
+ *			(table IDs 0x4f and 0x60 to 0x6f) is also collected
+ * @param handler	Callback for the changes
+ * @param priv		Private data passed to the callback
+ *
+ * @return Returns a pointer to the collector, or NULL if no memory.
+ */
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms, unsigned other,
+			      dvb_epg_change_t handler, void *priv);
+
+/**
+ * @brief Frees an EPG collector
+ * @ingroup dvb_table
+ *
+ * @param epg		EPG collector
+ */
+void dvb_epg_free(struct dvb_epg *epg);
+
+/**
+ * @brief Discards the state of all sub-tables
+ * @ingroup dvb_table
+ *
+ * @param epg		EPG collector
+ *
+ * @details Should be called after tuning to another transponder, if the
+ * sub-tables of the previous one won't be received anymore.
+ * DVB_EPG_SECTION_REMOVE is reported for all sections.
+ */
+void dvb_epg_reset(struct dvb_epg *epg);
+
+/**
+ * @brief Feeds an EIT section to the collector
+ * @ingroup dvb_table
+ *
+ * @param epg		EPG collector
+ * @param buf		Section, including its CRC
+ * @param buflen	Length of the section
+ *
+ * @details The CRC of the section is checked if it needs to be parsed.
+ * The callback is called before this function returns.
+ *
+ * @return Returns 1 if the section was parsed, 0 if it was ignored because
+ * it didn't change or isn't an EIT section the collector wants, or a
+ * negative value if the section is invalid.
+ */
+int dvb_epg_parse_section(struct dvb_epg *epg, const uint8_t *buf,
+			  size_t buflen);
+
+/**
+ * @brief Sets a section filter for the EIT at a demux
+ * @ingroup dvb_table
+ *
+ * @param epg		EPG collector
+ * @param dmx_fd	File descriptor of the demux
+ *
+ * @return Returns zero on success, -1 otherwise.
+ */
+int dvb_epg_set_filter(struct dvb_epg *epg, int dmx_fd);
+
+/**
+ * @brief Reads EIT sections from a demux and feeds them to the collector
+ * @ingroup dvb_table
+ *
+ * @param epg		EPG collector
+ * @param dmx_fd	File descriptor of the demux, with the filter set by
+ *			dvb_epg_set_filter()
+ * @param timeout	Time to wait for a section, in milliseconds
+ *
+ * @details All the sections that are already available are read, so
+ * this function can be called in the main loop of an application when
+ * poll() reports the demux readable.
+ *
+ * @return Returns the number of sections parsed, or a negative value if
+ * no section was read before the timeout or on read errors.
+ */
+int dvb_epg_read(struct dvb_epg *epg, int dmx_fd, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
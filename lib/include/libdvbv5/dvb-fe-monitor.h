@@ -0,0 +1,226 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-fe-monitor.h
+ * @ingroup frontend
+ * @brief Provides a monitor that samples the statistics of several frontends
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_FE_MONITOR_H
+#define _DVB_FE_MONITOR_H
+
+#include <stdint.h>
+
+#include <libdvbv5/dvb-fe.h>
+
+/**
+ * @struct dvb_fe_monitor_sample
+ *	@brief A sample of a frontend statistic
+ * @ingroup frontend
+ *
+ * @param timestamp	time when the sample was taken, in microseconds,
+ *			from CLOCK_MONOTONIC
+ * @param scale		scale of the value, as defined by
+ *			enum fecap_scale_params. FE_SCALE_NOT_AVAILABLE if
+ *			the frontend didn't have the statistic at that time
+ * @param uvalue	value, for FE_SCALE_RELATIVE and FE_SCALE_COUNTER
+ * @param svalue	value, for FE_SCALE_DECIBEL, in 0.001 dB steps
+ *
+ * For DTV_STATUS, uvalue contains the fe_status_t flags.
+ */
+struct dvb_fe_monitor_sample {
+	uint64_t timestamp;
+	uint32_t scale;
+	union {
+		uint64_t uvalue;
+		int64_t svalue;
+	};
+};
+
+/**
+ * @struct dvb_fe_monitor
+ * @ingroup frontend
+ * @brief Opaque struct with the state of the frontend monitor
+ *
+ * @details The monitor samples the statistics of all its frontends at a
+ * fixed period, with a single FE_GET_PROPERTY call per frontend that only
+ * asks for the statistics that were subscribed. Status changes are also
+ * reported as soon as the frontend notifies them.
+ *
+ * The samples of each statistic and layer are kept on a ring buffer, so
+ * rates and error ratios can be computed over a time window only when
+ * they are needed, instead of at every sample.
+ */
+struct dvb_fe_monitor;
+
+/**
+ * @brief Describes a callback for the frontend monitor
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ * @param fe		frontend ID, as returned by dvb_fe_monitor_add()
+ * @param priv		private data given to dvb_fe_monitor_alloc()
+ *
+ * Called after a frontend was sampled or reported a status change.
+ */
+typedef void (*dvb_fe_monitor_handler_t)(struct dvb_fe_monitor *mon, int fe,
+					 void *priv);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates a frontend monitor
+ * @ingroup frontend
+ *
+ * @param period	sampling period, in milliseconds
+ * @param handler	callback for the new samples. Can be NULL
+ * @param priv		private data passed to the callback
+ *
+ * @return Returns a pointer to the monitor, or NULL if no memory.
+ */
+struct dvb_fe_monitor *dvb_fe_monitor_alloc(unsigned period,
+					    dvb_fe_monitor_handler_t handler,
+					    void *priv);
+
+/**
+ * @brief Frees a frontend monitor
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ *
+ * @details The frontends aren't closed.
+ */
+void dvb_fe_monitor_free(struct dvb_fe_monitor *mon);
+
+/**
+ * @brief Adds a frontend to the monitor
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ * @param parms		frontend, opened with dvb_fe_open() or dvb_dev_open()
+ *			on a local device
+ * @param cmds		statistics to be sampled: DTV_STATUS and the
+ *			DTV_STAT_* kernel statistics. DTV_BER, DTV_PRE_BER and
+ *			DTV_PER are also accepted, and select the error and
+ *			total counters needed to calculate them
+ * @param n_cmds	number of elements at cmds
+ * @param history	number of samples kept for each statistic and layer
+ *
+ * @return Returns the ID of the frontend on the monitor, or a negative
+ * value on error.
+ */
+int dvb_fe_monitor_add(struct dvb_fe_monitor *mon,
+		       struct dvb_v5_fe_parms *parms,
+		       const uint32_t *cmds, unsigned n_cmds,
+		       unsigned history);
+
+/**
+ * @brief Removes a frontend from the monitor
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ * @param fe		frontend ID, as returned by dvb_fe_monitor_add()
+ */
+void dvb_fe_monitor_remove(struct dvb_fe_monitor *mon, int fe);
+
+/**
+ * @brief Waits for frontend events and samples the frontends when due
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ * @param timeout	maximum time to wait, in milliseconds. A negative
+ *			value waits until the next sampling period
+ *
+ * @details This is meant to be called in a loop, either at a thread or at
+ * the application main loop. The callback is called for each frontend that
+ * was updated. The other functions can be called from other threads, but
+ * only one thread should call this one.
+ *
+ * @return Returns the number of frontends that were updated, zero on
+ * timeout or a negative value on error.
+ */
+int dvb_fe_monitor_poll(struct dvb_fe_monitor *mon, int timeout);
+
+/**
+ * @brief Retrieves the latest samples of a statistic
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ * @param fe		frontend ID, as returned by dvb_fe_monitor_add()
+ * @param cmd		DTV_STATUS or a DTV_STAT_* kernel statistic
+ * @param layer		layer of the statistic
+ * @param samples	array where the samples will be stored, from the
+ *			oldest to the newest
+ * @param max		number of elements at samples
+ *
+ * @return Returns the number of samples stored, or a negative value if
+ * the statistic isn't monitored.
+ */
+int dvb_fe_monitor_get_samples(struct dvb_fe_monitor *mon, int fe,
+			       uint32_t cmd, unsigned layer,
+			       struct dvb_fe_monitor_sample *samples,
+			       unsigned max);
+
+/**
+ * @brief Calculates how fast a counter increases
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ * @param fe		frontend ID, as returned by dvb_fe_monitor_add()
+ * @param cmd		a DTV_STAT_* counter, like DTV_STAT_ERROR_BLOCK_COUNT
+ * @param layer		layer of the statistic
+ * @param window	time window, in milliseconds
+ * @param rate		the increase per second
+ *
+ * @return Returns zero on success, or a negative value if there aren't at
+ * least two samples with the counter available on the window.
+ */
+int dvb_fe_monitor_rate(struct dvb_fe_monitor *mon, int fe,
+			uint32_t cmd, unsigned layer, unsigned window,
+			float *rate);
+
+/**
+ * @brief Calculates an error ratio
+ * @ingroup frontend
+ *
+ * @param mon		frontend monitor
+ * @param fe		frontend ID, as returned by dvb_fe_monitor_add()
+ * @param cmd		DTV_BER, DTV_PRE_BER or DTV_PER
+ * @param layer		layer of the statistic
+ * @param window	time window, in milliseconds
+ * @param ratio		errors divided by the total bits or blocks received
+ *			during the window
+ *
+ * @return Returns zero on success, or a negative value if the counters
+ * aren't available or didn't change during the window.
+ */
+int dvb_fe_monitor_error_ratio(struct dvb_fe_monitor *mon, int fe,
+			       uint32_t cmd, unsigned layer, unsigned window,
+			       float *ratio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -147,6 +147,38 @@ struct dvb_v5_fe_parms {
 	char				*output_charset;
 };
 
+/**
+ * @struct dvb_fe_tune_info
+ * @ingroup frontend
+ * @brief What the tuning cache knows about a transponder
+ *
+ * @param delivery_system	Delivery system
+ * @param frequency		Frequency asked by the client, as stored at
+ *				DTV_FREQUENCY
+ * @param polarization		Polarization, for satellite systems
+ * @param sat_number		Number of the satellite
+ * @param tunes			Number of times the transponder was tuned
+ * @param locks			Number of tunes that got a lock
+ * @param lock_time		Time the last lock took, in milliseconds
+ * @param freq_offset		Difference between the frequency reported by
+ *				the frontend at the last lock and the one asked
+ *
+ * @details The lock time is measured from the tune up to the first call
+ * to dvb_fe_get_stats() that reports a lock, so its precision depends on
+ * how often the client checks the frontend status.
+ */
+struct dvb_fe_tune_info {
+	uint32_t			delivery_system;
+	uint32_t			frequency;
+	uint32_t			polarization;
+	int				sat_number;
+
+	unsigned			tunes;
+	unsigned			locks;
+	unsigned			lock_time;
+	int				freq_offset;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -734,6 +766,51 @@ int dvb_fe_is_satellite(uint32_t delivery_system);
 int dvb_fe_set_default_country(struct dvb_v5_fe_parms *parms,
 			       const char *country);
 
+/**
+ * @brief Enables or disables the tuning cache
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param enable	a value different than 0 enables the cache
+ *
+ * While the cache is enabled, dvb_fe_set_parms() remembers how the
+ * frontend was set, in order to re-tune faster:
+ *
+ * - the SEC/DiSEqC commands to select the LNBf band, polarization and
+ *   satellite are only sent when they change;
+ *
+ * - the properties that didn't change since the previous tune aren't sent
+ *   again, on Kernels with DVB API 5.11 or upper. The frequency, the
+ *   inversion and the properties set to auto are always sent;
+ *
+ * - the lock time and the frequency offset of each transponder are
+ *   recorded. When the transponder is tuned again, the frequency offset is
+ *   applied, if it is within the shift given by dvb_estimate_freq_shift().
+ *
+ * Tuning again to the same transponder without getting a lock in between
+ * does a full tune, without the recorded offset.
+ *
+ * @return Returns the previous state (0 or 1), or -ENOMEM.
+ */
+int dvb_fe_set_tune_cache(struct dvb_v5_fe_parms *parms, int enable);
+
+/**
+ * @brief Retrieves what the tuning cache knows about the transponder that
+ *	  was tuned last
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param info		filled with the transponder data
+ *
+ * @details Can be called just after dvb_fe_set_parms(), in order to know
+ * how long the lock took on the previous tunes, if any.
+ *
+ * @return 0 if success, or -ENOENT if the tuning cache is disabled or
+ * nothing was tuned with it.
+ */
+int dvb_fe_get_tune_info(struct dvb_v5_fe_parms *parms,
+			 struct dvb_fe_tune_info *info);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,6 +16,8 @@
 #ifndef _DVB_FILE_H
 #define _DVB_FILE_H
 
+#include <stdio.h>
+
 #include "dvb-fe.h"
 
 /**
@@ -243,6 +245,34 @@ struct dvb_v5_descriptors;
 extern "C" {
 #endif
 
+/**
+ * @brief Deallocates memory associated with a struct dvb_entry
+ * @ingroup file
+ *
+ * @param entry		dvb_entry struct to be deallocated
+ *
+ * This function assumes that the entry fields were dynamically allocated
+ * by the library file functions. It doesn't touch entry->next.
+ */
+static inline void dvb_file_entry_free(struct dvb_entry *entry)
+{
+	if (entry->channel)
+		free(entry->channel);
+	if (entry->vchannel)
+		free(entry->vchannel);
+	if (entry->location)
+		free(entry->location);
+	if (entry->video_pid)
+		free(entry->video_pid);
+	if (entry->audio_pid)
+		free(entry->audio_pid);
+	if (entry->other_el_pid)
+		free(entry->other_el_pid);
+	if (entry->lnb)
+		free(entry->lnb);
+	free(entry);
+}
+
 /**
  * @brief Deallocates memory associated with a struct dvb_file
  * @ingroup file
@@ -257,21 +287,7 @@ static inline void dvb_file_free(struct dvb_file *dvb_file)
 	struct dvb_entry *entry = dvb_file->first_entry, *next;
 	while (entry) {
 		next = entry->next;
-		if (entry->channel)
-			free(entry->channel);
-		if (entry->vchannel)
-			free(entry->vchannel);
-		if (entry->location)
-			free(entry->location);
-		if (entry->video_pid)
-			free(entry->video_pid);
-		if (entry->audio_pid)
-			free(entry->audio_pid);
-		if (entry->other_el_pid)
-			free(entry->other_el_pid);
-		if (entry->lnb)
-			free(entry->lnb);
-		free(entry);
+		dvb_file_entry_free(entry);
 		entry = next;
 	}
 	free(dvb_file);
@@ -320,6 +336,128 @@ struct dvb_file *dvb_read_file(const char *fname);
  */
 int dvb_write_file(const char *fname, struct dvb_file *dvb_file);
 
+/**
+ * @brief Describes a callback for dvb_read_file_foreach()
+ * @ingroup file
+ *
+ * @param entry		entry that was read
+ * @param priv		private data given to dvb_read_file_foreach()
+ *
+ * @return Zero to continue reading the file. Any other value stops the
+ * parser, and is returned by dvb_read_file_foreach().
+ */
+typedef int (*dvb_file_entry_handler_t)(struct dvb_entry *entry, void *priv);
+
+/**
+ * @brief Read a file at libdvbv5 format, one entry at a time
+ * @ingroup file
+ *
+ * @param fname		file name
+ * @param handler	callback called for each entry
+ * @param priv		private data passed to the callback
+ *
+ * @details Unlike dvb_read_file(), the entries aren't kept in memory: each
+ * entry is freed when the callback returns, and entry->next is always NULL.
+ * This allows processing files with a large number of entries, for
+ * example by writing them with dvb_write_file_entry().
+ *
+ * @return It returns zero if the whole file was read, the non-zero value
+ * returned by the callback, or a negative error code if it fails: -errno
+ * if the file can't be opened, -EINVAL if it has a syntax error.
+ */
+int dvb_read_file_foreach(const char *fname,
+			  dvb_file_entry_handler_t handler, void *priv);
+
+/**
+ * @brief Write an entry at libdvbv5 format
+ * @ingroup file
+ *
+ * @param fp		file opened for write or append
+ * @param entry		entry to be written
+ *
+ * @details This can be used to append entries to an existing file, or to
+ * write a file while it is being generated or read.
+ *
+ * @return It returns zero if success, or a negative error number if it fails.
+ */
+int dvb_write_file_entry(FILE *fp, struct dvb_entry *entry);
+
+/**
+ * @struct dvb_file_index
+ * @ingroup file
+ * @brief Opaque struct with indexes over the entries of a struct dvb_file
+ *
+ * @details Allows finding entries by channel name, service ID or frequency
+ * without walking the entries list. The index refers to the entries of the
+ * file, so it should be freed before the file, and rebuilt if entries are
+ * added or removed.
+ */
+struct dvb_file_index;
+
+/**
+ * @brief Builds the indexes for a struct dvb_file
+ * @ingroup file
+ *
+ * @param dvb_file	file to be indexed
+ *
+ * @return It returns a pointer to the index, or NULL if no memory.
+ */
+struct dvb_file_index *dvb_file_index_alloc(struct dvb_file *dvb_file);
+
+/**
+ * @brief Deallocates the indexes for a struct dvb_file
+ * @ingroup file
+ *
+ * @param idx		index to be deallocated
+ */
+void dvb_file_index_free(struct dvb_file_index *idx);
+
+/**
+ * @brief Finds a channel by its name
+ * @ingroup file
+ *
+ * @param idx		index of the file
+ * @param name		channel name
+ *
+ * @details The first entry whose channel or vchannel matches exactly is
+ * returned. If there's none, the first entry whose channel matches without
+ * regard to the case is returned.
+ *
+ * @return It returns the entry, or NULL if not found.
+ */
+struct dvb_entry *dvb_file_find_channel(struct dvb_file_index *idx,
+					const char *name);
+
+/**
+ * @brief Finds the entries for a service ID
+ * @ingroup file
+ *
+ * @param idx		index of the file
+ * @param service_id	service ID
+ * @param prev		NULL to find the first entry, or the previous entry
+ *			returned, to find the next one
+ *
+ * @return It returns the entry, or NULL if there are no more entries.
+ */
+struct dvb_entry *dvb_file_find_service(struct dvb_file_index *idx,
+					uint16_t service_id,
+					struct dvb_entry *prev);
+
+/**
+ * @brief Finds the entries for a frequency
+ * @ingroup file
+ *
+ * @param idx		index of the file
+ * @param freq		frequency, as stored at DTV_FREQUENCY
+ * @param prev		NULL to find the first entry, or the previous entry
+ *			returned, to find the next one
+ *
+ * @return It returns the entry, or NULL if there are no more entries.
+ */
+struct dvb_entry *dvb_file_find_frequency(struct dvb_file_index *idx,
+					  uint32_t freq,
+					  struct dvb_entry *prev);
+
 /**
  * @brief Read a file on any format natively supported by
  *			    the library
@@ -0,0 +1,171 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-section-mux.h
+ * @ingroup frontend_scan
+ * @brief Provides a layer that reads several tables through a limited
+ *	  number of demux filters
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_SECTION_MUX_H
+#define _DVB_SECTION_MUX_H
+
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/dvb-scan.h>
+
+/**
+ * @struct dvb_section_mux
+ * @ingroup frontend_scan
+ * @brief Opaque struct with the state of the section multiplexer
+ *
+ * @details Each demux file descriptor given to the multiplexer is a
+ * filter it can use. Tables requested on the same PID share a filter: the
+ * table IDs are matched at the demux as far as a single filter allows
+ * (for example, 0x40 and 0x41 are both matched by 0x40 with mask 0xfe),
+ * and the sections are dispatched to the requests in userspace.
+ *
+ * When there are more PIDs than filters, the PIDs with the highest
+ * priority are filtered first, and each filter is moved to the next PID
+ * as soon as all tables of its PID are read. The timeout of a request
+ * only starts when its PID gets a filter.
+ *
+ * Filters that are no longer needed are stopped, but keep their settings,
+ * so requesting the same tables again, after tuning to another
+ * transponder, only restarts them.
+ */
+struct dvb_section_mux;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates a section multiplexer
+ * @ingroup frontend_scan
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer, used for logging
+ *			and by the table parsers
+ *
+ * @return Returns a pointer to the multiplexer, or NULL if no memory.
+ */
+struct dvb_section_mux *dvb_section_mux_alloc(struct dvb_v5_fe_parms *parms);
+
+/**
+ * @brief Frees a section multiplexer
+ * @ingroup frontend_scan
+ *
+ * @param mux		Section multiplexer
+ *
+ * @details The pending requests are cancelled and the filters are
+ * stopped. The demux file descriptors aren't closed.
+ */
+void dvb_section_mux_free(struct dvb_section_mux *mux);
+
+/**
+ * @brief Gives a demux to the multiplexer
+ * @ingroup frontend_scan
+ *
+ * @param mux		Section multiplexer
+ * @param dmx_fd	File descriptor of an opened demux
+ *
+ * @details The number of demuxes is the filter budget: devices with few
+ * hardware filters should get only as many demuxes as they have filters.
+ *
+ * @return Returns the number of demuxes of the multiplexer, or a negative
+ * value on error.
+ */
+int dvb_section_mux_add_fd(struct dvb_section_mux *mux, int dmx_fd);
+
+/**
+ * @brief Requests a table
+ * @ingroup frontend_scan
+ *
+ * @param mux		Section multiplexer
+ * @param sect		Table to read, as for dvb_read_sections(). It
+ *			should be kept valid until the request is done
+ * @param priority	Priority of the PID of the table, when there aren't
+ *			enough filters. Higher values are filtered first
+ * @param timeout	Maximum time to wait for a section of the table, in
+ *			milliseconds
+ *
+ * @details The table is only read by dvb_section_mux_wait().
+ *
+ * @return Returns an ID for the request, or a negative value on error.
+ */
+int dvb_section_mux_request(struct dvb_section_mux *mux,
+			    struct dvb_table_filter *sect,
+			    int priority, unsigned timeout);
+
+/**
+ * @brief Reads the requested tables
+ * @ingroup frontend_scan
+ *
+ * @param mux		Section multiplexer
+ * @param id		ID of the request to wait for, as returned by
+ *			dvb_section_mux_request(), or -1 to wait for all of
+ *			them
+ *
+ * @details All requests are served while waiting, so the other tables
+ * keep being read. If the application wants to abort, it can change the
+ * value of parms->abort to 1.
+ *
+ * @return Returns zero if the table was read, -ETIMEDOUT if it didn't
+ * arrive in time, -EINTR if aborted or another negative value on error.
+ * If waiting for all requests, returns zero once no request is pending.
+ */
+int dvb_section_mux_wait(struct dvb_section_mux *mux, int id);
+
+/**
+ * @brief Removes all requests
+ * @ingroup frontend_scan
+ *
+ * @param mux		Section multiplexer
+ *
+ * @details The tables already parsed by requests that didn't finish
+ * are kept, and should be freed by the application. The request IDs
+ * are reused afterwards.
+ */
+void dvb_section_mux_clear(struct dvb_section_mux *mux);
+
+/**
+ * @brief Attaches a section multiplexer to dvb_get_ts_tables()
+ * @ingroup frontend_scan
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer
+ * @param mux		Section multiplexer to be used by dvb_get_ts_tables()
+ *			and dvb_scan_transponder(), or NULL
+ *
+ * @details While a multiplexer with demuxes is attached, the demux given
+ * to dvb_get_ts_tables() is ignored and its filters are reused from one
+ * call to the next. Otherwise, a multiplexer with only the given demux is
+ * used for each call.
+ *
+ * @return Returns the multiplexer that was previously attached, if any.
+ */
+struct dvb_section_mux *dvb_fe_set_section_mux(struct dvb_v5_fe_parms *parms,
+					       struct dvb_section_mux *mux);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
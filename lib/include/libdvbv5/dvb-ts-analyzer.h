@@ -0,0 +1,292 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-ts-analyzer.h
+ * @ingroup demux
+ * @brief Provides an analyzer for MPEG Transport Streams
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * @par Relevant specs
+ * The checks are described at ETSI TR 101 290, sections 5.2.1 and 5.2.2.
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_TS_ANALYZER_H
+#define _DVB_TS_ANALYZER_H
+
+#include <stdint.h>
+#include <unistd.h> /* size_t */
+
+#include <libdvbv5/dvb-fe.h>
+
+/**
+ * @def DVB_TS_HISTOGRAM_SIZE
+ *	@brief Number of buckets of the per-PID bitrate histogram
+ * @ingroup demux
+ *
+ * Bucket 0 counts the intervals with less than 1 kbit/s. Bucket n counts
+ * the ones from 2^(n-1) up to 2^n kbit/s. The last bucket also counts the
+ * higher bitrates.
+ */
+#define DVB_TS_HISTOGRAM_SIZE	20
+
+/**
+ * @enum dvb_ts_check
+ *	@brief TR 101 290 checks done by the TS analyzer
+ * @ingroup demux
+ *
+ * @param DVB_TS_SYNC_LOSS		1.1: two or more consecutive
+ *					corrupted sync bytes
+ * @param DVB_TS_SYNC_BYTE_ERROR	1.2: sync byte isn't 0x47
+ * @param DVB_TS_PAT_ERROR		1.3: PAT missing for 0.5 s,
+ *					scrambled or with a wrong table ID
+ * @param DVB_TS_CC_ERROR		1.4: wrong continuity counter
+ * @param DVB_TS_PMT_ERROR		1.5: a PMT referred by the PAT is
+ *					missing for 0.5 s or is scrambled
+ * @param DVB_TS_PID_ERROR		1.6: a PID referred by a PMT is
+ *					missing for 5 s
+ * @param DVB_TS_TRANSPORT_ERROR	2.1: transport error indicator set
+ * @param DVB_TS_CRC_ERROR		2.2: CRC error on a PAT, CAT or PMT
+ * @param DVB_TS_PCR_REPETITION_ERROR	2.3: PCRs more than 40 ms apart
+ * @param DVB_TS_PCR_DISCONTINUITY_ERROR 2.3: PCR jumped more than 100 ms,
+ *					or backwards, without the
+ *					discontinuity indicator
+ * @param DVB_TS_PCR_ACCURACY_ERROR	2.4: PCR jitter above 500 ns
+ * @param DVB_TS_PTS_ERROR		2.5: PTSs more than 700 ms apart
+ * @param DVB_TS_CAT_ERROR		2.6: scrambled packets without a
+ *					CAT, or a wrong table ID on the CAT
+ * @param DVB_TS_NUM_CHECKS		number of checks
+ */
+enum dvb_ts_check {
+	DVB_TS_SYNC_LOSS,
+	DVB_TS_SYNC_BYTE_ERROR,
+	DVB_TS_PAT_ERROR,
+	DVB_TS_CC_ERROR,
+	DVB_TS_PMT_ERROR,
+	DVB_TS_PID_ERROR,
+	DVB_TS_TRANSPORT_ERROR,
+	DVB_TS_CRC_ERROR,
+	DVB_TS_PCR_REPETITION_ERROR,
+	DVB_TS_PCR_DISCONTINUITY_ERROR,
+	DVB_TS_PCR_ACCURACY_ERROR,
+	DVB_TS_PTS_ERROR,
+	DVB_TS_CAT_ERROR,
+	DVB_TS_NUM_CHECKS
+};
+
+/**
+ * @enum dvb_ts_pid_type
+ *	@brief Contents of a PID, as announced by the PAT and the PMTs
+ * @ingroup demux
+ *
+ * @param DVB_TS_PID_UNKNOWN	not referred by any table
+ * @param DVB_TS_PID_PAT	Program Association Table
+ * @param DVB_TS_PID_CAT	Conditional Access Table
+ * @param DVB_TS_PID_PMT	Program Map Table
+ * @param DVB_TS_PID_ES		elementary stream of a program
+ * @param DVB_TS_PID_NULL	null packets
+ */
+enum dvb_ts_pid_type {
+	DVB_TS_PID_UNKNOWN,
+	DVB_TS_PID_PAT,
+	DVB_TS_PID_CAT,
+	DVB_TS_PID_PMT,
+	DVB_TS_PID_ES,
+	DVB_TS_PID_NULL,
+};
+
+/**
+ * @struct dvb_ts_pid_stats
+ *	@brief Statistics of a PID
+ * @ingroup demux
+ *
+ * @param pid		PID number
+ * @param type		contents of the PID, as defined by
+ *			enum dvb_ts_pid_type
+ * @param stream_type	stream type at the PMT, for DVB_TS_PID_ES
+ * @param has_pcr	the PID carries PCRs
+ * @param packets	number of packets
+ * @param scrambled	number of scrambled packets
+ * @param errors	number of errors found by each check
+ * @param bitrate	bitrate during the last interval, in bit/s
+ * @param min_bitrate	lowest bitrate of an interval
+ * @param max_bitrate	highest bitrate of an interval
+ * @param avg_bitrate	average bitrate since the first PCR
+ * @param histogram	number of intervals per bitrate range. See
+ *			DVB_TS_HISTOGRAM_SIZE
+ * @param pcr_count	number of PCRs
+ * @param pcr_jitter_min lowest PCR jitter, in ns
+ * @param pcr_jitter_max highest PCR jitter, in ns
+ */
+struct dvb_ts_pid_stats {
+	uint16_t pid;
+	uint8_t type;
+	uint8_t stream_type;
+	uint8_t has_pcr;
+
+	uint64_t packets;
+	uint64_t scrambled;
+	uint64_t errors[DVB_TS_NUM_CHECKS];
+
+	uint32_t bitrate;
+	uint32_t min_bitrate;
+	uint32_t max_bitrate;
+	uint32_t avg_bitrate;
+	uint32_t histogram[DVB_TS_HISTOGRAM_SIZE];
+
+	uint64_t pcr_count;
+	int32_t pcr_jitter_min;
+	int32_t pcr_jitter_max;
+};
+
+/**
+ * @struct dvb_ts_stats
+ *	@brief Statistics of the whole Transport Stream
+ * @ingroup demux
+ *
+ * @param packets	number of packets
+ * @param skipped	number of bytes discarded to find the sync bytes
+ * @param synced	the analyzer is in sync with the stream
+ * @param time		time since the first PCR, in microseconds,
+ *			measured by the PCRs
+ * @param bitrate	multiplex bitrate during the last interval, in bit/s
+ * @param errors	number of errors found by each check
+ * @param n_pids	number of PIDs seen
+ */
+struct dvb_ts_stats {
+	uint64_t packets;
+	uint64_t skipped;
+	int synced;
+	uint64_t time;
+	uint32_t bitrate;
+	uint64_t errors[DVB_TS_NUM_CHECKS];
+	unsigned n_pids;
+};
+
+/**
+ * @struct dvb_ts_analyzer
+ * @ingroup demux
+ * @brief Opaque struct with the state of the TS analyzer
+ *
+ * @details The analyzer takes the time from the PCRs of the first PID
+ * that carries them, so a recorded stream is analyzed as if it was
+ * received live, no matter how fast it is read.
+ *
+ * The PAT, the CAT and the PMTs are followed, in order to know which PIDs
+ * should be present and which ones carry PCRs and PTSs.
+ */
+struct dvb_ts_analyzer;
+
+/**
+ * @brief Describes a callback for the errors found by the TS analyzer
+ * @ingroup demux
+ *
+ * @param an		TS analyzer
+ * @param check		check that failed, as defined by enum dvb_ts_check
+ * @param pid		PID where the error was found, or 0x1fff if the
+ *			error isn't related to a PID
+ * @param priv		private data given to dvb_ts_analyzer_alloc()
+ */
+typedef void (*dvb_ts_analyzer_error_t)(struct dvb_ts_analyzer *an,
+					enum dvb_ts_check check,
+					uint16_t pid, void *priv);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Names of the checks, as defined by enum dvb_ts_check
+ * @ingroup demux
+ */
+extern const char *dvb_ts_check_name[DVB_TS_NUM_CHECKS];
+
+/**
+ * @brief Allocates a TS analyzer
+ * @ingroup demux
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer, used for logging
+ * @param interval	interval used to measure the bitrates, in
+ *			milliseconds
+ * @param handler	callback for the errors. Can be NULL
+ * @param priv		private data passed to the callback
+ *
+ * @return Returns a pointer to the analyzer, or NULL if no memory.
+ */
+struct dvb_ts_analyzer *dvb_ts_analyzer_alloc(struct dvb_v5_fe_parms *parms,
+					      unsigned interval,
+					      dvb_ts_analyzer_error_t handler,
+					      void *priv);
+
+/**
+ * @brief Frees a TS analyzer
+ * @ingroup demux
+ *
+ * @param an		TS analyzer
+ */
+void dvb_ts_analyzer_free(struct dvb_ts_analyzer *an);
+
+/**
+ * @brief Feeds data from a Transport Stream to the analyzer
+ * @ingroup demux
+ *
+ * @param an		TS analyzer
+ * @param buf		data from the stream
+ * @param len		length of the data
+ *
+ * @details The data doesn't need to start or end at a packet boundary:
+ * the analyzer looks for the sync bytes and keeps an incomplete packet
+ * for the next call.
+ *
+ * @return Returns the number of packets analyzed.
+ */
+size_t dvb_ts_analyzer_feed(struct dvb_ts_analyzer *an, const uint8_t *buf,
+			    size_t len);
+
+/**
+ * @brief Retrieves the statistics of the whole Transport Stream
+ * @ingroup demux
+ *
+ * @param an		TS analyzer
+ *
+ * @return Returns a pointer to the statistics, that is valid until the
+ * analyzer is freed.
+ */
+const struct dvb_ts_stats *dvb_ts_analyzer_get_stats(struct dvb_ts_analyzer *an);
+
+/**
+ * @brief Retrieves the statistics of a PID
+ * @ingroup demux
+ *
+ * @param an		TS analyzer
+ * @param pid		PID number
+ *
+ * @return Returns a pointer to the statistics, that is valid until the
+ * analyzer is freed, or NULL if the PID wasn't seen nor referred by a
+ * table.
+ */
+const struct dvb_ts_pid_stats *dvb_ts_analyzer_get_pid(struct dvb_ts_analyzer *an,
+						       uint16_t pid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,6 +28,8 @@
 #include <libdvbv5/dvb-v5-std.h>
 #include <libdvbv5/dvb-log.h>
 
+#include "dvb-arena-priv.h"
+
 #include <libdvbv5/pat.h>
 #include <libdvbv5/cat.h>
 #include <libdvbv5/pmt.h>
@@ -186,7 +188,7 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			return -2;
 		}
 
-		current = calloc(1, size);
+		current = dvb_parse_calloc(parms, 1, size);
 		if (!current) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -198,7 +200,7 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			if (parms->verbose)
 				dvb_hexdump(parms, "content: ", ptr, desc_len);
 
-			free(current);
+			dvb_parse_free(parms, current);
 			return -4;
 		}
 		if (!*head_desc)
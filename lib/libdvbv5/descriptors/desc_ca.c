@@ -20,6 +20,7 @@
 
 #include <libdvbv5/desc_ca.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -47,7 +48,7 @@ int dvb_desc_ca_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf, struct d
 
 	len = dlen - len;
 	if (len) {
-		d->privdata = malloc(len);
+		d->privdata = dvb_parse_malloc(parms, len);
 		if (!d->privdata)
 			return -1;
 		d->privdata_len = len;
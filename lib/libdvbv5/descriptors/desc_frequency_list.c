@@ -20,6 +20,7 @@
 
 #include <libdvbv5/desc_frequency_list.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -38,7 +39,7 @@ int dvb_desc_frequency_list_init(struct dvb_v5_fe_parms *parms, const uint8_t *b
 
 	d->frequencies = (d->length - len) / sizeof(d->frequency[0]);
 
-	d->frequency = calloc(d->frequencies, sizeof(*d->frequency));
+	d->frequency = dvb_parse_calloc(parms, d->frequencies, sizeof(*d->frequency));
 
 	for (i = 0; i < d->frequencies; i++) {
 		d->frequency[i] = ((uint32_t *) p)[i];
@@ -19,6 +19,7 @@
 
 #include <libdvbv5/desc_isdbt_delivery.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 #include <inttypes.h>
 
 #if __GNUC__ >= 9
@@ -48,7 +49,7 @@ int isdbt_desc_delivery_init(struct dvb_v5_fe_parms *parms,
 	}
 	if (!d->num_freqs)
 		return 0;
-	d->frequency = malloc(d->num_freqs * sizeof(*d->frequency));
+	d->frequency = dvb_parse_malloc(parms, d->num_freqs * sizeof(*d->frequency));
 	if (!d->frequency) {
 		dvb_perror("Can't allocate space for ISDB-T frequencies");
 		return -2;
@@ -20,6 +20,7 @@
 
 #include <libdvbv5/desc_partial_reception.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -33,7 +34,7 @@ int isdb_desc_partial_reception_init(struct dvb_v5_fe_parms *parms,
 	size_t len;
 	int i;
 
-	d->partial_reception = malloc(d->length);
+	d->partial_reception = dvb_parse_malloc(parms, d->length);
 	if (!d->partial_reception) {
 		dvb_logerr("%s: out of memory", __func__);
 		return -1;
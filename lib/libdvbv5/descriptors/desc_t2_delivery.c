@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_extension.h>
 #include <libdvbv5/desc_t2_delivery.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -65,7 +66,9 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 			return -2;
 		}
 
-		d->cell = realloc(d->cell, (d->num_cell + 1) * sizeof(*d->cell));
+		d->cell = dvb_parse_realloc(parms, d->cell,
+					    d->num_cell * sizeof(*d->cell),
+					    (d->num_cell + 1) * sizeof(*d->cell));
 		if (!d->cell) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -83,8 +86,9 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 			d->cell[d->num_cell].num_freqs = 1;
 
 		d->frequency_loop_length += d->cell[d->num_cell].num_freqs;
-		d->centre_frequency = realloc(d->centre_frequency,
-					      d->frequency_loop_length * sizeof(*d->centre_frequency));
+		d->centre_frequency = dvb_parse_realloc(parms, d->centre_frequency,
+							pos * sizeof(*d->centre_frequency),
+							d->frequency_loop_length * sizeof(*d->centre_frequency));
 		if (!d->centre_frequency) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -107,7 +111,7 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 		p++;
 
 		if (d->cell[d->num_cell].subcel_length) {
-			d->cell[d->num_cell].subcel = calloc(d->cell[d->num_cell].subcel_length,
+			d->cell[d->num_cell].subcel = dvb_parse_calloc(parms, d->cell[d->num_cell].subcel_length,
 							     sizeof (*d->cell[d->num_cell].subcel));
 
 			if (!d->cell[d->num_cell].subcel) {
@@ -126,8 +130,9 @@ int dvb_desc_t2_delivery_init(struct dvb_v5_fe_parms *parms,
 
 			// Add transposer_frequency at centre_frequency table
 			d->frequency_loop_length++;
-			d->centre_frequency = realloc(d->centre_frequency,
-						      d->frequency_loop_length * sizeof(*d->centre_frequency));
+			d->centre_frequency = dvb_parse_realloc(parms, d->centre_frequency,
+								pos * sizeof(*d->centre_frequency),
+								d->frequency_loop_length * sizeof(*d->centre_frequency));
 			memcpy(&d->centre_frequency[pos], p, sizeof(*d->centre_frequency));
 			bswap32(d->centre_frequency[pos]);
 			d->cell[d->num_cell].subcel[i].transposer_frequency = d->centre_frequency[pos];
@@ -20,6 +20,7 @@
 
 #include <libdvbv5/desc_ts_info.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 #include <parse_string.h>
 
 #if __GNUC__ >= 9
@@ -52,7 +53,7 @@ int dvb_desc_ts_info_init(struct dvb_v5_fe_parms *parms,
 
 	t = &d->transmission_type;
 
-	d->service_id = malloc(sizeof(*d->service_id) * t->num_of_service);
+	d->service_id = dvb_parse_malloc(parms, sizeof(*d->service_id) * t->num_of_service);
 	if (!d->service_id) {
 		dvb_logerr("%s: out of memory", __func__);
 		return -1;
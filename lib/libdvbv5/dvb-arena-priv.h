@@ -0,0 +1,46 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#ifndef __DVB_ARENA_PRIV_H
+#define __DVB_ARENA_PRIV_H
+
+#include <stddef.h>
+
+#if HAVE_VISIBILITY
+#pragma GCC visibility push(hidden)
+#endif
+
+struct dvb_v5_fe_parms;
+
+/*
+ * Allocators used by the table and descriptor parsers. They take the memory
+ * from the arena attached to parms, if any, or from malloc() otherwise.
+ *
+ * With an arena, dvb_parse_free() is a no-op and dvb_parse_realloc() needs
+ * the old size to copy the data. Shrinking or growing the last allocation
+ * is done in place.
+ */
+void *dvb_parse_malloc(struct dvb_v5_fe_parms *parms, size_t size);
+void *dvb_parse_calloc(struct dvb_v5_fe_parms *parms, size_t nmemb, size_t size);
+void *dvb_parse_realloc(struct dvb_v5_fe_parms *parms, void *ptr,
+			size_t old_size, size_t size);
+void dvb_parse_free(struct dvb_v5_fe_parms *parms, void *ptr);
+
+#if HAVE_VISIBILITY
+#pragma GCC visibility pop
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdvbv5/dvb-arena.h>
+
+#include "dvb-fe-priv.h"
+#include "dvb-arena-priv.h"
+
+#define DVB_ARENA_CHUNK_SIZE	(64 * 1024)
+
+/* Same alignment as glibc's malloc() */
+#define DVB_ARENA_ALIGN		(2 * sizeof(size_t))
+#define ARENA_ALIGN(size)	(((size) + DVB_ARENA_ALIGN - 1) & ~(DVB_ARENA_ALIGN - 1))
+
+struct dvb_arena_chunk {
+	struct dvb_arena_chunk	*next;
+	size_t			size;
+	size_t			used;
+	unsigned char		data[] __attribute__((aligned(2 * sizeof(size_t))));
+};
+
+struct dvb_arena {
+	struct dvb_arena_chunk	*head, *cur;
+	size_t			chunk_size;
+
+	/* the last allocation can be resized in place */
+	void			*last;
+};
+
+static struct dvb_arena_chunk *arena_chunk_alloc(size_t size)
+{
+	struct dvb_arena_chunk *chunk;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+struct dvb_arena *dvb_arena_alloc(size_t chunk_size)
+{
+	struct dvb_arena *arena;
+
+	if (!chunk_size)
+		chunk_size = DVB_ARENA_CHUNK_SIZE;
+	chunk_size = ARENA_ALIGN(chunk_size);
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena)
+		return NULL;
+	arena->chunk_size = chunk_size;
+	arena->head = arena_chunk_alloc(chunk_size);
+	if (!arena->head) {
+		free(arena);
+		return NULL;
+	}
+	arena->cur = arena->head;
+
+	return arena;
+}
+
+void dvb_arena_reset(struct dvb_arena *arena)
+{
+	/* The other chunks are emptied when the allocator moves to them */
+	arena->cur = arena->head;
+	arena->cur->used = 0;
+	arena->last = NULL;
+}
+
+void dvb_arena_free(struct dvb_arena *arena)
+{
+	struct dvb_arena_chunk *chunk, *next;
+
+	if (!arena)
+		return;
+
+	for (chunk = arena->head; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+size_t dvb_arena_used(const struct dvb_arena *arena)
+{
+	const struct dvb_arena_chunk *chunk;
+	size_t used = 0;
+
+	for (chunk = arena->head; chunk != arena->cur; chunk = chunk->next)
+		used += chunk->used;
+
+	return used + chunk->used;
+}
+
+/*
+ * Moves to the next chunk, or allocates a new one if there isn't a next
+ * chunk left from before the last reset, or if it is too small.
+ */
+static struct dvb_arena_chunk *arena_next_chunk(struct dvb_arena *arena,
+						size_t size)
+{
+	struct dvb_arena_chunk *chunk = arena->cur->next;
+
+	if (!chunk || chunk->size < size) {
+		chunk = arena_chunk_alloc(size > arena->chunk_size ?
+					  size : arena->chunk_size);
+		if (!chunk)
+			return NULL;
+		chunk->next = arena->cur->next;
+		arena->cur->next = chunk;
+	}
+	chunk->used = 0;
+	arena->cur = chunk;
+
+	return chunk;
+}
+
+static void *arena_malloc(struct dvb_arena *arena, size_t size)
+{
+	struct dvb_arena_chunk *chunk = arena->cur;
+	void *p;
+
+	size = ARENA_ALIGN(size);
+	if (chunk->size - chunk->used < size) {
+		chunk = arena_next_chunk(arena, size);
+		if (!chunk)
+			return NULL;
+	}
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->last = p;
+
+	return p;
+}
+
+static void *arena_realloc(struct dvb_arena *arena, void *ptr,
+			   size_t old_size, size_t size)
+{
+	void *p;
+
+	if (!ptr)
+		return arena_malloc(arena, size);
+
+	if (ptr == arena->last) {
+		struct dvb_arena_chunk *chunk = arena->cur;
+		size_t offset = (unsigned char *)ptr - chunk->data;
+
+		if (chunk->size - offset >= ARENA_ALIGN(size)) {
+			chunk->used = offset + ARENA_ALIGN(size);
+			return ptr;
+		}
+	}
+	if (size <= old_size)
+		return ptr;
+
+	p = arena_malloc(arena, size);
+	if (p)
+		memcpy(p, ptr, old_size);
+
+	return p;
+}
+
+struct dvb_arena *dvb_fe_set_arena(struct dvb_v5_fe_parms *p,
+				   struct dvb_arena *arena)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_arena *old = parms->arena;
+
+	parms->arena = arena;
+
+	return old;
+}
+
+static inline struct dvb_arena *parms_arena(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+
+	return parms ? parms->arena : NULL;
+}
+
+void *dvb_parse_malloc(struct dvb_v5_fe_parms *parms, size_t size)
+{
+	struct dvb_arena *arena = parms_arena(parms);
+
+	if (!arena)
+		return malloc(size);
+
+	return arena_malloc(arena, size);
+}
+
+void *dvb_parse_calloc(struct dvb_v5_fe_parms *parms, size_t nmemb, size_t size)
+{
+	struct dvb_arena *arena = parms_arena(parms);
+	void *p;
+
+	if (!arena)
+		return calloc(nmemb, size);
+
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+	p = arena_malloc(arena, nmemb * size);
+	if (p)
+		memset(p, 0, nmemb * size);
+
+	return p;
+}
+
+void *dvb_parse_realloc(struct dvb_v5_fe_parms *parms, void *ptr,
+			size_t old_size, size_t size)
+{
+	struct dvb_arena *arena = parms_arena(parms);
+
+	if (!arena)
+		return realloc(ptr, size);
+
+	return arena_realloc(arena, ptr, old_size, size);
+}
+
+void dvb_parse_free(struct dvb_v5_fe_parms *parms, void *ptr)
+{
+	if (!parms_arena(parms))
+		free(ptr);
+}
@@ -26,6 +26,7 @@
 #include <locale.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <config.h>
 
@@ -35,6 +36,7 @@
 
 #include "dvb-fe-priv.h"
 #include "dvb-dev-priv.h"
+#include <libdvbv5/dvb-fe-monitor.h>
 
 #ifdef ENABLE_NLS
 # include "gettext.h"
@@ -58,6 +60,11 @@ struct dvb_dev_local_priv {
 
 #ifdef HAVE_PTHREAD
 	pthread_t dev_change_id;
+
+	/* frontend statistics monitor */
+	struct dvb_fe_monitor *fe_monitor;
+	pthread_t fe_monitor_id;
+	volatile int fe_monitor_stop;
 #endif
 
 	/* udev control fields */
@@ -506,6 +513,8 @@ static struct dvb_open_descriptor
 	return open_dev;
 }
 
+static int dvb_local_fe_monitor_stop(struct dvb_device_priv *dvb);
+
 static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 {
 	struct dvb_dev_list *dev = open_dev->dev;
@@ -513,9 +522,10 @@ static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct dvb_open_descriptor *cur;
 
-	if (dev->dvb_type == DVB_DEVICE_FRONTEND)
+	if (dev->dvb_type == DVB_DEVICE_FRONTEND) {
+		dvb_local_fe_monitor_stop(dvb);
 		__dvb_fe_close(parms);
-	else {
+	} else {
 		if (dev->dvb_type == DVB_DEVICE_DEMUX)
 			dvb_dev_dmx_stop(open_dev);
 
@@ -642,6 +652,135 @@ static ssize_t dvb_local_read(struct dvb_open_descriptor *open_dev,
 	return ret;
 }
 
+static void dvb_local_stream_free(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_dev_stream *stream = open_dev->stream;
+	struct dmx_requestbuffers req;
+	unsigned i;
+
+	for (i = 0; i < stream->count; i++) {
+		if (stream->mem[i])
+			munmap(stream->mem[i], stream->len[i]);
+		stream->mem[i] = NULL;
+	}
+
+	/* Buffers can only be released after being unmapped */
+	memset(&req, 0, sizeof(req));
+	ioctl(open_dev->fd, DMX_REQBUFS, &req);
+}
+
+static int dvb_local_stream_start(struct dvb_open_descriptor *open_dev,
+				  struct dvb_dev_stream *stream)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_requestbuffers req;
+	struct dmx_buffer buf;
+	int fd = open_dev->fd, ret;
+	unsigned i;
+
+	memset(&req, 0, sizeof(req));
+	req.count = stream->count;
+	req.size = stream->size;
+
+	/* Kernels without CONFIG_DVB_MMAP return -ENOTTY */
+	if (xioctl(fd, DMX_REQBUFS, &req) == -1) {
+		ret = -errno;
+		dvb_logdbg(_("DMX_REQBUFS failed: %m. Using read()"));
+		return ret;
+	}
+	if (!req.count) {
+		dvb_logdbg(_("no buffers to map. Using read()"));
+		return -ENOMEM;
+	}
+	if (req.count < stream->count)
+		stream->count = req.count;
+
+	for (i = 0; i < stream->count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.index = i;
+		if (xioctl(fd, DMX_QUERYBUF, &buf) == -1) {
+			ret = -errno;
+			dvb_perror("DMX_QUERYBUF");
+			goto err;
+		}
+
+		stream->mem[i] = mmap(NULL, buf.length, PROT_READ, MAP_SHARED,
+				      fd, buf.offset);
+		if (stream->mem[i] == MAP_FAILED) {
+			ret = -errno;
+			stream->mem[i] = NULL;
+			dvb_perror("mmap");
+			goto err;
+		}
+		stream->len[i] = buf.length;
+	}
+
+	/* Streaming starts with the first queued buffer */
+	for (i = 0; i < stream->count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.index = i;
+		if (xioctl(fd, DMX_QBUF, &buf) == -1) {
+			ret = -errno;
+			dvb_perror("DMX_QBUF");
+			goto err;
+		}
+	}
+
+	dvb_logdbg(_("streaming via %u mmapped buffers of %u bytes"),
+		   stream->count, stream->size);
+
+	return 0;
+
+err:
+	dvb_local_stream_free(open_dev);
+	return ret;
+}
+
+static int dvb_local_stream_get(struct dvb_open_descriptor *open_dev,
+				struct dvb_dev_buffer *buf)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_stream *stream = open_dev->stream;
+	struct dmx_buffer b;
+	int ret;
+
+	/* Not restarted on EINTR, as the caller may need to check a flag */
+	memset(&b, 0, sizeof(b));
+	ret = ioctl(open_dev->fd, DMX_DQBUF, &b);
+	if (ret == -1) {
+		if (errno != EOVERFLOW && errno != EAGAIN && errno != EINTR)
+			dvb_perror("DMX_DQBUF");
+		return -errno;
+	}
+
+	buf->data = stream->mem[b.index];
+	buf->len = b.bytesused;
+	buf->index = b.index;
+	buf->flags = b.flags;
+	buf->count = b.count;
+
+	return 0;
+}
+
+static int dvb_local_stream_put(struct dvb_open_descriptor *open_dev,
+				unsigned index)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_buffer b;
+
+	memset(&b, 0, sizeof(b));
+	b.index = index;
+	if (xioctl(open_dev->fd, DMX_QBUF, &b) == -1) {
+		dvb_perror("DMX_QBUF");
+		return -errno;
+	}
+
+	return 0;
+}
+
 static int dvb_local_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -823,12 +962,98 @@ int dvb_local_fe_get_stats(struct dvb_v5_fe_parms *p)
 	return __dvb_fe_get_stats(p);
 }
 
+#ifdef HAVE_PTHREAD
+static void *fe_monitor_thread(void *privdata)
+{
+	struct dvb_dev_local_priv *priv = privdata;
+
+	while (!priv->fe_monitor_stop) {
+		if (dvb_fe_monitor_poll(priv->fe_monitor, 100) < 0)
+			usleep(100000);
+	}
+	return NULL;
+}
+#endif
+
+static int dvb_local_fe_monitor_start(struct dvb_device_priv *dvb,
+				      unsigned period,
+				      const uint32_t *cmds, unsigned n_cmds,
+				      unsigned history)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+#ifndef HAVE_PTHREAD
+	dvb_logerr("Need to be compiled with pthreads for monitor");
+	return -EINVAL;
+#else
+	struct dvb_dev_local_priv *priv = dvb->priv;
+	int ret;
+
+	dvb_local_fe_monitor_stop(dvb);
+
+	priv->fe_monitor = dvb_fe_monitor_alloc(period, NULL, NULL);
+	if (!priv->fe_monitor)
+		return -ENOMEM;
+
+	ret = dvb_fe_monitor_add(priv->fe_monitor, &parms->p, cmds, n_cmds,
+				 history);
+	if (ret < 0)
+		goto error;
+
+	priv->fe_monitor_stop = 0;
+	ret = pthread_create(&priv->fe_monitor_id, NULL, fe_monitor_thread,
+			     priv);
+	if (ret) {
+		dvb_logerr("pthread_create: %s", strerror(ret));
+		ret = -ret;
+		goto error;
+	}
+	return 0;
+
+error:
+	dvb_fe_monitor_free(priv->fe_monitor);
+	priv->fe_monitor = NULL;
+	return ret;
+#endif
+}
+
+static int dvb_local_fe_monitor_get(struct dvb_device_priv *dvb,
+				    uint32_t cmd, unsigned layer,
+				    struct dvb_fe_monitor_sample *samples,
+				    unsigned max)
+{
+#ifdef HAVE_PTHREAD
+	struct dvb_dev_local_priv *priv = dvb->priv;
+
+	if (priv->fe_monitor)
+		return dvb_fe_monitor_get_samples(priv->fe_monitor, 0, cmd,
+						  layer, samples, max);
+#endif
+	return -EINVAL;
+}
+
+static int dvb_local_fe_monitor_stop(struct dvb_device_priv *dvb)
+{
+#ifdef HAVE_PTHREAD
+	struct dvb_dev_local_priv *priv = dvb->priv;
+
+	if (!priv->fe_monitor)
+		return 0;
+
+	priv->fe_monitor_stop = 1;
+	pthread_join(priv->fe_monitor_id, NULL);
+	dvb_fe_monitor_free(priv->fe_monitor);
+	priv->fe_monitor = NULL;
+#endif
+	return 0;
+}
+
 
 static void dvb_dev_local_free(struct dvb_device_priv *dvb)
 {
 	struct dvb_dev_local_priv *priv = dvb->priv;
 
 	dvb_local_stop_monitor(dvb);
+	dvb_local_fe_monitor_stop(dvb);
 
 	free(priv);
 }
@@ -856,6 +1081,10 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	ops->dmx_stop = dvb_local_dmx_stop;
 	ops->set_bufsize = dvb_local_set_bufsize;
 	ops->read = dvb_local_read;
+	ops->stream_start = dvb_local_stream_start;
+	ops->stream_get = dvb_local_stream_get;
+	ops->stream_put = dvb_local_stream_put;
+	ops->stream_free = dvb_local_stream_free;
 	ops->dmx_set_pesfilter = dvb_local_dmx_set_pesfilter;
 	ops->dmx_set_section_filter = dvb_local_dmx_set_section_filter;
 	ops->dmx_get_pmt_pid = dvb_local_dmx_get_pmt_pid;
@@ -866,6 +1095,9 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	ops->fe_get_parms = dvb_local_fe_get_parms;
 	ops->fe_set_parms = dvb_local_fe_set_parms;
 	ops->fe_get_stats = dvb_local_fe_get_stats;
+	ops->fe_monitor_start = dvb_local_fe_monitor_start;
+	ops->fe_monitor_get = dvb_local_fe_monitor_get;
+	ops->fe_monitor_stop = dvb_local_fe_monitor_stop;
 
 	ops->free = dvb_dev_local_free;
 }
@@ -21,13 +21,32 @@
 #define __DVB_DEV_PRIV_H
 
 #include <libdvbv5/dvb-dev.h>
+#include <pthread.h>
 
 struct dvb_device_priv;
+struct dvb_fe_monitor_sample;
+
+/*
+ * Buffers used by dvb_dev_stream_*(). When mapped, mem[] and len[] are
+ * the Kernel buffers mapped by the ops. Otherwise, they're allocated when
+ * first used, and busy[] tells which ones are with the application.
+ */
+struct dvb_dev_stream {
+	int mapped;
+	unsigned count, size;
+	void **mem;
+	size_t *len;
+	/* Protects busy, as buffers can be given back from another thread */
+	pthread_mutex_t lock;
+	char *busy;
+	uint32_t seq;
+};
 
 struct dvb_open_descriptor {
 	int fd;
 	struct dvb_dev_list *dev;
 	struct dvb_device_priv *dvb;
+	struct dvb_dev_stream *stream;
 	struct dvb_open_descriptor *next;
 };
 
@@ -49,6 +68,13 @@ struct dvb_dev_ops {
 			   int buffersize);
 	ssize_t (*read)(struct dvb_open_descriptor *open_dev,
 			void *buf, size_t count);
+	int (*stream_start)(struct dvb_open_descriptor *open_dev,
+			    struct dvb_dev_stream *stream);
+	int (*stream_get)(struct dvb_open_descriptor *open_dev,
+			  struct dvb_dev_buffer *buf);
+	int (*stream_put)(struct dvb_open_descriptor *open_dev,
+			  unsigned index);
+	void (*stream_free)(struct dvb_open_descriptor *open_dev);
 	int (*dmx_set_pesfilter)(struct dvb_open_descriptor *open_dev,
 				 int pid, dmx_pes_type_t type,
 				 dmx_output_t output, int bufsize);
@@ -70,6 +96,14 @@ struct dvb_dev_ops {
 	int (*fe_get_parms)(struct dvb_v5_fe_parms *p);
 	int (*fe_set_parms)(struct dvb_v5_fe_parms *p);
 	int (*fe_get_stats)(struct dvb_v5_fe_parms *p);
+	int (*fe_monitor_start)(struct dvb_device_priv *dvb, unsigned period,
+				const uint32_t *cmds, unsigned n_cmds,
+				unsigned history);
+	int (*fe_monitor_get)(struct dvb_device_priv *dvb,
+			      uint32_t cmd, unsigned layer,
+			      struct dvb_fe_monitor_sample *samples,
+			      unsigned max);
+	int (*fe_monitor_stop)(struct dvb_device_priv *dvb);
 
 	void (*free)(struct dvb_device_priv *dvb);
 	int (*get_fd)(struct dvb_open_descriptor *dvb);
@@ -42,6 +42,7 @@
 
 #include "dvb-fe-priv.h"
 #include "dvb-dev-priv.h"
+#include <libdvbv5/dvb-fe-monitor.h>
 
 #ifdef ENABLE_NLS
 # include "gettext.h"
@@ -505,7 +506,7 @@ static ssize_t scan_data(struct dvb_v5_fe_parms_priv *parms, char *buf,
 			}
 			u64 = va_arg(ap, uint64_t *);
 
-			*u64 = be32toh(*(uint64_t *)p);
+			*u64 = be64toh(*(uint64_t *)p);
 			p += 8;
 			break;
 		default:
@@ -1656,6 +1657,160 @@ error:
 	return 0;
 }
 
+/*
+ * Each monitor sample is sent as %lu%i%lu. Keep room for the reply header.
+ */
+#define MONITOR_SAMPLE_SIZE	(8 + 4 + 8)
+#define MONITOR_MAX_SAMPLES	((REMOTE_BUF_SIZE - CMD_SIZE - 16) / \
+				 MONITOR_SAMPLE_SIZE)
+
+static int dvb_remote_fe_monitor_start(struct dvb_device_priv *dvb,
+				       unsigned period,
+				       const uint32_t *cmds, unsigned n_cmds,
+				       unsigned history)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg = NULL;
+	char buf[REMOTE_BUF_SIZE], *p = buf;
+	char cmd[CMD_SIZE];
+	size_t size = sizeof(buf);
+	int ret;
+	unsigned i;
+
+	if (priv->disconnected)
+		return -ENODEV;
+
+	ret = prepare_data(parms, p, size, "%i%i%i", period, history, n_cmds);
+	if (ret < 0)
+		goto error;
+
+	p += ret;
+	size -= ret;
+
+	for (i = 0; i < n_cmds; i++) {
+		ret = prepare_data(parms, p, size, "%i", cmds[i]);
+		if (ret < 0)
+			goto error;
+
+		p += ret;
+		size -= ret;
+	}
+
+	strcpy(cmd, "fe_monitor_start");
+	msg = send_buf(dvb, priv->fd, cmd, buf, p - buf);
+	if (!msg) {
+		ret = -1;
+		goto error;
+	}
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	ret = msg->retval;
+
+error:
+	if (msg) {
+		msg->seq = 0; /* Avoids any risk of a recursive call */
+		pthread_mutex_unlock(&msg->lock);
+
+		free_msg(dvb, msg);
+	}
+	return ret;
+}
+
+static int dvb_remote_fe_monitor_get(struct dvb_device_priv *dvb,
+				     uint32_t cmd, unsigned layer,
+				     struct dvb_fe_monitor_sample *samples,
+				     unsigned max)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
+	int ret, i, n;
+	char *p;
+	size_t size;
+
+	if (priv->disconnected)
+		return -ENODEV;
+
+	if (max > MONITOR_MAX_SAMPLES)
+		max = MONITOR_MAX_SAMPLES;
+
+	msg = send_fmt(dvb, priv->fd, "fe_monitor_get", "%i%i%i",
+		       cmd, layer, max);
+	if (!msg)
+		return -1;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	n = msg->retval;
+	if (n < 0 || n > max) {
+		ret = n < 0 ? n : -EINVAL;
+		goto error;
+	}
+
+	p = msg->args;
+	size = msg->args_size;
+
+	for (i = 0; i < n; i++) {
+		struct dvb_fe_monitor_sample *s = &samples[i];
+
+		ret = scan_data(parms, p, size, "%" SCNu64 "%i%" SCNu64,
+				&s->timestamp, &s->scale, &s->uvalue);
+		if (ret < 0)
+			goto error;
+
+		p += ret;
+		size -= ret;
+	}
+	ret = n;
+
+error:
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	return ret;
+}
+
+static int dvb_remote_fe_monitor_stop(struct dvb_device_priv *dvb)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
+	int ret;
+
+	if (priv->disconnected)
+		return -ENODEV;
+
+	msg = send_fmt(dvb, priv->fd, "fe_monitor_stop", "-");
+	if (!msg)
+		return -1;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	ret = msg->retval;
+
+error:
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	return ret;
+}
+
 static struct dvb_v5_descriptors *dvb_remote_scan(struct dvb_open_descriptor *open_dev,
 					struct dvb_entry *entry,
 					check_frontend_t *check_frontend,
@@ -1797,6 +1952,9 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	ops->fe_get_parms = dvb_remote_fe_get_parms;
 	ops->fe_set_parms = dvb_remote_fe_set_parms;
 	ops->fe_get_stats = dvb_remote_fe_get_stats;
+	ops->fe_monitor_start = dvb_remote_fe_monitor_start;
+	ops->fe_monitor_get = dvb_remote_fe_monitor_get;
+	ops->fe_monitor_stop = dvb_remote_fe_monitor_stop;
 
 	ops->free = dvb_dev_remote_free;
 
@@ -17,6 +17,7 @@
  */
 
 #include <libudev.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <locale.h>
@@ -242,11 +243,36 @@ int dvb_dev_get_fd(struct dvb_open_descriptor *open_dev)
 	return ops->get_fd(open_dev);
 }
 
+static void dvb_dev_stream_free(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+	struct dvb_dev_stream *stream = open_dev->stream;
+	unsigned i;
+
+	if (stream->mapped) {
+		ops->stream_free(open_dev);
+	} else {
+		for (i = 0; i < stream->count; i++)
+			free(stream->mem[i]);
+	}
+	free(stream->mem);
+	free(stream->len);
+	free(stream->busy);
+	pthread_mutex_destroy(&stream->lock);
+	free(stream);
+
+	open_dev->stream = NULL;
+}
+
 void dvb_dev_close(struct dvb_open_descriptor *open_dev)
 {
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_ops *ops = &dvb->ops;
 
+	if (open_dev->stream)
+		dvb_dev_stream_free(open_dev);
+
 	if (ops->close)
 		ops->close(open_dev);
 }
@@ -284,6 +310,117 @@ ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 	return ops->read(open_dev, buf, count);
 }
 
+int dvb_dev_stream_start(struct dvb_open_descriptor *open_dev,
+			 unsigned count, unsigned size)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+	struct dvb_dev_stream *stream;
+	enum dvb_dev_type type = open_dev->dev->dvb_type;
+
+	if (type != DVB_DEVICE_DEMUX && type != DVB_DEVICE_DVR)
+		return -EINVAL;
+	if (open_dev->stream)
+		return -EBUSY;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return -ENOMEM;
+	pthread_mutex_init(&stream->lock, NULL);
+
+	stream->count = count ? count : DVB_DEV_STREAM_COUNT;
+	stream->size = size ? size : DVB_DEV_STREAM_SIZE;
+	stream->mem = calloc(stream->count, sizeof(*stream->mem));
+	stream->len = calloc(stream->count, sizeof(*stream->len));
+	stream->busy = calloc(stream->count, sizeof(*stream->busy));
+	open_dev->stream = stream;
+	if (!stream->mem || !stream->len || !stream->busy) {
+		dvb_dev_stream_free(open_dev);
+		return -ENOMEM;
+	}
+
+	/* The ops may reduce the number of buffers, if the Kernel wants so */
+	if (ops->stream_start && !ops->stream_start(open_dev, stream)) {
+		stream->mapped = 1;
+		return stream->count;
+	}
+
+	return 0;
+}
+
+int dvb_dev_stream_get(struct dvb_open_descriptor *open_dev,
+		       struct dvb_dev_buffer *buf)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+	struct dvb_dev_stream *stream = open_dev->stream;
+	ssize_t ret;
+	unsigned i;
+
+	if (!stream)
+		return -EINVAL;
+
+	if (stream->mapped)
+		return ops->stream_get(open_dev, buf);
+
+	pthread_mutex_lock(&stream->lock);
+	for (i = 0; i < stream->count; i++)
+		if (!stream->busy[i])
+			break;
+	if (i < stream->count)
+		stream->busy[i] = 1;
+	pthread_mutex_unlock(&stream->lock);
+	if (i == stream->count)
+		return -ENOBUFS;
+
+	if (!stream->mem[i]) {
+		stream->mem[i] = malloc(stream->size);
+		if (!stream->mem[i]) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		stream->len[i] = stream->size;
+	}
+
+	ret = dvb_dev_read(open_dev, stream->mem[i], stream->len[i]);
+	if (ret < 0)
+		goto err;
+
+	buf->data = stream->mem[i];
+	buf->len = ret;
+	buf->index = i;
+	buf->flags = 0;
+	buf->count = stream->seq++;
+
+	return 0;
+
+err:
+	pthread_mutex_lock(&stream->lock);
+	stream->busy[i] = 0;
+	pthread_mutex_unlock(&stream->lock);
+	return ret;
+}
+
+int dvb_dev_stream_put(struct dvb_open_descriptor *open_dev,
+		       struct dvb_dev_buffer *buf)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+	struct dvb_dev_stream *stream = open_dev->stream;
+
+	if (!stream || buf->index >= stream->count)
+		return -EINVAL;
+
+	if (stream->mapped)
+		return ops->stream_put(open_dev, buf->index);
+
+	pthread_mutex_lock(&stream->lock);
+	stream->busy[buf->index] = 0;
+	pthread_mutex_unlock(&stream->lock);
+
+	return 0;
+}
+
 int dvb_dev_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -342,6 +479,44 @@ struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
 			 timeout_multiply);
 }
 
+int dvb_dev_fe_monitor_start(struct dvb_device *d, unsigned period,
+			     const uint32_t *cmds, unsigned n_cmds,
+			     unsigned history)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->fe_monitor_start)
+		return -1;
+
+	return ops->fe_monitor_start(dvb, period, cmds, n_cmds, history);
+}
+
+int dvb_dev_fe_monitor_get(struct dvb_device *d, uint32_t cmd,
+			   unsigned layer,
+			   struct dvb_fe_monitor_sample *samples,
+			   unsigned max)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->fe_monitor_get)
+		return -1;
+
+	return ops->fe_monitor_get(dvb, cmd, layer, samples, max);
+}
+
+int dvb_dev_fe_monitor_stop(struct dvb_device *d)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->fe_monitor_stop)
+		return -1;
+
+	return ops->fe_monitor_stop(dvb);
+}
+
 /* Frontend functions that can be overriden */
 
 int dvb_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys)
@@ -0,0 +1,453 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libdvbv5/dvb-epg.h>
+#include <libdvbv5/dvb-arena.h>
+#include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/dvb-log.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/crc32.h>
+
+#include <config.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+
+#else
+# define _(string) string
+#endif
+
+/* Offsets of the fields of an EIT section */
+#define EIT_HEADER_SIZE		14
+#define EIT_SEGMENT_LAST	12
+
+#define EPG_HASH_MIN		256
+
+#define BITS_PER_LONG		(8 * sizeof(long))
+
+/* State of a sub-table */
+struct dvb_epg_table {
+	struct dvb_epg_table	*next;
+	uint64_t		key;
+
+	uint8_t			version;
+	uint8_t			last_section;
+	bool			complete;
+
+	/* segment_last_section of each segment, if segment_seen */
+	uint8_t			segment_last[32];
+	uint32_t		segment_seen;
+
+	unsigned long		received[256 / BITS_PER_LONG];
+	uint32_t		crc[256];
+};
+
+struct dvb_epg {
+	struct dvb_v5_fe_parms	*parms;
+	unsigned		other;
+	dvb_epg_change_t	handler;
+	void			*priv;
+
+	/* the sections are parsed into it, and it is reset afterwards */
+	struct dvb_arena	*arena;
+
+	struct dvb_epg_table	**hash;
+	unsigned		hash_size;
+	unsigned		n_tables;
+};
+
+static uint64_t epg_key(uint16_t network_id, uint16_t transport_id,
+			uint16_t service_id, uint8_t table_id)
+{
+	return (uint64_t)network_id << 40 | (uint64_t)transport_id << 24 |
+	       (uint64_t)service_id << 8 | table_id;
+}
+
+static unsigned epg_hash(uint64_t key, unsigned size)
+{
+	key *= 0x9e3779b97f4a7c15ULL;
+
+	return (key >> 32) & (size - 1);
+}
+
+static void epg_fill_section(struct dvb_epg_section *sect,
+			     const struct dvb_epg_table *t)
+{
+	memset(sect, 0, sizeof(*sect));
+	sect->network_id = t->key >> 40;
+	sect->transport_id = t->key >> 24;
+	sect->service_id = t->key >> 8;
+	sect->table_id = t->key;
+	sect->version = t->version;
+}
+
+static int test_received(const struct dvb_epg_table *t, unsigned nr)
+{
+	return !!(t->received[nr / BITS_PER_LONG] & (1UL << (nr % BITS_PER_LONG)));
+}
+
+static void set_received(struct dvb_epg_table *t, unsigned nr)
+{
+	t->received[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+/* Reports all received sections of a sub-table as removed and forgets them */
+static void epg_table_clear(struct dvb_epg *epg, struct dvb_epg_table *t)
+{
+	struct dvb_epg_section sect;
+	unsigned i;
+
+	epg_fill_section(&sect, t);
+	for (i = 0; i < 256; i++) {
+		if (!test_received(t, i))
+			continue;
+		sect.section = i;
+		epg->handler(DVB_EPG_SECTION_REMOVE, &sect, epg->priv);
+	}
+
+	memset(t->received, 0, sizeof(t->received));
+	t->segment_seen = 0;
+	t->complete = false;
+}
+
+static int epg_hash_grow(struct dvb_epg *epg)
+{
+	unsigned size = epg->hash_size * 2, i;
+	struct dvb_epg_table **hash, *t, *next;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+
+	for (i = 0; i < epg->hash_size; i++) {
+		for (t = epg->hash[i]; t; t = next) {
+			unsigned h = epg_hash(t->key, size);
+
+			next = t->next;
+			t->next = hash[h];
+			hash[h] = t;
+		}
+	}
+	free(epg->hash);
+	epg->hash = hash;
+	epg->hash_size = size;
+
+	return 0;
+}
+
+static struct dvb_epg_table *epg_table_get(struct dvb_epg *epg, uint64_t key,
+					   bool *new)
+{
+	unsigned h = epg_hash(key, epg->hash_size);
+	struct dvb_epg_table *t;
+
+	*new = false;
+	for (t = epg->hash[h]; t; t = t->next) {
+		if (t->key == key)
+			return t;
+	}
+
+	/* Not a problem if the table can't grow: the chains get longer */
+	if (epg->n_tables >= epg->hash_size && !epg_hash_grow(epg))
+		h = epg_hash(key, epg->hash_size);
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->key = key;
+	t->next = epg->hash[h];
+	epg->hash[h] = t;
+	epg->n_tables++;
+	*new = true;
+
+	return t;
+}
+
+static bool epg_table_is_complete(const struct dvb_epg_table *t)
+{
+	unsigned seg, i, last;
+
+	/* present/following: all sections up to last_section_number */
+	if ((uint8_t)t->key < DVB_TABLE_EIT_SCHEDULE) {
+		for (i = 0; i <= t->last_section; i++) {
+			if (!test_received(t, i))
+				return false;
+		}
+		return true;
+	}
+
+	/* schedule: each segment up to its segment_last_section_number */
+	for (seg = 0; seg <= t->last_section / 8U; seg++) {
+		if (!(t->segment_seen & (1U << seg)))
+			return false;
+		last = t->segment_last[seg];
+		if (last / 8U != seg)
+			last = seg * 8 + 7;
+		if (last > t->last_section)
+			last = t->last_section;
+		for (i = seg * 8; i <= last; i++) {
+			if (!test_received(t, i))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool epg_wanted_table(struct dvb_epg *epg, uint8_t table_id)
+{
+	if (table_id == DVB_TABLE_EIT ||
+	    (table_id >= DVB_TABLE_EIT_SCHEDULE &&
+	     table_id <= DVB_TABLE_EIT_SCHEDULE + 0xf))
+		return true;
+
+	if (!epg->other)
+		return false;
+
+	return table_id == DVB_TABLE_EIT_OTHER ||
+	       (table_id >= DVB_TABLE_EIT_SCHEDULE_OTHER &&
+		table_id <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0xf);
+}
+
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms, unsigned other,
+			      dvb_epg_change_t handler, void *priv)
+{
+	struct dvb_epg *epg;
+
+	epg = calloc(1, sizeof(*epg));
+	if (!epg)
+		return NULL;
+
+	epg->parms = parms;
+	epg->other = other;
+	epg->handler = handler;
+	epg->priv = priv;
+
+	epg->hash_size = EPG_HASH_MIN;
+	epg->hash = calloc(epg->hash_size, sizeof(*epg->hash));
+	epg->arena = dvb_arena_alloc(0);
+	if (!epg->hash || !epg->arena) {
+		dvb_epg_free(epg);
+		return NULL;
+	}
+
+	return epg;
+}
+
+static void epg_free_tables(struct dvb_epg *epg, bool report)
+{
+	struct dvb_epg_table *t, *next;
+	unsigned i;
+
+	for (i = 0; i < epg->hash_size; i++) {
+		for (t = epg->hash[i]; t; t = next) {
+			next = t->next;
+			if (report)
+				epg_table_clear(epg, t);
+			free(t);
+		}
+		epg->hash[i] = NULL;
+	}
+	epg->n_tables = 0;
+}
+
+void dvb_epg_free(struct dvb_epg *epg)
+{
+	if (!epg)
+		return;
+
+	if (epg->hash) {
+		epg_free_tables(epg, false);
+		free(epg->hash);
+	}
+	dvb_arena_free(epg->arena);
+	free(epg);
+}
+
+void dvb_epg_reset(struct dvb_epg *epg)
+{
+	epg_free_tables(epg, true);
+}
+
+static int epg_parse(struct dvb_epg *epg, struct dvb_epg_table *t,
+		     const uint8_t *buf, size_t buflen,
+		     enum dvb_epg_change_type type, uint8_t section)
+{
+	struct dvb_v5_fe_parms *parms = epg->parms;
+	struct dvb_table_eit *eit = NULL;
+	struct dvb_epg_section sect;
+	struct dvb_arena *arena;
+	ssize_t ret;
+
+	arena = dvb_fe_set_arena(parms, epg->arena);
+	ret = dvb_table_eit_init(parms, buf, buflen - DVB_CRC_SIZE, &eit);
+	dvb_fe_set_arena(parms, arena);
+
+	if (ret >= 0 && eit) {
+		epg_fill_section(&sect, t);
+		sect.section = section;
+		sect.eit = eit;
+		epg->handler(type, &sect, epg->priv);
+	}
+	dvb_arena_reset(epg->arena);
+
+	return ret < 0 ? -1 : 0;
+}
+
+int dvb_epg_parse_section(struct dvb_epg *epg, const uint8_t *buf,
+			  size_t buflen)
+{
+	struct dvb_v5_fe_parms *parms = epg->parms;
+	enum dvb_epg_change_type type;
+	struct dvb_table_header h;
+	struct dvb_epg_table *t;
+	uint16_t transport_id, network_id;
+	uint8_t segment_last;
+	uint32_t crc;
+	bool new;
+
+	if (buflen < EIT_HEADER_SIZE + DVB_CRC_SIZE)
+		return 0;
+	if (!epg_wanted_table(epg, buf[0]))
+		return 0;
+
+	memcpy(&h, buf, sizeof(h));
+	dvb_table_header_init(&h);
+	if (!h.syntax || h.section_length + 3U > buflen)
+		return -1;
+	buflen = h.section_length + 3;
+
+	/* the next version of the sub-table isn't valid yet */
+	if (!h.current_next)
+		return 0;
+
+	transport_id = buf[8] << 8 | buf[9];
+	network_id = buf[10] << 8 | buf[11];
+	segment_last = buf[EIT_SEGMENT_LAST];
+	crc = (uint32_t)buf[buflen - 4] << 24 | buf[buflen - 3] << 16 |
+	      buf[buflen - 2] << 8 | buf[buflen - 1];
+
+	t = epg_table_get(epg, epg_key(network_id, transport_id, h.id,
+				       h.table_id), &new);
+	if (!t) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return -1;
+	}
+
+	if (!new && t->version == h.version) {
+		/* The usual case: a repetition of a section already parsed */
+		if (test_received(t, h.section_id) &&
+		    t->crc[h.section_id] == crc)
+			return 0;
+	}
+
+	if (dvb_crc32((uint8_t *)buf, buflen, 0xffffffff)) {
+		dvb_logwarn(_("%s: crc error on table 0x%02x, service 0x%04x, section %d"),
+			    __func__, h.table_id, h.id, h.section_id);
+		return -1;
+	}
+
+	if (!new && t->version != h.version) {
+		if (parms->verbose)
+			dvb_log(_("%s: table 0x%02x, service 0x%04x: version %d -> %d"),
+				__func__, h.table_id, h.id, t->version, h.version);
+		epg_table_clear(epg, t);
+	}
+	t->version = h.version;
+	t->last_section = h.last_section;
+
+	if (test_received(t, h.section_id))
+		type = DVB_EPG_SECTION_CHANGE;
+	else
+		type = DVB_EPG_SECTION_NEW;
+
+	/* Only record a section once parsed, so a bad one is retried */
+	if (epg_parse(epg, t, buf, buflen, type, h.section_id) < 0)
+		return -1;
+
+	set_received(t, h.section_id);
+	t->crc[h.section_id] = crc;
+	t->segment_last[h.section_id / 8] = segment_last;
+	t->segment_seen |= 1U << (h.section_id / 8);
+
+	if (!t->complete && epg_table_is_complete(t)) {
+		struct dvb_epg_section sect;
+
+		if (parms->verbose)
+			dvb_log(_("%s: table 0x%02x, service 0x%04x, version %d: complete"),
+				__func__, h.table_id, h.id, h.version);
+		t->complete = true;
+		epg_fill_section(&sect, t);
+		epg->handler(DVB_EPG_TABLE_COMPLETE, &sect, epg->priv);
+	}
+
+	return 1;
+}
+
+int dvb_epg_set_filter(struct dvb_epg *epg, int dmx_fd)
+{
+	/* EIT table IDs are 0x4e to 0x6f; the others are ignored when read */
+	unsigned char filter = 0x40, mask = 0xc0;
+
+	return dvb_set_section_filter(dmx_fd, DVB_EPG_PID, 1, &filter, &mask,
+				      NULL, DMX_IMMEDIATE_START | DMX_CHECK_CRC);
+}
+
+int dvb_epg_read(struct dvb_epg *epg, int dmx_fd, int timeout)
+{
+	struct dvb_v5_fe_parms *parms = epg->parms;
+	uint8_t buf[DVB_MAX_PAYLOAD_PACKET_SIZE];
+	struct pollfd pfd = { .fd = dmx_fd, .events = POLLIN };
+	int parsed = 0, read_any = 0, ret;
+	ssize_t len;
+
+	for (;;) {
+		ret = poll(&pfd, 1, read_any ? 0 : timeout);
+		if (ret < 0 && errno == EINTR && !parms->abort)
+			continue;
+		if (ret <= 0 || parms->abort)
+			break;
+
+		len = read(dmx_fd, buf, sizeof(buf));
+		if (len < 0) {
+			/* demux buffer overflow: some sections were lost */
+			if (errno == EOVERFLOW || errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			dvb_perror(_("dvb_epg_read: read error"));
+			return -2;
+		}
+		read_any = 1;
+
+		if (dvb_epg_parse_section(epg, buf, len) > 0)
+			parsed++;
+	}
+
+	if (!read_any)
+		return -1;
+
+	return parsed;
+}
@@ -0,0 +1,674 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-fe-monitor.h>
+#include <libdvbv5/dvb-v5-std.h>
+
+#include <config.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+
+#else
+# define _(string) string
+#endif
+
+/* Statistics that can be sampled. DTV_STATUS isn't a kernel property */
+static const uint32_t mon_stat_cmd[] = {
+	DTV_STATUS,
+	DTV_STAT_SIGNAL_STRENGTH,
+	DTV_STAT_CNR,
+	DTV_STAT_PRE_ERROR_BIT_COUNT,
+	DTV_STAT_PRE_TOTAL_BIT_COUNT,
+	DTV_STAT_POST_ERROR_BIT_COUNT,
+	DTV_STAT_POST_TOTAL_BIT_COUNT,
+	DTV_STAT_ERROR_BLOCK_COUNT,
+	DTV_STAT_TOTAL_BLOCK_COUNT,
+};
+
+#define MON_NUM_STATS	ARRAY_SIZE(mon_stat_cmd)
+
+/* Error and total counters used to calculate an error ratio */
+static const struct mon_ratio {
+	uint32_t cmd;
+	uint32_t error, total;
+} mon_ratio[] = {
+	{ DTV_BER, DTV_STAT_POST_ERROR_BIT_COUNT, DTV_STAT_POST_TOTAL_BIT_COUNT },
+	{ DTV_PRE_BER, DTV_STAT_PRE_ERROR_BIT_COUNT, DTV_STAT_PRE_TOTAL_BIT_COUNT },
+	{ DTV_PER, DTV_STAT_ERROR_BLOCK_COUNT, DTV_STAT_TOTAL_BLOCK_COUNT },
+};
+
+struct mon_ring {
+	struct dvb_fe_monitor_sample	*samples;
+	unsigned			head, count;
+};
+
+struct mon_fe {
+	struct dvb_v5_fe_parms_priv	*parms;
+	unsigned			history;
+	int				updated;
+
+	/* Set if the Kernel can't report the DVBv5 statistics */
+	int				v3_stats;
+
+	/* Kernel statistics asked by FE_GET_PROPERTY */
+	unsigned			n_props;
+	struct dtv_property		props[MON_NUM_STATS];
+
+	/* Rings of the subscribed statistics, for each layer */
+	struct mon_ring			*ring[MON_NUM_STATS];
+	struct mon_ring			*rings;
+	struct dvb_fe_monitor_sample	*samples;
+};
+
+struct dvb_fe_monitor {
+	unsigned			period;
+	dvb_fe_monitor_handler_t	handler;
+	void				*priv;
+
+	/* time of the next sampling, in microseconds */
+	uint64_t			next;
+
+	struct mon_fe			**fe;
+	unsigned			n_fe;
+
+	/* Used only by dvb_fe_monitor_poll() */
+	struct pollfd			*pfd;
+	int				*updated;
+	unsigned			poll_size;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t			lock;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+#  define mon_lock(mon)		pthread_mutex_lock(&(mon)->lock)
+#  define mon_unlock(mon)	pthread_mutex_unlock(&(mon)->lock)
+#else
+#  define mon_lock(mon)		do { } while (0)
+#  define mon_unlock(mon)	do { } while (0)
+#endif
+
+static uint64_t mon_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int mon_stat_index(uint32_t cmd)
+{
+	int i;
+
+	for (i = 0; i < MON_NUM_STATS; i++)
+		if (mon_stat_cmd[i] == cmd)
+			return i;
+	return -1;
+}
+
+static const struct mon_ratio *mon_ratio_find(uint32_t cmd)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mon_ratio); i++)
+		if (mon_ratio[i].cmd == cmd)
+			return &mon_ratio[i];
+	return NULL;
+}
+
+/* Returns the i-th sample of a ring, where 0 is the oldest one */
+static struct dvb_fe_monitor_sample *ring_sample(struct mon_fe *fe,
+						 struct mon_ring *ring,
+						 unsigned i)
+{
+	i += fe->history + ring->head - ring->count;
+
+	return &ring->samples[i % fe->history];
+}
+
+static void ring_store(struct mon_fe *fe, struct mon_ring *ring,
+		       uint64_t now, uint32_t scale, uint64_t value)
+{
+	struct dvb_fe_monitor_sample *s = &ring->samples[ring->head];
+
+	s->timestamp = now;
+	s->scale = scale;
+	s->uvalue = value;
+
+	ring->head = (ring->head + 1) % fe->history;
+	if (ring->count < fe->history)
+		ring->count++;
+}
+
+/*
+ * Finds the first and the last available samples of a counter within the
+ * window that ends at the newest sample.
+ */
+static int ring_window(struct mon_fe *fe, struct mon_ring *ring,
+		       uint64_t window,
+		       struct dvb_fe_monitor_sample **first,
+		       struct dvb_fe_monitor_sample **last)
+{
+	struct dvb_fe_monitor_sample *s;
+	int i;
+
+	*first = NULL;
+	*last = NULL;
+	for (i = ring->count - 1; i >= 0; i--) {
+		s = ring_sample(fe, ring, i);
+		if (*last && (*last)->timestamp - s->timestamp > window)
+			break;
+		if (s->scale != FE_SCALE_COUNTER)
+			continue;
+		if (!*last)
+			*last = s;
+		*first = s;
+	}
+	if (!*last || *first == *last)
+		return -EINVAL;
+
+	return 0;
+}
+
+static struct dvb_fe_monitor_sample *ring_find(struct mon_fe *fe,
+					       struct mon_ring *ring,
+					       uint64_t timestamp)
+{
+	struct dvb_fe_monitor_sample *s;
+	int i;
+
+	for (i = ring->count - 1; i >= 0; i--) {
+		s = ring_sample(fe, ring, i);
+		if (s->timestamp == timestamp)
+			return s->scale == FE_SCALE_COUNTER ? s : NULL;
+		if (s->timestamp < timestamp)
+			break;
+	}
+	return NULL;
+}
+
+static void mon_fe_free(struct mon_fe *fe)
+{
+	free(fe->rings);
+	free(fe->samples);
+	free(fe);
+}
+
+static struct mon_fe *mon_get_fe(struct dvb_fe_monitor *mon, int fe)
+{
+	if (fe < 0 || fe >= mon->n_fe)
+		return NULL;
+	return mon->fe[fe];
+}
+
+struct dvb_fe_monitor *dvb_fe_monitor_alloc(unsigned period,
+					    dvb_fe_monitor_handler_t handler,
+					    void *priv)
+{
+	struct dvb_fe_monitor *mon;
+
+	mon = calloc(1, sizeof(*mon));
+	if (!mon)
+		return NULL;
+
+	mon->period = period ? period : 1;
+	mon->handler = handler;
+	mon->priv = priv;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&mon->lock, NULL);
+#endif
+
+	return mon;
+}
+
+void dvb_fe_monitor_free(struct dvb_fe_monitor *mon)
+{
+	int i;
+
+	if (!mon)
+		return;
+
+	for (i = 0; i < mon->n_fe; i++)
+		if (mon->fe[i])
+			mon_fe_free(mon->fe[i]);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&mon->lock);
+#endif
+	free(mon->fe);
+	free(mon->pfd);
+	free(mon->updated);
+	free(mon);
+}
+
+int dvb_fe_monitor_add(struct dvb_fe_monitor *mon,
+		       struct dvb_v5_fe_parms *p,
+		       const uint32_t *cmds, unsigned n_cmds,
+		       unsigned history)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	const struct mon_ratio *ratio;
+	uint32_t stats = 0;
+	struct mon_fe *fe;
+	int i, j, n = 0, id;
+
+	if (parms->fd < 0) {
+		dvb_logerr(_("%s: frontend is not opened locally"), __func__);
+		return -EBADF;
+	}
+	if (!history)
+		history = 1;
+
+	for (i = 0; i < n_cmds; i++) {
+		ratio = mon_ratio_find(cmds[i]);
+		if (ratio) {
+			stats |= 1 << mon_stat_index(ratio->error);
+			stats |= 1 << mon_stat_index(ratio->total);
+			continue;
+		}
+		j = mon_stat_index(cmds[i]);
+		if (j < 0) {
+			dvb_logerr(_("%s: %s can't be monitored"), __func__,
+				   dvb_cmd_name(cmds[i]));
+			return -EINVAL;
+		}
+		stats |= 1 << j;
+	}
+
+	fe = calloc(1, sizeof(*fe));
+	if (!fe)
+		return -ENOMEM;
+	fe->parms = parms;
+	fe->history = history;
+
+	for (i = 0; i < MON_NUM_STATS; i++)
+		if (stats & (1 << i))
+			n++;
+
+	fe->rings = calloc(n * MAX_DTV_STATS, sizeof(*fe->rings));
+	fe->samples = calloc(n * MAX_DTV_STATS * history, sizeof(*fe->samples));
+	if (!fe->rings || !fe->samples) {
+		mon_fe_free(fe);
+		return -ENOMEM;
+	}
+
+	n = 0;
+	for (i = 0; i < MON_NUM_STATS; i++) {
+		if (!(stats & (1 << i)))
+			continue;
+
+		fe->ring[i] = &fe->rings[n * MAX_DTV_STATS];
+		for (j = 0; j < MAX_DTV_STATS; j++)
+			fe->ring[i][j].samples = &fe->samples[(n * MAX_DTV_STATS + j) * history];
+		n++;
+
+		if (mon_stat_cmd[i] != DTV_STATUS)
+			fe->props[fe->n_props++].cmd = mon_stat_cmd[i];
+	}
+
+	mon_lock(mon);
+	for (id = 0; id < mon->n_fe; id++)
+		if (!mon->fe[id])
+			break;
+	if (id == mon->n_fe) {
+		struct mon_fe **fes;
+
+		fes = realloc(mon->fe, (id + 1) * sizeof(*fes));
+		if (!fes) {
+			mon_unlock(mon);
+			mon_fe_free(fe);
+			return -ENOMEM;
+		}
+		mon->fe = fes;
+		mon->n_fe++;
+	}
+	mon->fe[id] = fe;
+	mon_unlock(mon);
+
+	return id;
+}
+
+void dvb_fe_monitor_remove(struct dvb_fe_monitor *mon, int id)
+{
+	struct mon_fe *fe;
+
+	mon_lock(mon);
+	fe = mon_get_fe(mon, id);
+	if (fe) {
+		mon->fe[id] = NULL;
+		mon_fe_free(fe);
+	}
+	mon_unlock(mon);
+}
+
+static void mon_store_status(struct mon_fe *fe, uint64_t now,
+			     fe_status_t status)
+{
+	struct mon_ring *ring = fe->ring[0];
+
+	if (ring) {
+		ring_store(fe, ring, now, FE_SCALE_RELATIVE, status);
+		fe->updated = 1;
+	}
+}
+
+static void mon_handle_event(struct mon_fe *fe, uint64_t now)
+{
+	struct dvb_v5_fe_parms_priv *parms = fe->parms;
+	struct dvb_frontend_event event;
+
+	if (ioctl(parms->fd, FE_GET_EVENT, &event) == -1) {
+		if (errno != EWOULDBLOCK && errno != EOVERFLOW)
+			dvb_perror("FE_GET_EVENT");
+		return;
+	}
+	mon_store_status(fe, now, event.status);
+}
+
+/* Uses the DVBv3 calls, for drivers that don't provide the v5 stats */
+static void mon_sample_v3(struct mon_fe *fe, uint64_t now)
+{
+	struct dvb_v5_fe_parms_priv *parms = fe->parms;
+	uint16_t val16;
+	uint32_t val32;
+	int i, ret;
+
+	for (i = 0; i < fe->n_props; i++) {
+		uint32_t scale = FE_SCALE_RELATIVE;
+		uint64_t value = 0;
+
+		switch (fe->props[i].cmd) {
+		case DTV_STAT_SIGNAL_STRENGTH:
+			ret = ioctl(parms->fd, FE_READ_SIGNAL_STRENGTH, &val16);
+			value = val16;
+			break;
+		case DTV_STAT_CNR:
+			ret = ioctl(parms->fd, FE_READ_SNR, &val16);
+			value = val16;
+			break;
+		case DTV_STAT_ERROR_BLOCK_COUNT:
+			ret = ioctl(parms->fd, FE_READ_UNCORRECTED_BLOCKS,
+				    &val32);
+			value = val32;
+			scale = FE_SCALE_COUNTER;
+			break;
+		default:
+			/* DVBv3 BER has no defined scale, so isn't a counter */
+			ret = -1;
+		}
+		if (ret == -1)
+			scale = FE_SCALE_NOT_AVAILABLE;
+
+		ring_store(fe, &fe->ring[mon_stat_index(fe->props[i].cmd)][0],
+			   now, scale, value);
+	}
+}
+
+static void mon_sample(struct mon_fe *fe, uint64_t now)
+{
+	struct dvb_v5_fe_parms_priv *parms = fe->parms;
+	struct dtv_properties props;
+	fe_status_t status;
+	int i, layer;
+
+	if (fe->ring[0]) {
+		if (ioctl(parms->fd, FE_READ_STATUS, &status) == -1)
+			dvb_perror("FE_READ_STATUS");
+		else
+			mon_store_status(fe, now, status);
+	}
+
+	if (!fe->n_props)
+		return;
+
+	fe->updated = 1;
+
+	if (!parms->p.has_v5_stats || fe->v3_stats) {
+		mon_sample_v3(fe, now);
+		return;
+	}
+
+	/*
+	 * The frontend parms are shared with dvb_fe_get_stats(), so only
+	 * this monitor falls back to DVBv3 if the ioctl isn't supported.
+	 * Other errors just skip the sample.
+	 */
+	props.num = fe->n_props;
+	props.props = fe->props;
+	if (ioctl(parms->fd, FE_GET_PROPERTY, &props) == -1) {
+		if (errno == ENOTTY || errno == EOPNOTSUPP) {
+			fe->v3_stats = 1;
+			mon_sample_v3(fe, now);
+			return;
+		}
+		if (errno != EAGAIN)
+			dvb_logdbg(_("FE_GET_PROPERTY failed: %m. Sample skipped"));
+		fe->updated = 0;
+		return;
+	}
+
+	for (i = 0; i < fe->n_props; i++) {
+		struct dtv_fe_stats *st = &fe->props[i].u.st;
+		struct mon_ring *ring;
+
+		ring = fe->ring[mon_stat_index(fe->props[i].cmd)];
+		for (layer = 0; layer < MAX_DTV_STATS; layer++) {
+			if (layer < st->len)
+				ring_store(fe, &ring[layer], now,
+					   st->stat[layer].scale,
+					   st->stat[layer].uvalue);
+			else if (ring[layer].count)
+				ring_store(fe, &ring[layer], now,
+					   FE_SCALE_NOT_AVAILABLE, 0);
+		}
+	}
+}
+
+int dvb_fe_monitor_poll(struct dvb_fe_monitor *mon, int timeout)
+{
+	uint64_t now, period = mon->period * 1000ULL;
+	int i, ret, wait, n_fe, n_updated = 0;
+	struct mon_fe *fe;
+
+	mon_lock(mon);
+	n_fe = mon->n_fe;
+	if (n_fe > mon->poll_size) {
+		struct pollfd *pfd;
+		int *updated;
+
+		pfd = realloc(mon->pfd, n_fe * sizeof(*pfd));
+		if (pfd)
+			mon->pfd = pfd;
+		updated = realloc(mon->updated, n_fe * sizeof(*updated));
+		if (updated)
+			mon->updated = updated;
+		if (!pfd || !updated) {
+			mon_unlock(mon);
+			return -ENOMEM;
+		}
+		mon->poll_size = n_fe;
+	}
+
+	now = mon_now();
+	if (!mon->next)
+		mon->next = now;
+	wait = mon->next > now ? (mon->next - now + 999) / 1000 : 0;
+	if (timeout >= 0 && timeout < wait)
+		wait = timeout;
+
+	for (i = 0; i < n_fe; i++) {
+		mon->pfd[i].fd = mon->fe[i] ? mon->fe[i]->parms->fd : -1;
+		mon->pfd[i].events = POLLPRI;
+		mon->pfd[i].revents = 0;
+	}
+	mon_unlock(mon);
+
+	ret = poll(mon->pfd, n_fe, wait);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	mon_lock(mon);
+	now = mon_now();
+	for (i = 0; i < n_fe; i++) {
+		fe = mon->fe[i];
+
+		/* The frontend may have been replaced while polling */
+		if (fe && fe->parms->fd == mon->pfd[i].fd &&
+		    (mon->pfd[i].revents & POLLPRI))
+			mon_handle_event(fe, now);
+	}
+
+	if (now >= mon->next) {
+		for (i = 0; i < n_fe; i++)
+			if (mon->fe[i])
+				mon_sample(mon->fe[i], now);
+
+		mon->next += period;
+		if (mon->next <= now)
+			mon->next = now + period;
+	}
+
+	for (i = 0; i < n_fe; i++) {
+		fe = mon->fe[i];
+		if (!fe || !fe->updated)
+			continue;
+		fe->updated = 0;
+		mon->updated[n_updated++] = i;
+	}
+	mon_unlock(mon);
+
+	/* The callback may retrieve the samples, so it is called unlocked */
+	if (mon->handler) {
+		for (i = 0; i < n_updated; i++)
+			mon->handler(mon, mon->updated[i], mon->priv);
+	}
+
+	return n_updated;
+}
+
+static struct mon_ring *mon_get_ring(struct dvb_fe_monitor *mon, int id,
+				     uint32_t cmd, unsigned layer,
+				     struct mon_fe **fe)
+{
+	int i = mon_stat_index(cmd);
+
+	*fe = mon_get_fe(mon, id);
+	if (!*fe || i < 0 || layer >= MAX_DTV_STATS || !(*fe)->ring[i])
+		return NULL;
+
+	return &(*fe)->ring[i][layer];
+}
+
+int dvb_fe_monitor_get_samples(struct dvb_fe_monitor *mon, int id,
+			       uint32_t cmd, unsigned layer,
+			       struct dvb_fe_monitor_sample *samples,
+			       unsigned max)
+{
+	struct mon_ring *ring;
+	struct mon_fe *fe;
+	int i, n;
+
+	mon_lock(mon);
+	ring = mon_get_ring(mon, id, cmd, layer, &fe);
+	if (!ring) {
+		mon_unlock(mon);
+		return -EINVAL;
+	}
+
+	n = ring->count < max ? ring->count : max;
+	for (i = 0; i < n; i++)
+		samples[i] = *ring_sample(fe, ring, ring->count - n + i);
+	mon_unlock(mon);
+
+	return n;
+}
+
+int dvb_fe_monitor_rate(struct dvb_fe_monitor *mon, int id,
+			uint32_t cmd, unsigned layer, unsigned window,
+			float *rate)
+{
+	struct dvb_fe_monitor_sample *first, *last;
+	struct mon_ring *ring;
+	struct mon_fe *fe;
+	int ret = -EINVAL;
+
+	mon_lock(mon);
+	ring = mon_get_ring(mon, id, cmd, layer, &fe);
+	if (ring && !ring_window(fe, ring, window * 1000ULL, &first, &last) &&
+	    last->uvalue >= first->uvalue) {
+		*rate = (float)(last->uvalue - first->uvalue) * 1000000 /
+			(last->timestamp - first->timestamp);
+		ret = 0;
+	}
+	mon_unlock(mon);
+
+	return ret;
+}
+
+int dvb_fe_monitor_error_ratio(struct dvb_fe_monitor *mon, int id,
+			       uint32_t cmd, unsigned layer, unsigned window,
+			       float *ratio)
+{
+	struct dvb_fe_monitor_sample *first, *last, *err_first, *err_last;
+	const struct mon_ratio *r = mon_ratio_find(cmd);
+	struct mon_ring *total, *error;
+	struct mon_fe *fe;
+	int ret = -EINVAL;
+
+	if (!r)
+		return -EINVAL;
+
+	mon_lock(mon);
+	total = mon_get_ring(mon, id, r->total, layer, &fe);
+	error = mon_get_ring(mon, id, r->error, layer, &fe);
+	if (!total || !error)
+		goto out;
+
+	if (ring_window(fe, total, window * 1000ULL, &first, &last))
+		goto out;
+
+	/* Both counters are read by the same ioctl, so have the same time */
+	err_first = ring_find(fe, error, first->timestamp);
+	err_last = ring_find(fe, error, last->timestamp);
+	if (!err_first || !err_last || last->uvalue <= first->uvalue ||
+	    err_last->uvalue < err_first->uvalue)
+		goto out;
+
+	*ratio = (float)(err_last->uvalue - err_first->uvalue) /
+		 (last->uvalue - first->uvalue);
+	ret = 0;
+out:
+	mon_unlock(mon);
+
+	return ret;
+}
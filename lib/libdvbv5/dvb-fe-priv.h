@@ -54,7 +54,42 @@ struct dvb_v5_stats {
 
 };
 
+/* SEC/DiSEqC setup done by dvb_sat_set_parms() */
+struct dvb_fe_sec_state {
+	const struct dvb_sat_lnb	*lnb;
+	int				sat_number;
+	int				high_band;
+	int				pol_v;
+	int				vol_high;
+	int				tone_on;
+	uint16_t			t;
+};
+
+struct dvb_fe_tune_cache {
+	/* properties sent to the Kernel on the last tune */
+	fe_delivery_system_t		delsys;
+	int				n_props;
+	struct dtv_property		prop[DTV_MAX_COMMAND];
+
+	/* SEC setup, reset by any SEC/DiSEqC command */
+	int				sec_valid;
+	struct dvb_fe_sec_state		sec;
+
+	/* transponders tuned so far */
+	struct dvb_fe_tune_info		*entry;
+	unsigned			n_entries, max_entries;
+
+	/* last tune: transponder (or -1), lock status and time, in ms */
+	int				cur;
+	int				locked;
+	uint64_t			tune_time;
+};
+
 struct dvb_device_priv;
+struct dvb_iconv_cache;
+struct dvb_arena;
+struct dvb_section_mux;
+struct dvb_table_filter;
 
 struct dvb_v5_fe_parms_priv {
 	/* dvbv_v4_fe_parms should be the first element on this struct */
@@ -78,6 +113,18 @@ struct dvb_v5_fe_parms_priv {
 
 	dvb_logfunc_priv		logfunc_priv;
 	void				*logpriv;
+
+	/* iconv descriptors used by parse_string.c */
+	struct dvb_iconv_cache		*iconv_cache;
+
+	/* arena used by the table parsers, see dvb_fe_set_arena() */
+	struct dvb_arena		*arena;
+
+	/* used by dvb_get_ts_tables(), see dvb_fe_set_section_mux() */
+	struct dvb_section_mux		*section_mux;
+
+	/* see dvb_fe_set_tune_cache() */
+	struct dvb_fe_tune_cache	*tune_cache;
 };
 
 /* Functions used internally by dvb-dev.c. Aren't part of the API */
@@ -86,6 +133,16 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms);
 void __dvb_fe_close(struct dvb_v5_fe_parms_priv *parms);
 
+/* From dvb-scan.c, used by dvb-section-mux.c */
+int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
+			    struct dvb_table_filter *sect);
+int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
+		      struct dvb_table_filter *sect,
+		      const uint8_t *buf, ssize_t buf_length);
+
+/* From dvb-section-mux.c */
+int dvb_section_mux_has_fds(const struct dvb_section_mux *mux);
+
 /* Functions that can be overriden to be executed remotely */
 int __dvb_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys);
 int __dvb_fe_get_parms(struct dvb_v5_fe_parms *p);
@@ -19,9 +19,11 @@
 
 #include "dvb-fe-priv.h"
 #include "dvb-v5.h"
+#include "parse_string.h"
 #include <libdvbv5/dvb-dev.h>
 #include <libdvbv5/countries.h>
 #include <libdvbv5/dvb-v5-std.h>
+#include <libdvbv5/dvb-scan.h>
 
 #include <inttypes.h>
 #include <math.h>
@@ -85,6 +87,9 @@ void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms)
 	if (parms->fname)
 		free(parms->fname);
 
+	dvb_fe_set_tune_cache(&parms->p, 0);
+
+	dvb_iconv_cache_free(&parms->p);
 	free(parms);
 }
 
@@ -873,16 +878,198 @@ static void dvb_setup_delsys_default(struct dvb_v5_fe_parms *p)
 	}
 }
 
+static uint64_t dvb_fe_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Finds the transponder being tuned at the tuning cache, adding it if
+ * needed, and applies the frequency offset found at its last lock.
+ * Returns 1 if it is a retry after a tune without lock.
+ */
+static int dvb_fe_tune_cache_start(struct dvb_v5_fe_parms_priv *parms,
+				   struct dvb_v5_fe_parms_priv *tmp_parms)
+{
+	struct dvb_fe_tune_cache *cache = parms->tune_cache;
+	struct dvb_fe_tune_info *entry;
+	uint32_t freq = 0, pol = POLARIZATION_OFF;
+	unsigned i;
+	int retry;
+
+	dvb_fe_retrieve_parm(&parms->p, DTV_FREQUENCY, &freq);
+	dvb_fe_retrieve_parm(&parms->p, DTV_POLARIZATION, &pol);
+
+	for (i = 0; i < cache->n_entries; i++) {
+		entry = &cache->entry[i];
+		if (entry->delivery_system == parms->p.current_sys &&
+		    entry->frequency == freq && entry->polarization == pol &&
+		    entry->sat_number == parms->p.sat_number)
+			break;
+	}
+	if (i == cache->n_entries) {
+		if (cache->n_entries == cache->max_entries) {
+			unsigned max = cache->max_entries ? cache->max_entries * 2 : 16;
+
+			entry = realloc(cache->entry, max * sizeof(*entry));
+			if (!entry) {
+				cache->cur = -1;
+				return 0;
+			}
+			cache->entry = entry;
+			cache->max_entries = max;
+		}
+		entry = &cache->entry[cache->n_entries++];
+		memset(entry, 0, sizeof(*entry));
+		entry->delivery_system = parms->p.current_sys;
+		entry->frequency = freq;
+		entry->polarization = pol;
+		entry->sat_number = parms->p.sat_number;
+	}
+	entry = &cache->entry[i];
+
+	/*
+	 * Tuning again without a lock: the cached state or the offset may
+	 * be what is preventing it, so do a full tune.
+	 */
+	retry = (cache->cur == i && !cache->locked);
+	if (retry) {
+		cache->sec_valid = 0;
+		cache->n_props = 0;
+		entry->freq_offset = 0;
+	}
+
+	cache->cur = i;
+	cache->locked = 0;
+	entry->tunes++;
+
+	/* So that dvb_fe_get_stats() notices the lock of this tune */
+	parms->stats.prev_status = 0;
+
+	if (entry->freq_offset) {
+		if (parms->p.verbose)
+			dvb_log(_("Using the frequency offset of %d from the last lock"),
+				entry->freq_offset);
+		dvb_fe_store_parm(&tmp_parms->p, DTV_FREQUENCY,
+				  freq + entry->freq_offset);
+	}
+
+	return retry;
+}
+
+/*
+ * Called when dvb_fe_get_stats() gets a lock, after dvb_fe_get_parms(), so
+ * DTV_FREQUENCY is the one reported by the frontend.
+ */
+static void dvb_fe_tune_cache_lock(struct dvb_v5_fe_parms_priv *parms)
+{
+	struct dvb_fe_tune_cache *cache = parms->tune_cache;
+	struct dvb_fe_tune_info *entry;
+	uint32_t freq;
+	int offset;
+
+	if (cache->cur < 0 || cache->locked)
+		return;
+
+	entry = &cache->entry[cache->cur];
+	cache->locked = 1;
+	entry->locks++;
+	entry->lock_time = dvb_fe_time_ms() - cache->tune_time;
+
+	if (!dvb_fe_retrieve_parm(&parms->p, DTV_FREQUENCY, &freq)) {
+		offset = (int)(freq - entry->frequency);
+		if (offset && abs(offset) > dvb_estimate_freq_shift(&parms->p))
+			offset = 0;
+		entry->freq_offset = offset;
+	}
+
+	if (parms->p.verbose)
+		dvb_log(_("Lock after %u ms, frequency offset: %d"),
+			entry->lock_time, entry->freq_offset);
+}
+
+/*
+ * Properties that can't be skipped, as the Kernel may change them after a
+ * tune: the frequency and inversion, while zigzagging, and the ones left
+ * to be detected by the driver.
+ */
+static int dvb_fe_prop_is_volatile(uint32_t cmd, uint32_t value)
+{
+	switch (cmd) {
+	case DTV_FREQUENCY:
+	case DTV_INVERSION:
+		return 1;
+	case DTV_BANDWIDTH_HZ:
+		return value == 0;
+	case DTV_MODULATION:
+	case DTV_ISDBT_LAYERA_MODULATION:
+	case DTV_ISDBT_LAYERB_MODULATION:
+	case DTV_ISDBT_LAYERC_MODULATION:
+		return value == QAM_AUTO;
+	case DTV_INNER_FEC:
+	case DTV_CODE_RATE_HP:
+	case DTV_CODE_RATE_LP:
+	case DTV_ISDBT_LAYERA_FEC:
+	case DTV_ISDBT_LAYERB_FEC:
+	case DTV_ISDBT_LAYERC_FEC:
+		return value == FEC_AUTO;
+	case DTV_TRANSMISSION_MODE:
+		return value == TRANSMISSION_MODE_AUTO;
+	case DTV_GUARD_INTERVAL:
+		return value == GUARD_INTERVAL_AUTO;
+	case DTV_HIERARCHY:
+		return value == HIERARCHY_AUTO;
+	case DTV_ROLLOFF:
+		return value == ROLLOFF_AUTO;
+	case DTV_PILOT:
+		return value == PILOT_AUTO;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Copies the properties that weren't sent with the same value on the
+ * previous tune. Returns the number of properties copied.
+ */
+static int dvb_fe_tune_cache_props(struct dvb_fe_tune_cache *cache,
+				   const struct dtv_property *from, int n,
+				   struct dtv_property *to)
+{
+	int i, j, n_to = 0;
+
+	for (i = 0; i < n; i++) {
+		if (!dvb_fe_prop_is_volatile(from[i].cmd, from[i].u.data)) {
+			for (j = 0; j < cache->n_props; j++)
+				if (cache->prop[j].cmd == from[i].cmd)
+					break;
+			if (j < cache->n_props &&
+			    cache->prop[j].u.data == from[i].u.data)
+				continue;
+		}
+		to[n_to++] = from[i];
+	}
+
+	return n_to;
+}
+
 int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
 	/* Use a temporary copy of the parameters so we can safely perform
 	 * adjustments for satellite */
 	struct dvb_v5_fe_parms_priv tmp_parms = *parms;
+	struct dvb_fe_tune_cache *cache = parms->tune_cache;
 
 	struct dtv_properties prop;
+	struct dtv_property changed[DTV_MAX_COMMAND];
 	struct dvb_frontend_parameters v3_parms;
 	uint32_t bw;
+	int retry = 0;
 
 	if (parms->p.lna != LNA_AUTO && !parms->p.legacy_fe) {
 		struct dvb_v5_fe_parms_priv tmp_lna_parms;
@@ -900,6 +1087,9 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 			dvb_logdbg(_("LNA is %s"), parms->p.lna ? _("ON") : _("OFF"));
 	}
 
+	if (cache)
+		retry = dvb_fe_tune_cache_start(parms, &tmp_parms);
+
 	if (dvb_fe_is_satellite(tmp_parms.p.current_sys)) {
 		dvb_sat_set_parms(&tmp_parms.p);
 		/*
@@ -924,16 +1114,41 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 	memset(&prop, 0, sizeof(prop));
 	prop.props = tmp_parms.dvb_prop;
 	prop.num = tmp_parms.n_props;
+
+	/*
+	 * Older Kernels overwrite the properties they keep with the
+	 * detected ones, so they need the full list on every tune.
+	 */
+	if (cache && !retry && cache->n_props &&
+	    cache->delsys == parms->p.current_sys && parms->p.version >= 0x50b) {
+		prop.props = changed;
+		prop.num = dvb_fe_tune_cache_props(cache, tmp_parms.dvb_prop,
+						   tmp_parms.n_props, changed);
+		if (parms->p.verbose)
+			dvb_log(_("Sending %d of %d properties"),
+				prop.num, tmp_parms.n_props);
+	}
 	prop.props[prop.num].cmd = DTV_TUNE;
 	prop.num++;
 
+	if (cache)
+		cache->tune_time = dvb_fe_time_ms();
+
 	if (!parms->p.legacy_fe) {
 		if (xioctl(parms->fd, FE_SET_PROPERTY, &prop) == -1) {
+			if (cache)
+				cache->n_props = 0;
 			dvb_perror("FE_SET_PROPERTY");
 			if (parms->p.verbose)
 				dvb_fe_prt_parms(&parms->p);
 			return -errno;
 		}
+		if (cache) {
+			memcpy(cache->prop, tmp_parms.dvb_prop,
+			       tmp_parms.n_props * sizeof(*cache->prop));
+			cache->n_props = tmp_parms.n_props;
+			cache->delsys = parms->p.current_sys;
+		}
 		return 0;
 	}
 	/* DVBv3 call */
@@ -1457,8 +1672,11 @@ int __dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 	/* if lock has obtained, get DVB parameters */
 	if (status != parms->stats.prev_status) {
 		if ((status & FE_HAS_LOCK) &&
-		    parms->stats.prev_status != status)
+		    parms->stats.prev_status != status) {
 			dvb_fe_get_parms(&parms->p);
+			if (parms->tune_cache)
+				dvb_fe_tune_cache_lock(parms);
+		}
 		parms->stats.prev_status = status;
 	}
 
@@ -1849,6 +2067,13 @@ int dvb_fe_snprintf_stat(struct dvb_v5_fe_parms *p, uint32_t cmd,
  * version.
  */
 
+/* The SEC setup cached by dvb_sat_set_parms() is lost on any SEC command */
+static void dvb_fe_sec_changed(struct dvb_v5_fe_parms_priv *parms)
+{
+	if (parms->tune_cache)
+		parms->tune_cache->sec_valid = 0;
+}
+
 int dvb_fe_sec_voltage(struct dvb_v5_fe_parms *p, int on, int v18)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
@@ -1864,6 +2089,7 @@ int dvb_fe_sec_voltage(struct dvb_v5_fe_parms *p, int on, int v18)
 		if (parms->p.verbose)
 			dvb_log(_("SEC: set voltage to %sV"), v18 ? "18" : "13");
 	}
+	dvb_fe_sec_changed(parms);
 	rc = xioctl(parms->fd, FE_SET_VOLTAGE, v);
 	if (rc == -1) {
 		if (errno == ENOTSUP) {
@@ -1882,6 +2108,7 @@ int dvb_fe_sec_tone(struct dvb_v5_fe_parms *p, fe_sec_tone_mode_t tone)
 	int rc;
 	if (parms->p.verbose)
 		dvb_log( _("DiSEqC TONE: %s"), fe_tone_name[tone] );
+	dvb_fe_sec_changed(parms);
 	rc = xioctl(parms->fd, FE_SET_TONE, tone);
 	if (rc == -1) {
 		dvb_perror("FE_SET_TONE");
@@ -1898,6 +2125,7 @@ int dvb_fe_lnb_high_voltage(struct dvb_v5_fe_parms *p, int on)
 	if (on) on = 1;
 	if (parms->p.verbose)
 		dvb_log( _("DiSEqC HIGH LNB VOLTAGE: %s"), on ? _("ON") : _("OFF") );
+	dvb_fe_sec_changed(parms);
 	rc = xioctl(parms->fd, FE_ENABLE_HIGH_LNB_VOLTAGE, on);
 	if (rc == -1) {
 		dvb_perror("FE_ENABLE_HIGH_LNB_VOLTAGE");
@@ -1916,6 +2144,7 @@ int dvb_fe_diseqc_burst(struct dvb_v5_fe_parms *p, int mini_b)
 
 	if (parms->p.verbose)
 		dvb_log( _("DiSEqC BURST: %s"), mini_b ? "SEC_MINI_B" : "SEC_MINI_A" );
+	dvb_fe_sec_changed(parms);
 	rc = xioctl(parms->fd, FE_DISEQC_SEND_BURST, mini);
 	if (rc == -1) {
 		dvb_perror("FE_DISEQC_SEND_BURST");
@@ -1947,6 +2176,7 @@ int dvb_fe_diseqc_cmd(struct dvb_v5_fe_parms *p, const unsigned len,
 		dvb_log("%s", log);
 	}
 
+	dvb_fe_sec_changed(parms);
 	rc = xioctl(parms->fd, FE_DISEQC_SEND_MASTER_CMD, &msg);
 	if (rc == -1) {
 		dvb_perror("FE_DISEQC_SEND_MASTER_CMD");
@@ -2003,6 +2233,42 @@ int dvb_fe_set_default_country(struct dvb_v5_fe_parms *p, const char *cc)
 	return (parms->country == COUNTRY_UNKNOWN) ? -EINVAL : 0;
 }
 
+int dvb_fe_set_tune_cache(struct dvb_v5_fe_parms *p, int enable)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_fe_tune_cache *cache = parms->tune_cache;
+
+	if (enable && !cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (!cache)
+			return -ENOMEM;
+		cache->cur = -1;
+		parms->tune_cache = cache;
+		return 0;
+	}
+	if (!enable && cache) {
+		free(cache->entry);
+		free(cache);
+		parms->tune_cache = NULL;
+	}
+
+	return cache != NULL;
+}
+
+int dvb_fe_get_tune_info(struct dvb_v5_fe_parms *p,
+			 struct dvb_fe_tune_info *info)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_fe_tune_cache *cache = parms->tune_cache;
+
+	if (!cache || cache->cur < 0)
+		return -ENOENT;
+
+	*info = cache->entry[cache->cur];
+
+	return 0;
+}
+
 dvb_logfunc_priv dvb_get_log_priv(struct dvb_v5_fe_parms *p, void **priv)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
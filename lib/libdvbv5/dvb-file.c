@@ -22,6 +22,7 @@
 #include <string.h>
 #include <strings.h> /* strcasecmp */
 #include <unistd.h>
+#include <ctype.h>
 
 #include "dvb-fe-priv.h"
 #include <libdvbv5/dvb-file.h>
@@ -52,6 +53,10 @@
 
 #include <config.h>
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
 #ifdef ENABLE_NLS
 # include "gettext.h"
 # include <libintl.h>
@@ -575,24 +580,173 @@ error:
 
 #define CHANNEL "CHANNEL"
 
+/*
+ * Keys accepted by the DVBv5 file format. They're looked up on a
+ * case-insensitive hash table, as channel files may have several
+ * thousands of entries with about 15 keys each.
+ */
+enum file_key_type {
+	KEY_V5_PROP,
+	KEY_USER_PROP,
+	KEY_SERVICE_ID,
+	KEY_NETWORK_ID,
+	KEY_TRANSPORT_ID,
+	KEY_VCHANNEL,
+	KEY_SAT_NUMBER,
+	KEY_FREQ_BPF,
+	KEY_DISEQC_WAIT,
+	KEY_LNB,
+	KEY_COUNTRY,
+	KEY_VIDEO_PID,
+	KEY_AUDIO_PID,
+	KEY_POLARIZATION,
+};
+
+struct file_key {
+	const char		*name;
+	enum file_key_type	type;
+	uint32_t		cmd;
+};
+
+/* Should be a power of two, and at least twice the number of keys */
+#define FILE_KEY_HASH_SIZE	512
+
+static struct file_key file_keys[FILE_KEY_HASH_SIZE];
+
+/* FNV-1a hash, ignoring the case */
+static unsigned strcase_hash(const char *str)
+{
+	unsigned hash = 2166136261u;
+
+	for (; *str; str++)
+		hash = (hash ^ tolower((unsigned char)*str)) * 16777619u;
+
+	return hash;
+}
+
+static unsigned file_key_hash(const char *key)
+{
+	return strcase_hash(key) & (FILE_KEY_HASH_SIZE - 1);
+}
+
+static const struct file_key *__file_key_find(const char *key)
+{
+	unsigned i = file_key_hash(key);
+
+	while (file_keys[i].name) {
+		if (!strcasecmp(key, file_keys[i].name))
+			return &file_keys[i];
+		i = (i + 1) & (FILE_KEY_HASH_SIZE - 1);
+	}
+	return NULL;
+}
+
+static void file_key_add(const char *name, enum file_key_type type,
+			 uint32_t cmd)
+{
+	unsigned i;
+
+	/* Keep the first definition, as the linear search used to do */
+	if (!name || __file_key_find(name))
+		return;
+
+	i = file_key_hash(name);
+	while (file_keys[i].name)
+		i = (i + 1) & (FILE_KEY_HASH_SIZE - 1);
+
+	file_keys[i].name = name;
+	file_keys[i].type = type;
+	file_keys[i].cmd = cmd;
+}
+
+static void file_keys_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(dvb_v5_name); i++)
+		file_key_add(dvb_v5_name[i], KEY_V5_PROP, i);
+
+	file_key_add("SERVICE_ID", KEY_SERVICE_ID, 0);
+	file_key_add("NETWORK_ID", KEY_NETWORK_ID, 0);
+	file_key_add("TRANSPORT_ID", KEY_TRANSPORT_ID, 0);
+	file_key_add("VCHANNEL", KEY_VCHANNEL, 0);
+	file_key_add("SAT_NUMBER", KEY_SAT_NUMBER, 0);
+	file_key_add("FREQ_BPF", KEY_FREQ_BPF, 0);
+	file_key_add("DISEQC_WAIT", KEY_DISEQC_WAIT, 0);
+	file_key_add("LNB", KEY_LNB, 0);
+	file_key_add("COUNTRY", KEY_COUNTRY, 0);
+	file_key_add("VIDEO_PID", KEY_VIDEO_PID, 0);
+	file_key_add("AUDIO_PID", KEY_AUDIO_PID, 0);
+	file_key_add("POLARIZATION", KEY_POLARIZATION, 0);
+
+	for (i = 0; i < DTV_USER_NAME_SIZE; i++)
+		file_key_add(dvb_user_name[i], KEY_USER_PROP,
+			     i + DTV_USER_COMMAND_START);
+}
+
+static const struct file_key *file_key_find(const char *key)
+{
+#ifdef HAVE_PTHREAD
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, file_keys_init);
+#else
+	static int initialized;
+
+	if (!initialized) {
+		file_keys_init();
+		initialized = 1;
+	}
+#endif
+	return __file_key_find(key);
+}
+
 static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 {
-	int i, j, len, type = 0;
-	int is_video = 0, is_audio = 0, n_prop;
+	const struct file_key *k;
+	int j, len, type = 0;
+	int is_video = 0, n_prop;
 	uint16_t *pid = NULL;
 	char *p;
 
-	/* Handle the DVBv5 DTV_foo properties */
-	for (i = 0; i < ARRAY_SIZE(dvb_v5_name); i++) {
-		if (!dvb_v5_name[i])
-			continue;
-		if (!strcasecmp(key, dvb_v5_name[i]))
-			break;
+	k = file_key_find(key);
+	if (!k) {
+		if (strncasecmp(key, "PID_", 4))
+			/*
+			 * If the key is not known, just discard.
+			 * This way, it provides forward compatibility with
+			 * new keys that may be added in the future.
+			 */
+			return 0;
+
+		type = strtol(&key[4], NULL, 16);
+		if (!type)
+			return 0;
+
+		len = 0;
+
+		p = strtok(value," \t");
+		if (!p)
+			return 0;
+		while (p) {
+			entry->other_el_pid = realloc(entry->other_el_pid,
+						      (len + 1) *
+						      sizeof (*entry->other_el_pid));
+			entry->other_el_pid[len].type = type;
+			entry->other_el_pid[len].pid = atol(p);
+			p = strtok(NULL, " \t\n");
+			len++;
+		}
+		entry->other_el_pid_len = len;
+		return 0;
 	}
-	if (i < ARRAY_SIZE(dvb_v5_name)) {
-		const char * const *attr_name = dvb_attr_names(i);
+
+	switch (k->type) {
+	case KEY_V5_PROP: {
+		/* Handle the DVBv5 DTV_foo properties */
+		const char * const *attr_name = dvb_attr_names(k->cmd);
 		n_prop = entry->n_props;
-		entry->props[n_prop].cmd = i;
+		entry->props[n_prop].cmd = k->cmd;
 		if (!attr_name || !*attr_name)
 			entry->props[n_prop].u.data = atol(value);
 		else {
@@ -606,62 +760,45 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 		entry->n_props++;
 		return 0;
 	}
-
-	/* Handle the other properties */
-
-	if (!strcasecmp(key, "SERVICE_ID")) {
+	case KEY_USER_PROP:
+		/* FIXME: this works only for integer values */
+		n_prop = entry->n_props;
+		entry->props[n_prop].cmd = k->cmd;
+		entry->props[n_prop].u.data = atol(value);
+		entry->n_props++;
+		return 0;
+	case KEY_SERVICE_ID:
 		entry->service_id = atol(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "NETWORK_ID")) {
+	case KEY_NETWORK_ID:
 		entry->network_id = atol(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "TRANSPORT_ID")) {
+	case KEY_TRANSPORT_ID:
 		entry->transport_id = atol(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "VCHANNEL")) {
+	case KEY_VCHANNEL:
 		entry->vchannel = strdup(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "SAT_NUMBER")) {
+	case KEY_SAT_NUMBER:
 		entry->sat_number = atol(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "FREQ_BPF")) {
+	case KEY_FREQ_BPF:
 		entry->freq_bpf = atol(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "DISEQC_WAIT")) {
+	case KEY_DISEQC_WAIT:
 		entry->diseqc_wait = atol(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "LNB")) {
+	case KEY_LNB:
 		entry->lnb = strdup(value);
 		return 0;
-	}
-
-	if (!strcasecmp(key, "COUNTRY")) {
+	case KEY_COUNTRY: {
 		enum dvb_country_t id = dvb_country_a2_to_id(value);
 		if (id == COUNTRY_UNKNOWN)
 			return -2;
 		dvb_store_entry_prop(entry, DTV_COUNTRY_CODE, id);
 		return 0;
 	}
-
-	if (!strcasecmp(key, "VIDEO_PID"))
-		is_video = 1;
-	else if (!strcasecmp(key, "AUDIO_PID"))
-		is_audio = 1;
-	else if (!strcasecmp(key, "POLARIZATION")) {
+	case KEY_POLARIZATION:
 		for (j = 0; j < ARRAY_SIZE(dvb_sat_pol_name); j++)
 			if (dvb_sat_pol_name[j] && !strcasecmp(value, dvb_sat_pol_name[j]))
 				break;
@@ -669,54 +806,11 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 			return -2;
 		dvb_store_entry_prop(entry, DTV_POLARIZATION, j);
 		return 0;
-	} else if (!strncasecmp(key,"PID_", 4)){
-		type = strtol(&key[4], NULL, 16);
-		if (!type)
-			return 0;
-
-		len = 0;
-
-		p = strtok(value," \t");
-		if (!p)
-			return 0;
-		while (p) {
-			entry->other_el_pid = realloc(entry->other_el_pid,
-						      (len + 1) *
-						      sizeof (*entry->other_el_pid));
-			entry->other_el_pid[len].type = type;
-			entry->other_el_pid[len].pid = atol(p);
-			p = strtok(NULL, " \t\n");
-			len++;
-		}
-		entry->other_el_pid_len = len;
-	}
-
-	if (!is_video && !is_audio) {
-		int cmd = 0;
-
-		for (i = 0; i < DTV_USER_NAME_SIZE; i++) {
-			cmd = i + DTV_USER_COMMAND_START;
-
-			if (!strcasecmp(key, dvb_user_name[i]))
-				break;
-		}
-
-		/*
-		 * If the key is not known, just discard.
-		 * This way, it provides forward compatibility with new keys
-		 * that may be added in the future.
-		 */
-
-		if (i >= DTV_USER_NAME_SIZE)
-			return 0;
-
-		/* FIXME: this works only for integer values */
-		n_prop = entry->n_props;
-		entry->props[n_prop].cmd = cmd;
-		entry->props[n_prop].u.data = atol(value);
-		entry->n_props++;
-
-		return 0;
+	case KEY_VIDEO_PID:
+		is_video = 1;
+		break;
+	case KEY_AUDIO_PID:
+		break;
 	}
 
 	/* Video and audio may have multiple values */
@@ -745,28 +839,27 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 }
 
 
-struct dvb_file *dvb_read_file(const char *fname)
+/*
+ * Parses a file in the DVBv5 format, calling handler for each entry once
+ * it is complete. The handler takes ownership of the entry.
+ */
+static int __dvb_read_file(const char *fname,
+			   dvb_file_entry_handler_t handler, void *priv)
 {
 	char *buf = NULL, *p, *key, *value;
 	size_t size = 0;
 	int len = 0;
-	int line = 0, rc;
-	struct dvb_file *dvb_file;
+	int line = 0, rc = 0;
 	FILE *fd;
 	struct dvb_entry *entry = NULL;
 	char err_msg[80];
-
-	dvb_file = calloc(sizeof(*dvb_file), 1);
-	if (!dvb_file) {
-		perror(_("Allocating memory for dvb_file"));
-		return NULL;
-	}
+	int err = -EINVAL;
 
 	fd = fopen(fname, "r");
 	if (!fd) {
+		err = -errno;
 		perror(fname);
-		free(dvb_file);
-		return NULL;
+		return err;
 	}
 
 	do {
@@ -782,13 +875,18 @@ struct dvb_file *dvb_read_file(const char *fname)
 
 		if (*p == '[') {
 			/* NEW Entry */
-			if (!entry) {
-				dvb_file->first_entry = calloc(sizeof(*entry), 1);
-				entry = dvb_file->first_entry;
-			} else {
+			if (entry) {
 				adjust_delsys(entry);
-				entry->next = calloc(sizeof(*entry), 1);
-				entry = entry->next;
+				rc = handler(entry, priv);
+				entry = NULL;
+				if (rc)
+					break;
+			}
+			entry = calloc(sizeof(*entry), 1);
+			if (!entry) {
+				sprintf(err_msg, _("not enough memory"));
+				err = -ENOMEM;
+				goto error;
 			}
 			entry->sat_number = -1;
 			p++;
@@ -833,149 +931,412 @@ struct dvb_file *dvb_read_file(const char *fname)
 					value, key);
 				goto error;
 			}
+			rc = 0;
 		}
 	} while (1);
 	if (buf)
 		free(buf);
-	if (entry)
+	if (entry) {
 		adjust_delsys(entry);
+		rc = handler(entry, priv);
+	}
 	fclose(fd);
-	return dvb_file;
+	return rc;
 
 error:
 	fprintf (stderr, _("ERROR %s while parsing line %d of %s\n"),
 		 err_msg, line, fname);
 	if (buf)
 		free(buf);
-	dvb_file_free(dvb_file);
+	if (entry)
+		dvb_file_entry_free(entry);
 	fclose(fd);
-	return NULL;
+	return err;
+}
+
+struct foreach_priv {
+	dvb_file_entry_handler_t handler;
+	void *priv;
 };
 
-int dvb_write_file(const char *fname, struct dvb_file *dvb_file)
+static int foreach_entry(struct dvb_entry *entry, void *priv)
+{
+	struct foreach_priv *p = priv;
+	int rc;
+
+	rc = p->handler(entry, p->priv);
+	dvb_file_entry_free(entry);
+
+	return rc;
+}
+
+int dvb_read_file_foreach(const char *fname,
+			  dvb_file_entry_handler_t handler, void *priv)
+{
+	struct foreach_priv p = {
+		.handler = handler,
+		.priv = priv,
+	};
+
+	return __dvb_read_file(fname, foreach_entry, &p);
+}
+
+struct read_file_priv {
+	struct dvb_file *dvb_file;
+	struct dvb_entry *last;
+};
+
+static int read_file_add_entry(struct dvb_entry *entry, void *priv)
+{
+	struct read_file_priv *p = priv;
+
+	if (p->last)
+		p->last->next = entry;
+	else
+		p->dvb_file->first_entry = entry;
+	p->last = entry;
+	p->dvb_file->n_entries++;
+
+	return 0;
+}
+
+struct dvb_file *dvb_read_file(const char *fname)
+{
+	struct read_file_priv priv = { 0 };
+	struct dvb_file *dvb_file;
+
+	dvb_file = calloc(sizeof(*dvb_file), 1);
+	if (!dvb_file) {
+		perror(_("Allocating memory for dvb_file"));
+		return NULL;
+	}
+	priv.dvb_file = dvb_file;
+
+	if (__dvb_read_file(fname, read_file_add_entry, &priv)) {
+		dvb_file_free(dvb_file);
+		return NULL;
+	}
+	return dvb_file;
+};
+
+int dvb_write_file_entry(FILE *fp, struct dvb_entry *entry)
 {
-	FILE *fp;
 	int i;
-	struct dvb_entry *entry = dvb_file->first_entry;
 	static const char *off = "OFF";
 
-	fp = fopen(fname, "w");
-	if (!fp) {
-		perror(fname);
-		return -errno;
+	adjust_delsys(entry);
+	if (entry->channel) {
+		fprintf(fp, "[%s]\n", entry->channel);
+		if (entry->vchannel)
+			fprintf(fp, "\tVCHANNEL = %s\n", entry->vchannel);
+	} else {
+		fprintf(fp, "[CHANNEL]\n");
 	}
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		adjust_delsys(entry);
-		if (entry->channel) {
-			fprintf(fp, "[%s]\n", entry->channel);
-			if (entry->vchannel)
-				fprintf(fp, "\tVCHANNEL = %s\n", entry->vchannel);
-		} else {
-			fprintf(fp, "[CHANNEL]\n");
-		}
+	if (entry->service_id)
+		fprintf(fp, "\tSERVICE_ID = %d\n", entry->service_id);
 
-		if (entry->service_id)
-			fprintf(fp, "\tSERVICE_ID = %d\n", entry->service_id);
+	if (entry->network_id)
+		fprintf(fp, "\tNETWORK_ID = %d\n", entry->network_id);
 
-		if (entry->network_id)
-			fprintf(fp, "\tNETWORK_ID = %d\n", entry->network_id);
+	if (entry->transport_id)
+		fprintf(fp, "\tTRANSPORT_ID = %d\n", entry->transport_id);
 
-		if (entry->transport_id)
-			fprintf(fp, "\tTRANSPORT_ID = %d\n", entry->transport_id);
+	if (entry->video_pid_len){
+		fprintf(fp, "\tVIDEO_PID =");
+		for (i = 0; i < entry->video_pid_len; i++)
+			fprintf(fp, " %d", entry->video_pid[i]);
+		fprintf(fp, "\n");
+	}
 
-		if (entry->video_pid_len){
-			fprintf(fp, "\tVIDEO_PID =");
-			for (i = 0; i < entry->video_pid_len; i++)
-				fprintf(fp, " %d", entry->video_pid[i]);
-			fprintf(fp, "\n");
-		}
+	if (entry->audio_pid_len) {
+		fprintf(fp, "\tAUDIO_PID =");
+		for (i = 0; i < entry->audio_pid_len; i++)
+			fprintf(fp, " %d", entry->audio_pid[i]);
+		fprintf(fp, "\n");
+	}
 
-		if (entry->audio_pid_len) {
-			fprintf(fp, "\tAUDIO_PID =");
-			for (i = 0; i < entry->audio_pid_len; i++)
-				fprintf(fp, " %d", entry->audio_pid[i]);
-			fprintf(fp, "\n");
+	if (entry->other_el_pid_len) {
+		int type = -1;
+		for (i = 0; i < entry->other_el_pid_len; i++) {
+			if (type != entry->other_el_pid[i].type) {
+				type = entry->other_el_pid[i].type;
+				if (i)
+					fprintf(fp, "\n");
+				fprintf(fp, "\tPID_%02x =", type);
+			}
+			fprintf(fp, " %d", entry->other_el_pid[i].pid);
 		}
+		fprintf(fp, "\n");
+	}
 
-		if (entry->other_el_pid_len) {
-			int type = -1;
-			for (i = 0; i < entry->other_el_pid_len; i++) {
-				if (type != entry->other_el_pid[i].type) {
-					type = entry->other_el_pid[i].type;
-					if (i)
-						fprintf(fp, "\n");
-					fprintf(fp, "\tPID_%02x =", type);
-				}
-				fprintf(fp, " %d", entry->other_el_pid[i].pid);
+	if (entry->sat_number >= 0) {
+		fprintf(fp, "\tSAT_NUMBER = %d\n",
+			entry->sat_number);
+	}
+
+	if (entry->freq_bpf > 0) {
+		fprintf(fp, "\tFREQ_BPF = %d\n",
+			entry->freq_bpf);
+	}
+
+	if (entry->diseqc_wait > 0) {
+		fprintf(fp, "\tDISEQC_WAIT = %d\n",
+			entry->diseqc_wait);
+	}
+	if (entry->lnb)
+			fprintf(fp, "\tLNB = %s\n", entry->lnb);
+
+	for (i = 0; i < entry->n_props; i++) {
+		const char * const *attr_name = dvb_attr_names(entry->props[i].cmd);
+		const char *buf;
+
+		if (attr_name) {
+			int j;
+
+			for (j = 0; j < entry->props[i].u.data; j++) {
+				if (!*attr_name)
+					break;
+				attr_name++;
 			}
-			fprintf(fp, "\n");
 		}
 
-		if (entry->sat_number >= 0) {
-			fprintf(fp, "\tSAT_NUMBER = %d\n",
-				entry->sat_number);
+		if (entry->props[i].cmd == DTV_COUNTRY_CODE) {
+			buf = dvb_country_to_2letters(entry->props[i].u.data);
+			attr_name = &buf;
 		}
 
-		if (entry->freq_bpf > 0) {
-			fprintf(fp, "\tFREQ_BPF = %d\n",
-				entry->freq_bpf);
+		switch (entry->props[i].cmd) {
+		/* Handle parameters with optional values */
+		case DTV_PLS_CODE:
+		case DTV_PLS_MODE:
+			if (entry->props[i].u.data == (unsigned)-1)
+				continue;
+			break;
+		case DTV_PILOT:
+			if (entry->props[i].u.data == (unsigned)-1)
+				attr_name = &off;
+			break;
 		}
 
-		if (entry->diseqc_wait > 0) {
-			fprintf(fp, "\tDISEQC_WAIT = %d\n",
-				entry->diseqc_wait);
-		}
-		if (entry->lnb)
-				fprintf(fp, "\tLNB = %s\n", entry->lnb);
+		if (!attr_name || !*attr_name)
+			fprintf(fp, "\t%s = %u\n",
+				dvb_cmd_name(entry->props[i].cmd),
+				entry->props[i].u.data);
+		else
+			fprintf(fp, "\t%s = %s\n",
+				dvb_cmd_name(entry->props[i].cmd),
+				*attr_name);
+	}
+	fprintf(fp, "\n");
 
-		for (i = 0; i < entry->n_props; i++) {
-			const char * const *attr_name = dvb_attr_names(entry->props[i].cmd);
-			const char *buf;
+	return ferror(fp) ? -EIO : 0;
+}
 
-			if (attr_name) {
-				int j;
+int dvb_write_file(const char *fname, struct dvb_file *dvb_file)
+{
+	FILE *fp;
+	int rc = 0;
+	struct dvb_entry *entry;
 
-				for (j = 0; j < entry->props[i].u.data; j++) {
-					if (!*attr_name)
-						break;
-					attr_name++;
-				}
-			}
+	fp = fopen(fname, "w");
+	if (!fp) {
+		perror(fname);
+		return -errno;
+	}
 
-			if (entry->props[i].cmd == DTV_COUNTRY_CODE) {
-				buf = dvb_country_to_2letters(entry->props[i].u.data);
-				attr_name = &buf;
-			}
+	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+		rc = dvb_write_file_entry(fp, entry);
+		if (rc)
+			break;
+	}
+	if (fclose(fp) && !rc)
+		rc = -errno;
+	return rc;
+};
 
-			switch (entry->props[i].cmd) {
-			/* Handle parameters with optional values */
-			case DTV_PLS_CODE:
-			case DTV_PLS_MODE:
-				if (entry->props[i].u.data == (unsigned)-1)
-					continue;
-				break;
-			case DTV_PILOT:
-				if (entry->props[i].u.data == (unsigned)-1)
-					attr_name = &off;
-				break;
-			}
+/*
+ * Indexes over a dvb_file. The hash chains keep the file order, so the
+ * lookups return the same entry as a linear search from the first one.
+ */
+struct dvb_file_index_node {
+	struct dvb_entry	*entry;
+	const char		*name;
+	int			is_channel;
+	int			next;
+};
 
-			if (!attr_name || !*attr_name)
-				fprintf(fp, "\t%s = %u\n",
-					dvb_cmd_name(entry->props[i].cmd),
-					entry->props[i].u.data);
-			else
-				fprintf(fp, "\t%s = %s\n",
-					dvb_cmd_name(entry->props[i].cmd),
-					*attr_name);
-		}
-		fprintf(fp, "\n");
-	}
-	fclose(fp);
-	return 0;
+struct dvb_file_index {
+	unsigned			size;
+	int				*name_hash, *sid_hash, *freq_hash;
+	struct dvb_file_index_node	*names, *sids, *freqs;
 };
 
+static unsigned index_int_hash(uint32_t val)
+{
+	return val * 2654435761u;
+}
+
+static void index_add(int *hash, struct dvb_file_index_node *nodes,
+		      int *n_nodes, unsigned bucket, struct dvb_entry *entry,
+		      const char *name, int is_channel)
+{
+	struct dvb_file_index_node *node = &nodes[*n_nodes];
+
+	node->entry = entry;
+	node->name = name;
+	node->is_channel = is_channel;
+	node->next = hash[bucket];
+	hash[bucket] = (*n_nodes)++;
+}
+
+struct dvb_file_index *dvb_file_index_alloc(struct dvb_file *dvb_file)
+{
+	struct dvb_file_index *idx;
+	struct dvb_entry *entry, **entries;
+	int i, n = 0, n_names = 0, n_sids = 0, n_freqs = 0;
+	uint32_t freq;
+
+	for (entry = dvb_file->first_entry; entry; entry = entry->next)
+		n++;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	for (idx->size = 16; idx->size < 2 * n; idx->size <<= 1);
+
+	entries = malloc((n + 1) * sizeof(*entries));
+	idx->name_hash = malloc(idx->size * sizeof(*idx->name_hash));
+	idx->sid_hash = malloc(idx->size * sizeof(*idx->sid_hash));
+	idx->freq_hash = malloc(idx->size * sizeof(*idx->freq_hash));
+	idx->names = malloc((2 * n + 1) * sizeof(*idx->names));
+	idx->sids = malloc((n + 1) * sizeof(*idx->sids));
+	idx->freqs = malloc((n + 1) * sizeof(*idx->freqs));
+	if (!entries || !idx->name_hash || !idx->sid_hash || !idx->freq_hash ||
+	    !idx->names || !idx->sids || !idx->freqs) {
+		free(entries);
+		dvb_file_index_free(idx);
+		return NULL;
+	}
+	memset(idx->name_hash, -1, idx->size * sizeof(*idx->name_hash));
+	memset(idx->sid_hash, -1, idx->size * sizeof(*idx->sid_hash));
+	memset(idx->freq_hash, -1, idx->size * sizeof(*idx->freq_hash));
+
+	n = 0;
+	for (entry = dvb_file->first_entry; entry; entry = entry->next)
+		entries[n++] = entry;
+
+	/* Insert backwards, as the new nodes are put at the chain heads */
+	for (i = n - 1; i >= 0; i--) {
+		unsigned mask = idx->size - 1;
+
+		entry = entries[i];
+		if (entry->vchannel)
+			index_add(idx->name_hash, idx->names, &n_names,
+				  strcase_hash(entry->vchannel) & mask,
+				  entry, entry->vchannel, 0);
+		if (entry->channel)
+			index_add(idx->name_hash, idx->names, &n_names,
+				  strcase_hash(entry->channel) & mask,
+				  entry, entry->channel, 1);
+
+		index_add(idx->sid_hash, idx->sids, &n_sids,
+			  index_int_hash(entry->service_id) & mask,
+			  entry, NULL, 0);
+
+		if (!dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq))
+			index_add(idx->freq_hash, idx->freqs, &n_freqs,
+				  index_int_hash(freq) & mask,
+				  entry, NULL, 0);
+	}
+	free(entries);
+
+	return idx;
+}
+
+void dvb_file_index_free(struct dvb_file_index *idx)
+{
+	if (!idx)
+		return;
+
+	free(idx->name_hash);
+	free(idx->sid_hash);
+	free(idx->freq_hash);
+	free(idx->names);
+	free(idx->sids);
+	free(idx->freqs);
+	free(idx);
+}
+
+struct dvb_entry *dvb_file_find_channel(struct dvb_file_index *idx,
+					const char *name)
+{
+	struct dvb_file_index_node *node;
+	int head, i;
+
+	head = idx->name_hash[strcase_hash(name) & (idx->size - 1)];
+
+	for (i = head; i >= 0; i = node->next) {
+		node = &idx->names[i];
+		if (!strcmp(node->name, name))
+			return node->entry;
+	}
+
+	/* Give a second shot, using a case insensitive seek */
+	for (i = head; i >= 0; i = node->next) {
+		node = &idx->names[i];
+		if (node->is_channel && !strcasecmp(node->name, name))
+			return node->entry;
+	}
+
+	return NULL;
+}
+
+struct dvb_entry *dvb_file_find_service(struct dvb_file_index *idx,
+					uint16_t service_id,
+					struct dvb_entry *prev)
+{
+	struct dvb_file_index_node *node;
+	int i;
+
+	i = idx->sid_hash[index_int_hash(service_id) & (idx->size - 1)];
+	for (; i >= 0; i = node->next) {
+		node = &idx->sids[i];
+		if (node->entry->service_id != service_id)
+			continue;
+		if (!prev)
+			return node->entry;
+		if (node->entry == prev)
+			prev = NULL;
+	}
+
+	return NULL;
+}
+
+struct dvb_entry *dvb_file_find_frequency(struct dvb_file_index *idx,
+					  uint32_t freq,
+					  struct dvb_entry *prev)
+{
+	struct dvb_file_index_node *node;
+	uint32_t f;
+	int i;
+
+	i = idx->freq_hash[index_int_hash(freq) & (idx->size - 1)];
+	for (; i >= 0; i = node->next) {
+		node = &idx->freqs[i];
+		if (dvb_retrieve_entry_prop(node->entry, DTV_FREQUENCY, &f) ||
+		    f != freq)
+			continue;
+		if (!prev)
+			return node->entry;
+		if (node->entry == prev)
+			prev = NULL;
+	}
+
+	return NULL;
+}
+
 static char *dvb_vchannel(struct dvb_v5_fe_parms_priv *parms,
 			  struct dvb_table_nit *nit, uint16_t service_id)
 {
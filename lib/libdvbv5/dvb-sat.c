@@ -522,6 +522,8 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 	int tone_on = 0;
 	struct diseqc_cmd cmd;
 	const struct dvb_sat_lnb_priv *lnb = (void *)parms->p.lnb;
+	struct dvb_fe_tune_cache *cache = parms->tune_cache;
+	struct dvb_fe_sec_state sec;
 
 	if (sat_number < 0 && t) {
 		dvb_logwarn(_("DiSEqC disabled. Can't tune using SCR/Unicable."));
@@ -549,6 +551,21 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 		}
 	}
 
+	/* Nothing to do if the LNBf and the switches are already set */
+	memset(&sec, 0, sizeof(sec));
+	sec.lnb = parms->p.lnb;
+	sec.sat_number = sat_number;
+	sec.high_band = high_band;
+	sec.pol_v = pol_v;
+	sec.vol_high = vol_high;
+	sec.tone_on = tone_on;
+	sec.t = t;
+	if (cache && cache->sec_valid && !memcmp(&cache->sec, &sec, sizeof(sec))) {
+		if (parms->p.verbose)
+			dvb_log(_("SEC/DiSEqC setup didn't change"));
+		return 0;
+	}
+
 	rc = dvb_fe_sec_voltage(&parms->p, 1, vol_high);
 	if (rc)
 		return rc;
@@ -584,6 +601,10 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 	}
 
 	rc = dvb_fe_sec_tone(&parms->p, tone_on ? SEC_TONE_ON : SEC_TONE_OFF);
+	if (!rc && cache) {
+		cache->sec = sec;
+		cache->sec_valid = 1;
+	}
 
 	return rc;
 }
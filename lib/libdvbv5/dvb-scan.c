@@ -46,6 +46,7 @@
 #include <libdvbv5/dvb-scan.h>
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/dvb-section-mux.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/header.h>
 #include <libdvbv5/pat.h>
@@ -150,8 +151,8 @@ struct dvb_table_filter_priv {
 	struct dvb_table_filter_ext_priv *extensions;
 };
 
-static int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
-				   struct dvb_table_filter *sect)
+int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
+			    struct dvb_table_filter *sect)
 {
 	struct dvb_table_filter_priv *priv;
 
@@ -182,9 +183,9 @@ void dvb_table_filter_free(struct dvb_table_filter *sect)
 	}
 }
 
-static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
-			     struct dvb_table_filter *sect,
-			     const uint8_t *buf, ssize_t buf_length)
+int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
+		      struct dvb_table_filter *sect,
+		      const uint8_t *buf, ssize_t buf_length)
 {
 	struct dvb_table_header h;
 	struct dvb_table_filter_priv *priv;
@@ -447,17 +448,111 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler)
 	free(dvb_scan_handler);
 }
 
-struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
-					     int dmx_fd,
-					     uint32_t delivery_system,
-					     unsigned other_nit,
-					     unsigned timeout_multiply)
+/* Priorities of the tables, when there aren't enough demux filters */
+#define PRIO_PAT	3
+#define PRIO_PMT	2
+#define PRIO_VCT	2
+#define PRIO_SDT	1
+#define PRIO_NIT	0
+
+static int request_table(struct dvb_section_mux *mux,
+			 struct dvb_table_filter *sect,
+			 unsigned char tid, uint16_t pid, void **table,
+			 int priority, unsigned timeout)
+{
+	sect->tid = tid;
+	sect->pid = pid;
+	sect->ts_id = -1;
+	sect->table = table;
+	sect->allow_section_gaps = 0;
+	sect->priv = NULL;
+
+	return dvb_section_mux_request(mux, sect, priority, timeout * 1000);
+}
+
+static int wait_table(struct dvb_section_mux *mux, int id)
+{
+	return id < 0 ? id : dvb_section_mux_wait(mux, id);
+}
+
+/*
+ * The other NIT/SDT are read into their own tables, as they're read at the
+ * same time as the actual ones. Append their lists to the actual tables,
+ * as if all sections were parsed into the same table.
+ */
+static void merge_nit(struct dvb_table_nit **nit, struct dvb_table_nit *other)
+{
+	struct dvb_table_nit_transport *transport;
+	struct dvb_desc *desc;
+
+	if (!*nit) {
+		*nit = other;
+		return;
+	}
+
+	desc = (*nit)->descriptor;
+	if (!desc) {
+		(*nit)->descriptor = other->descriptor;
+	} else {
+		while (desc->next)
+			desc = desc->next;
+		desc->next = other->descriptor;
+	}
+
+	transport = (*nit)->transport;
+	if (!transport) {
+		(*nit)->transport = other->transport;
+	} else {
+		while (transport->next)
+			transport = transport->next;
+		transport->next = other->transport;
+	}
+
+	free(other);
+}
+
+static void merge_sdt(struct dvb_table_sdt **sdt, struct dvb_table_sdt *other)
+{
+	struct dvb_table_sdt_service *service;
+
+	if (!*sdt) {
+		*sdt = other;
+		return;
+	}
+
+	service = (*sdt)->service;
+	if (!service) {
+		(*sdt)->service = other->service;
+	} else {
+		while (service->next)
+			service = service->next;
+		service->next = other->service;
+	}
+
+	free(other);
+}
+
+/*
+ * All tables are requested as soon as it is known that they're needed,
+ * so the section multiplexer can read them at the same time, as far as
+ * the demux filters allow.
+ */
+static struct dvb_v5_descriptors *__dvb_get_ts_tables(struct dvb_v5_fe_parms_priv *parms,
+						      struct dvb_section_mux *mux,
+						      uint32_t delivery_system,
+						      unsigned other_nit,
+						      unsigned timeout_multiply)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
 	int rc;
-	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
+	unsigned pat_pmt_time, sdt_time, nit_time, vct_time = 0;
 	int atsc_filter = 0;
 	unsigned num_pmt = 0;
+	struct dvb_table_filter pat_f, vct_f, nit_f, sdt_f, nit2_f, sdt2_f;
+	struct dvb_table_filter *pmt_f = NULL;
+	int pat_id, vct_id = -1, nit_id, sdt_id = -1, nit2_id = -1, sdt2_id = -1;
+	int *pmt_id = NULL;
+	struct dvb_table_nit *nit2 = NULL;
+	struct dvb_table_sdt *sdt2 = NULL;
 
 	struct dvb_v5_descriptors *dvb_scan_handler;
 
@@ -511,41 +606,68 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 			break;
 	};
 
+	pat_pmt_time *= timeout_multiply;
+	vct_time *= timeout_multiply;
+	sdt_time *= timeout_multiply;
+	nit_time *= timeout_multiply;
+
+	/* The tables that don't depend on the PAT */
+	pat_id = request_table(mux, &pat_f, DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
+			       (void **)&dvb_scan_handler->pat,
+			       PRIO_PAT, pat_pmt_time);
+	if (atsc_filter)
+		vct_id = request_table(mux, &vct_f, atsc_filter,
+				       ATSC_TABLE_VCT_PID,
+				       (void **)&dvb_scan_handler->vct,
+				       PRIO_VCT, vct_time);
+	nit_id = request_table(mux, &nit_f, DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
+			       (void **)&dvb_scan_handler->nit,
+			       PRIO_NIT, nit_time);
+	if (!atsc_filter)
+		sdt_id = request_table(mux, &sdt_f, DVB_TABLE_SDT,
+				       DVB_TABLE_SDT_PID,
+				       (void **)&dvb_scan_handler->sdt,
+				       PRIO_SDT, sdt_time);
+	if (other_nit) {
+		nit2_id = request_table(mux, &nit2_f, DVB_TABLE_NIT2,
+					DVB_TABLE_NIT_PID, (void **)&nit2,
+					PRIO_NIT, nit_time);
+		sdt2_id = request_table(mux, &sdt2_f, DVB_TABLE_SDT2,
+					DVB_TABLE_SDT_PID, (void **)&sdt2,
+					PRIO_SDT, sdt_time);
+	}
+
 	/* PAT table */
-	rc = dvb_read_section(&parms->p, dmx_fd,
-			      DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
-			      (void **)&dvb_scan_handler->pat,
-			      pat_pmt_time * timeout_multiply);
+	rc = wait_table(mux, pat_id);
 	if (parms->p.abort)
-		return dvb_scan_handler;
+		goto abort;
 	if (rc < 0) {
 		dvb_logerr(_("error while waiting for PAT table"));
+		dvb_section_mux_clear(mux);
+		if (nit2)
+			dvb_table_nit_free(nit2);
+		if (sdt2)
+			dvb_table_sdt_free(sdt2);
 		dvb_scan_free_handler_table(dvb_scan_handler);
 		return NULL;
 	}
 	if (parms->p.verbose)
 		dvb_table_pat_print(&parms->p, dvb_scan_handler->pat);
 
-	/* ATSC-specific VCT table */
-	if (atsc_filter) {
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      atsc_filter, ATSC_TABLE_VCT_PID,
-				      (void **)&dvb_scan_handler->vct,
-				      vct_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
-			dvb_logerr(_("error while waiting for VCT table"));
-		else if (parms->p.verbose)
-			atsc_table_vct_print(&parms->p, dvb_scan_handler->vct);
-	}
-
 	/* PMT tables */
 	dvb_scan_handler->program = calloc(dvb_scan_handler->pat->programs,
 					   sizeof(*dvb_scan_handler->program));
+	pmt_f = calloc(dvb_scan_handler->pat->programs, sizeof(*pmt_f));
+	pmt_id = calloc(dvb_scan_handler->pat->programs, sizeof(*pmt_id));
+	if (dvb_scan_handler->pat->programs &&
+	    (!dvb_scan_handler->program || !pmt_f || !pmt_id)) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		goto abort;
+	}
 
 	dvb_pat_program_foreach(program, dvb_scan_handler->pat) {
 		dvb_scan_handler->program[num_pmt].pat_pgm = program;
+		pmt_id[num_pmt] = -1;
 
 		if (!program->service_id) {
 			if (parms->p.verbose)
@@ -557,80 +679,143 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 		if (parms->p.verbose)
 			dvb_log(_("Program #%d ID 0x%04x, service ID 0x%04x"),
 				num_pmt, program->pid, program->service_id);
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_PMT, program->pid,
-				      (void **)&dvb_scan_handler->program[num_pmt].pmt,
-				      pat_pmt_time * timeout_multiply);
-		if (parms->p.abort) {
-			dvb_scan_handler->num_program = num_pmt + 1;
-			return dvb_scan_handler;
-		}
+		pmt_id[num_pmt] = request_table(mux, &pmt_f[num_pmt],
+						DVB_TABLE_PMT, program->pid,
+						(void **)&dvb_scan_handler->program[num_pmt].pmt,
+						PRIO_PMT, pat_pmt_time);
+		num_pmt++;
+	}
+	dvb_scan_handler->num_program = num_pmt;
+
+	/* ATSC-specific VCT table */
+	if (atsc_filter) {
+		rc = wait_table(mux, vct_id);
+		if (parms->p.abort)
+			goto abort;
+		if (rc < 0)
+			dvb_logerr(_("error while waiting for VCT table"));
+		else if (parms->p.verbose)
+			atsc_table_vct_print(&parms->p, dvb_scan_handler->vct);
+
+		/* SDT table */
+		if (!dvb_scan_handler->vct || other_nit)
+			sdt_id = request_table(mux, &sdt_f, DVB_TABLE_SDT,
+					       DVB_TABLE_SDT_PID,
+					       (void **)&dvb_scan_handler->sdt,
+					       PRIO_SDT, sdt_time);
+	}
+
+	/* Everything else */
+	dvb_section_mux_wait(mux, -1);
+	if (parms->p.abort)
+		goto abort;
+
+	for (num_pmt = 0; num_pmt < dvb_scan_handler->num_program; num_pmt++) {
+		struct dvb_v5_descriptors_program *program;
+
+		program = &dvb_scan_handler->program[num_pmt];
+		if (!program->pat_pgm->service_id)
+			continue;
+
+		rc = wait_table(mux, pmt_id[num_pmt]);
 		if (rc < 0) {
 			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
-				   program->service_id);
-			dvb_scan_handler->program[num_pmt].pmt = NULL;
+				   program->pat_pgm->service_id);
+			if (program->pmt)
+				dvb_table_pmt_free(program->pmt);
+			program->pmt = NULL;
 		} else {
 			if (parms->p.verbose)
-				dvb_table_pmt_print(&parms->p,
-						    dvb_scan_handler->program[num_pmt].pmt);
+				dvb_table_pmt_print(&parms->p, program->pmt);
 		}
-		num_pmt++;
 	}
-	dvb_scan_handler->num_program = num_pmt;
 
 	/* NIT table */
-	rc = dvb_read_section(&parms->p, dmx_fd,
-			      DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
-			      (void **)&dvb_scan_handler->nit,
-			      nit_time * timeout_multiply);
-	if (parms->p.abort)
-		return dvb_scan_handler;
+	rc = wait_table(mux, nit_id);
 	if (rc < 0)
 		dvb_logerr(_("error while reading the NIT table"));
 	else if (parms->p.verbose)
 		dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
 
 	/* SDT table */
-	if (!dvb_scan_handler->vct || other_nit) {
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
+	if (sdt_id >= 0) {
+		rc = wait_table(mux, sdt_id);
 		if (rc < 0)
 			dvb_logerr(_("error while reading the SDT table"));
 		else if (parms->p.verbose)
 			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
 	}
 
-	/* NIT/SDT other tables */
+	/* NIT/SDT other tables are merged into the ones of the actual network */
 	if (other_nit) {
 		if (parms->p.verbose)
 			dvb_log(_("Parsing other NIT/SDT"));
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_NIT2, DVB_TABLE_NIT_PID,
-				      (void **)&dvb_scan_handler->nit,
-				      nit_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
+
+		rc = wait_table(mux, nit2_id);
+		if (rc < 0) {
 			dvb_logerr(_("error while reading the NIT table"));
-		else if (parms->p.verbose)
-			dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+		} else if (nit2) {
+			merge_nit(&dvb_scan_handler->nit, nit2);
+			nit2 = NULL;
+			if (parms->p.verbose)
+				dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+		}
 
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT2, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
+		rc = wait_table(mux, sdt2_id);
+		if (rc < 0) {
 			dvb_logerr(_("error while reading the SDT table"));
-		else if (parms->p.verbose)
-			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+		} else if (sdt2) {
+			merge_sdt(&dvb_scan_handler->sdt, sdt2);
+			sdt2 = NULL;
+			if (parms->p.verbose)
+				dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+		}
+	}
+
+abort:
+	dvb_section_mux_clear(mux);
+	if (nit2)
+		dvb_table_nit_free(nit2);
+	if (sdt2)
+		dvb_table_sdt_free(sdt2);
+	free(pmt_f);
+	free(pmt_id);
+
+	return dvb_scan_handler;
+}
+
+struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
+					     int dmx_fd,
+					     uint32_t delivery_system,
+					     unsigned other_nit,
+					     unsigned timeout_multiply)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	struct dvb_v5_descriptors *dvb_scan_handler;
+	struct dvb_arena *arena = parms->arena;
+	struct dvb_section_mux *mux = parms->section_mux;
+
+	if (!dvb_section_mux_has_fds(mux)) {
+		mux = dvb_section_mux_alloc(__p);
+		if (!mux || dvb_section_mux_add_fd(mux, dmx_fd) < 0) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			dvb_section_mux_free(mux);
+			return NULL;
+		}
 	}
 
+	/*
+	 * The tables are freed with dvb_scan_free_handler_table(), so they
+	 * can't be parsed into the caller's arena
+	 */
+	parms->arena = NULL;
+	dvb_scan_handler = __dvb_get_ts_tables(parms, mux, delivery_system,
+					       other_nit, timeout_multiply);
+	parms->arena = arena;
+
+	if (mux != parms->section_mux)
+		dvb_section_mux_free(mux);
+
 	return dvb_scan_handler;
 }
 
@@ -0,0 +1,509 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-section-mux.h>
+#include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/dvb-log.h>
+#include <libdvbv5/crc32.h>
+
+#include <config.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+
+#else
+# define _(string) string
+#endif
+
+#define REQ_PENDING		1
+
+/* A demux file descriptor, used as one filter */
+struct dvb_section_slot {
+	int			fd;
+	int			running;
+
+	/* last filter set, kept after stopping it, for reuse */
+	int			pid;
+	uint8_t			filter, mask;
+};
+
+struct dvb_section_req {
+	struct dvb_table_filter	*sect;
+	int			priority;
+	unsigned		timeout;
+
+	int			status;
+	uint64_t		deadline;	/* zero until it has a filter */
+};
+
+struct dvb_section_mux {
+	struct dvb_v5_fe_parms_priv *parms;
+
+	struct dvb_section_slot	*slots;
+	unsigned		n_slots;
+
+	struct dvb_section_req	*reqs;
+	unsigned		n_reqs, max_reqs;
+
+	uint8_t			*buf;
+};
+
+static uint64_t mux_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct dvb_section_mux *dvb_section_mux_alloc(struct dvb_v5_fe_parms *parms)
+{
+	struct dvb_section_mux *mux;
+
+	mux = calloc(1, sizeof(*mux));
+	if (!mux)
+		return NULL;
+
+	mux->buf = malloc(DVB_MAX_PAYLOAD_PACKET_SIZE);
+	if (!mux->buf) {
+		free(mux);
+		return NULL;
+	}
+	mux->parms = (void *)parms;
+
+	return mux;
+}
+
+void dvb_section_mux_free(struct dvb_section_mux *mux)
+{
+	if (!mux)
+		return;
+
+	dvb_section_mux_clear(mux);
+
+	free(mux->slots);
+	free(mux->reqs);
+	free(mux->buf);
+	free(mux);
+}
+
+int dvb_section_mux_add_fd(struct dvb_section_mux *mux, int dmx_fd)
+{
+	struct dvb_section_slot *slots;
+	unsigned i;
+
+	for (i = 0; i < mux->n_slots; i++)
+		if (mux->slots[i].fd == dmx_fd)
+			return mux->n_slots;
+
+	slots = realloc(mux->slots, (mux->n_slots + 1) * sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+	mux->slots = slots;
+
+	memset(&slots[mux->n_slots], 0, sizeof(*slots));
+	slots[mux->n_slots].fd = dmx_fd;
+	slots[mux->n_slots].pid = -1;
+
+	return ++mux->n_slots;
+}
+
+int dvb_section_mux_request(struct dvb_section_mux *mux,
+			    struct dvb_table_filter *sect,
+			    int priority, unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = mux->parms;
+	struct dvb_section_req *req;
+	int ret;
+
+	if (mux->n_reqs == mux->max_reqs) {
+		unsigned max = mux->max_reqs ? mux->max_reqs * 2 : 16;
+
+		req = realloc(mux->reqs, max * sizeof(*req));
+		if (!req) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			return -ENOMEM;
+		}
+		mux->reqs = req;
+		mux->max_reqs = max;
+	}
+
+	ret = dvb_parse_section_alloc(parms, sect);
+	if (ret < 0)
+		return ret;
+
+	req = &mux->reqs[mux->n_reqs];
+	req->sect = sect;
+	req->priority = priority;
+	req->timeout = timeout;
+	req->status = REQ_PENDING;
+	req->deadline = 0;
+
+	if (parms->p.verbose)
+		dvb_log(_("%s: requested table ID 0x%02x, program ID 0x%02x"),
+			__func__, sect->tid, sect->pid);
+
+	return mux->n_reqs++;
+}
+
+static void mux_req_done(struct dvb_section_mux *mux,
+			 struct dvb_section_req *req, int status)
+{
+	req->status = status;
+	dvb_table_filter_free(req->sect);
+}
+
+void dvb_section_mux_clear(struct dvb_section_mux *mux)
+{
+	unsigned i;
+
+	for (i = 0; i < mux->n_reqs; i++)
+		if (mux->reqs[i].status == REQ_PENDING)
+			mux_req_done(mux, &mux->reqs[i], -EINTR);
+	mux->n_reqs = 0;
+
+	for (i = 0; i < mux->n_slots; i++) {
+		if (mux->slots[i].running)
+			dvb_dmx_stop(mux->slots[i].fd);
+		mux->slots[i].running = 0;
+	}
+}
+
+/*
+ * Calculates a filter that matches the table IDs of all pending requests
+ * of a PID. Returns the highest priority among them, or INT_MIN if none.
+ */
+static int mux_pid_filter(struct dvb_section_mux *mux, int pid,
+			  uint8_t *filter, uint8_t *mask, unsigned *first)
+{
+	struct dvb_section_req *req;
+	int priority = INT_MIN;
+	uint8_t diff = 0;
+	unsigned i;
+
+	*filter = 0;
+	*first = 0;
+	for (i = 0; i < mux->n_reqs; i++) {
+		req = &mux->reqs[i];
+		if (req->status != REQ_PENDING || req->sect->pid != pid)
+			continue;
+
+		if (priority == INT_MIN) {
+			*filter = req->sect->tid;
+			*first = i;
+		}
+		diff |= *filter ^ req->sect->tid;
+		if (req->priority > priority)
+			priority = req->priority;
+	}
+	*mask = ~diff;
+	*filter &= *mask;
+
+	return priority;
+}
+
+static int mux_start_slot(struct dvb_section_mux *mux,
+			  struct dvb_section_slot *slot,
+			  int pid, uint8_t filter, uint8_t mask)
+{
+	struct dvb_v5_fe_parms_priv *parms = mux->parms;
+
+	/* The Kernel discards the old data when a filter is restarted */
+	if (slot->pid == pid && slot->filter == filter && slot->mask == mask &&
+	    ioctl(slot->fd, DMX_START) == 0) {
+		slot->running = 1;
+		return 0;
+	}
+
+	if (dvb_set_section_filter(slot->fd, pid, 1, &filter, &mask, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		slot->pid = -1;
+		return -1;
+	}
+
+	if (parms->p.verbose)
+		dvb_log(_("%s: filtering program ID 0x%02x, table ID 0x%02x/0x%02x"),
+			__func__, pid, filter, mask);
+
+	slot->pid = pid;
+	slot->filter = filter;
+	slot->mask = mask;
+	slot->running = 1;
+
+	return 0;
+}
+
+static int mux_pid_running(struct dvb_section_mux *mux, int pid)
+{
+	unsigned i;
+
+	for (i = 0; i < mux->n_slots; i++)
+		if (mux->slots[i].running && mux->slots[i].pid == pid)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Stops the filters that aren't needed anymore or that don't match the
+ * pending table IDs, and gives the free ones to the pending PIDs, from the highest
+ * priority to the lowest one, and then by the order of the requests.
+ */
+static void mux_schedule(struct dvb_section_mux *mux)
+{
+	struct dvb_section_slot *slot;
+	struct dvb_section_req *req;
+	uint8_t filter, mask;
+	unsigned i, j, first, best_first = 0, started = 0;
+	int priority, best = 0, best_pid;
+	uint64_t now = mux_now();
+
+	for (i = 0; i < mux->n_slots; i++) {
+		slot = &mux->slots[i];
+		if (!slot->running)
+			continue;
+
+		/* Keep it if it still matches all table IDs needed there */
+		priority = mux_pid_filter(mux, slot->pid, &filter, &mask, &first);
+		if (priority != INT_MIN && (slot->mask & ~mask) == 0 &&
+		    (filter & slot->mask) == slot->filter) {
+			started++;
+			continue;
+		}
+
+		dvb_dmx_stop(slot->fd);
+		slot->running = 0;
+		if (priority != INT_MIN)
+			slot->pid = -1;
+	}
+
+	while (started < mux->n_slots) {
+		best_pid = -1;
+
+		for (i = 0; i < mux->n_reqs; i++) {
+			req = &mux->reqs[i];
+			if (req->status != REQ_PENDING ||
+			    mux_pid_running(mux, req->sect->pid))
+				continue;
+
+			priority = mux_pid_filter(mux, req->sect->pid, &filter,
+						  &mask, &first);
+			if (best_pid < 0 || priority > best ||
+			    (priority == best && first < best_first)) {
+				best = priority;
+				best_first = first;
+				best_pid = req->sect->pid;
+			}
+		}
+		if (best_pid < 0)
+			break;
+
+		mux_pid_filter(mux, best_pid, &filter, &mask, &first);
+
+		/*
+		 * Prefer a filter that was already set for that PID, then one
+		 * that was never set, keeping the others for their PIDs
+		 */
+		slot = NULL;
+		for (i = 0; i < mux->n_slots; i++) {
+			if (mux->slots[i].running)
+				continue;
+			if (mux->slots[i].pid == best_pid &&
+			    mux->slots[i].filter == filter &&
+			    mux->slots[i].mask == mask) {
+				slot = &mux->slots[i];
+				break;
+			}
+			if (!slot || (slot->pid >= 0 && mux->slots[i].pid < 0))
+				slot = &mux->slots[i];
+		}
+
+		if (mux_start_slot(mux, slot, best_pid, filter, mask) < 0) {
+			for (j = 0; j < mux->n_reqs; j++) {
+				req = &mux->reqs[j];
+				if (req->status == REQ_PENDING &&
+				    req->sect->pid == best_pid)
+					mux_req_done(mux, req, -EIO);
+			}
+			continue;
+		}
+		started++;
+	}
+
+	/* The timeouts only run while the PID is filtered */
+	for (i = 0; i < mux->n_reqs; i++) {
+		req = &mux->reqs[i];
+		if (req->status != REQ_PENDING)
+			continue;
+		if (!mux_pid_running(mux, req->sect->pid))
+			req->deadline = 0;
+		else if (!req->deadline)
+			req->deadline = now + req->timeout;
+	}
+}
+
+static void mux_dispatch(struct dvb_section_mux *mux,
+			 struct dvb_section_slot *slot,
+			 const uint8_t *buf, ssize_t len)
+{
+	struct dvb_v5_fe_parms_priv *parms = mux->parms;
+	struct dvb_section_req *req;
+	uint64_t now = mux_now();
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < mux->n_reqs; i++) {
+		req = &mux->reqs[i];
+		if (req->status != REQ_PENDING ||
+		    req->sect->pid != slot->pid || req->sect->tid != buf[0])
+			continue;
+
+		ret = dvb_parse_section(parms, req->sect, buf, len);
+		if (ret > 0)
+			mux_req_done(mux, req, 0);
+		else if (ret < 0)
+			mux_req_done(mux, req, ret);
+		else
+			req->deadline = now + req->timeout;
+	}
+}
+
+static void mux_read(struct dvb_section_mux *mux,
+		     struct dvb_section_slot *slot)
+{
+	struct dvb_v5_fe_parms_priv *parms = mux->parms;
+	ssize_t len;
+
+	len = read(slot->fd, mux->buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+	if (len < 0) {
+		if (errno != EOVERFLOW && errno != EAGAIN && errno != EINTR)
+			dvb_perror(_("dvb_section_mux_wait: read error"));
+		return;
+	}
+	if (len < 3)
+		return;
+
+	if (dvb_crc32(mux->buf, len, 0xFFFFFFFF) != 0) {
+		dvb_logerr(_("%s: crc error"), __func__);
+		return;
+	}
+
+	mux_dispatch(mux, slot, mux->buf, len);
+}
+
+int dvb_section_mux_wait(struct dvb_section_mux *mux, int id)
+{
+	struct dvb_v5_fe_parms_priv *parms = mux->parms;
+	struct dvb_section_req *req;
+	struct pollfd fds[mux->n_slots + 1];
+	struct dvb_section_slot *slot[mux->n_slots + 1];
+	uint64_t now, next;
+	unsigned i, pending;
+	int n, ret;
+
+	if (id >= (int)mux->n_reqs)
+		return -EINVAL;
+
+	while (1) {
+		if (id >= 0 && mux->reqs[id].status != REQ_PENDING)
+			return mux->reqs[id].status;
+		if (parms->p.abort)
+			return -EINTR;
+
+		mux_schedule(mux);
+
+		/* Expire the requests and find out the next deadline */
+		now = mux_now();
+		next = 0;
+		pending = 0;
+		for (i = 0; i < mux->n_reqs; i++) {
+			req = &mux->reqs[i];
+			if (req->status != REQ_PENDING)
+				continue;
+			if (req->deadline && req->deadline <= now) {
+				if (parms->p.verbose)
+					dvb_log(_("%s: timeout waiting for table ID 0x%02x, program ID 0x%02x"),
+						__func__, req->sect->tid,
+						req->sect->pid);
+				mux_req_done(mux, req, -ETIMEDOUT);
+				continue;
+			}
+			pending++;
+			if (req->deadline && (!next || req->deadline < next))
+				next = req->deadline;
+		}
+		if (!pending)
+			return id >= 0 ? mux->reqs[id].status : 0;
+
+		n = 0;
+		for (i = 0; i < mux->n_slots; i++) {
+			if (!mux->slots[i].running)
+				continue;
+			slot[n] = &mux->slots[i];
+			fds[n].fd = mux->slots[i].fd;
+			fds[n].events = POLLIN | POLLPRI;
+			fds[n].revents = 0;
+			n++;
+		}
+		if (!n) {
+			dvb_logerr(_("%s: no demux to read the tables"), __func__);
+			return -ENODEV;
+		}
+
+		ret = poll(fds, n, next > now ? next - now : 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			dvb_perror("poll");
+			return -errno;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (fds[i].revents & (POLLIN | POLLPRI | POLLERR))
+				mux_read(mux, slot[i]);
+		}
+	}
+}
+
+struct dvb_section_mux *dvb_fe_set_section_mux(struct dvb_v5_fe_parms *p,
+					       struct dvb_section_mux *mux)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_section_mux *old = parms->section_mux;
+
+	parms->section_mux = mux;
+
+	return old;
+}
+
+int dvb_section_mux_has_fds(const struct dvb_section_mux *mux)
+{
+	return mux && mux->n_slots;
+}
@@ -0,0 +1,890 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdvbv5/dvb-ts-analyzer.h>
+#include <libdvbv5/dvb-log.h>
+#include <libdvbv5/crc32.h>
+
+#include <config.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+
+#else
+# define _(string) string
+#endif
+
+#define TS_SIZE			188
+#define TS_SYNC			0x47
+#define TS_NUM_PIDS		0x2000
+#define TS_NULL_PID		0x1fff
+
+/* The PCR is a 33 bits base at 90 kHz plus a 9 bits extension at 27 MHz */
+#define PCR_HZ			27000000ULL
+#define PCR_WRAP		((1ULL << 33) * 300)
+#define PCR_MS			(PCR_HZ / 1000)
+
+/* TR 101 290 limits */
+#define SYNC_LOST_BYTES		2
+#define SYNC_FOUND_BYTES	5
+#define PSI_TIMEOUT		500000		/* us */
+#define PID_TIMEOUT		5000000		/* us */
+#define PCR_REPETITION		(40 * PCR_MS)
+#define PCR_DISCONTINUITY	(100 * PCR_MS)
+#define PCR_ACCURACY		500		/* ns */
+#define PTS_TIMEOUT		700000		/* us */
+#define CAT_TIMEOUT		1000000		/* us */
+
+/* PCR jitter isn't measured until the bitrate is known with this precision */
+#define PCR_RATE_MIN_TIME	(2 * PCR_HZ)
+
+#define MAX_SECTION_SIZE	1024
+
+#define TS_PID_CC_VALID		(1 << 0)
+#define TS_PID_CC_DUP		(1 << 1)
+#define TS_PID_PCR_VALID	(1 << 2)
+#define TS_PID_PTS_SEEN		(1 << 3)
+#define TS_PID_RATE_VALID	(1 << 4)
+#define TS_PID_JITTER_VALID	(1 << 5)
+
+const char *dvb_ts_check_name[DVB_TS_NUM_CHECKS] = {
+	[DVB_TS_SYNC_LOSS]		= "TS_sync_loss",
+	[DVB_TS_SYNC_BYTE_ERROR]	= "Sync_byte_error",
+	[DVB_TS_PAT_ERROR]		= "PAT_error",
+	[DVB_TS_CC_ERROR]		= "Continuity_count_error",
+	[DVB_TS_PMT_ERROR]		= "PMT_error",
+	[DVB_TS_PID_ERROR]		= "PID_error",
+	[DVB_TS_TRANSPORT_ERROR]	= "Transport_error",
+	[DVB_TS_CRC_ERROR]		= "CRC_error",
+	[DVB_TS_PCR_REPETITION_ERROR]	= "PCR_repetition_error",
+	[DVB_TS_PCR_DISCONTINUITY_ERROR] = "PCR_discontinuity_indicator_error",
+	[DVB_TS_PCR_ACCURACY_ERROR]	= "PCR_accuracy_error",
+	[DVB_TS_PTS_ERROR]		= "PTS_error",
+	[DVB_TS_CAT_ERROR]		= "CAT_error",
+};
+
+
+struct ts_pid {
+	struct dvb_ts_pid_stats	stats;
+
+	uint8_t			flags;
+	uint8_t			cc;
+	int16_t			version;	/* PAT/PMT version, or -1 */
+	uint16_t		pmt_pid;	/* PMT that refers to an ES */
+
+	/* stream times, in us */
+	uint64_t		last_seen;
+	uint64_t		table_time;
+	uint64_t		pts_time;
+
+	/* bitrate measurement */
+	uint64_t		interval_packets;
+	uint64_t		timed_packets;
+
+	/* last PCR and its position at the stream */
+	uint64_t		pcr;
+	uint64_t		pcr_pos;
+
+	/* PSI section being assembled */
+	uint8_t			*sec;
+	unsigned		sec_len;
+};
+
+struct dvb_ts_analyzer {
+	struct dvb_v5_fe_parms	*parms;
+	uint64_t		interval;	/* us */
+	dvb_ts_analyzer_error_t	handler;
+	void			*priv;
+
+	struct dvb_ts_stats	stats;
+
+	struct ts_pid		*pid[TS_NUM_PIDS];
+	uint16_t		active[TS_NUM_PIDS];	/* PIDs, in order */
+
+	/* sync */
+	int			aligned;
+	unsigned		good_sync, bad_sync;
+	uint8_t			carry[TS_SIZE];
+	unsigned		carry_len;
+
+	/* position of the current packet at the stream, in bytes */
+	uint64_t		pos;
+
+	/*
+	 * The time base is the PCR of the first PID that has it. The
+	 * multiplex bitrate, used to measure the PCR jitter, is averaged
+	 * since clock_start/pos_start.
+	 */
+	struct ts_pid		*ref;
+	uint64_t		clock;		/* 27 MHz */
+	uint64_t		clock_start, pos_start;
+	uint64_t		interval_start, interval_pos;
+	uint64_t		last_check;
+
+	int			scrambled;
+	uint64_t		cat_time;
+};
+
+static void ts_error(struct dvb_ts_analyzer *an, struct ts_pid *p,
+		     enum dvb_ts_check check)
+{
+	an->stats.errors[check]++;
+	if (p)
+		p->stats.errors[check]++;
+	if (an->handler)
+		an->handler(an, check, p ? p->stats.pid : TS_NULL_PID, an->priv);
+}
+
+static struct ts_pid *ts_get_pid(struct dvb_ts_analyzer *an, uint16_t pid)
+{
+	struct dvb_v5_fe_parms *parms = an->parms;
+	struct ts_pid *p = an->pid[pid];
+
+	if (p)
+		return p;
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return NULL;
+	}
+	p->stats.pid = pid;
+	p->version = -1;
+	p->last_seen = an->stats.time;
+	p->table_time = an->stats.time;
+
+	switch (pid) {
+	case 0x0000:
+		p->stats.type = DVB_TS_PID_PAT;
+		break;
+	case 0x0001:
+		p->stats.type = DVB_TS_PID_CAT;
+		break;
+	case TS_NULL_PID:
+		p->stats.type = DVB_TS_PID_NULL;
+		break;
+	}
+
+	an->pid[pid] = p;
+	an->active[an->stats.n_pids++] = pid;
+
+	return p;
+}
+
+/*
+ * Bitrates and timeouts
+ */
+
+static unsigned ts_histogram_bucket(uint32_t bitrate)
+{
+	unsigned bucket = 0;
+
+	bitrate /= 1000;
+	while (bitrate && bucket < DVB_TS_HISTOGRAM_SIZE - 1) {
+		bitrate >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void ts_interval(struct dvb_ts_analyzer *an)
+{
+	uint64_t now = an->stats.time;
+	uint64_t elapsed = now - an->interval_start;
+	unsigned i;
+
+	an->stats.bitrate = (an->pos - an->interval_pos) * 8 * 1000000 /
+			    elapsed;
+
+	for (i = 0; i < an->stats.n_pids; i++) {
+		struct ts_pid *p = an->pid[an->active[i]];
+		struct dvb_ts_pid_stats *st = &p->stats;
+		uint32_t rate;
+
+		rate = p->interval_packets * TS_SIZE * 8 * 1000000 / elapsed;
+		p->timed_packets += p->interval_packets;
+		p->interval_packets = 0;
+
+		st->bitrate = rate;
+		if (!(p->flags & TS_PID_RATE_VALID)) {
+			st->min_bitrate = rate;
+			st->max_bitrate = rate;
+			p->flags |= TS_PID_RATE_VALID;
+		} else if (rate < st->min_bitrate) {
+			st->min_bitrate = rate;
+		} else if (rate > st->max_bitrate) {
+			st->max_bitrate = rate;
+		}
+		st->histogram[ts_histogram_bucket(rate)]++;
+		st->avg_bitrate = p->timed_packets * TS_SIZE * 8 * 1000000. /
+				  now;
+	}
+
+	an->interval_start = now;
+	an->interval_pos = an->pos;
+}
+
+/*
+ * Checks for the tables and streams that should be repeated. Called
+ * every time the stream time advances.
+ */
+static void ts_check_timeouts(struct dvb_ts_analyzer *an)
+{
+	uint64_t now = an->stats.time;
+	struct ts_pid *p;
+	unsigned i;
+
+	p = ts_get_pid(an, 0);
+	if (p && now - p->table_time > PSI_TIMEOUT) {
+		ts_error(an, p, DVB_TS_PAT_ERROR);
+		p->table_time = now;
+	}
+
+	if (an->scrambled && now - an->cat_time > CAT_TIMEOUT) {
+		ts_error(an, an->pid[1], DVB_TS_CAT_ERROR);
+		an->cat_time = now;
+	}
+
+	for (i = 0; i < an->stats.n_pids; i++) {
+		p = an->pid[an->active[i]];
+
+		switch (p->stats.type) {
+		case DVB_TS_PID_PMT:
+			if (now - p->table_time > PSI_TIMEOUT) {
+				ts_error(an, p, DVB_TS_PMT_ERROR);
+				p->table_time = now;
+			}
+			break;
+		case DVB_TS_PID_ES:
+			if (now - p->last_seen > PID_TIMEOUT) {
+				ts_error(an, p, DVB_TS_PID_ERROR);
+				p->last_seen = now;
+			}
+			if ((p->flags & TS_PID_PTS_SEEN) &&
+			    now - p->pts_time > PTS_TIMEOUT) {
+				ts_error(an, p, DVB_TS_PTS_ERROR);
+				p->pts_time = now;
+			}
+			break;
+		}
+	}
+}
+
+static void ts_advance_clock(struct dvb_ts_analyzer *an, uint64_t ticks)
+{
+	an->clock += ticks;
+	an->stats.time = an->clock / 27;
+
+	if (an->stats.time == an->last_check)
+		return;
+	an->last_check = an->stats.time;
+
+	ts_check_timeouts(an);
+	if (an->stats.time - an->interval_start >= an->interval)
+		ts_interval(an);
+}
+
+/*
+ * PCR
+ */
+
+static void ts_pcr_jitter(struct dvb_ts_analyzer *an, struct ts_pid *p,
+			  uint64_t delta)
+{
+	uint64_t span = an->clock - an->clock_start;
+	double ticks_per_byte;
+	int64_t jitter;
+
+	/* The bitrate isn't known with enough precision yet */
+	if (span < PCR_RATE_MIN_TIME)
+		return;
+
+	/*
+	 * The jitter is the difference between the PCR and the value it
+	 * should have, given its position at the stream and the average
+	 * multiplex bitrate.
+	 */
+	ticks_per_byte = (double)span / (an->ref->pcr_pos - an->pos_start);
+	jitter = (int64_t)delta -
+		 (int64_t)((an->pos - p->pcr_pos) * ticks_per_byte + .5);
+	jitter = jitter * 1000 / 27;
+
+	if (!(p->flags & TS_PID_JITTER_VALID)) {
+		p->stats.pcr_jitter_min = jitter;
+		p->stats.pcr_jitter_max = jitter;
+		p->flags |= TS_PID_JITTER_VALID;
+	} else if (jitter < p->stats.pcr_jitter_min) {
+		p->stats.pcr_jitter_min = jitter;
+	} else if (jitter > p->stats.pcr_jitter_max) {
+		p->stats.pcr_jitter_max = jitter;
+	}
+	if (jitter > PCR_ACCURACY || jitter < -PCR_ACCURACY)
+		ts_error(an, p, DVB_TS_PCR_ACCURACY_ERROR);
+}
+
+static void ts_pcr(struct dvb_ts_analyzer *an, struct ts_pid *p,
+		   uint64_t pcr, int discontinuity)
+{
+	uint64_t delta = 0, prev_pos = p->pcr_pos;
+	int valid = p->flags & TS_PID_PCR_VALID;
+
+	p->stats.has_pcr = 1;
+	p->stats.pcr_count++;
+
+	if (valid) {
+		delta = (pcr + PCR_WRAP - p->pcr) % PCR_WRAP;
+
+		/* The checks restart after a signalled discontinuity */
+		if (discontinuity) {
+			valid = 0;
+		} else if (delta > PCR_DISCONTINUITY) {
+			ts_error(an, p, DVB_TS_PCR_DISCONTINUITY_ERROR);
+			valid = 0;
+		} else {
+			if (delta > PCR_REPETITION)
+				ts_error(an, p, DVB_TS_PCR_REPETITION_ERROR);
+			ts_pcr_jitter(an, p, delta);
+		}
+	}
+
+	p->pcr = pcr;
+	p->pcr_pos = an->pos;
+	p->flags |= TS_PID_PCR_VALID;
+
+	if (!an->ref) {
+		an->ref = p;
+		an->pos_start = an->pos;
+		an->interval_pos = an->pos;
+		return;
+	}
+	if (an->ref != p)
+		return;
+
+	if (!valid) {
+		/*
+		 * The time base jumped: estimate the elapsed time from the
+		 * bitrate, and restart the average bitrate used for jitter.
+		 */
+		delta = 0;
+		if (an->stats.bitrate)
+			delta = (an->pos - prev_pos) * 8 * PCR_HZ /
+				an->stats.bitrate;
+		an->clock_start = an->clock + delta;
+		an->pos_start = an->pos;
+	}
+	ts_advance_clock(an, delta);
+}
+
+/*
+ * PSI tables
+ */
+
+static void ts_parse_pat(struct dvb_ts_analyzer *an, struct ts_pid *p,
+			 const uint8_t *sec, unsigned len)
+{
+	int version = (sec[5] >> 1) & 0x1f;
+	unsigned i;
+
+	if (sec[6] == 0) {
+		if (version == p->version)
+			return;
+		p->version = version;
+
+		/* Forget the PMTs of the previous version */
+		for (i = 0; i < an->stats.n_pids; i++) {
+			struct ts_pid *q = an->pid[an->active[i]];
+
+			if (q->stats.type == DVB_TS_PID_PMT)
+				q->stats.type = DVB_TS_PID_UNKNOWN;
+		}
+	}
+
+	for (i = 8; i + 4 <= len - 4; i += 4) {
+		uint16_t program = sec[i] << 8 | sec[i + 1];
+		uint16_t pid = (sec[i + 2] & 0x1f) << 8 | sec[i + 3];
+		struct ts_pid *q;
+
+		/* Program 0 is the NIT */
+		if (!program || pid < 0x10 || pid == TS_NULL_PID)
+			continue;
+
+		q = ts_get_pid(an, pid);
+		if (!q || q->stats.type == DVB_TS_PID_PMT)
+			continue;
+
+		q->stats.type = DVB_TS_PID_PMT;
+		q->table_time = an->stats.time;
+		q->version = -1;
+	}
+}
+
+static void ts_parse_pmt(struct dvb_ts_analyzer *an, struct ts_pid *p,
+			 const uint8_t *sec, unsigned len)
+{
+	int version = (sec[5] >> 1) & 0x1f;
+	unsigned i;
+
+	if (len < 16 || version == p->version)
+		return;
+	p->version = version;
+
+	/* Forget the streams of the previous version */
+	for (i = 0; i < an->stats.n_pids; i++) {
+		struct ts_pid *q = an->pid[an->active[i]];
+
+		if (q->stats.type == DVB_TS_PID_ES &&
+		    q->pmt_pid == p->stats.pid)
+			q->stats.type = DVB_TS_PID_UNKNOWN;
+	}
+
+	i = 12 + ((sec[10] & 0x0f) << 8 | sec[11]);
+	while (i + 5 <= len - 4) {
+		uint8_t type = sec[i];
+		uint16_t pid = (sec[i + 1] & 0x1f) << 8 | sec[i + 2];
+		unsigned info_len = (sec[i + 3] & 0x0f) << 8 | sec[i + 4];
+		struct ts_pid *q;
+
+		i += 5 + info_len;
+
+		q = ts_get_pid(an, pid);
+		if (!q || (q->stats.type != DVB_TS_PID_UNKNOWN &&
+			   q->stats.type != DVB_TS_PID_ES))
+			continue;
+
+		if (q->stats.type == DVB_TS_PID_UNKNOWN)
+			q->last_seen = an->stats.time;
+		q->stats.type = DVB_TS_PID_ES;
+		q->stats.stream_type = type;
+		q->pmt_pid = p->stats.pid;
+	}
+}
+
+static void ts_section(struct dvb_ts_analyzer *an, struct ts_pid *p,
+		       const uint8_t *sec, unsigned len)
+{
+	/* The tables handled here all have the long syntax */
+	if (!(sec[1] & 0x80) || len < 12)
+		return;
+
+	if (dvb_crc32((uint8_t *)sec, len, 0xffffffff)) {
+		ts_error(an, p, DVB_TS_CRC_ERROR);
+		return;
+	}
+
+	switch (p->stats.type) {
+	case DVB_TS_PID_PAT:
+		if (sec[0] != 0x00) {
+			ts_error(an, p, DVB_TS_PAT_ERROR);
+			return;
+		}
+		p->table_time = an->stats.time;
+		ts_parse_pat(an, p, sec, len);
+		break;
+	case DVB_TS_PID_CAT:
+		if (sec[0] != 0x01) {
+			ts_error(an, p, DVB_TS_CAT_ERROR);
+			return;
+		}
+		an->cat_time = an->stats.time;
+		break;
+	case DVB_TS_PID_PMT:
+		if (sec[0] != 0x02)
+			return;
+		p->table_time = an->stats.time;
+		ts_parse_pmt(an, p, sec, len);
+		break;
+	}
+}
+
+/* Appends data to the section being assembled, returning the bytes used */
+static unsigned ts_section_append(struct dvb_ts_analyzer *an,
+				  struct ts_pid *p,
+				  const uint8_t *buf, unsigned len)
+{
+	unsigned used = 0, size, n;
+
+	if (!p->sec) {
+		p->sec = malloc(MAX_SECTION_SIZE);
+		if (!p->sec)
+			return len;
+	}
+
+	/* Section header, with its length */
+	if (p->sec_len < 3) {
+		n = 3 - p->sec_len;
+		if (n > len)
+			n = len;
+		memcpy(p->sec + p->sec_len, buf, n);
+		p->sec_len += n;
+		used += n;
+		if (p->sec_len < 3)
+			return used;
+	}
+
+	size = 3 + ((p->sec[1] & 0x0f) << 8 | p->sec[2]);
+	if (size > MAX_SECTION_SIZE) {
+		p->sec_len = 0;
+		return len;
+	}
+
+	n = size - p->sec_len;
+	if (n > len - used)
+		n = len - used;
+	memcpy(p->sec + p->sec_len, buf + used, n);
+	p->sec_len += n;
+	used += n;
+
+	if (p->sec_len == size) {
+		p->sec_len = 0;
+		ts_section(an, p, p->sec, size);
+	}
+	return used;
+}
+
+static void ts_psi(struct dvb_ts_analyzer *an, struct ts_pid *p,
+		   const uint8_t *buf, unsigned len, int pusi)
+{
+	unsigned pointer;
+
+	if (!pusi) {
+		if (p->sec_len)
+			ts_section_append(an, p, buf, len);
+		return;
+	}
+
+	pointer = buf[0];
+	buf++;
+	len--;
+	if (pointer > len) {
+		p->sec_len = 0;
+		return;
+	}
+
+	/* The end of the previous section. It is dropped if incomplete */
+	if (p->sec_len)
+		ts_section_append(an, p, buf, pointer);
+	p->sec_len = 0;
+
+	buf += pointer;
+	len -= pointer;
+	while (len && buf[0] != 0xff) {
+		unsigned used = ts_section_append(an, p, buf, len);
+
+		buf += used;
+		len -= used;
+	}
+}
+
+/*
+ * Packets
+ */
+
+static void ts_pes(struct dvb_ts_analyzer *an, struct ts_pid *p,
+		   const uint8_t *buf, unsigned len)
+{
+	if (len < 9 || buf[0] || buf[1] || buf[2] != 0x01)
+		return;
+
+	/* Streams without the optional PES header */
+	switch (buf[3]) {
+	case 0xbc: case 0xbe: case 0xbf:
+	case 0xf0: case 0xf1: case 0xf2: case 0xf8: case 0xff:
+		return;
+	}
+
+	if (buf[7] & 0x80) {
+		p->pts_time = an->stats.time;
+		p->flags |= TS_PID_PTS_SEEN;
+	}
+}
+
+static void ts_packet(struct dvb_ts_analyzer *an, const uint8_t *buf)
+{
+	uint16_t pid = (buf[1] & 0x1f) << 8 | buf[2];
+	unsigned afc = (buf[3] >> 4) & 0x03, cc = buf[3] & 0x0f;
+	const uint8_t *payload = buf + 4, *end = buf + TS_SIZE;
+	int discontinuity = 0, scrambled = buf[3] & 0xc0;
+	struct ts_pid *p;
+
+	an->stats.packets++;
+
+	p = an->pid[pid];
+	if (!p) {
+		p = ts_get_pid(an, pid);
+		if (!p)
+			goto out;
+	}
+	p->stats.packets++;
+	p->interval_packets++;
+	p->last_seen = an->stats.time;
+
+	if (buf[1] & 0x80) {
+		ts_error(an, p, DVB_TS_TRANSPORT_ERROR);
+		goto out;
+	}
+	if (pid == TS_NULL_PID)
+		goto out;
+
+	if (scrambled) {
+		p->stats.scrambled++;
+		an->scrambled = 1;
+		if (p->stats.type == DVB_TS_PID_PAT)
+			ts_error(an, p, DVB_TS_PAT_ERROR);
+		else if (p->stats.type == DVB_TS_PID_PMT)
+			ts_error(an, p, DVB_TS_PMT_ERROR);
+	}
+
+	if (afc & 0x02) {
+		unsigned af_len = buf[4];
+
+		payload += 1 + af_len;
+		if (payload > end)
+			goto out;
+
+		if (af_len) {
+			discontinuity = buf[5] & 0x80;
+
+			if ((buf[5] & 0x10) && af_len >= 7) {
+				uint64_t pcr;
+
+				pcr = (uint64_t)buf[6] << 25 | buf[7] << 17 |
+				      buf[8] << 9 | buf[9] << 1 | buf[10] >> 7;
+				pcr = pcr * 300 +
+				      ((buf[10] & 0x01) << 8 | buf[11]);
+				ts_pcr(an, p, pcr, discontinuity);
+			}
+		}
+	}
+
+	/* The continuity counter only increments on packets with payload */
+	if (!(afc & 0x01))
+		goto out;
+
+	if ((p->flags & TS_PID_CC_VALID) && !discontinuity) {
+		if (cc == p->cc) {
+			/* A packet can be sent twice, but not more */
+			if (!(p->flags & TS_PID_CC_DUP)) {
+				p->flags |= TS_PID_CC_DUP;
+				goto out;
+			}
+			ts_error(an, p, DVB_TS_CC_ERROR);
+			p->sec_len = 0;
+		} else if (cc != ((p->cc + 1) & 0x0f)) {
+			ts_error(an, p, DVB_TS_CC_ERROR);
+			p->sec_len = 0;
+		}
+	}
+	p->cc = cc;
+	p->flags = (p->flags | TS_PID_CC_VALID) & ~TS_PID_CC_DUP;
+
+	if (scrambled || payload >= end)
+		goto out;
+
+	switch (p->stats.type) {
+	case DVB_TS_PID_PAT:
+	case DVB_TS_PID_CAT:
+	case DVB_TS_PID_PMT:
+		ts_psi(an, p, payload, end - payload, buf[1] & 0x40);
+		break;
+	case DVB_TS_PID_ES:
+		if (buf[1] & 0x40)
+			ts_pes(an, p, payload, end - payload);
+		break;
+	}
+
+out:
+	an->pos += TS_SIZE;
+}
+
+/*
+ * Checks the sync byte of the next packet. Returns 1 if the packet can be
+ * analyzed, 0 if it should be discarded or -1 if the sync was lost.
+ */
+static int ts_sync(struct dvb_ts_analyzer *an, const uint8_t *buf)
+{
+	if (buf[0] == TS_SYNC) {
+		an->bad_sync = 0;
+		if (!an->stats.synced && ++an->good_sync >= SYNC_FOUND_BYTES)
+			an->stats.synced = 1;
+		return 1;
+	}
+
+	an->good_sync = 0;
+	if (an->stats.synced)
+		ts_error(an, NULL, DVB_TS_SYNC_BYTE_ERROR);
+
+	if (++an->bad_sync >= SYNC_LOST_BYTES) {
+		if (an->stats.synced)
+			ts_error(an, NULL, DVB_TS_SYNC_LOSS);
+		an->stats.synced = 0;
+		an->aligned = 0;
+		return -1;
+	}
+
+	an->pos += TS_SIZE;
+	return 0;
+}
+
+/* Looks for a sync byte followed by another one, one packet later */
+static const uint8_t *ts_find_sync(struct dvb_ts_analyzer *an,
+				   const uint8_t *buf, const uint8_t *end)
+{
+	const uint8_t *p = buf;
+
+	while ((p = memchr(p, TS_SYNC, end - p))) {
+		if (p + TS_SIZE >= end || p[TS_SIZE] == TS_SYNC)
+			break;
+		p++;
+	}
+	if (!p)
+		p = end;
+
+	an->stats.skipped += p - buf;
+	an->pos += p - buf;
+
+	if (p < end) {
+		an->aligned = 1;
+		an->bad_sync = 0;
+	}
+	return p;
+}
+
+size_t dvb_ts_analyzer_feed(struct dvb_ts_analyzer *an, const uint8_t *buf,
+			    size_t len)
+{
+	uint64_t packets = an->stats.packets;
+	const uint8_t *end = buf + len;
+	size_t n;
+
+	/* Completes the packet split by the previous call */
+	if (an->carry_len) {
+		n = TS_SIZE - an->carry_len;
+		if (n > len)
+			n = len;
+		memcpy(an->carry + an->carry_len, buf, n);
+		an->carry_len += n;
+		buf += n;
+		if (an->carry_len < TS_SIZE)
+			return 0;
+
+		an->carry_len = 0;
+		switch (ts_sync(an, an->carry)) {
+		case 1:
+			ts_packet(an, an->carry);
+			break;
+		case -1:
+			an->stats.skipped += TS_SIZE;
+			an->pos += TS_SIZE;
+			break;
+		}
+	}
+
+	while (buf < end) {
+		if (!an->aligned) {
+			buf = ts_find_sync(an, buf, end);
+			continue;
+		}
+
+		/*
+		 * Most of the time, the stream is in sync: check the sync
+		 * bytes of four packets at once.
+		 */
+		while (an->stats.synced && end - buf >= 4 * TS_SIZE &&
+		       !((buf[0] ^ TS_SYNC) |
+			 (buf[TS_SIZE] ^ TS_SYNC) |
+			 (buf[2 * TS_SIZE] ^ TS_SYNC) |
+			 (buf[3 * TS_SIZE] ^ TS_SYNC))) {
+			ts_packet(an, buf);
+			ts_packet(an, buf + TS_SIZE);
+			ts_packet(an, buf + 2 * TS_SIZE);
+			ts_packet(an, buf + 3 * TS_SIZE);
+			buf += 4 * TS_SIZE;
+			an->bad_sync = 0;
+		}
+
+		if (end - buf < TS_SIZE) {
+			an->carry_len = end - buf;
+			memcpy(an->carry, buf, an->carry_len);
+			break;
+		}
+
+		switch (ts_sync(an, buf)) {
+		case 1:
+			ts_packet(an, buf);
+			/* fall through */
+		case 0:
+			buf += TS_SIZE;
+			break;
+		}
+	}
+
+	return an->stats.packets - packets;
+}
+
+struct dvb_ts_analyzer *dvb_ts_analyzer_alloc(struct dvb_v5_fe_parms *parms,
+					      unsigned interval,
+					      dvb_ts_analyzer_error_t handler,
+					      void *priv)
+{
+	struct dvb_ts_analyzer *an;
+
+	an = calloc(1, sizeof(*an));
+	if (!an)
+		return NULL;
+
+	an->parms = parms;
+	an->interval = (interval ? interval : 1000) * 1000ULL;
+	an->handler = handler;
+	an->priv = priv;
+
+	return an;
+}
+
+void dvb_ts_analyzer_free(struct dvb_ts_analyzer *an)
+{
+	unsigned i;
+
+	if (!an)
+		return;
+
+	for (i = 0; i < an->stats.n_pids; i++) {
+		struct ts_pid *p = an->pid[an->active[i]];
+
+		free(p->sec);
+		free(p);
+	}
+	free(an);
+}
+
+const struct dvb_ts_stats *dvb_ts_analyzer_get_stats(struct dvb_ts_analyzer *an)
+{
+	return &an->stats;
+}
+
+const struct dvb_ts_pid_stats *dvb_ts_analyzer_get_pid(struct dvb_ts_analyzer *an,
+						       uint16_t pid)
+{
+	if (pid >= TS_NUM_PIDS || !an->pid[pid])
+		return NULL;
+
+	return &an->pid[pid]->stats;
+}
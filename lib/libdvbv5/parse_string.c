@@ -27,13 +27,39 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <sys/types.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 
 #include <parse_string.h>
+#include "dvb-fe-priv.h"
+#include "dvb-arena-priv.h"
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-fe.h>
 
 #define CS_OPTIONS "//TRANSLIT"
 
+/*
+ * iconv_open() is expensive compared to converting a short string, and
+ * EIT parsing converts a lot of them, so the descriptors are kept per
+ * parms, keyed by input and output charset.
+ */
+#define ICONV_CACHE_SIZE 8
+
+struct dvb_iconv_cache {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	unsigned next;
+	struct {
+		char *input_charset;
+		char *output_charset;
+		iconv_t cd;
+	} entry[ICONV_CACHE_SIZE];
+};
+
 struct charset_conv {
 	unsigned len;
 	unsigned char  data[3];
@@ -299,72 +325,537 @@ static struct charset_conv en300468_latin_00_to_utf8[256] = {
 	[0xff] = { 2, {0xc2, 0xad, } },
 };
 
-void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
+/*
+ * Upper half (0xa0 to 0xff) of ISO-8859-2 to ISO-8859-16, as Unicode code
+ * points. Characters that are not defined are 0.
+ */
+static const uint16_t iso8859_to_ucs[17][96] = {
+	[2] = {
+		0x00a0, 0x0104, 0x02d8, 0x0141, 0x00a4, 0x013d, 0x015a, 0x00a7,
+		0x00a8, 0x0160, 0x015e, 0x0164, 0x0179, 0x00ad, 0x017d, 0x017b,
+		0x00b0, 0x0105, 0x02db, 0x0142, 0x00b4, 0x013e, 0x015b, 0x02c7,
+		0x00b8, 0x0161, 0x015f, 0x0165, 0x017a, 0x02dd, 0x017e, 0x017c,
+		0x0154, 0x00c1, 0x00c2, 0x0102, 0x00c4, 0x0139, 0x0106, 0x00c7,
+		0x010c, 0x00c9, 0x0118, 0x00cb, 0x011a, 0x00cd, 0x00ce, 0x010e,
+		0x0110, 0x0143, 0x0147, 0x00d3, 0x00d4, 0x0150, 0x00d6, 0x00d7,
+		0x0158, 0x016e, 0x00da, 0x0170, 0x00dc, 0x00dd, 0x0162, 0x00df,
+		0x0155, 0x00e1, 0x00e2, 0x0103, 0x00e4, 0x013a, 0x0107, 0x00e7,
+		0x010d, 0x00e9, 0x0119, 0x00eb, 0x011b, 0x00ed, 0x00ee, 0x010f,
+		0x0111, 0x0144, 0x0148, 0x00f3, 0x00f4, 0x0151, 0x00f6, 0x00f7,
+		0x0159, 0x016f, 0x00fa, 0x0171, 0x00fc, 0x00fd, 0x0163, 0x02d9,
+	},
+	[3] = {
+		0x00a0, 0x0126, 0x02d8, 0x00a3, 0x00a4, 0x0000, 0x0124, 0x00a7,
+		0x00a8, 0x0130, 0x015e, 0x011e, 0x0134, 0x00ad, 0x0000, 0x017b,
+		0x00b0, 0x0127, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x0125, 0x00b7,
+		0x00b8, 0x0131, 0x015f, 0x011f, 0x0135, 0x00bd, 0x0000, 0x017c,
+		0x00c0, 0x00c1, 0x00c2, 0x0000, 0x00c4, 0x010a, 0x0108, 0x00c7,
+		0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+		0x0000, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x0120, 0x00d6, 0x00d7,
+		0x011c, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x016c, 0x015c, 0x00df,
+		0x00e0, 0x00e1, 0x00e2, 0x0000, 0x00e4, 0x010b, 0x0109, 0x00e7,
+		0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+		0x0000, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x0121, 0x00f6, 0x00f7,
+		0x011d, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x016d, 0x015d, 0x02d9,
+	},
+	[4] = {
+		0x00a0, 0x0104, 0x0138, 0x0156, 0x00a4, 0x0128, 0x013b, 0x00a7,
+		0x00a8, 0x0160, 0x0112, 0x0122, 0x0166, 0x00ad, 0x017d, 0x00af,
+		0x00b0, 0x0105, 0x02db, 0x0157, 0x00b4, 0x0129, 0x013c, 0x02c7,
+		0x00b8, 0x0161, 0x0113, 0x0123, 0x0167, 0x014a, 0x017e, 0x014b,
+		0x0100, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x012e,
+		0x010c, 0x00c9, 0x0118, 0x00cb, 0x0116, 0x00cd, 0x00ce, 0x012a,
+		0x0110, 0x0145, 0x014c, 0x0136, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+		0x00d8, 0x0172, 0x00da, 0x00db, 0x00dc, 0x0168, 0x016a, 0x00df,
+		0x0101, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x012f,
+		0x010d, 0x00e9, 0x0119, 0x00eb, 0x0117, 0x00ed, 0x00ee, 0x012b,
+		0x0111, 0x0146, 0x014d, 0x0137, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+		0x00f8, 0x0173, 0x00fa, 0x00fb, 0x00fc, 0x0169, 0x016b, 0x02d9,
+	},
+	[5] = {
+		0x00a0, 0x0401, 0x0402, 0x0403, 0x0404, 0x0405, 0x0406, 0x0407,
+		0x0408, 0x0409, 0x040a, 0x040b, 0x040c, 0x00ad, 0x040e, 0x040f,
+		0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+		0x0418, 0x0419, 0x041a, 0x041b, 0x041c, 0x041d, 0x041e, 0x041f,
+		0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+		0x0428, 0x0429, 0x042a, 0x042b, 0x042c, 0x042d, 0x042e, 0x042f,
+		0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+		0x0438, 0x0439, 0x043a, 0x043b, 0x043c, 0x043d, 0x043e, 0x043f,
+		0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+		0x0448, 0x0449, 0x044a, 0x044b, 0x044c, 0x044d, 0x044e, 0x044f,
+		0x2116, 0x0451, 0x0452, 0x0453, 0x0454, 0x0455, 0x0456, 0x0457,
+		0x0458, 0x0459, 0x045a, 0x045b, 0x045c, 0x00a7, 0x045e, 0x045f,
+	},
+	[6] = {
+		0x00a0, 0x0000, 0x0000, 0x0000, 0x00a4, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x060c, 0x00ad, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x061b, 0x0000, 0x0000, 0x0000, 0x061f,
+		0x0000, 0x0621, 0x0622, 0x0623, 0x0624, 0x0625, 0x0626, 0x0627,
+		0x0628, 0x0629, 0x062a, 0x062b, 0x062c, 0x062d, 0x062e, 0x062f,
+		0x0630, 0x0631, 0x0632, 0x0633, 0x0634, 0x0635, 0x0636, 0x0637,
+		0x0638, 0x0639, 0x063a, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0640, 0x0641, 0x0642, 0x0643, 0x0644, 0x0645, 0x0646, 0x0647,
+		0x0648, 0x0649, 0x064a, 0x064b, 0x064c, 0x064d, 0x064e, 0x064f,
+		0x0650, 0x0651, 0x0652, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	},
+	[7] = {
+		0x00a0, 0x2018, 0x2019, 0x00a3, 0x20ac, 0x20af, 0x00a6, 0x00a7,
+		0x00a8, 0x00a9, 0x037a, 0x00ab, 0x00ac, 0x00ad, 0x0000, 0x2015,
+		0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x0384, 0x0385, 0x0386, 0x00b7,
+		0x0388, 0x0389, 0x038a, 0x00bb, 0x038c, 0x00bd, 0x038e, 0x038f,
+		0x0390, 0x0391, 0x0392, 0x0393, 0x0394, 0x0395, 0x0396, 0x0397,
+		0x0398, 0x0399, 0x039a, 0x039b, 0x039c, 0x039d, 0x039e, 0x039f,
+		0x03a0, 0x03a1, 0x0000, 0x03a3, 0x03a4, 0x03a5, 0x03a6, 0x03a7,
+		0x03a8, 0x03a9, 0x03aa, 0x03ab, 0x03ac, 0x03ad, 0x03ae, 0x03af,
+		0x03b0, 0x03b1, 0x03b2, 0x03b3, 0x03b4, 0x03b5, 0x03b6, 0x03b7,
+		0x03b8, 0x03b9, 0x03ba, 0x03bb, 0x03bc, 0x03bd, 0x03be, 0x03bf,
+		0x03c0, 0x03c1, 0x03c2, 0x03c3, 0x03c4, 0x03c5, 0x03c6, 0x03c7,
+		0x03c8, 0x03c9, 0x03ca, 0x03cb, 0x03cc, 0x03cd, 0x03ce, 0x0000,
+	},
+	[8] = {
+		0x00a0, 0x0000, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7,
+		0x00a8, 0x00a9, 0x00d7, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+		0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7,
+		0x00b8, 0x00b9, 0x00f7, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x2017,
+		0x05d0, 0x05d1, 0x05d2, 0x05d3, 0x05d4, 0x05d5, 0x05d6, 0x05d7,
+		0x05d8, 0x05d9, 0x05da, 0x05db, 0x05dc, 0x05dd, 0x05de, 0x05df,
+		0x05e0, 0x05e1, 0x05e2, 0x05e3, 0x05e4, 0x05e5, 0x05e6, 0x05e7,
+		0x05e8, 0x05e9, 0x05ea, 0x0000, 0x0000, 0x200e, 0x200f, 0x0000,
+	},
+	[9] = {
+		0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7,
+		0x00a8, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+		0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7,
+		0x00b8, 0x00b9, 0x00ba, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+		0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+		0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+		0x011e, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+		0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x0130, 0x015e, 0x00df,
+		0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+		0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+		0x011f, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+		0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x0131, 0x015f, 0x00ff,
+	},
+	[10] = {
+		0x00a0, 0x0104, 0x0112, 0x0122, 0x012a, 0x0128, 0x0136, 0x00a7,
+		0x013b, 0x0110, 0x0160, 0x0166, 0x017d, 0x00ad, 0x016a, 0x014a,
+		0x00b0, 0x0105, 0x0113, 0x0123, 0x012b, 0x0129, 0x0137, 0x00b7,
+		0x013c, 0x0111, 0x0161, 0x0167, 0x017e, 0x2015, 0x016b, 0x014b,
+		0x0100, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x012e,
+		0x010c, 0x00c9, 0x0118, 0x00cb, 0x0116, 0x00cd, 0x00ce, 0x00cf,
+		0x00d0, 0x0145, 0x014c, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x0168,
+		0x00d8, 0x0172, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+		0x0101, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x012f,
+		0x010d, 0x00e9, 0x0119, 0x00eb, 0x0117, 0x00ed, 0x00ee, 0x00ef,
+		0x00f0, 0x0146, 0x014d, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x0169,
+		0x00f8, 0x0173, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x0138,
+	},
+	[11] = {
+		0x00a0, 0x0e01, 0x0e02, 0x0e03, 0x0e04, 0x0e05, 0x0e06, 0x0e07,
+		0x0e08, 0x0e09, 0x0e0a, 0x0e0b, 0x0e0c, 0x0e0d, 0x0e0e, 0x0e0f,
+		0x0e10, 0x0e11, 0x0e12, 0x0e13, 0x0e14, 0x0e15, 0x0e16, 0x0e17,
+		0x0e18, 0x0e19, 0x0e1a, 0x0e1b, 0x0e1c, 0x0e1d, 0x0e1e, 0x0e1f,
+		0x0e20, 0x0e21, 0x0e22, 0x0e23, 0x0e24, 0x0e25, 0x0e26, 0x0e27,
+		0x0e28, 0x0e29, 0x0e2a, 0x0e2b, 0x0e2c, 0x0e2d, 0x0e2e, 0x0e2f,
+		0x0e30, 0x0e31, 0x0e32, 0x0e33, 0x0e34, 0x0e35, 0x0e36, 0x0e37,
+		0x0e38, 0x0e39, 0x0e3a, 0x0000, 0x0000, 0x0000, 0x0000, 0x0e3f,
+		0x0e40, 0x0e41, 0x0e42, 0x0e43, 0x0e44, 0x0e45, 0x0e46, 0x0e47,
+		0x0e48, 0x0e49, 0x0e4a, 0x0e4b, 0x0e4c, 0x0e4d, 0x0e4e, 0x0e4f,
+		0x0e50, 0x0e51, 0x0e52, 0x0e53, 0x0e54, 0x0e55, 0x0e56, 0x0e57,
+		0x0e58, 0x0e59, 0x0e5a, 0x0e5b, 0x0000, 0x0000, 0x0000, 0x0000,
+	},
+	[13] = {
+		0x00a0, 0x201d, 0x00a2, 0x00a3, 0x00a4, 0x201e, 0x00a6, 0x00a7,
+		0x00d8, 0x00a9, 0x0156, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00c6,
+		0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x201c, 0x00b5, 0x00b6, 0x00b7,
+		0x00f8, 0x00b9, 0x0157, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00e6,
+		0x0104, 0x012e, 0x0100, 0x0106, 0x00c4, 0x00c5, 0x0118, 0x0112,
+		0x010c, 0x00c9, 0x0179, 0x0116, 0x0122, 0x0136, 0x012a, 0x013b,
+		0x0160, 0x0143, 0x0145, 0x00d3, 0x014c, 0x00d5, 0x00d6, 0x00d7,
+		0x0172, 0x0141, 0x015a, 0x016a, 0x00dc, 0x017b, 0x017d, 0x00df,
+		0x0105, 0x012f, 0x0101, 0x0107, 0x00e4, 0x00e5, 0x0119, 0x0113,
+		0x010d, 0x00e9, 0x017a, 0x0117, 0x0123, 0x0137, 0x012b, 0x013c,
+		0x0161, 0x0144, 0x0146, 0x00f3, 0x014d, 0x00f5, 0x00f6, 0x00f7,
+		0x0173, 0x0142, 0x015b, 0x016b, 0x00fc, 0x017c, 0x017e, 0x2019,
+	},
+	[14] = {
+		0x00a0, 0x1e02, 0x1e03, 0x00a3, 0x010a, 0x010b, 0x1e0a, 0x00a7,
+		0x1e80, 0x00a9, 0x1e82, 0x1e0b, 0x1ef2, 0x00ad, 0x00ae, 0x0178,
+		0x1e1e, 0x1e1f, 0x0120, 0x0121, 0x1e40, 0x1e41, 0x00b6, 0x1e56,
+		0x1e81, 0x1e57, 0x1e83, 0x1e60, 0x1ef3, 0x1e84, 0x1e85, 0x1e61,
+		0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+		0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+		0x0174, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x1e6a,
+		0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x0176, 0x00df,
+		0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+		0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+		0x0175, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x1e6b,
+		0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x0177, 0x00ff,
+	},
+	[15] = {
+		0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x20ac, 0x00a5, 0x0160, 0x00a7,
+		0x0161, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+		0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x017d, 0x00b5, 0x00b6, 0x00b7,
+		0x017e, 0x00b9, 0x00ba, 0x00bb, 0x0152, 0x0153, 0x0178, 0x00bf,
+		0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+		0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+		0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+		0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+		0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+		0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+		0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+		0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+	},
+	[16] = {
+		0x00a0, 0x0104, 0x0105, 0x0141, 0x20ac, 0x201e, 0x0160, 0x00a7,
+		0x0161, 0x00a9, 0x0218, 0x00ab, 0x0179, 0x00ad, 0x017a, 0x017b,
+		0x00b0, 0x00b1, 0x010c, 0x0142, 0x017d, 0x201d, 0x00b6, 0x00b7,
+		0x017e, 0x010d, 0x0219, 0x00bb, 0x0152, 0x0153, 0x0178, 0x017c,
+		0x00c0, 0x00c1, 0x00c2, 0x0102, 0x00c4, 0x0106, 0x00c6, 0x00c7,
+		0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+		0x0110, 0x0143, 0x00d2, 0x00d3, 0x00d4, 0x0150, 0x00d6, 0x015a,
+		0x0170, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x0118, 0x021a, 0x00df,
+		0x00e0, 0x00e1, 0x00e2, 0x0103, 0x00e4, 0x0107, 0x00e6, 0x00e7,
+		0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+		0x0111, 0x0144, 0x00f2, 0x00f3, 0x00f4, 0x0151, 0x00f6, 0x015b,
+		0x0171, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x0119, 0x021b, 0x00ff,
+	},
+};
+
+static int is_utf8(const char *charset)
+{
+	return !strcasecmp(charset, "UTF-8") || !strcasecmp(charset, "UTF8");
+}
+
+/* Returns the part of ISO-8859 of the charset, or 0 if it isn't ISO-8859 */
+static int iso8859_part(const char *charset)
+{
+	char *end;
+	long part;
+
+	if (strncasecmp(charset, "ISO-8859-", 9))
+		return 0;
+
+	part = strtol(charset + 9, &end, 10);
+	if (*end || part < 1 || part > 16 || part == 12)
+		return 0;
+
+	return part;
+}
+
+static size_t ucs_to_utf8(unsigned char *p, uint16_t c)
+{
+	if (c < 0x80) {
+		p[0] = c;
+		return 1;
+	}
+	if (c < 0x800) {
+		p[0] = 0xc0 | (c >> 6);
+		p[1] = 0x80 | (c & 0x3f);
+		return 2;
+	}
+	p[0] = 0xe0 | (c >> 12);
+	p[1] = 0x80 | ((c >> 6) & 0x3f);
+	p[2] = 0x80 | (c & 0x3f);
+	return 3;
+}
+
+/*
+ * Returns the length of the UTF-8 sequence at s, or 0 if it is malformed.
+ * Like iconv, overlong sequences, surrogates and code points above
+ * U+10FFFF are malformed.
+ */
+static size_t utf8_seq_len(const unsigned char *s, const unsigned char *end)
+{
+	size_t i, n;
+
+	if (*s < 0x80)
+		return 1;
+	if (*s < 0xc2 || *s > 0xf4)
+		return 0;
+
+	n = *s < 0xe0 ? 2 : *s < 0xf0 ? 3 : 4;
+	if (n > (size_t)(end - s))
+		return 0;
+	for (i = 1; i < n; i++)
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+
+	if ((*s == 0xe0 && s[1] < 0xa0) || (*s == 0xed && s[1] >= 0xa0) ||
+	    (*s == 0xf0 && s[1] < 0x90) || (*s == 0xf4 && s[1] >= 0x90))
+		return 0;
+
+	return n;
+}
+
+/*
+ * Table driven conversion to UTF-8 of the charsets commonly used by
+ * EN 300 468 strings. Like iconv, it stops when dest is full.
+ *
+ * Returns the length of the output, or -1 if the charset isn't handled
+ * or, for UTF-8, if the input is malformed, so that iconv handles it.
+ */
+static ssize_t fast_to_utf8(unsigned char *dest, size_t destlen,
+			    const unsigned char *src, size_t len,
+			    const char *input_charset)
+{
+	const unsigned char *s, *end = src + len;
+	unsigned char *p = dest;
+	int part;
+
+	if (!strcasecmp(input_charset, "ISO-6937")) {
+		for (s = src; s < end; s++) {
+			const struct charset_conv *conv = &en300468_latin_00_to_utf8[*s];
+
+			if (conv->len > destlen - (p - dest))
+				break;
+			memcpy(p, conv->data, conv->len);
+			p += conv->len;
+		}
+		return p - dest;
+	}
+
+	if (is_utf8(input_charset) ||
+	    !strcasecmp(input_charset, "ISO-10646/UTF-8")) {
+		size_t n;
+
+		for (s = src; s < end; s += n) {
+			n = utf8_seq_len(s, end);
+			if (!n)
+				return -1;
+			if (n > destlen - (s - src))
+				break;
+		}
+		memcpy(dest, src, s - src);
+		return s - src;
+	}
+
+	part = iso8859_part(input_charset);
+	if (!part)
+		return -1;
+
+	for (s = src; s < end; s++) {
+		uint16_t c = *s;
+		size_t n;
+
+		if (c >= 0xa0 && part > 1) {
+			c = iso8859_to_ucs[part][c - 0xa0];
+			/* Not defined in this part */
+			if (!c)
+				continue;
+		}
+
+		n = c < 0x80 ? 1 : c < 0x800 ? 2 : 3;
+		if (n > destlen - (p - dest))
+			break;
+		p += ucs_to_utf8(p, c);
+	}
+
+	return p - dest;
+}
+
+static struct dvb_iconv_cache *iconv_cache_get(struct dvb_v5_fe_parms_priv *parms)
+{
+	struct dvb_iconv_cache *cache = parms->iconv_cache;
+
+	if (cache)
+		return cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&cache->lock, NULL);
+#endif
+
+	/* Another thread may have been faster */
+	if (!__sync_bool_compare_and_swap(&parms->iconv_cache, NULL, cache)) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_destroy(&cache->lock);
+#endif
+		free(cache);
+	}
+
+	return parms->iconv_cache;
+}
+
+/* Should be called with the cache locked */
+static iconv_t iconv_cache_open(struct dvb_iconv_cache *cache,
+				const char *input_charset,
+				const char *output_charset)
+{
+	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
+	char *in, *out;
+	iconv_t cd;
+	unsigned i;
+
+	for (i = 0; i < ICONV_CACHE_SIZE; i++) {
+		if (!cache->entry[i].input_charset)
+			continue;
+		if (!strcasecmp(cache->entry[i].input_charset, input_charset) &&
+		    !strcasecmp(cache->entry[i].output_charset, output_charset)) {
+			cd = cache->entry[i].cd;
+
+			/* Back to the initial shift state */
+			iconv(cd, NULL, NULL, NULL, NULL);
+			return cd;
+		}
+	}
+
+	in = strdup(input_charset);
+	out = strdup(output_charset);
+	if (!in || !out) {
+		free(in);
+		free(out);
+		return (iconv_t)(-1);
+	}
+
+	strcpy(out_cs, output_charset);
+	strcat(out_cs, CS_OPTIONS);
+
+	cd = iconv_open(out_cs, input_charset);
+	if (cd == (iconv_t)(-1)) {
+		free(in);
+		free(out);
+		return cd;
+	}
+
+	/* Replace the oldest entry */
+	i = cache->next;
+	cache->next = (i + 1) % ICONV_CACHE_SIZE;
+
+	if (cache->entry[i].input_charset) {
+		iconv_close(cache->entry[i].cd);
+		free(cache->entry[i].input_charset);
+		free(cache->entry[i].output_charset);
+	}
+
+	cache->entry[i].input_charset = in;
+	cache->entry[i].output_charset = out;
+	cache->entry[i].cd = cd;
+
+	return cd;
+}
+
+void dvb_iconv_cache_free(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_iconv_cache *cache = parms->iconv_cache;
+	unsigned i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < ICONV_CACHE_SIZE; i++) {
+		if (!cache->entry[i].input_charset)
+			continue;
+		iconv_close(cache->entry[i].cd);
+		free(cache->entry[i].input_charset);
+		free(cache->entry[i].output_charset);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&cache->lock);
+#endif
+	free(cache);
+	parms->iconv_cache = NULL;
+}
+
+void dvb_iconv_to_charset(struct dvb_v5_fe_parms *p,
 			  char *dest,
 			  size_t destlen,
 			  const unsigned char *src,
 			  size_t len,
 			  char *input_charset, char *output_charset)
 {
-	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
-	char *p = dest;
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_iconv_cache *cache;
+	char *out = dest;
+	ssize_t ret;
+	iconv_t cd;
 
-	strcpy(out_cs, output_charset);
-	strcat(out_cs, CS_OPTIONS);
+	if (is_utf8(output_charset)) {
+		ret = fast_to_utf8((unsigned char *)dest, destlen, src, len,
+				   input_charset);
+		if (ret >= 0) {
+			dest[ret] = '\0';
+			return;
+		}
+	}
 
-	iconv_t cd = iconv_open(out_cs, input_charset);
+	cache = iconv_cache_get(parms);
+	if (!cache) {
+		dvb_logerr("%s: can't allocate memory", __func__);
+		*dest = '\0';
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&cache->lock);
+#endif
+	cd = iconv_cache_open(cache, input_charset, output_charset);
 	if (cd == (iconv_t)(-1)) {
-		memcpy(p, src, len);
-		p[len] = '\0';
+		memcpy(out, src, len);
+		out[len] = '\0';
 		dvb_logerr("Conversion from %s to %s not supported\n",
 				input_charset, output_charset);
 		if (!strcasecmp(input_charset, "ARIB-STD-B24"))
 			dvb_log("Try setting GCONV_PATH to the bundled gconv dir.\n");
 	} else {
-		iconv(cd, (ICONV_CONST char **)&src, &len, &p, &destlen);
-		iconv_close(cd);
-		*p = '\0';
+		iconv(cd, (ICONV_CONST char **)&src, &len, &out, &destlen);
+		*out = '\0';
 	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&cache->lock);
+#endif
 }
 
 static void charset_conversion(struct dvb_v5_fe_parms *parms, char **dest, const unsigned char *s,
 			       size_t len, char *input_charset)
 {
 	size_t destlen = len * 3;
-	int need_conversion = 1;
+	unsigned char *tmp = NULL, buf[3 * 255 + 1];
 
-	/* Special handler for ISO-6937 */
-	if (!strcasecmp(input_charset, "ISO-6937")) {
-		char *p = *dest;
-		unsigned char *tmp;
-		unsigned char *p1, *p2;
-
-		/* Convert charset to UTF-8 using Code table 00 - Latin */
-		for (p1 = (unsigned char *)s; p1 < s + len; p1++)
-			for (p2 = en300468_latin_00_to_utf8[*p1].data;
-			     p2 < en300468_latin_00_to_utf8[*p1].data + en300468_latin_00_to_utf8[*p1].len;
-			     p2++)
-				*p++ = *p2;
-		*p = '\0';
-
-		/* If desired charset is not UTF-8, prepare for conversion */
-		if (strcasecmp(parms->output_charset, "UTF-8")) {
-			tmp = (unsigned char *)*dest;
-			len = p - *dest;
-
-			*dest = malloc(destlen + 1);
-			input_charset = "UTF-8";
-			s = tmp;
-		} else
-			need_conversion = 0;
+	/*
+	 * ISO-6937 is converted to UTF-8 using Code table 00 - Latin. If the
+	 * desired charset is not UTF-8, convert from UTF-8 afterwards.
+	 */
+	if (!strcasecmp(input_charset, "ISO-6937") &&
+	    !is_utf8(parms->output_charset)) {
+		tmp = destlen < sizeof(buf) ? buf : malloc(destlen + 1);
+		if (!tmp) {
+			**dest = '\0';
+			return;
+		}
+		len = fast_to_utf8(tmp, destlen, s, len, input_charset);
 
+		input_charset = "UTF-8";
+		s = tmp;
 	}
 
 	/* Convert from original charset to the desired one */
-	if (need_conversion)
-		dvb_iconv_to_charset(parms, *dest, destlen, s, len,
-				     input_charset,
-				     parms->output_charset);
+	dvb_iconv_to_charset(parms, *dest, destlen, s, len,
+			     input_charset,
+			     parms->output_charset);
+	if (tmp != buf)
+		free(tmp);
+}
+
+/*
+ * Strings inside descriptors are up to 255 bytes, so the buffers used to
+ * remove the control codes are normally on the stack
+ */
+static unsigned char *parse_string_tmp(uint16_t *stack, size_t size, size_t len)
+{
+	if (len + 2 <= size)
+		return (unsigned char *)stack;
+
+	return malloc(len + 2);
 }
 
 void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
@@ -373,15 +864,16 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	size_t destlen, i, len2 = 0;
 	char *p, *p2, *type = parms->default_charset;
 	unsigned char *tmp1 = NULL, *tmp2 = NULL;
+	uint16_t stack[2][129];
 	const unsigned char *s;
 	int emphasis = 0;
 
 	if (*dest) {
-		free(*dest);
+		dvb_parse_free(parms, *dest);
 		*dest = NULL;
 	}
 	if (*emph) {
-		free(*emph);
+		dvb_parse_free(parms, *emph);
 		*emph = NULL;
 	}
 	if (!len)
@@ -442,8 +934,9 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	 * use 3 chars for one code, use it for destlen
 	 */
 	destlen = len * 3;
-	*dest = malloc(destlen + 1);
-	*emph = malloc(destlen + 1);
+	*dest = dvb_parse_malloc(parms, destlen + 1);
+	if (!*dest)
+		return;
 
 	/* Remove special chars */
 	if (!strncasecmp(type, "ISO-8859", 8) || !strcasecmp(type, "ISO-6937") || !strcasecmp(type, "ISO-10646/UTF-8")) {
@@ -451,8 +944,8 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 		 * Handles the ISO/IEC 10646 1-byte control codes
 		 * (EN 300 468 v1.11.1 Table A.1)
 		 */
-		tmp1 = malloc(len + 2);
-		tmp2 = malloc(len + 2);
+		tmp1 = parse_string_tmp(stack[0], sizeof(stack[0]), len);
+		tmp2 = parse_string_tmp(stack[1], sizeof(stack[1]), len);
 		p = (char *)tmp1;
 		p2 = (char *)tmp2;
 		s = src;
@@ -482,8 +975,8 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 		uint16_t *out_code;
 		uint16_t *out_emph;
 
-		tmp1 = malloc(len + 2);
-		tmp2 = malloc(len + 2);
+		tmp1 = parse_string_tmp(stack[0], sizeof(stack[0]), len);
+		tmp2 = parse_string_tmp(stack[1], sizeof(stack[1]), len);
 		out_code = (void *)tmp1;
 		out_emph = (void *)tmp2;
 
@@ -518,25 +1011,25 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 		s = src;
 
 	charset_conversion(parms, dest, s, len, type);
-	/* The code had over-sized the space. Fix it. */
-	if (*dest)
-		*dest = realloc(*dest, strlen(*dest) + 1);
-
-	if (!len2) {
-		if (tmp2) {
-			free (tmp2);
-			tmp2 = NULL;
+	/*
+	 * The code had over-sized the space. Fix it. This is done before
+	 * allocating the emphasis string, as shrinking the last allocation
+	 * of an arena gives the space back.
+	 */
+	*dest = dvb_parse_realloc(parms, *dest, destlen + 1, strlen(*dest) + 1);
+
+	if (len2) {
+		*emph = dvb_parse_malloc(parms, len2 * 3 + 1);
+		if (*emph) {
+			charset_conversion(parms, emph, tmp2, len2, type);
+			*emph = dvb_parse_realloc(parms, *emph, len2 * 3 + 1,
+						  strlen(*emph) + 1);
 		}
-		free (*emph);
-		*emph = NULL;
-	} else {
-		charset_conversion(parms, emph, tmp2, len2, type);
-		*emph = realloc(*emph, strlen(*emph) + 1);
 	}
 
-	if (tmp1)
+	if (tmp1 != (unsigned char *)stack[0])
 		free(tmp1);
-	if (tmp2)
+	if (tmp2 != (unsigned char *)stack[1])
 		free(tmp2);
 }
 
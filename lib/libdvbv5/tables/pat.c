@@ -21,6 +21,7 @@
 #include <libdvbv5/pat.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ ssize_t dvb_table_pat_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_pat), 1);
+		*table = dvb_parse_calloc(parms, 1, sizeof(struct dvb_table_pat));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -76,7 +77,7 @@ ssize_t dvb_table_pat_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_pat_program *prog;
 
-		prog = malloc(sizeof(struct dvb_table_pat_program));
+		prog = dvb_parse_malloc(parms, sizeof(struct dvb_table_pat_program));
 		if (!prog) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
@@ -88,7 +89,7 @@ ssize_t dvb_table_pat_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		bswap16(prog->service_id);
 
 		if (prog->pid == 0x1fff) { /* ignore null packets */
-			free(prog);
+			dvb_parse_free(parms, prog);
 			break;
 		}
 		bswap16(prog->bitfield);
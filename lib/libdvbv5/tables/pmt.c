@@ -21,6 +21,7 @@
 #include <libdvbv5/pmt.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #include <string.h> /* memcpy */
 
@@ -51,7 +52,7 @@ ssize_t dvb_table_pmt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_pmt), 1);
+		*table = dvb_parse_calloc(parms, 1, sizeof(struct dvb_table_pmt));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -100,7 +101,7 @@ ssize_t dvb_table_pmt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_pmt_stream *stream;
 
-		stream = malloc(sizeof(struct dvb_table_pmt_stream));
+		stream = dvb_parse_malloc(parms, sizeof(struct dvb_table_pmt_stream));
 		if (!stream) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
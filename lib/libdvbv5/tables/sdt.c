@@ -21,6 +21,7 @@
 #include <libdvbv5/sdt.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ ssize_t dvb_table_sdt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_sdt), 1);
+		*table = dvb_parse_calloc(parms, 1, sizeof(struct dvb_table_sdt));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -78,7 +79,7 @@ ssize_t dvb_table_sdt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_sdt_service *service;
 
-		service = malloc(sizeof(struct dvb_table_sdt_service));
+		service = dvb_parse_malloc(parms, sizeof(struct dvb_table_sdt_service));
 		if (!service) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
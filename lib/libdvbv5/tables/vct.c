@@ -21,6 +21,7 @@
 #include <libdvbv5/vct.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 #include <parse_string.h>
 
 #if __GNUC__ >= 9
@@ -50,7 +51,7 @@ ssize_t atsc_table_vct_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct atsc_table_vct), 1);
+		*table = dvb_parse_calloc(parms, 1, sizeof(struct atsc_table_vct));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -77,7 +78,7 @@ ssize_t atsc_table_vct_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			break;
 		}
 
-		channel = malloc(sizeof(struct atsc_table_vct_channel));
+		channel = dvb_parse_malloc(parms, sizeof(struct atsc_table_vct_channel));
 		if (!channel) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -4;
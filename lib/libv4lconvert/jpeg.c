@@ -188,7 +188,7 @@ static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
 	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
 	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
 
-	uv_buf = v4lconvert_alloc_buffer(width * 16,
+	uv_buf = v4lconvert_alloc_buffer(data, width * 16,
 					 &data->convert_pixfmt_buf,
 					 &data->convert_pixfmt_buf_size);
 	if (!uv_buf)
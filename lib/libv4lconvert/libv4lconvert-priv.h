@@ -43,6 +43,15 @@
 #define V4LCONVERT_ERROR_MSG_SIZE 256
 #define V4LCONVERT_MAX_FRAMESIZES 256
 
+/*
+ * Intermediate conversion buffers come from a per-instance arena of
+ * page-aligned blocks. The block sizes are in steps of 1/4 of a power of
+ * two, starting at 4 pages, and up to V4LCONVERT_ARENA_MAX_FREE unused
+ * blocks per size class are kept for reuse.
+ */
+#define V4LCONVERT_ARENA_CLASSES 64
+#define V4LCONVERT_ARENA_MAX_FREE 2
+
 #define V4LCONVERT_ERR(...) \
 	snprintf(data->error_msg, V4LCONVERT_ERROR_MSG_SIZE, \
 			"v4l-convert: error " __VA_ARGS__)
@@ -82,6 +91,9 @@ struct v4lconvert_data {
 	unsigned char *rotate90_buf;
 	unsigned char *flip_buf;
 	unsigned char *convert_pixfmt_buf;
+	/* Free arena blocks per size class, linked through their first bytes */
+	unsigned char *arena_free[V4LCONVERT_ARENA_CLASSES];
+	int arena_hugepages;
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
 	void *dev_ops_priv;
@@ -109,7 +121,9 @@ struct v4lconvert_pixfmt {
 
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
-unsigned char *v4lconvert_alloc_buffer(int needed,
+unsigned char *v4lconvert_alloc_buffer(struct v4lconvert_data *data,
+		int needed, unsigned char **buf, int *buf_size);
+void v4lconvert_free_buffer(struct v4lconvert_data *data,
 		unsigned char **buf, int *buf_size);
 
 int v4lconvert_oom_error(struct v4lconvert_data *data);
@@ -25,6 +25,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "libv4lconvert.h"
@@ -239,6 +241,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->dev_ops_priv = dev_ops_priv;
 	data->decompress_pid = -1;
 	data->fps = 30;
+	data->arena_hugepages = getenv("LIBV4LCONVERT_HUGEPAGES") != NULL;
 
 	/* Check supported formats */
 	for (i = 0; ; i++) {
@@ -298,6 +301,153 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	return data;
 }
 
+static size_t v4lconvert_arena_class_size(int class)
+{
+	return (size_t)getpagesize() * (4 + (class & 3)) << (class >> 2);
+}
+
+/* Return the smallest size class that fits needed, or -1 if there is none */
+static int v4lconvert_arena_class(int needed)
+{
+	int class;
+
+	for (class = 0; class < V4LCONVERT_ARENA_CLASSES; class++) {
+		size_t size = v4lconvert_arena_class_size(class);
+
+		if (size > INT_MAX)
+			break;
+		if (size >= (size_t)needed)
+			return class;
+	}
+	return -1;
+}
+
+static unsigned char *v4lconvert_arena_map(struct v4lconvert_data *data,
+		size_t size)
+{
+	unsigned char *block;
+
+	block = (void *)SYS_MMAP(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (block == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	if (data->arena_hugepages && size >= 2 * 1024 * 1024)
+		madvise(block, size, MADV_HUGEPAGE);
+#endif
+	/*
+	 * Fault the pages in now, when the format is set up, rather than
+	 * in the middle of converting a frame.
+	 */
+	memset(block, 0, size);
+	return block;
+}
+
+unsigned char *v4lconvert_alloc_buffer(struct v4lconvert_data *data,
+		int needed, unsigned char **buf, int *buf_size)
+{
+	unsigned char *block = NULL;
+	size_t size;
+	int class, i;
+
+	if (*buf_size >= needed)
+		return *buf;
+
+	v4lconvert_free_buffer(data, buf, buf_size);
+
+	/* Without arena (tinyjpeg has no v4lconvert_data) use the heap */
+	if (data == NULL) {
+		*buf = malloc(needed);
+		if (*buf == NULL)
+			return NULL;
+		*buf_size = needed;
+		return *buf;
+	}
+
+	class = v4lconvert_arena_class(needed);
+	if (class < 0) {
+		size = ((size_t)needed + getpagesize() - 1) &
+			~((size_t)getpagesize() - 1);
+		block = v4lconvert_arena_map(data, size);
+	} else {
+		/* A somewhat larger free block is better than fresh pages */
+		for (i = class; i < V4LCONVERT_ARENA_CLASSES && i <= class + 4; i++) {
+			block = data->arena_free[i];
+			if (block) {
+				data->arena_free[i] = *(unsigned char **)block;
+				size = v4lconvert_arena_class_size(i);
+				break;
+			}
+		}
+		if (block == NULL) {
+			size = v4lconvert_arena_class_size(class);
+			block = v4lconvert_arena_map(data, size);
+		}
+	}
+	if (block == NULL)
+		return NULL;
+
+	*buf = block;
+	*buf_size = size;
+	return block;
+}
+
+void v4lconvert_free_buffer(struct v4lconvert_data *data,
+		unsigned char **buf, int *buf_size)
+{
+	unsigned char *block;
+	int class, n = 0;
+
+	if (*buf == NULL)
+		return;
+
+	if (data == NULL) {
+		free(*buf);
+		goto out;
+	}
+
+	for (class = 0; class < V4LCONVERT_ARENA_CLASSES; class++)
+		if (v4lconvert_arena_class_size(class) >= (size_t)*buf_size)
+			break;
+	if (class < V4LCONVERT_ARENA_CLASSES &&
+	    v4lconvert_arena_class_size(class) == (size_t)*buf_size)
+		for (block = data->arena_free[class]; block;
+		     block = *(unsigned char **)block)
+			n++;
+	else
+		n = V4LCONVERT_ARENA_MAX_FREE;
+
+	if (n < V4LCONVERT_ARENA_MAX_FREE) {
+		*(unsigned char **)*buf = data->arena_free[class];
+		data->arena_free[class] = *buf;
+	} else {
+		SYS_MUNMAP(*buf, *buf_size);
+	}
+out:
+	*buf = NULL;
+	*buf_size = 0;
+}
+
+static void v4lconvert_arena_destroy(struct v4lconvert_data *data)
+{
+	unsigned char *block;
+	int class;
+
+	v4lconvert_free_buffer(data, &data->convert1_buf, &data->convert1_buf_size);
+	v4lconvert_free_buffer(data, &data->convert2_buf, &data->convert2_buf_size);
+	v4lconvert_free_buffer(data, &data->rotate90_buf, &data->rotate90_buf_size);
+	v4lconvert_free_buffer(data, &data->flip_buf, &data->flip_buf_size);
+	v4lconvert_free_buffer(data, &data->convert_pixfmt_buf,
+			&data->convert_pixfmt_buf_size);
+
+	for (class = 0; class < V4LCONVERT_ARENA_CLASSES; class++) {
+		while ((block = data->arena_free[class])) {
+			data->arena_free[class] = *(unsigned char **)block;
+			SYS_MUNMAP(block, v4lconvert_arena_class_size(class));
+		}
+	}
+}
+
 void v4lconvert_destroy(struct v4lconvert_data *data)
 {
 	if (!data)
@@ -318,11 +468,7 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 #ifdef HAVE_LIBV4LCONVERT_HELPERS
 	v4lconvert_helper_cleanup(data);
 #endif
-	free(data->convert1_buf);
-	free(data->convert2_buf);
-	free(data->rotate90_buf);
-	free(data->flip_buf);
-	free(data->convert_pixfmt_buf);
+	v4lconvert_arena_destroy(data);
 	free(data->previous_frame);
 	free(data);
 }
@@ -753,21 +899,6 @@ static int v4lconvert_processing_needs_double_conversion(
 	return 1;
 }
 
-unsigned char *v4lconvert_alloc_buffer(int needed,
-		unsigned char **buf, int *buf_size)
-{
-	if (*buf_size < needed) {
-		free(*buf);
-		*buf = malloc(needed);
-		if (*buf == NULL) {
-			*buf_size = 0;
-			return NULL;
-		}
-		*buf_size = needed;
-	}
-	return *buf;
-}
-
 int v4lconvert_oom_error(struct v4lconvert_data *data)
 {
 	V4LCONVERT_ERR("could not allocate memory\n");
@@ -775,6 +906,27 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
+/* HSV is converted to RGB24 first, the YUV420 destination is too small */
+static int v4lconvert_hsv_to_yuv420(struct v4lconvert_data *data,
+	const unsigned char *src, unsigned char *dest,
+	const struct v4l2_format *fmt, int bits, int yvu)
+{
+	struct v4l2_format rgb_fmt = *fmt;
+	unsigned char *rgb;
+
+	rgb = v4lconvert_alloc_buffer(data, fmt->fmt.pix.width * fmt->fmt.pix.height * 3,
+			&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+	if (!rgb)
+		return v4lconvert_oom_error(data);
+
+	v4lconvert_hsv_to_rgb24(src, rgb, fmt->fmt.pix.width, fmt->fmt.pix.height,
+				0, bits, fmt->fmt.pix.hsv_enc);
+	rgb_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+	v4lconvert_fixup_fmt(&rgb_fmt);
+	v4lconvert_rgb24_to_yuv420(rgb, dest, &rgb_fmt, 0, yvu, 3);
+	return 0;
+}
+
 static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
@@ -839,7 +991,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		if (dest_pix_fmt != V4L2_PIX_FMT_YUV420 &&
 				dest_pix_fmt != V4L2_PIX_FMT_YVU420) {
-			d = v4lconvert_alloc_buffer(width * height * 3 / 2,
+			d = v4lconvert_alloc_buffer(data, width * height * 3 / 2,
 					&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
 			if (!d)
 				return v4lconvert_oom_error(data);
@@ -965,7 +1117,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		unsigned char *tmpbuf;
 		struct v4l2_format tmpfmt = *fmt;
 
-		tmpbuf = v4lconvert_alloc_buffer(width * height,
+		tmpbuf = v4lconvert_alloc_buffer(data, width * height,
 				&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
 		if (!tmpbuf)
 			return v4lconvert_oom_error(data);
@@ -1182,7 +1334,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_BGR24:
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
-			d = v4lconvert_alloc_buffer(width * height * 3,
+			d = v4lconvert_alloc_buffer(data, width * height * 3,
 					&data->convert_pixfmt_buf,
 					&data->convert_pixfmt_buf_size);
 			if (!d)
@@ -1440,7 +1592,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_NV16: {
 		unsigned char *tmpbuf;
 
-		tmpbuf = v4lconvert_alloc_buffer(width * height * 2,
+		tmpbuf = v4lconvert_alloc_buffer(data, width * height * 2,
 				&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
 		if (!tmpbuf)
 			return v4lconvert_oom_error(data);
@@ -1476,7 +1628,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_NV61: {
 		unsigned char *tmpbuf;
 
-		tmpbuf = v4lconvert_alloc_buffer(width * height * 2,
+		tmpbuf = v4lconvert_alloc_buffer(data, width * height * 2,
 				&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
 		if (!tmpbuf)
 			return v4lconvert_oom_error(data);
@@ -1549,14 +1701,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 						24, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
-			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt, 24,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420))
+				result = -1;
 			break;
 		}
 
@@ -1578,14 +1726,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 						32, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
-			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt, 32,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420))
+				result = -1;
 			break;
 		}
 
@@ -1686,7 +1830,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
 	   rotate -> flip -> crop, all steps are optional */
 	if (convert == 2) {
-		convert1_dest = v4lconvert_alloc_buffer(
+		convert1_dest = v4lconvert_alloc_buffer(data,
 				my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3,
 				&data->convert1_buf, &data->convert1_buf_size);
 		if (!convert1_dest)
@@ -1698,7 +1842,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	}
 
 	if (convert && (rotate90 || hflip || vflip || crop)) {
-		convert2_dest = v4lconvert_alloc_buffer(temp_needed,
+		convert2_dest = v4lconvert_alloc_buffer(data, temp_needed,
 				&data->convert2_buf, &data->convert2_buf_size);
 		if (!convert2_dest)
 			return v4lconvert_oom_error(data);
@@ -1708,7 +1852,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	}
 
 	if (rotate90 && (hflip || vflip || crop)) {
-		rotate90_dest = v4lconvert_alloc_buffer(temp_needed,
+		rotate90_dest = v4lconvert_alloc_buffer(data, temp_needed,
 				&data->rotate90_buf, &data->rotate90_buf_size);
 		if (!rotate90_dest)
 			return v4lconvert_oom_error(data);
@@ -1717,7 +1861,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	}
 
 	if ((vflip || hflip) && crop) {
-		flip_dest = v4lconvert_alloc_buffer(temp_needed, &data->flip_buf,
+		flip_dest = v4lconvert_alloc_buffer(data, temp_needed, &data->flip_buf,
 				&data->flip_buf_size);
 		if (!flip_dest)
 			return v4lconvert_oom_error(data);
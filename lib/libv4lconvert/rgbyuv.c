@@ -689,7 +689,7 @@ int v4lconvert_y10b_to_rgb24(struct v4lconvert_data *data,
 {
 	unsigned char *unpacked_buffer;
 
-	unpacked_buffer = v4lconvert_alloc_buffer(width * height * 2,
+	unpacked_buffer = v4lconvert_alloc_buffer(data, width * height * 2,
 					&data->convert_pixfmt_buf,
 					&data->convert_pixfmt_buf_size);
 	if (!unpacked_buffer)
@@ -720,7 +720,7 @@ int v4lconvert_y10b_to_yuv420(struct v4lconvert_data *data,
 {
 	unsigned char *unpacked_buffer;
 
-	unpacked_buffer = v4lconvert_alloc_buffer(width * height * 2,
+	unpacked_buffer = v4lconvert_alloc_buffer(data, width * height * 2,
 					&data->convert_pixfmt_buf,
 					&data->convert_pixfmt_buf_size);
 	if (!unpacked_buffer)
@@ -2262,7 +2262,7 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 		int length;
 
 		priv->stream_filtered =
-			v4lconvert_alloc_buffer(priv->stream_end - priv->stream,
+			v4lconvert_alloc_buffer(NULL, priv->stream_end - priv->stream,
 					&priv->stream_filtered,
 					&priv->stream_filtered_bufsize);
 		if (!priv->stream_filtered)
@@ -735,8 +735,15 @@ public:
 	{
 		v4l_queue_init(this, type, memory);
 	}
+	cv4l_queue(const cv4l_queue &) = delete;
+	cv4l_queue &operator=(const cv4l_queue &) = delete;
+	~cv4l_queue()
+	{
+		v4l_queue_exit(this);
+	}
 	void init(unsigned type, unsigned memory)
 	{
+		v4l_queue_exit(this);
 		v4l_queue_init(this, type, memory);
 	}
 	unsigned g_type() const { return v4l_queue_g_type(this); }
@@ -790,6 +797,14 @@ public:
 	{
 		return v4l_queue_release_bufs(fd->g_v4l_fd(), this, from);
 	}
+	bool has_remove_bufs() const
+	{
+		return v4l_queue_has_remove_bufs(this);
+	}
+	int remove_bufs(cv4l_fd *fd, unsigned count)
+	{
+		return v4l_queue_remove_bufs(fd->g_v4l_fd(), this, count);
+	}
 	bool has_expbuf(cv4l_fd *fd)
 	{
 		return v4l_queue_has_expbuf(fd->g_v4l_fd());
@@ -0,0 +1,747 @@
+/*
+ * ir-decode.c - decodes IR pulse/space streams into scancodes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * The decoders are modelled after the kernel decoders in
+ * drivers/media/rc/ir-*-decoder.c, and use the timings ir-encode.c
+ * generates. Durations are in microseconds.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/lirc.h>
+
+#include "ir-decode.h"
+
+/* Longer than any space within a message of any protocol */
+#define FLUSH_SPACE	1000000
+
+static bool eq_margin(unsigned d, unsigned expected, unsigned margin)
+{
+	return d + margin > expected && d < expected + margin;
+}
+
+/*
+ * Pulse distance protocols: an optional header, bits encoded in the
+ * length of the space following a fixed pulse, and a trailing pulse.
+ */
+enum pd_state_ty {
+	PD_INACTIVE,
+	PD_HEADER_SPACE,
+	PD_BIT_PULSE,
+	PD_BIT_SPACE,
+	PD_TRAILER_PULSE,
+	PD_TRAILER_SPACE,
+	PD_CHECK_REPEAT,
+};
+
+struct pd_state {
+	enum pd_state_ty state;
+	unsigned count;
+	/* first bit received is bit 0 */
+	uint64_t bits;
+	bool repeat;
+	uint64_t start;
+
+	/* previous message, for repeats and sharp echo messages */
+	uint64_t last_bits;
+	bool pending;
+	uint64_t pending_start;
+};
+
+struct ir_decoder;
+
+struct pd_desc {
+	unsigned header_pulse;	/* 0 if there is no header */
+	unsigned header_space;
+	unsigned repeat_space;	/* 0 if there is no repeat message */
+	unsigned bit_pulse;
+	unsigned bit0_space;
+	unsigned bit1_space;
+	unsigned margin;
+	unsigned nbits;
+	unsigned trailer_space;	/* minimum */
+	/* jvc repeats the message without header */
+	bool headerless_repeat;
+	void (*finish)(struct ir_decoder *dec, struct pd_state *s);
+};
+
+struct sony_state {
+	enum { SONY_INACTIVE, SONY_SPACE, SONY_PULSE } state;
+	unsigned count;
+	uint32_t bits;
+	uint64_t start;
+};
+
+/* Manchester encoded protocols */
+struct rc5_state {
+	bool active;
+	unsigned count;
+	uint32_t bits;
+	/* the first half of the current bit was received */
+	bool half;
+	bool first;
+	/* rc5x has a 4 unit space after the address */
+	bool rc5x;
+	uint64_t start;
+};
+
+struct rc6_state {
+	enum { RC6_INACTIVE, RC6_HEADER_SPACE, RC6_BITS } state;
+	unsigned count;
+	uint64_t bits;
+	bool half;
+	bool first;
+	uint64_t start;
+};
+
+enum pd_proto {
+	PD_NEC,
+	PD_JVC,
+	PD_SANYO,
+	PD_SHARP,
+	PD_XBOX_DVD,
+	PD_MAX
+};
+
+struct ir_decoder {
+	ir_decode_cb cb;
+	void *priv;
+
+	/* start of the event being decoded */
+	uint64_t now;
+	bool have_event;
+	bool event_pulse;
+	unsigned event_duration;
+
+	/* the decoder that produced the last scancode */
+	const void *last_owner;
+	struct ir_scancode last;
+	uint64_t last_end;
+
+	struct pd_state pd[PD_MAX];
+	struct sony_state sony;
+	struct rc5_state rc5;
+	struct rc6_state rc6;
+};
+
+static void emit(struct ir_decoder *dec, const void *owner, enum rc_proto proto,
+		 unsigned scancode, bool toggle, uint64_t start)
+{
+	struct ir_scancode sc = {
+		.proto = proto,
+		.scancode = scancode,
+		.toggle = toggle,
+		.timestamp = start,
+	};
+
+	dec->last_owner = owner;
+	dec->last = sc;
+	dec->last_end = dec->now;
+	dec->cb(dec->priv, &sc);
+}
+
+/*
+ * Protocols without a header easily match parts of other messages, so
+ * ignore them if they overlap with a message that was already decoded.
+ */
+static bool overlaps_last(struct ir_decoder *dec, uint64_t start)
+{
+	return start < dec->last_end;
+}
+
+/* Repeat messages only count if the same decoder decoded the last scancode */
+static void emit_repeat(struct ir_decoder *dec, const void *owner, uint64_t start)
+{
+	struct ir_scancode sc = dec->last;
+
+	if (dec->last_owner != owner)
+		return;
+
+	sc.repeat = true;
+	sc.timestamp = start;
+	dec->cb(dec->priv, &sc);
+}
+
+static void nec_finish(struct ir_decoder *dec, struct pd_state *s)
+{
+	unsigned address = s->bits & 0xff;
+	unsigned not_address = (s->bits >> 8) & 0xff;
+	unsigned command = (s->bits >> 16) & 0xff;
+	unsigned not_command = (s->bits >> 24) & 0xff;
+
+	if (s->repeat) {
+		emit_repeat(dec, s, s->start);
+		return;
+	}
+
+	if ((command ^ not_command) != 0xff)
+		emit(dec, s, RC_PROTO_NEC32, not_address << 24 | address << 16 |
+		     not_command << 8 | command, false, s->start);
+	else if ((address ^ not_address) != 0xff)
+		emit(dec, s, RC_PROTO_NECX, address << 16 | not_address << 8 |
+		     command, false, s->start);
+	else
+		emit(dec, s, RC_PROTO_NEC, address << 8 | command, false, s->start);
+}
+
+static void jvc_finish(struct ir_decoder *dec, struct pd_state *s)
+{
+	if (s->repeat) {
+		if (s->bits == s->last_bits)
+			emit_repeat(dec, s, s->start);
+		return;
+	}
+
+	s->last_bits = s->bits;
+	emit(dec, s, RC_PROTO_JVC, (s->bits & 0xff) << 8 | ((s->bits >> 8) & 0xff),
+	     false, s->start);
+}
+
+static void sanyo_finish(struct ir_decoder *dec, struct pd_state *s)
+{
+	unsigned address = s->bits & 0x1fff;
+	unsigned command = (s->bits >> 26) & 0xff;
+	unsigned not_command = (s->bits >> 34) & 0xff;
+
+	if (s->repeat) {
+		emit_repeat(dec, s, s->start);
+		return;
+	}
+
+	if ((command ^ not_command) != 0xff)
+		return;
+
+	emit(dec, s, RC_PROTO_SANYO, address << 8 | command, false, s->start);
+}
+
+/*
+ * A sharp message is followed by an echo message with the command and the
+ * expansion/check bits inverted, 40ms later.
+ */
+static void sharp_finish(struct ir_decoder *dec, struct pd_state *s)
+{
+	unsigned address = s->bits & 0x1f;
+	unsigned command = (s->bits >> 5) & 0xff;
+	unsigned check = (s->bits >> 13) & 3;
+
+	if (check == 1) {
+		s->last_bits = s->bits;
+		s->pending = true;
+		s->pending_start = s->start;
+		return;
+	}
+
+	if (check == 2 && s->pending && s->start - s->pending_start < 100000 &&
+	    !overlaps_last(dec, s->pending_start) &&
+	    (s->last_bits & 0x1f) == address &&
+	    ((s->last_bits >> 5) & 0xff) == (~command & 0xff))
+		emit(dec, s, RC_PROTO_SHARP, address << 8 | (~command & 0xff),
+		     false, s->pending_start);
+
+	s->pending = false;
+}
+
+static void xbox_dvd_finish(struct ir_decoder *dec, struct pd_state *s)
+{
+	unsigned v = 0;
+	int i;
+
+	/* most significant bit first */
+	for (i = 0; i < 24; i++)
+		if (s->bits & (1 << i))
+			v |= 1 << (23 - i);
+
+	if ((((v >> 12) ^ v) & 0xfff) != 0xfff)
+		return;
+
+	emit(dec, s, RC_PROTO_XBOX_DVD, v & 0xfff, false, s->start);
+}
+
+static const struct pd_desc pd_protocols[PD_MAX] = {
+	[PD_NEC] = {
+		.header_pulse = 9000, .header_space = 4500, .repeat_space = 2250,
+		.bit_pulse = 563, .bit0_space = 563, .bit1_space = 1688,
+		.margin = 281, .nbits = 32, .trailer_space = 5625,
+		.finish = nec_finish,
+	},
+	[PD_JVC] = {
+		.header_pulse = 8400, .header_space = 4200,
+		.bit_pulse = 525, .bit0_space = 525, .bit1_space = 1575,
+		.margin = 262, .nbits = 16, .trailer_space = 5250,
+		.headerless_repeat = true,
+		.finish = jvc_finish,
+	},
+	[PD_SANYO] = {
+		.header_pulse = 9000, .header_space = 4500, .repeat_space = 2250,
+		.bit_pulse = 563, .bit0_space = 563, .bit1_space = 1688,
+		.margin = 281, .nbits = 42, .trailer_space = 5625,
+		.finish = sanyo_finish,
+	},
+	[PD_SHARP] = {
+		/* remotes use a 680us/1680us space, ir-encode 1000us/2000us */
+		.bit_pulse = 320, .bit0_space = 850, .bit1_space = 1850,
+		.margin = 270, .nbits = 15, .trailer_space = 2600,
+		.finish = sharp_finish,
+	},
+	[PD_XBOX_DVD] = {
+		.header_pulse = 4000, .header_space = 3900,
+		.bit_pulse = 550, .bit0_space = 900, .bit1_space = 1900,
+		.margin = 275, .nbits = 24, .trailer_space = 5000,
+		.finish = xbox_dvd_finish,
+	},
+};
+
+static void pd_decode(struct ir_decoder *dec, const struct pd_desc *desc,
+		      struct pd_state *s, bool pulse, unsigned d)
+{
+	switch (s->state) {
+	case PD_CHECK_REPEAT:
+		if (pulse && eq_margin(d, desc->bit_pulse, desc->margin)) {
+			s->start = dec->now;
+			s->repeat = true;
+			s->count = 0;
+			s->bits = 0;
+			s->state = PD_BIT_SPACE;
+			return;
+		}
+		/* fall through */
+	case PD_INACTIVE:
+		if (!pulse)
+			break;
+
+		s->start = dec->now;
+		s->repeat = false;
+		s->count = 0;
+		s->bits = 0;
+		if (!desc->header_pulse) {
+			if (!eq_margin(d, desc->bit_pulse, desc->margin))
+				break;
+			s->state = PD_BIT_SPACE;
+			return;
+		}
+		if (!eq_margin(d, desc->header_pulse, desc->header_pulse / 8))
+			break;
+		s->state = PD_HEADER_SPACE;
+		return;
+	case PD_HEADER_SPACE:
+		if (pulse)
+			break;
+		if (eq_margin(d, desc->header_space, desc->header_space / 8)) {
+			s->state = PD_BIT_PULSE;
+			return;
+		}
+		if (desc->repeat_space &&
+		    eq_margin(d, desc->repeat_space, desc->repeat_space / 8)) {
+			s->repeat = true;
+			s->state = PD_TRAILER_PULSE;
+			return;
+		}
+		break;
+	case PD_BIT_PULSE:
+	case PD_TRAILER_PULSE:
+		if (!pulse || !eq_margin(d, desc->bit_pulse, desc->margin))
+			break;
+		s->state = s->state == PD_BIT_PULSE ? PD_BIT_SPACE : PD_TRAILER_SPACE;
+		return;
+	case PD_BIT_SPACE:
+		if (pulse)
+			break;
+		if (eq_margin(d, desc->bit1_space, desc->margin * 2))
+			s->bits |= 1ULL << s->count;
+		else if (!eq_margin(d, desc->bit0_space, desc->margin))
+			break;
+		s->state = ++s->count == desc->nbits ? PD_TRAILER_PULSE : PD_BIT_PULSE;
+		return;
+	case PD_TRAILER_SPACE:
+		if (pulse || d < desc->trailer_space)
+			break;
+		desc->finish(dec, s);
+		if (desc->headerless_repeat) {
+			s->state = PD_CHECK_REPEAT;
+			return;
+		}
+		break;
+	}
+
+	s->state = PD_INACTIVE;
+}
+
+/*
+ * Sony: the bits are encoded in the pulse length, the message ends with
+ * a long space. The number of bits determines the protocol variant.
+ */
+#define SONY_UNIT	600
+
+static void sony_finish(struct ir_decoder *dec, struct sony_state *s)
+{
+	unsigned command = s->bits & 0x7f;
+
+	switch (s->count) {
+	case 12:
+		emit(dec, s, RC_PROTO_SONY12, ((s->bits >> 7) & 0x1f) << 16 | command,
+		     false, s->start);
+		break;
+	case 15:
+		emit(dec, s, RC_PROTO_SONY15, ((s->bits >> 7) & 0xff) << 16 | command,
+		     false, s->start);
+		break;
+	case 20:
+		emit(dec, s, RC_PROTO_SONY20, ((s->bits >> 7) & 0x1f) << 16 |
+		     ((s->bits >> 12) & 0xff) << 8 | command, false, s->start);
+		break;
+	}
+}
+
+static void sony_decode(struct ir_decoder *dec, bool pulse, unsigned d)
+{
+	struct sony_state *s = &dec->sony;
+
+	switch (s->state) {
+	case SONY_INACTIVE:
+		if (!pulse || !eq_margin(d, 4 * SONY_UNIT, SONY_UNIT / 2))
+			break;
+		s->start = dec->now;
+		s->count = 0;
+		s->bits = 0;
+		s->state = SONY_SPACE;
+		return;
+	case SONY_SPACE:
+		if (pulse)
+			break;
+		if (eq_margin(d, SONY_UNIT, SONY_UNIT / 3)) {
+			s->state = SONY_PULSE;
+			return;
+		}
+		if (d >= SONY_UNIT + SONY_UNIT / 2)
+			sony_finish(dec, s);
+		break;
+	case SONY_PULSE:
+		if (!pulse)
+			break;
+		if (eq_margin(d, 2 * SONY_UNIT, SONY_UNIT / 2))
+			s->bits |= 1 << s->count;
+		else if (!eq_margin(d, SONY_UNIT, SONY_UNIT / 2))
+			break;
+		if (++s->count > 20)
+			break;
+		s->state = SONY_SPACE;
+		return;
+	}
+
+	s->state = SONY_INACTIVE;
+}
+
+/*
+ * RC5: a 1 is a space followed by a pulse, each half a unit long. The first
+ * half of the first start bit is not visible. rc5-sz has an extra bit, and
+ * rc5x_20 has six more bits and a 4 unit space after the address.
+ */
+#define RC5_UNIT	889
+
+static bool rc5_half(struct rc5_state *s, bool pulse)
+{
+	if (!s->half) {
+		s->first = pulse;
+		s->half = true;
+		return true;
+	}
+
+	/* there must be a transition in the middle of each bit */
+	if (s->first == pulse)
+		return false;
+
+	s->bits = s->bits << 1 | pulse;
+	s->half = false;
+	return ++s->count <= 20;
+}
+
+static void rc5_finish(struct ir_decoder *dec, struct rc5_state *s)
+{
+	unsigned bits = s->bits;
+
+	if (overlaps_last(dec, s->start))
+		return;
+
+	switch (s->count) {
+	case 14:
+		if (s->rc5x)
+			break;
+		emit(dec, s, RC_PROTO_RC5, ((bits >> 6) & 0x1f) << 8 | (bits & 0x3f) |
+		     !((bits >> 12) & 1) << 6, (bits >> 11) & 1, s->start);
+		break;
+	case 15:
+		if (s->rc5x)
+			break;
+		emit(dec, s, RC_PROTO_RC5_SZ, bits & 0x2fff, (bits >> 12) & 1,
+		     s->start);
+		break;
+	case 20:
+		if (!s->rc5x)
+			break;
+		emit(dec, s, RC_PROTO_RC5X_20, ((bits >> 12) & 0x1f) << 16 |
+		     ((bits >> 6) & 0x3f) << 8 | (bits & 0x3f) |
+		     !((bits >> 18) & 1) << 14, (bits >> 17) & 1, s->start);
+		break;
+	}
+}
+
+static void rc5_decode(struct ir_decoder *dec, bool pulse, unsigned d)
+{
+	struct rc5_state *s = &dec->rc5;
+	unsigned n = (d + RC5_UNIT / 2) / RC5_UNIT;
+
+	if (!s->active) {
+		if (!pulse || n < 1 || n > 2)
+			return;
+		s->active = true;
+		s->start = dec->now;
+		s->count = 0;
+		s->bits = 0;
+		s->rc5x = false;
+		/* the first half of the start bit is a space */
+		s->half = true;
+		s->first = false;
+	} else if (!n || (pulse && n > 2)) {
+		goto reset;
+	} else if (!pulse && n > 2) {
+		/* a trailing space is merged with the gap */
+		if (s->half) {
+			if (!rc5_half(s, false))
+				goto reset;
+			n--;
+		}
+		if (s->count == 8 && !s->rc5x && (n == 4 || n == 5)) {
+			s->rc5x = true;
+			n -= 4;
+		} else {
+			rc5_finish(dec, s);
+			goto reset;
+		}
+	}
+
+	while (n--)
+		if (!rc5_half(s, pulse))
+			goto reset;
+	return;
+
+reset:
+	s->active = false;
+}
+
+/*
+ * RC6: header, then a start bit, three mode bits, the trailer bit with
+ * double length and the data bits. A 1 is a pulse followed by a space.
+ */
+#define RC6_UNIT	444
+
+static bool rc6_half(struct rc6_state *s, bool pulse)
+{
+	if (!s->half) {
+		s->first = pulse;
+		s->half = true;
+		return true;
+	}
+
+	if (s->first == pulse)
+		return false;
+
+	s->bits = s->bits << 1 | s->first;
+	s->half = false;
+	s->count++;
+
+	/* the start bit is always 1 */
+	if (s->count == 1 && !s->bits)
+		return false;
+	return s->count <= 5 + 32;
+}
+
+static void rc6_finish(struct ir_decoder *dec, struct rc6_state *s)
+{
+	unsigned mode, data_bits;
+	bool toggle;
+	unsigned scancode;
+
+	if (s->count <= 5)
+		return;
+
+	data_bits = s->count - 5;
+	mode = (s->bits >> (data_bits + 1)) & 7;
+	toggle = (s->bits >> data_bits) & 1;
+	scancode = s->bits & ((1ULL << data_bits) - 1);
+
+	if (mode == 0 && data_bits == 16) {
+		emit(dec, s, RC_PROTO_RC6_0, scancode, toggle, s->start);
+		return;
+	}
+	if (mode != 6)
+		return;
+
+	switch (data_bits) {
+	case 20:
+		emit(dec, s, RC_PROTO_RC6_6A_20, scancode, false, s->start);
+		break;
+	case 24:
+		emit(dec, s, RC_PROTO_RC6_6A_24, scancode, false, s->start);
+		break;
+	case 32:
+		if ((scancode & 0xffff0000) == 0x800f0000)
+			emit(dec, s, RC_PROTO_RC6_MCE, scancode & ~0x8000,
+			     scancode & 0x8000, s->start);
+		else
+			emit(dec, s, RC_PROTO_RC6_6A_32, scancode, false, s->start);
+		break;
+	}
+}
+
+static void rc6_decode(struct ir_decoder *dec, bool pulse, unsigned d)
+{
+	struct rc6_state *s = &dec->rc6;
+	unsigned n = (d + RC6_UNIT / 2) / RC6_UNIT;
+
+	switch (s->state) {
+	case RC6_INACTIVE:
+		if (!pulse || !eq_margin(d, 6 * RC6_UNIT, RC6_UNIT))
+			return;
+		s->start = dec->now;
+		s->state = RC6_HEADER_SPACE;
+		return;
+	case RC6_HEADER_SPACE:
+		if (pulse || !eq_margin(d, 2 * RC6_UNIT, RC6_UNIT / 2))
+			break;
+		s->count = 0;
+		s->bits = 0;
+		s->half = false;
+		s->state = RC6_BITS;
+		return;
+	case RC6_BITS:
+		if (!n)
+			break;
+		/* the longest space within a message is 3 units */
+		if (!pulse && n > 4) {
+			if (s->half && !rc6_half(s, false))
+				break;
+			rc6_finish(dec, s);
+			break;
+		}
+		while (n) {
+			/* the halves of the trailer bit are two units long */
+			unsigned len = s->count == 4 ? 2 : 1;
+
+			if (n < len || !rc6_half(s, pulse))
+				goto reset;
+			n -= len;
+		}
+		return;
+	}
+
+reset:
+	s->state = RC6_INACTIVE;
+}
+
+/*
+ * The protocols without a header (rc5 and sharp) run last, so a message that
+ * another decoder completes on the same event is reported first and
+ * overlaps_last() can suppress the bogus headerless match.
+ */
+static void ir_decode_event(struct ir_decoder *dec, bool pulse, unsigned duration)
+{
+	unsigned i;
+
+	for (i = 0; i < PD_MAX; i++)
+		if (i != PD_SHARP)
+			pd_decode(dec, &pd_protocols[i], &dec->pd[i], pulse, duration);
+	sony_decode(dec, pulse, duration);
+	rc6_decode(dec, pulse, duration);
+	rc5_decode(dec, pulse, duration);
+	pd_decode(dec, &pd_protocols[PD_SHARP], &dec->pd[PD_SHARP], pulse, duration);
+
+	dec->now += duration;
+}
+
+struct ir_decoder *ir_decode_alloc(ir_decode_cb cb, void *priv)
+{
+	struct ir_decoder *dec = calloc(1, sizeof(*dec));
+
+	if (!dec)
+		return NULL;
+
+	dec->cb = cb;
+	dec->priv = priv;
+	return dec;
+}
+
+void ir_decode_free(struct ir_decoder *dec)
+{
+	free(dec);
+}
+
+/*
+ * Consecutive pulses or spaces are merged, so the decoders always see
+ * alternating pulses and spaces. This means an event is decoded once the
+ * next event arrives, or on ir_decode_flush().
+ */
+void ir_decode_add(struct ir_decoder *dec, bool pulse, unsigned duration)
+{
+	if (dec->have_event && dec->event_pulse == pulse) {
+		if (dec->event_duration < UINT32_MAX - duration)
+			dec->event_duration += duration;
+		return;
+	}
+
+	if (dec->have_event)
+		ir_decode_event(dec, dec->event_pulse, dec->event_duration);
+
+	dec->have_event = true;
+	dec->event_pulse = pulse;
+	dec->event_duration = duration;
+}
+
+/* Decode all pending IR, e.g. at the end of a stream or on a timeout */
+void ir_decode_flush(struct ir_decoder *dec)
+{
+	if (!dec->have_event)
+		return;
+
+	ir_decode_event(dec, dec->event_pulse, dec->event_duration);
+	if (dec->event_pulse)
+		ir_decode_event(dec, false, FLUSH_SPACE);
+	dec->have_event = false;
+}
+
+/* Drop any partially decoded messages, e.g. after a receive overflow */
+void ir_decode_reset(struct ir_decoder *dec)
+{
+	dec->have_event = false;
+	dec->last_owner = NULL;
+	dec->last_end = 0;
+	memset(dec->pd, 0, sizeof(dec->pd));
+	memset(&dec->sony, 0, sizeof(dec->sony));
+	memset(&dec->rc5, 0, sizeof(dec->rc5));
+	memset(&dec->rc6, 0, sizeof(dec->rc6));
+}
+
+/* Set the timestamp of the next pulse or space */
+void ir_decode_set_time(struct ir_decoder *dec, uint64_t timestamp)
+{
+	if (dec->have_event) {
+		ir_decode_event(dec, dec->event_pulse, dec->event_duration);
+		dec->have_event = false;
+	}
+	if (timestamp < dec->last_end)
+		dec->last_end = 0;
+	dec->now = timestamp;
+}
@@ -0,0 +1,35 @@
+#ifndef __IR_DECODE_H__
+#define __IR_DECODE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <linux/lirc.h>
+
+/*
+ * Userspace IR decoder: the pulse/space stream is fed to the decoders of
+ * all protocols ir-encode.c can encode at the same time, in a single pass.
+ */
+
+struct ir_scancode {
+	enum rc_proto proto;
+	unsigned scancode;
+	bool toggle;
+	/* repeat message of the last scancode, e.g. nec repeat */
+	bool repeat;
+	/* start of the message in microseconds */
+	uint64_t timestamp;
+};
+
+typedef void (*ir_decode_cb)(void *priv, const struct ir_scancode *sc);
+
+struct ir_decoder;
+
+struct ir_decoder *ir_decode_alloc(ir_decode_cb cb, void *priv);
+void ir_decode_free(struct ir_decoder *dec);
+void ir_decode_add(struct ir_decoder *dec, bool pulse, unsigned duration);
+void ir_decode_flush(struct ir_decoder *dec);
+void ir_decode_reset(struct ir_decoder *dec);
+void ir_decode_set_time(struct ir_decoder *dec, uint64_t timestamp);
+
+#endif
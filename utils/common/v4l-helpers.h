@@ -1404,6 +1404,13 @@ static inline int v4l_buffer_querybuf(struct v4l_fd *f, struct v4l_buffer *buf,
 	return v4l_ioctl(f, VIDIOC_QUERYBUF, &buf->buf);
 }
 
+struct v4l_queue_buffer {
+	__u32 mem_offsets[VIDEO_MAX_PLANES];
+	void *mmappings[VIDEO_MAX_PLANES];
+	unsigned long userptrs[VIDEO_MAX_PLANES];
+	int fds[VIDEO_MAX_PLANES];
+};
+
 struct v4l_queue {
 	unsigned type;
 	unsigned memory;
@@ -1413,23 +1420,51 @@ struct v4l_queue {
 	unsigned capabilities;
 
 	__u32 lengths[VIDEO_MAX_PLANES];
-	__u32 mem_offsets[VIDEO_MAX_FRAME][VIDEO_MAX_PLANES];
-	void *mmappings[VIDEO_MAX_FRAME][VIDEO_MAX_PLANES];
-	unsigned long userptrs[VIDEO_MAX_FRAME][VIDEO_MAX_PLANES];
-	int fds[VIDEO_MAX_FRAME][VIDEO_MAX_PLANES];
+
+	/*
+	 * Per-buffer bookkeeping. This grows with the number of buffers
+	 * and is only freed by v4l_queue_exit(), so it can be reused if
+	 * the buffers are reallocated.
+	 */
+	struct v4l_queue_buffer *bufs;
+	unsigned bufs_size;
 };
 
 static inline void v4l_queue_init(struct v4l_queue *q,
 		unsigned type, unsigned memory)
 {
-	unsigned i, p;
-
 	memset(q, 0, sizeof(*q));
 	q->type = type;
 	q->memory = memory;
-	for (i = 0; i < VIDEO_MAX_FRAME; i++)
+}
+
+static inline void v4l_queue_exit(struct v4l_queue *q)
+{
+	free(q->bufs);
+	q->bufs = NULL;
+	q->bufs_size = 0;
+}
+
+static inline int v4l_queue_reserve(struct v4l_queue *q, unsigned count)
+{
+	struct v4l_queue_buffer *bufs;
+	unsigned size = q->bufs_size ? q->bufs_size : 8;
+	unsigned b, p;
+
+	if (count <= q->bufs_size)
+		return 0;
+	while (size < count)
+		size *= 2;
+	bufs = (struct v4l_queue_buffer *)realloc(q->bufs, size * sizeof(*bufs));
+	if (bufs == NULL)
+		return ENOMEM;
+	memset(bufs + q->bufs_size, 0, (size - q->bufs_size) * sizeof(*bufs));
+	for (b = q->bufs_size; b < size; b++)
 		for (p = 0; p < VIDEO_MAX_PLANES; p++)
-			q->fds[i][p] = -1;
+			bufs[b].fds[p] = -1;
+	q->bufs = bufs;
+	q->bufs_size = size;
+	return 0;
 }
 
 static inline unsigned v4l_queue_g_type(const struct v4l_queue *q) { return q->type; }
@@ -1446,41 +1481,48 @@ static inline __u32 v4l_queue_g_length(const struct v4l_queue *q, unsigned plane
 
 static inline __u32 v4l_queue_g_mem_offset(const struct v4l_queue *q, unsigned index, unsigned plane)
 {
-	return q->mem_offsets[index][plane];
+	if (index >= q->bufs_size)
+		return 0;
+	return q->bufs[index].mem_offsets[plane];
 }
 
 static inline void v4l_queue_s_mmapping(struct v4l_queue *q, unsigned index, unsigned plane, void *m)
 {
-	q->mmappings[index][plane] = m;
+	if (index < q->bufs_size)
+		q->bufs[index].mmappings[plane] = m;
 }
 
 static inline void *v4l_queue_g_mmapping(const struct v4l_queue *q, unsigned index, unsigned plane)
 {
 	if (index >= v4l_queue_g_mappings(q) || plane >= v4l_queue_g_num_planes(q))
 		return NULL;
-	return q->mmappings[index][plane];
+	return q->bufs[index].mmappings[plane];
 }
 
 static inline void v4l_queue_s_userptr(struct v4l_queue *q, unsigned index, unsigned plane, void *m)
 {
-	q->userptrs[index][plane] = (unsigned long)m;
+	if (index < q->bufs_size)
+		q->bufs[index].userptrs[plane] = (unsigned long)m;
 }
 
 static inline void *v4l_queue_g_userptr(const struct v4l_queue *q, unsigned index, unsigned plane)
 {
 	if (index >= v4l_queue_g_buffers(q) || plane >= v4l_queue_g_num_planes(q))
 		return NULL;
-	return (void *)q->userptrs[index][plane];
+	return (void *)q->bufs[index].userptrs[plane];
 }
 
 static inline void v4l_queue_s_fd(struct v4l_queue *q, unsigned index, unsigned plane, int fd)
 {
-	q->fds[index][plane] = fd;
+	if (index < q->bufs_size)
+		q->bufs[index].fds[plane] = fd;
 }
 
 static inline int v4l_queue_g_fd(const struct v4l_queue *q, unsigned index, unsigned plane)
 {
-	return q->fds[index][plane];
+	if (index >= q->bufs_size)
+		return -1;
+	return q->bufs[index].fds[plane];
 }
 
 static inline void *v4l_queue_g_dataptr(const struct v4l_queue *q, unsigned index, unsigned plane)
@@ -1495,6 +1537,9 @@ static inline int v4l_queue_querybufs(struct v4l_fd *f, struct v4l_queue *q, uns
 	unsigned b, p;
 	int ret;
 
+	ret = v4l_queue_reserve(q, v4l_queue_g_buffers(q));
+	if (ret)
+		return ret;
 	for (b = from; b < v4l_queue_g_buffers(q); b++) {
 		struct v4l_buffer buf;
 
@@ -1509,7 +1554,7 @@ static inline int v4l_queue_querybufs(struct v4l_fd *f, struct v4l_queue *q, uns
 		}
 		if (q->memory == V4L2_MEMORY_MMAP)
 			for (p = 0; p < q->num_planes; p++)
-				q->mem_offsets[b][p] = v4l_buffer_g_mem_offset(&buf, p);
+				q->bufs[b].mem_offsets[p] = v4l_buffer_g_mem_offset(&buf, p);
 	}
 	return 0;
 }
@@ -1679,6 +1724,58 @@ static inline int v4l_queue_release_bufs(struct v4l_fd *f, struct v4l_queue *q,
 	return v4l_queue_munmap_bufs(f, q, from);
 }
 
+static inline bool v4l_queue_has_remove_bufs(const struct v4l_queue *q)
+{
+#ifdef V4L2_BUF_CAP_SUPPORTS_REMOVE_BUFS
+	return q->capabilities & V4L2_BUF_CAP_SUPPORTS_REMOVE_BUFS;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Remove the last count buffers, which must not be queued. This is the
+ * counterpart of v4l_queue_create_bufs() and allows the queue to shrink
+ * again after it was grown.
+ */
+static inline int v4l_queue_remove_bufs(struct v4l_fd *f, struct v4l_queue *q,
+					unsigned count)
+{
+#ifdef VIDIOC_REMOVE_BUFS
+	struct v4l2_remove_buffers remove;
+	unsigned from, b, p;
+	int ret;
+
+	if (count > v4l_queue_g_buffers(q))
+		return EINVAL;
+	from = v4l_queue_g_buffers(q) - count;
+	memset(&remove, 0, sizeof(remove));
+	remove.index = from;
+	remove.count = count;
+	remove.type = q->type;
+	ret = v4l_ioctl(f, VIDIOC_REMOVE_BUFS, &remove);
+	if (ret)
+		return ret;
+	ret = v4l_queue_release_bufs(f, q, from);
+	for (b = from; b < v4l_queue_g_buffers(q); b++) {
+		for (p = 0; p < v4l_queue_g_num_planes(q); p++) {
+			int fd = v4l_queue_g_fd(q, b, p);
+
+			if (fd != -1) {
+				close(fd);
+				v4l_queue_s_fd(q, b, p, -1);
+			}
+		}
+	}
+	q->buffers = from;
+	if (q->mappings > from)
+		q->mappings = from;
+	return ret;
+#else
+	return ENOTTY;
+#endif
+}
+
 
 static inline bool v4l_queue_has_expbuf(struct v4l_fd *f)
 {
@@ -7,7 +7,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include "v4l-stream.h"
 #include "codec-fwht.h"
@@ -298,3 +300,250 @@ bool fwht_decompress(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
 	copy_cap_to_ref(p_out, ctx->state.info, &ctx->state);
 	return true;
 }
+
+bool fwht_is_i_frame(const __u8 *comp_buf)
+{
+	const struct fwht_cframe_hdr *hdr = (const struct fwht_cframe_hdr *)comp_buf;
+
+	return ntohl(hdr->flags) & V4L2_FWHT_FL_I_FRAME;
+}
+
+/*
+ * Send a message as a sequence of UDP fragments. The message consists of
+ * hdr followed by data, this avoids having to copy the (large) frame data
+ * just to prefix it with the stream and format headers.
+ */
+int v4l_stream_udp_send(int fd, const struct sockaddr *addr, socklen_t addr_len,
+			__u32 seq, __u32 flags, const __u8 *hdr, unsigned hdr_size,
+			const __u8 *data, unsigned size)
+{
+	unsigned msg_size = hdr_size + size;
+	unsigned frag_cnt = (msg_size + V4L_STREAM_UDP_FRAG_SIZE - 1) / V4L_STREAM_UDP_FRAG_SIZE;
+	unsigned offset = 0;
+	unsigned i;
+
+	if (!frag_cnt || msg_size > V4L_STREAM_UDP_MAX_MSG_SIZE)
+		return -EINVAL;
+
+	for (i = 0; i < frag_cnt; i++) {
+		__u32 udp_hdr[V4L_STREAM_UDP_HDR_SIZE / 4];
+		unsigned todo = msg_size - offset;
+		struct iovec iov[3];
+		struct msghdr msg = {};
+		unsigned n = 0;
+
+		if (todo > V4L_STREAM_UDP_FRAG_SIZE)
+			todo = V4L_STREAM_UDP_FRAG_SIZE;
+		udp_hdr[0] = htonl(V4L_STREAM_PACKET_UDP_FRAG);
+		udp_hdr[1] = htonl(seq);
+		udp_hdr[2] = htonl(i);
+		udp_hdr[3] = htonl(frag_cnt);
+		udp_hdr[4] = htonl(msg_size);
+		udp_hdr[5] = htonl(flags);
+		iov[n].iov_base = udp_hdr;
+		iov[n++].iov_len = sizeof(udp_hdr);
+		if (offset < hdr_size) {
+			unsigned len = hdr_size - offset;
+
+			if (len > todo)
+				len = todo;
+			iov[n].iov_base = (void *)(hdr + offset);
+			iov[n++].iov_len = len;
+			if (len < todo) {
+				iov[n].iov_base = (void *)data;
+				iov[n++].iov_len = todo - len;
+			}
+		} else {
+			iov[n].iov_base = (void *)(data + offset - hdr_size);
+			iov[n++].iov_len = todo;
+		}
+		msg.msg_name = (void *)addr;
+		msg.msg_namelen = addr_len;
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		while (sendmsg(fd, &msg, 0) < 0) {
+			if (errno == EINTR)
+				continue;
+			/*
+			 * Not fatal for an unreliable transport, the receivers
+			 * will see a lost message and ask for a refresh.
+			 */
+			if (errno == ENOBUFS || errno == EAGAIN ||
+			    errno == ECONNREFUSED)
+				break;
+			return -errno;
+		}
+		offset += todo;
+	}
+	return frag_cnt;
+}
+
+/*
+ * Check without blocking if any receiver sent a REFRESH datagram since
+ * the last call.
+ */
+bool v4l_stream_udp_refresh_requested(int fd)
+{
+	bool refresh = false;
+	__u32 pkt[2];
+	ssize_t n;
+
+	for (;;) {
+		n = recv(fd, pkt, sizeof(pkt), MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR || errno == ECONNREFUSED)
+				continue;
+			return refresh;
+		}
+		if (n == sizeof(pkt) && ntohl(pkt[0]) == V4L_STREAM_PACKET_UDP_REFRESH)
+			refresh = true;
+	}
+}
+
+int v4l_stream_udp_send_refresh(int fd, const struct sockaddr *addr, socklen_t addr_len,
+				__u32 seq)
+{
+	__u32 pkt[2];
+
+	pkt[0] = htonl(V4L_STREAM_PACKET_UDP_REFRESH);
+	pkt[1] = htonl(seq);
+	if (sendto(fd, pkt, sizeof(pkt), 0, addr, addr_len) < 0)
+		return -errno;
+	return 0;
+}
+
+void v4l_stream_udp_rx_init(struct v4l_stream_udp_rx *rx)
+{
+	memset(rx, 0, sizeof(*rx));
+	/* A receiver may join mid-stream: start from a key frame */
+	rx->need_key = true;
+	rx->refresh = true;
+}
+
+void v4l_stream_udp_rx_free(struct v4l_stream_udp_rx *rx)
+{
+	free(rx->buf);
+	free(rx->frag_map);
+	v4l_stream_udp_rx_init(rx);
+}
+
+static void udp_rx_loss(struct v4l_stream_udp_rx *rx, unsigned lost)
+{
+	rx->lost_msgs += lost;
+	rx->need_key = true;
+	rx->refresh = true;
+}
+
+static __u32 udp_get_u32(const __u8 *p, unsigned idx)
+{
+	__u32 v;
+
+	memcpy(&v, p + idx * 4, sizeof(v));
+	return ntohl(v);
+}
+
+/*
+ * Add a received datagram to the reassembly state.
+ *
+ * Returns V4L_STREAM_UDP_RX_MSG if this completed a message that can be
+ * decoded (it is then available in rx->buf, rx->size bytes long), or
+ * V4L_STREAM_UDP_RX_NONE if more datagrams are needed. Returns -EINVAL
+ * for malformed datagrams and -ENOMEM if no memory could be allocated.
+ *
+ * Fragments may arrive out of order within a message, but once a fragment
+ * of a newer message arrives the incomplete message is considered lost.
+ */
+int v4l_stream_udp_rx_add(struct v4l_stream_udp_rx *rx, const __u8 *dgram, unsigned len)
+{
+	__u32 seq, idx, frag_cnt, size, flags;
+	unsigned payload;
+
+	if (len < V4L_STREAM_UDP_HDR_SIZE ||
+	    udp_get_u32(dgram, 0) != V4L_STREAM_PACKET_UDP_FRAG) {
+		rx->bad_dgrams++;
+		return -EINVAL;
+	}
+	seq = udp_get_u32(dgram, 1);
+	idx = udp_get_u32(dgram, 2);
+	frag_cnt = udp_get_u32(dgram, 3);
+	size = udp_get_u32(dgram, 4);
+	flags = udp_get_u32(dgram, 5);
+	payload = len - V4L_STREAM_UDP_HDR_SIZE;
+
+	if (!size || size > V4L_STREAM_UDP_MAX_MSG_SIZE || idx >= frag_cnt ||
+	    frag_cnt != (size + V4L_STREAM_UDP_FRAG_SIZE - 1) / V4L_STREAM_UDP_FRAG_SIZE ||
+	    payload != (idx == frag_cnt - 1 ? size - idx * V4L_STREAM_UDP_FRAG_SIZE :
+					     V4L_STREAM_UDP_FRAG_SIZE)) {
+		rx->bad_dgrams++;
+		return -EINVAL;
+	}
+
+	if (rx->busy && seq != rx->seq) {
+		/* Late fragment of an older message, ignore */
+		if ((__s32)(seq - rx->seq) < 0)
+			return V4L_STREAM_UDP_RX_NONE;
+		/* The current message will never be completed */
+		rx->busy = false;
+		udp_rx_loss(rx, 1);
+	}
+
+	if (!rx->busy) {
+		/* Late fragment of a completed or abandoned message */
+		if (rx->have_seq && (__s32)(seq - rx->next_seq) < 0)
+			return V4L_STREAM_UDP_RX_NONE;
+		if (rx->have_seq && seq != rx->next_seq)
+			udp_rx_loss(rx, seq - rx->next_seq);
+
+		if (size > rx->buf_size) {
+			__u8 *buf = realloc(rx->buf, size);
+
+			if (!buf)
+				return -ENOMEM;
+			rx->buf = buf;
+			rx->buf_size = size;
+		}
+		if (frag_cnt > rx->frag_map_size) {
+			__u8 *map = realloc(rx->frag_map, frag_cnt);
+
+			if (!map)
+				return -ENOMEM;
+			rx->frag_map = map;
+			rx->frag_map_size = frag_cnt;
+		}
+		memset(rx->frag_map, 0, frag_cnt);
+		rx->busy = true;
+		rx->seq = seq;
+		rx->flags = flags;
+		rx->size = size;
+		rx->frag_cnt = frag_cnt;
+		rx->frags = 0;
+		rx->have_seq = true;
+		rx->next_seq = seq + 1;
+	}
+
+	if (size != rx->size || frag_cnt != rx->frag_cnt) {
+		rx->bad_dgrams++;
+		return -EINVAL;
+	}
+	/* Duplicate */
+	if (rx->frag_map[idx])
+		return V4L_STREAM_UDP_RX_NONE;
+	memcpy(rx->buf + idx * V4L_STREAM_UDP_FRAG_SIZE,
+	       dgram + V4L_STREAM_UDP_HDR_SIZE, payload);
+	rx->frag_map[idx] = 1;
+	if (++rx->frags < rx->frag_cnt)
+		return V4L_STREAM_UDP_RX_NONE;
+
+	rx->busy = false;
+	if (rx->need_key) {
+		if (!(rx->flags & V4L_STREAM_UDP_FL_KEY)) {
+			/* Keep asking in case the REFRESH datagram got lost */
+			rx->skipped_msgs++;
+			rx->refresh = true;
+			return V4L_STREAM_UDP_RX_NONE;
+		}
+		rx->need_key = false;
+	}
+	rx->msgs++;
+	return V4L_STREAM_UDP_RX_MSG;
+}
@@ -9,6 +9,7 @@
 #define _V4L_STREAM_H_
 
 #include <linux/videodev2.h>
+#include <sys/socket.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -136,6 +137,89 @@ extern "C" {
  */
 #define V4L_STREAM_PACKET_END				v4l2_fourcc('e', 'n', 'd', ' ')
 
+/*
+ * UDP/multicast transport
+ *
+ * The same packets can also be sent over UDP, typically to a multicast
+ * group so a single source can be watched by many receivers. The UDP port
+ * defaults to V4L_STREAM_PORT as well.
+ *
+ * Each frame is sent as one message, which is a self-contained byte stream
+ * in exactly the TCP format described above: the stream ID, the version,
+ * a FMT_VIDEO packet and then a single FRAME_VIDEO_RLE/FWHT packet (or just
+ * the END packet at the end of the stream). Since each message carries the
+ * format, receivers can join at any time.
+ *
+ * A message is split into fragments, each sent in its own datagram that
+ * starts with this header:
+ *
+ * uint32_t packet;	// V4L_STREAM_PACKET_UDP_FRAG
+ * uint32_t frame_seq;	// message sequence number, incremented by 1 per message
+ * uint32_t frag_idx;	// index of this fragment
+ * uint32_t frag_cnt;	// total number of fragments of this message
+ * uint32_t msg_size;	// total size of the message in bytes
+ * uint32_t flags;	// V4L_STREAM_UDP_FL_* flags
+ * uint8_t data[];	// message bytes at offset frag_idx * V4L_STREAM_UDP_FRAG_SIZE
+ *
+ * A receiver that detects a missing message (gap in frame_seq or a message
+ * that was never completed) drops all messages until one with the
+ * V4L_STREAM_UDP_FL_KEY flag set arrives, since FWHT P-frames cannot be
+ * decoded without the previous frame. A receiver that just joined the stream
+ * starts in that same state. To get that key frame quickly it sends
+ * a REFRESH datagram back to the source address of the stream:
+ *
+ * uint32_t packet;	// V4L_STREAM_PACKET_UDP_REFRESH
+ * uint32_t frame_seq;	// last frame_seq seen by the receiver
+ *
+ * after which the sender encodes the next frame as an FWHT I-frame.
+ */
+#define V4L_STREAM_PACKET_UDP_FRAG			v4l2_fourcc('f', 'r', 'g', 'u')
+#define V4L_STREAM_PACKET_UDP_REFRESH			v4l2_fourcc('r', 'f', 's', 'u')
+
+/* The message can be decoded without the preceding messages */
+#define V4L_STREAM_UDP_FL_KEY				(1 << 0)
+
+#define V4L_STREAM_UDP_HDR_SIZE				(6 * 4)
+/* Keep each datagram within a standard 1500 byte ethernet MTU */
+#define V4L_STREAM_UDP_MAX_DGRAM_SIZE			1472
+#define V4L_STREAM_UDP_FRAG_SIZE			(V4L_STREAM_UDP_MAX_DGRAM_SIZE - \
+							 V4L_STREAM_UDP_HDR_SIZE)
+/* Upper limit of a reassembled message, protects against bogus headers */
+#define V4L_STREAM_UDP_MAX_MSG_SIZE			(64 * 1024 * 1024)
+
+/* Return values of v4l_stream_udp_rx_add() */
+#define V4L_STREAM_UDP_RX_NONE				0
+#define V4L_STREAM_UDP_RX_MSG				1
+
+struct v4l_stream_udp_rx {
+	__u8		*buf;
+	unsigned	buf_size;
+	__u8		*frag_map;
+	unsigned	frag_map_size;
+
+	/* message that is currently being reassembled */
+	bool		busy;
+	__u32		seq;
+	__u32		flags;
+	unsigned	size;
+	unsigned	frag_cnt;
+	unsigned	frags;
+
+	/* sequence number of the next expected message */
+	bool		have_seq;
+	__u32		next_seq;
+	/* set on loss: drop messages until the next key message */
+	bool		need_key;
+	/* set on loss: the caller should send a REFRESH datagram */
+	bool		refresh;
+
+	/* statistics */
+	unsigned	msgs;
+	unsigned	lost_msgs;
+	unsigned	skipped_msgs;
+	unsigned	bad_dgrams;
+};
+
 struct codec_ctx {
 	struct v4l2_fwht_state	state;
 	unsigned int		flags;
@@ -155,6 +239,17 @@ __u8 *fwht_compress(struct codec_ctx *ctx, __u8 *buf, unsigned size, unsigned *c
 bool fwht_decompress(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
 		     __u8 *buf, unsigned size);
 unsigned rle_calc_bpl(unsigned bpl, __u32 pixelformat);
+bool fwht_is_i_frame(const __u8 *comp_buf);
+
+int v4l_stream_udp_send(int fd, const struct sockaddr *addr, socklen_t addr_len,
+			__u32 seq, __u32 flags, const __u8 *hdr, unsigned hdr_size,
+			const __u8 *data, unsigned size);
+bool v4l_stream_udp_refresh_requested(int fd);
+int v4l_stream_udp_send_refresh(int fd, const struct sockaddr *addr, socklen_t addr_len,
+				__u32 seq);
+void v4l_stream_udp_rx_init(struct v4l_stream_udp_rx *rx);
+void v4l_stream_udp_rx_free(struct v4l_stream_udp_rx *rx);
+int v4l_stream_udp_rx_add(struct v4l_stream_udp_rx *rx, const __u8 *dgram, unsigned len);
 
 #ifdef __cplusplus
 }
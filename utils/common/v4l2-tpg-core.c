@@ -8,6 +8,10 @@
  * Copyright 2014 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <pthread.h>
+#include <stddef.h>
+#include <unistd.h>
+
 #include "compiler.h"
 #include "v4l2-tpg-colors.h"
 
@@ -2576,34 +2580,41 @@ static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
 	}
 }
 
-void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
-			   unsigned p, u8 *vbuf)
+static void tpg_fill_params(const struct tpg_data *tpg, v4l2_std_id std,
+			    unsigned p, struct tpg_draw_params *params)
 {
-	struct tpg_draw_params params;
+	params->is_tv = std;
+	params->is_60hz = std & V4L2_STD_525_60;
+	params->twopixsize = tpg->twopixelsize[p];
+	params->img_width = tpg_hdiv(tpg, p, tpg->compose.width);
+	params->stride = tpg->bytesperline[p];
+	params->hmax = (tpg->compose.height * tpg->perc_fill) / 100;
+
+	tpg_fill_params_pattern(tpg, p, params);
+	tpg_fill_params_extras(tpg, p, params);
+}
+
+/*
+ * Fill compose lines [start, end). Each line only depends on the Bresenham
+ * state for that line, so disjoint line ranges can be filled concurrently.
+ */
+static void tpg_fill_plane_lines(const struct tpg_data *tpg,
+				 const struct tpg_draw_params *draw_params,
+				 unsigned p, u8 *vbuf, unsigned start, unsigned end)
+{
+	struct tpg_draw_params params = *draw_params;
 	unsigned factor = V4L2_FIELD_HAS_T_OR_B(tpg->field) ? 2 : 1;
 
 	/* Coarse scaling with Bresenham */
 	unsigned int_part = (tpg->crop.height / factor) / tpg->compose.height;
 	unsigned fract_part = (tpg->crop.height / factor) % tpg->compose.height;
-	unsigned src_y = 0;
-	unsigned error = 0;
+	unsigned src_y = start * int_part + (start * fract_part) / tpg->compose.height;
+	unsigned error = (start * fract_part) % tpg->compose.height;
 	unsigned h;
 
-	tpg_recalc(tpg);
-
-	params.is_tv = std;
-	params.is_60hz = std & V4L2_STD_525_60;
-	params.twopixsize = tpg->twopixelsize[p];
-	params.img_width = tpg_hdiv(tpg, p, tpg->compose.width);
-	params.stride = tpg->bytesperline[p];
-	params.hmax = (tpg->compose.height * tpg->perc_fill) / 100;
-
-	tpg_fill_params_pattern(tpg, p, &params);
-	tpg_fill_params_extras(tpg, p, &params);
-
 	vbuf += tpg_hdiv(tpg, p, tpg->compose.left);
 
-	for (h = 0; h < tpg->compose.height; h++) {
+	for (h = start; h < end; h++) {
 		unsigned buf_line;
 
 		params.frame_line = tpg_calc_frameline(tpg, src_y, tpg->field);
@@ -2659,6 +2670,16 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 	}
 }
 
+void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
+			   unsigned p, u8 *vbuf)
+{
+	struct tpg_draw_params params;
+
+	tpg_recalc(tpg);
+	tpg_fill_params(tpg, std, p, &params);
+	tpg_fill_plane_lines(tpg, &params, p, vbuf, 0, tpg->compose.height);
+}
+
 void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std, unsigned p, u8 *vbuf)
 {
 	unsigned offset = 0;
@@ -2674,3 +2695,342 @@ void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std, unsigned p, u8 *vbuf)
 		offset += tpg_calc_plane_size(tpg, i);
 	}
 }
+
+/*
+ * Line-parallel pattern generation
+ *
+ * The compose lines of a plane are split into one contiguous range per
+ * thread. The calling thread fills the first range itself, so a pool with
+ * N threads uses N - 1 worker threads.
+ */
+struct tpg_pool {
+	unsigned		threads;
+	pthread_t		*workers;
+	pthread_mutex_t		lock;
+	pthread_cond_t		work;
+	pthread_cond_t		done;
+	unsigned		generation;
+	unsigned		busy;
+	bool			quit;
+
+	/* the current job */
+	const struct tpg_data		*tpg;
+	const struct tpg_draw_params	*params;
+	unsigned			p;
+	u8				*vbuf;
+};
+
+struct tpg_pool_worker {
+	struct tpg_pool		*pool;
+	unsigned		idx;
+};
+
+static void tpg_pool_fill_range(struct tpg_pool *pool, unsigned idx)
+{
+	unsigned height = pool->tpg->compose.height;
+	unsigned start = (unsigned long long)height * idx / pool->threads;
+	unsigned end = (unsigned long long)height * (idx + 1) / pool->threads;
+
+	if (start < end)
+		tpg_fill_plane_lines(pool->tpg, pool->params, pool->p,
+				     pool->vbuf, start, end);
+}
+
+static void *tpg_pool_thread(void *arg)
+{
+	struct tpg_pool_worker *worker = arg;
+	struct tpg_pool *pool = worker->pool;
+	unsigned generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		tpg_pool_fill_range(pool, worker->idx);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	free(worker);
+	return NULL;
+}
+
+struct tpg_pool *tpg_pool_alloc(unsigned threads)
+{
+	struct tpg_pool *pool;
+	unsigned i;
+
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = cpus > 0 ? cpus : 1;
+	}
+	if (threads > TPG_POOL_MAX_THREADS)
+		threads = TPG_POOL_MAX_THREADS;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pool->workers = calloc(threads, sizeof(*pool->workers));
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->threads = 1;
+
+	for (i = 1; i < threads; i++) {
+		struct tpg_pool_worker *worker = malloc(sizeof(*worker));
+
+		if (!worker)
+			break;
+		worker->pool = pool;
+		worker->idx = i;
+		if (pthread_create(&pool->workers[i], NULL, tpg_pool_thread, worker)) {
+			free(worker);
+			break;
+		}
+		pool->threads++;
+	}
+	return pool;
+}
+
+void tpg_pool_free(struct tpg_pool *pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 1; i < pool->threads; i++)
+		pthread_join(pool->workers[i], NULL);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+unsigned tpg_pool_g_threads(const struct tpg_pool *pool)
+{
+	return pool ? pool->threads : 1;
+}
+
+void tpg_fill_plane_buffer_mt(struct tpg_data *tpg, struct tpg_pool *pool,
+			      v4l2_std_id std, unsigned p, u8 *vbuf)
+{
+	struct tpg_draw_params params;
+
+	if (!pool || pool->threads == 1) {
+		tpg_fill_plane_buffer(tpg, std, p, vbuf);
+		return;
+	}
+
+	tpg_recalc(tpg);
+	tpg_fill_params(tpg, std, p, &params);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->tpg = tpg;
+	pool->params = &params;
+	pool->p = p;
+	pool->vbuf = vbuf;
+	pool->busy = pool->threads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	tpg_pool_fill_range(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void tpg_fillbuffer_mt(struct tpg_data *tpg, struct tpg_pool *pool,
+		       v4l2_std_id std, unsigned p, u8 *vbuf)
+{
+	unsigned offset = 0;
+	unsigned i;
+
+	if (tpg->buffers > 1) {
+		tpg_fill_plane_buffer_mt(tpg, pool, std, p, vbuf);
+		return;
+	}
+
+	for (i = 0; i < tpg_g_planes(tpg); i++) {
+		tpg_fill_plane_buffer_mt(tpg, pool, std, i, vbuf + offset);
+		offset += tpg_calc_plane_size(tpg, i);
+	}
+}
+
+/*
+ * Frame cache for static patterns
+ *
+ * If the pattern does not move and contains no noise, then rendering it
+ * again with the same configuration gives the same bytes. Since rendering
+ * is already little more than copying precomputed lines, copying a cached
+ * frame would not be any faster. Instead the cache remembers which
+ * configuration each destination buffer was last filled with, and skips
+ * the fill if the buffer already contains that frame. For output streaming
+ * where the same buffers are queued again and again that means each buffer
+ * is filled only once.
+ *
+ * A configuration is a snapshot of the configuration part of struct tpg_data
+ * (everything before recalc_colors), the std and the plane. A few of them are
+ * kept so that e.g. alternating top and bottom fields both stay valid.
+ */
+#define TPG_CACHE_STATES	4
+#define TPG_CACHE_BUFS		(VIDEO_MAX_FRAME * TPG_MAX_PLANES)
+#define TPG_CACHE_STATE_SIZE	offsetof(struct tpg_data, recalc_colors)
+
+struct tpg_cache_state {
+	u8			state[TPG_CACHE_STATE_SIZE];
+	v4l2_std_id		std;
+	unsigned		p;
+	/* 0 means unused */
+	unsigned long		id;
+	unsigned long		last_used;
+};
+
+struct tpg_cache_buf {
+	const u8		*vbuf;
+	unsigned long		id;
+	unsigned long		last_used;
+};
+
+struct tpg_cache {
+	struct tpg_cache_state	states[TPG_CACHE_STATES];
+	struct tpg_cache_buf	bufs[TPG_CACHE_BUFS];
+	unsigned long		counter;
+	unsigned long		hits;
+	unsigned long		misses;
+};
+
+struct tpg_cache *tpg_cache_alloc(void)
+{
+	return calloc(1, sizeof(struct tpg_cache));
+}
+
+void tpg_cache_free(struct tpg_cache *cache)
+{
+	free(cache);
+}
+
+void tpg_cache_invalidate(struct tpg_cache *cache)
+{
+	if (!cache)
+		return;
+	memset(cache->bufs, 0, sizeof(cache->bufs));
+}
+
+void tpg_cache_g_stats(const struct tpg_cache *cache,
+		       unsigned long *hits, unsigned long *misses)
+{
+	*hits = cache ? cache->hits : 0;
+	*misses = cache ? cache->misses : 0;
+}
+
+/* Return the id of the current configuration, adding it if it is new */
+static unsigned long tpg_cache_state_id(struct tpg_cache *cache,
+					const struct tpg_data *tpg,
+					v4l2_std_id std, unsigned p)
+{
+	struct tpg_cache_state *lru = &cache->states[0];
+	unsigned i;
+
+	for (i = 0; i < TPG_CACHE_STATES; i++) {
+		struct tpg_cache_state *s = &cache->states[i];
+
+		if (s->id && s->std == std && s->p == p &&
+		    !memcmp(s->state, tpg, TPG_CACHE_STATE_SIZE)) {
+			s->last_used = cache->counter;
+			return s->id;
+		}
+		if (s->last_used < lru->last_used)
+			lru = s;
+	}
+	/*
+	 * Ids are never reused, so buffers that were filled with the
+	 * evicted configuration no longer match anything.
+	 */
+	memcpy(lru->state, tpg, TPG_CACHE_STATE_SIZE);
+	lru->std = std;
+	lru->p = p;
+	lru->id = cache->counter;
+	lru->last_used = cache->counter;
+	return lru->id;
+}
+
+void tpg_fill_plane_buffer_cached(struct tpg_data *tpg, struct tpg_cache *cache,
+				  struct tpg_pool *pool, v4l2_std_id std,
+				  unsigned p, u8 *vbuf)
+{
+	struct tpg_cache_buf *lru;
+	struct tpg_cache_buf *b;
+	unsigned long id;
+	unsigned i;
+
+	if (!cache || !tpg_pattern_is_static(tpg) ||
+	    tpg->qual == TPG_QUAL_NOISE) {
+		tpg_fill_plane_buffer_mt(tpg, pool, std, p, vbuf);
+		return;
+	}
+
+	/* Apply pending changes first so the snapshot is up to date */
+	tpg_recalc(tpg);
+	cache->counter++;
+	id = tpg_cache_state_id(cache, tpg, std, p);
+
+	lru = &cache->bufs[0];
+	for (i = 0; i < TPG_CACHE_BUFS; i++) {
+		b = &cache->bufs[i];
+		if (b->id && b->vbuf == vbuf)
+			break;
+		if (b->last_used < lru->last_used)
+			lru = b;
+	}
+	if (i == TPG_CACHE_BUFS) {
+		b = lru;
+		b->vbuf = vbuf;
+		b->id = 0;
+	}
+	b->last_used = cache->counter;
+	if (b->id == id) {
+		cache->hits++;
+		return;
+	}
+	cache->misses++;
+	tpg_fill_plane_buffer_mt(tpg, pool, std, p, vbuf);
+	b->id = id;
+}
+
+void tpg_fillbuffer_cached(struct tpg_data *tpg, struct tpg_cache *cache,
+			   struct tpg_pool *pool, v4l2_std_id std,
+			   unsigned p, u8 *vbuf)
+{
+	unsigned offset = 0;
+	unsigned i;
+
+	if (tpg->buffers > 1) {
+		tpg_fill_plane_buffer_cached(tpg, cache, pool, std, p, vbuf);
+		return;
+	}
+
+	for (i = 0; i < tpg_g_planes(tpg); i++) {
+		tpg_fill_plane_buffer_cached(tpg, cache, pool, std, i, vbuf + offset);
+		offset += tpg_calc_plane_size(tpg, i);
+	}
+}
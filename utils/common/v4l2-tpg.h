@@ -296,6 +296,40 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 			   unsigned p, u8 *vbuf);
 void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std,
 		    unsigned p, u8 *vbuf);
+
+/* Line-parallel pattern generation using a pool of threads */
+#define TPG_POOL_MAX_THREADS 64
+
+struct tpg_pool;
+
+struct tpg_pool *tpg_pool_alloc(unsigned threads);
+void tpg_pool_free(struct tpg_pool *pool);
+unsigned tpg_pool_g_threads(const struct tpg_pool *pool);
+void tpg_fill_plane_buffer_mt(struct tpg_data *tpg, struct tpg_pool *pool,
+			      v4l2_std_id std, unsigned p, u8 *vbuf);
+void tpg_fillbuffer_mt(struct tpg_data *tpg, struct tpg_pool *pool,
+		       v4l2_std_id std, unsigned p, u8 *vbuf);
+
+/*
+ * Frame cache for static patterns: the fill is skipped if the buffer was
+ * already filled with the current configuration. Callers that modify the
+ * buffer contents themselves or reallocate their buffers must call
+ * tpg_cache_invalidate().
+ */
+struct tpg_cache;
+
+struct tpg_cache *tpg_cache_alloc(void);
+void tpg_cache_free(struct tpg_cache *cache);
+void tpg_cache_invalidate(struct tpg_cache *cache);
+void tpg_cache_g_stats(const struct tpg_cache *cache,
+		       unsigned long *hits, unsigned long *misses);
+void tpg_fill_plane_buffer_cached(struct tpg_data *tpg, struct tpg_cache *cache,
+				  struct tpg_pool *pool, v4l2_std_id std,
+				  unsigned p, u8 *vbuf);
+void tpg_fillbuffer_cached(struct tpg_data *tpg, struct tpg_cache *cache,
+			   struct tpg_pool *pool, v4l2_std_id std,
+			   unsigned p, u8 *vbuf);
+
 bool tpg_s_fourcc(struct tpg_data *tpg, u32 fourcc);
 void tpg_s_crop_compose(struct tpg_data *tpg, const struct v4l2_rect *crop,
 		const struct v4l2_rect *compose);
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <argp.h>
 
@@ -99,11 +100,83 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	return 0;
 }
 
+static int write_entry(struct dvb_entry *entry, void *priv)
+{
+	return dvb_write_file_entry(priv, entry);
+}
+
+/*
+ * DVBv5 to DVBv5 conversion doesn't need the whole file in memory, so
+ * write each entry as soon as it is read. The entries are written to a
+ * temporary file that replaces the output one at the end, as the output
+ * may be the input file itself, and as an error should not lose it.
+ */
+static int stream_file(struct arguments *args)
+{
+	char *tmp_fname;
+	mode_t mask;
+	FILE *fp;
+	int fd, ret;
+
+	printf(_("Reading file %s\n"), args->input_file);
+	printf(_("Writing file %s\n"), args->output_file);
+
+	if (asprintf(&tmp_fname, "%s.XXXXXX", args->output_file) < 0)
+		return -ENOMEM;
+	fd = mkstemp(tmp_fname);
+	if (fd < 0 || !(fp = fdopen(fd, "w"))) {
+		ret = -errno;
+		perror(args->output_file);
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_fname);
+		}
+		free(tmp_fname);
+		return ret;
+	}
+
+	/* Same permissions as a file created by fopen() */
+	mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
+
+	ret = dvb_read_file_foreach(args->input_file, write_entry, fp);
+	if (fclose(fp) && !ret)
+		ret = -errno;
+	if (!ret && rename(tmp_fname, args->output_file)) {
+		ret = -errno;
+		perror(args->output_file);
+	}
+	if (ret) {
+		unlink(tmp_fname);
+		fprintf(stderr, _("Error converting file %s\n"),
+			args->input_file);
+	}
+	free(tmp_fname);
+
+	return ret;
+}
+
+/* Only a regular file can be replaced by the temporary one */
+static int can_stream(struct arguments *args)
+{
+	struct stat st;
+
+	if (args->input_format != FILE_DVBV5 ||
+	    args->output_format != FILE_DVBV5)
+		return 0;
+
+	return stat(args->output_file, &st) ? errno == ENOENT : S_ISREG(st.st_mode);
+}
+
 static int convert_file(struct arguments *args)
 {
 	struct dvb_file *dvb_file = NULL;
 	int ret;
 
+	if (can_stream(args))
+		return stream_file(args);
+
 	printf(_("Reading file %s\n"), args->input_file);
 
 	dvb_file = dvb_read_file_format(args->input_file, args->delsys,
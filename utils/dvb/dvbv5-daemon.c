@@ -54,6 +54,7 @@
 #include "../../lib/libdvbv5/dvb-dev-priv.h"
 #include "libdvbv5/dvb-file.h"
 #include "libdvbv5/dvb-dev.h"
+#include "libdvbv5/dvb-fe-monitor.h"
 
 #ifdef ENABLE_NLS
 # define _(string) gettext(string)
@@ -81,6 +82,15 @@ const char *argp_program_bug_address = "Mauro Carvalho Chehab <mchehab@kernel.or
 
 #define CMD_SIZE	80
 
+/*
+ * Maximum data sent on a data_read message: the client stores the whole
+ * message, header included, on a REMOTE_BUF_SIZE buffer
+ */
+#define DATA_READ_SIZE	(REMOTE_BUF_SIZE - 188)
+
+/* Number of DVR buffers of DATA_READ_SIZE. The Kernel may give less */
+#define STREAM_BUF_COUNT	64
+
 static const char doc[] = N_(
 	"\nA DVB remote daemon using API version 5\n");
 
@@ -204,6 +214,7 @@ static pthread_t read_id = 0;
 struct dvb_descriptors {
 	int uid;
 	struct dvb_open_descriptor *open_dev;
+	int stream;
 };
 
 static struct dvb_device *dvb = NULL;
@@ -248,7 +259,7 @@ static int dvb_desc_compare(const void *__a, const void *__b)
 	return (b->uid - a->uid);
 }
 
-static struct dvb_open_descriptor *get_open_dev(int uid)
+static struct dvb_descriptors *get_desc(int uid)
 {
 	struct dvb_descriptors desc, **p;
 
@@ -263,7 +274,17 @@ static struct dvb_open_descriptor *get_open_dev(int uid)
 		return NULL;
 	}
 
-	return (*p)->open_dev;
+	return *p;
+}
+
+static struct dvb_open_descriptor *get_open_dev(int uid)
+{
+	struct dvb_descriptors *desc = get_desc(uid);
+
+	if (!desc)
+		return NULL;
+
+	return desc->open_dev;
 }
 
 static void destroy_open_dev(int uid)
@@ -457,6 +478,46 @@ static int send_buf(int fd, const char *buf, size_t size)
 	return ret;
 }
 
+/*
+ * Sends a "data_read" message. The data is sent from where it is, in
+ * order to avoid copying the DVR buffers.
+ */
+static int send_data_read(int fd, int uid, int read_ret,
+			  const void *data, size_t len)
+{
+	char buf[64];
+	int ret, size;
+	int32_t i32;
+
+	if (fd < 0)
+		return ECONNRESET;
+
+	size = prepare_data(buf, sizeof(buf), "%i%s%i%i", 0, "data_read",
+			    read_ret, uid);
+	if (size < 0) {
+		err("Failed to prepare answer to dvb_read()");
+		return -1;
+	}
+
+	pthread_mutex_lock(&msg_mutex);
+	i32 = htobe32(size + len);
+	ret = send(fd, (void *)&i32, 4, MSG_MORE);
+	if (ret >= 0)
+		ret = send(fd, buf, size, len ? MSG_MORE : 0);
+	if (ret >= 0 && len)
+		ret = send(fd, data, len, 0);
+	pthread_mutex_unlock(&msg_mutex);
+	if (ret < 0) {
+		local_perror("write");
+		if (ret == ECONNRESET)
+			close_all_devs();
+
+		return errno;
+	}
+
+	return ret;
+}
+
 static ssize_t send_data(int fd, const char *fmt, ...)
 	__attribute__ (( format( printf, 2, 3 )));
 
@@ -537,7 +598,7 @@ static ssize_t scan_data(char *buf, int buf_size, const char *fmt, ...)
 			}
 			u64 = va_arg(ap, uint64_t *);
 
-			*u64 = be32toh(*(uint64_t *)p);
+			*u64 = be64toh(*(uint64_t *)p);
 			p += 8;
 			break;
 		default:
@@ -671,15 +732,48 @@ error:
 	return send_data(fd, "%i%s%i", seq, cmd, ret);
 }
 
+/*
+ * Relays a buffer filled by a DVR. A buffer bigger than a message is split.
+ */
+static int relay_stream(struct dvb_open_descriptor *open_dev, int uid)
+{
+	struct dvb_dev_buffer dbuf;
+	size_t pos, len;
+	int ret;
+
+	ret = dvb_dev_stream_get(open_dev, &dbuf);
+	if (verbose) {
+		if (ret < 0)
+			dbg("#%d: stream error: %d on %p", uid, ret, open_dev);
+		else
+			dbg("#%d: buffer %u with %zu bytes", uid, dbuf.index, dbuf.len);
+	}
+	if (ret < 0)
+		return send_data_read(dvb_fd, uid, ret, NULL, 0);
+
+	for (pos = 0; pos < dbuf.len; pos += len) {
+		len = dbuf.len - pos;
+		if (len > DATA_READ_SIZE)
+			len = DATA_READ_SIZE;
+
+		ret = send_data_read(dvb_fd, uid, len,
+				     (const char *)dbuf.data + pos, len);
+		if (ret == ECONNRESET)
+			break;
+	}
+
+	dvb_dev_stream_put(open_dev, &dbuf);
+
+	return ret;
+}
+
 static void *read_data(void *privdata)
 {
+	struct dvb_descriptors *desc;
 	struct dvb_open_descriptor *open_dev;
 	int timeout;
 	int ret, read_ret = -1, fd, i;
-	char databuf[REMOTE_BUF_SIZE];
-	char buf[REMOTE_BUF_SIZE + 32], *p;
-	size_t size;
-	size_t count;
+	char databuf[DATA_READ_SIZE];
 	struct pollfd __fds[NUM_FOPEN];
 	nfds_t __numfds;
 
@@ -721,46 +815,29 @@ static void *read_data(void *privdata)
 		if (!desc_root)
 			break;
 
-		open_dev = get_open_dev(fd);
-		if (!open_dev) {
+		desc = get_desc(fd);
+		if (!desc) {
 			err("Couldn't find opened file %d", fd);
 			continue;
 		}
-
-		count = REMOTE_BUF_SIZE;
-		read_ret = dvb_dev_read(open_dev, databuf, count);
-		if (verbose) {
-			if (read_ret < 0)
-				dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
-			else
-				dbg("#%d: read %ul bytes (count %d)", fd, read_ret, count);
-		}
-
-		/* Initialize to the start of the buffer */
-		p = buf;
-		size = sizeof(buf);
-
-		ret = prepare_data(p, size, "%i%s%i%i", 0, "data_read",
-				   read_ret, fd);
-		if (ret < 0) {
-			err("Failed to prepare answer to dvb_read()");
-			break;
-		}
-
-		p += ret;
-		size -= ret;
-
-		if (read_ret > 0) {
-			if (read_ret > size) {
-				dbg("buffer to short to store read data!");
-				read_ret = -EOVERFLOW;
-			} else {
-				memcpy(p, databuf, read_ret);
-				p += read_ret;
+		open_dev = desc->open_dev;
+
+		if (desc->stream) {
+			ret = relay_stream(open_dev, fd);
+		} else {
+			read_ret = dvb_dev_read(open_dev, databuf,
+						sizeof(databuf));
+			if (verbose) {
+				if (read_ret < 0)
+					dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
+				else
+					dbg("#%d: read %d bytes (count %zu)", fd, read_ret,
+					    sizeof(databuf));
 			}
-		}
 
-		ret = send_buf(dvb_fd, buf, p - buf);
+			ret = send_data_read(dvb_fd, fd, read_ret, databuf,
+					     read_ret > 0 ? read_ret : 0);
+		}
 		if (ret < 0) {
 			err("Error %d sending buffer\n", ret);
 			if (ret == ECONNRESET) {
@@ -815,6 +892,19 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 		dbg("open dev handler for %s: %p with uid#%d", sysname, open_dev, open_dev->fd);
 
 	dev = open_dev->dev;
+
+	/*
+	 * The DVR is relayed from its buffers, in order to avoid copying
+	 * the whole Transport Stream. The demux is kept on read(), as each
+	 * read() there returns a single section.
+	 *
+	 * The Kernel only returns full buffers, so each one is sized to fit
+	 * on a single message. Bigger ones would be relayed in bursts.
+	 */
+	if (dev->dvb_type == DVB_DEVICE_DVR)
+		desc->stream = dvb_dev_stream_start(open_dev, STREAM_BUF_COUNT,
+						    DATA_READ_SIZE) >= 0;
+
 	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
 	    dev->dvb_type == DVB_DEVICE_DVR) {
 		pthread_mutex_lock(&dvb_read_mutex);
@@ -1301,6 +1391,111 @@ error:
 	return send_data(fd, "%i%s%i", seq, cmd, ret);
 }
 
+/*
+ * Each monitor sample is sent as %lu%i%lu. Keep room for the reply header.
+ */
+#define MONITOR_SAMPLE_SIZE	(8 + 4 + 8)
+#define MONITOR_MAX_SAMPLES	((REMOTE_BUF_SIZE - CMD_SIZE - 16) / \
+				 MONITOR_SAMPLE_SIZE)
+
+static int dev_fe_monitor_start(uint32_t seq, char *cmd, int fd,
+				char *buf, ssize_t size)
+{
+	uint32_t cmds[32];
+	int period, history, n_cmds, i, ret;
+
+	if (verbose)
+		dbg("dev_fe_monitor_start called");
+
+	ret = scan_data(buf, size, "%i%i%i", &period, &history, &n_cmds);
+	if (ret < 0)
+		goto error;
+
+	buf += ret;
+	size -= ret;
+
+	if (period <= 0 || history <= 0 || n_cmds <= 0 ||
+	    n_cmds > ARRAY_SIZE(cmds)) {
+		ret = -EINVAL;
+		goto error;
+	}
+
+	for (i = 0; i < n_cmds; i++) {
+		ret = scan_data(buf, size, "%i", &cmds[i]);
+		if (ret < 0)
+			goto error;
+
+		buf += ret;
+		size -= ret;
+	}
+
+	ret = dvb_dev_fe_monitor_start(dvb, period, cmds, n_cmds, history);
+error:
+	return send_data(fd, "%i%s%i", seq, cmd, ret);
+}
+
+static int dev_fe_monitor_get(uint32_t seq, char *cmd, int fd,
+			      char *inbuf, ssize_t insize)
+{
+	struct dvb_fe_monitor_sample samples[MONITOR_MAX_SAMPLES];
+	int stat, layer, max, n, ret, i;
+	char buf[REMOTE_BUF_SIZE], *p = buf;
+	size_t size = sizeof(buf);
+
+	if (verbose)
+		dbg("dev_fe_monitor_get called");
+
+	ret = scan_data(inbuf, insize, "%i%i%i", &stat, &layer, &max);
+	if (ret < 0)
+		goto error;
+
+	if (max < 0 || max > MONITOR_MAX_SAMPLES)
+		max = MONITOR_MAX_SAMPLES;
+
+	ret = dvb_dev_fe_monitor_get(dvb, stat, layer, samples, max);
+	if (ret < 0)
+		goto error;
+	n = ret;
+
+	ret = prepare_data(p, size, "%i%s%i", seq, cmd, n);
+	if (ret < 0)
+		goto error;
+
+	p += ret;
+	size -= ret;
+
+	for (i = 0; i < n; i++) {
+#pragma GCC diagnostic ignored "-Wformat"
+		ret = prepare_data(p, size, "%lu%i%lu",
+				   samples[i].timestamp,
+				   samples[i].scale,
+				   samples[i].uvalue);
+#pragma GCC diagnostic pop
+		if (ret < 0)
+			goto error;
+
+		p += ret;
+		size -= ret;
+	}
+
+	return send_buf(fd, buf, p - buf);
+error:
+	return send_data(fd, "%i%s%i", seq, cmd, ret);
+}
+
+static int dev_fe_monitor_stop(uint32_t seq, char *cmd, int fd,
+			       char *buf, ssize_t size)
+{
+	int ret;
+
+	if (verbose)
+		dbg("dev_fe_monitor_stop called");
+
+	ret = dvb_dev_fe_monitor_stop(dvb);
+
+	return send_data(fd, "%i%s%i", seq, cmd, ret);
+}
+
 /*
  * Structure with all methods with RPC calls
  */
@@ -1334,6 +1529,9 @@ static const struct method_types methods[] = {
 	{"fe_get_parms", &dev_get_parms, 0},
 	{"fe_set_parms", &dev_set_parms, 0},
 	{"fe_get_stats", &dev_get_stats, 0},
+	{"fe_monitor_start", &dev_fe_monitor_start, 0},
+	{"fe_monitor_get", &dev_fe_monitor_get, 0},
+	{"fe_monitor_stop", &dev_fe_monitor_stop, 0},
 
 	{}
 };
@@ -555,6 +555,9 @@ int main(int argc, char **argv)
 	if (err < 0)
 		fprintf(stderr, _("Failed to set the country code:%s\n"), args.cc);
 
+	/* Consecutive transponders often share the LNBf and switch setup */
+	dvb_fe_set_tune_cache(parms, 1);
+
 	timeout_flag = &parms->abort;
 	signal(SIGTERM, do_timeout);
 	signal(SIGINT, do_timeout);
@@ -38,6 +38,13 @@
  */
 #define BUFLEN (188 * 512)
 
+/*
+ * The recording ring is made of blocks that are multiple of both the
+ * TS packet size and of the 4096 bytes alignment needed by O_DIRECT.
+ */
+#define REC_BLOCK_SIZE	(188 * 4096)
+#define REC_RING_SIZE	64	/* MBytes */
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,11 +53,17 @@
 #include <errno.h>
 #include <signal.h>
 #include <argp.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <time.h>
 
 #include <config.h>
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #ifdef ENABLE_NLS
 # define _(string) gettext(string)
 # include "gettext.h"
@@ -70,6 +83,7 @@
 #include "libdvbv5/dvb-scan.h"
 #include "libdvbv5/header.h"
 #include "libdvbv5/countries.h"
+#include "libdvbv5/dvb-ts-analyzer.h"
 
 #define CHANNEL_FILE	"channels.conf"
 #define PROGRAM_NAME	"dvbv5-zap"
@@ -94,8 +108,9 @@ struct arguments {
 	unsigned timeout, dvr, rec_psi, exit_after_tuning;
 	unsigned n_apid, n_vpid, all_pids;
 	enum dvb_file_formats input_format, output_format;
-	unsigned traffic_monitor, low_traffic, non_human, port;
-	char *search, *server;
+	unsigned traffic_monitor, low_traffic, non_human, port, analyze;
+	unsigned rec_buffer, direct_io, preallocate, mmap;
+	char *search, *server, *replay;
 	const char *cc;
 
 	/* Used by status print */
@@ -115,8 +130,13 @@ static const struct argp_option options[] = {
 	{"monitor",	'm', NULL,			0, N_("monitors the DVB traffic"), 0},
 	{"output",	'o', N_("file"),		0, N_("output filename (use -o - for stdout)"), 0},
 	{"pat",		'p', NULL,			0, N_("add pat and pmt to TS recording (implies -r)"), 0},
+	{"rec-buffer",	'B', N_("MBytes"),		0, N_("size of the recording buffer (default 64 MBytes)"), 0},
+	{"direct-io",	'O', NULL,			0, N_("write the recording with O_DIRECT, bypassing the page cache"), 0},
+	{"preallocate",	'F', N_("MBytes"),		0, N_("preallocate the disk space for the recording"), 0},
+	{"mmap",	'M', NULL,			0, N_("record from memory-mapped DVR buffers, if the Kernel supports them"), 0},
 	{"all-pids",	'P', NULL,			0, N_("don't filter any pids. Instead, outputs all of them"), 0 },
 	{"record",	'r', NULL,			0, N_("set up /dev/dvb/adapterX/dvr0 for TS recording"), 0},
+	{"replay",	'R', N_("file"),		0, N_("analyzes a recorded TS file instead of tuning (implies --analyze)"), 0},
 	{"silence",	's', NULL,			0, N_("increases silence (can be used more than once)"), 0},
 	{"sat_number",	'S', N_("satellite_number"),	0, N_("satellite number. If not specified, disable DISEqC"), 0},
 	{"timeout",	't', N_("seconds"),		0, N_("timeout for zapping and for recording"), 0},
@@ -125,6 +145,7 @@ static const struct argp_option options[] = {
 	{"video_pid",	'V', N_("video_pid#"),		0, N_("video pid program to use (default 0)"), 0},
 	{"wait",	'W', N_("time"),		0, N_("adds additional wait time for DISEqC command completion"), 0},
 	{"exit",	'x', NULL,			0, N_("exit after tuning"), 0},
+	{"analyze",	'y', NULL,			0, N_("analyzes the TS: TR 101 290 checks, PCR jitter and bitrates (implies -m)"), 0},
 	{"low_traffic",	'X', N_("packets_per_sec"),	0, N_("sets DVB low traffic threshold. PIDs with less than this amount of packets per second will be ignored. Default: 1 packet per second"), 0},
 	{"cc",		'C', N_("country_code"),	0, N_("Set the default country to be used (in ISO 3166-1 two letter code)"), 0},
 	{"non-numan",	'N', NULL,			0, N_("Non-human formatted stats (useful for scripts)"), 0},
@@ -202,6 +223,10 @@ static int parse(struct arguments *args,
 	if (!dvb_file)
 		return -2;
 
+	/*
+	 * A single channel is looked up, so just walk the entries, instead
+	 * of building a struct dvb_file_index
+	 */
 	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
 		if (entry->channel && !strcmp(entry->channel, channel))
 			break;
@@ -231,12 +256,11 @@ static int parse(struct arguments *args,
 		uint32_t f, freq = atoi(channel);
 		if (freq) {
 			for (entry = dvb_file->first_entry; entry != NULL;
-			entry = entry->next) {
-				dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &f);
-				if (f == freq)
+			     entry = entry->next) {
+				if (!dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &f) &&
+				    f == freq)
 					break;
 			}
-
 		}
 	}
 
@@ -615,6 +639,398 @@ static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 	}
 }
 
+#ifdef HAVE_PTHREAD
+/*
+ * Recording engine: the main thread reads the DVR into a ring of blocks,
+ * while another thread writes them to disk, so a disk stall doesn't stop
+ * the DVR from being read. If the ring fills up, the data is discarded
+ * here, where it can be accounted, instead of overflowing the DVR buffer.
+ *
+ * When the Kernel can map the DVR buffers, they are used as the ring
+ * instead, and the data is written straight from them.
+ */
+struct recorder {
+	int out_fd, done;
+
+	struct dvb_open_descriptor *in_fd;
+	struct dvb_dev_buffer *bufs;
+
+	unsigned char *ring;
+	size_t *len;
+	unsigned n_blocks;
+	unsigned long long head, tail;	/* blocks read / written */
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* counters */
+	long long bytes, dropped;
+	unsigned overruns, discontinuities, max_used;
+	double max_latency;
+	int error;
+};
+
+static void *rec_writer(void *privdata)
+{
+	struct recorder *rec = privdata;
+	struct timespec start, end;
+	unsigned char *buf;
+	size_t len, pos;
+	ssize_t r;
+	double latency;
+
+	pthread_mutex_lock(&rec->lock);
+	while (1) {
+		while (rec->tail == rec->head && !rec->done)
+			pthread_cond_wait(&rec->cond, &rec->lock);
+		if (rec->tail == rec->head)
+			break;
+
+		if (rec->bufs) {
+			buf = (unsigned char *)rec->bufs[rec->tail % rec->n_blocks].data;
+			len = rec->bufs[rec->tail % rec->n_blocks].len;
+		} else {
+			buf = &rec->ring[(rec->tail % rec->n_blocks) * REC_BLOCK_SIZE];
+			len = rec->len[rec->tail % rec->n_blocks];
+		}
+		pthread_mutex_unlock(&rec->lock);
+
+		/*
+		 * O_DIRECT can't write a block that isn't full, nor the ones
+		 * after it, as the file offset would be misaligned
+		 */
+		if (len % 4096)
+			fcntl(rec->out_fd, F_SETFL,
+			      fcntl(rec->out_fd, F_GETFL) & ~O_DIRECT);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (pos = 0; pos < len; pos += r) {
+			r = write(rec->out_fd, buf + pos, len - pos);
+			if (r < 0) {
+				if (errno == EINTR) {
+					r = 0;
+					continue;
+				}
+				PERROR(_("Write failed"));
+				break;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (rec->bufs)
+			dvb_dev_stream_put(rec->in_fd,
+					   &rec->bufs[rec->tail % rec->n_blocks]);
+
+		latency = end.tv_sec - start.tv_sec +
+			  (end.tv_nsec - start.tv_nsec) * 1. / NANO_SECONDS_IN_SEC;
+
+		pthread_mutex_lock(&rec->lock);
+		if (pos < len) {
+			rec->error = 1;
+			break;
+		}
+		if (latency > rec->max_latency)
+			rec->max_latency = latency;
+		rec->tail++;
+	}
+	pthread_mutex_unlock(&rec->lock);
+
+	return NULL;
+}
+
+static void rec_setup_output(struct arguments *args, int out_fd)
+{
+	struct stat st;
+	int flags;
+
+	/* Pipes, like stdout or the DVR pipe, are written as-is */
+	if (fstat(out_fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (args->preallocate &&
+	    fallocate(out_fd, FALLOC_FL_KEEP_SIZE, 0,
+		      (off_t)args->preallocate * 1024 * 1024) < 0 &&
+	    args->silent < 2)
+		PERROR(_("Can't preallocate the output file"));
+
+	if (args->direct_io) {
+		flags = fcntl(out_fd, F_GETFL);
+		if ((flags < 0 || fcntl(out_fd, F_SETFL, flags | O_DIRECT) < 0) &&
+		    args->silent < 2)
+			PERROR(_("Can't use O_DIRECT on the output file"));
+	}
+}
+
+static void rec_report(struct arguments *args, struct recorder *rec)
+{
+	if (args->silent >= 2)
+		return;
+
+	if (args->timeout)
+		fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"),
+			rec->bytes, rec->bytes / (1024 * args->timeout));
+	else
+		fprintf(stderr, _("received %lld bytes\n"), rec->bytes);
+
+	fprintf(stderr, _("recording buffer: %u%% max usage, max write latency %.3f s\n"),
+		rec->max_used * 100 / rec->n_blocks, rec->max_latency);
+	if (rec->overruns)
+		fprintf(stderr, _("%u DVR buffer overruns\n"), rec->overruns);
+	if (rec->discontinuities)
+		fprintf(stderr, _("%u DVR buffers with discontinuities\n"),
+			rec->discontinuities);
+	if (rec->dropped)
+		fprintf(stderr, _("%lld bytes dropped, as the disk was too slow\n"),
+			rec->dropped);
+}
+
+/*
+ * Zero-copy variant: the buffers dequeued from the DVR are given to the
+ * writer, which queues them back after writing. If the disk is too slow,
+ * the Kernel runs out of buffers and flags the discontinuity.
+ *
+ * The Kernel only dequeues full buffers, so the data at the buffer that
+ * is being filled when the recording stops is lost. That's why the
+ * buffers are DVB_DEV_STREAM_SIZE, and not REC_BLOCK_SIZE.
+ */
+static void record_mapped(struct arguments *args, struct recorder *rec)
+{
+	struct pollfd pfd = { .fd = dvb_dev_get_fd(rec->in_fd), .events = POLLIN };
+	struct timespec start, *elapsed;
+	struct dvb_dev_buffer buf;
+	unsigned long long used;
+	pthread_t writer;
+	int r;
+
+	if (pthread_create(&writer, NULL, rec_writer, rec)) {
+		PERROR(_("pthread_create failed"));
+		return;
+	}
+
+	/*
+	 * Unlike copy_to_file(), the timeout starts now, as filling the
+	 * first buffer may take long on a low bitrate stream
+	 */
+	if (args->timeout > 0)
+		alarm(args->timeout);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (timeout_flag == 0) {
+		/* Wake up once in a while, as the stream may stall */
+		r = poll(&pfd, 1, 1000);
+		if (r < 0 && errno != EINTR) {
+			PERROR(_("poll failed"));
+			break;
+		}
+		if (r <= 0)
+			continue;
+
+		r = dvb_dev_stream_get(rec->in_fd, &buf);
+		if (r < 0) {
+			if (r == -EINTR || r == -EAGAIN)
+				continue;
+			if (r == -EOVERFLOW) {
+				rec->overruns++;
+				elapsed = elapsed_time(&start);
+				if (!elapsed)
+					fprintf(stderr, _("buffer overrun at %lld\n"), rec->bytes);
+				else
+					fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
+						(long long)elapsed->tv_sec,
+						elapsed->tv_nsec / 10000000);
+				continue;
+			}
+			ERROR("Read failed");
+			break;
+		}
+
+		rec->bytes += buf.len;
+		if (buf.flags & (DMX_BUFFER_FLAG_DISCONTINUITY_DETECTED |
+				 DMX_BUFFER_PKT_COUNTER_MISMATCH))
+			rec->discontinuities++;
+
+		/* There are never more dequeued buffers than n_blocks */
+		pthread_mutex_lock(&rec->lock);
+		rec->bufs[rec->head % rec->n_blocks] = buf;
+		rec->head++;
+		pthread_cond_signal(&rec->cond);
+
+		used = rec->head - rec->tail;
+		if (used > rec->max_used)
+			rec->max_used = used;
+		if (rec->error) {
+			pthread_mutex_unlock(&rec->lock);
+			break;
+		}
+		pthread_mutex_unlock(&rec->lock);
+	}
+
+	pthread_mutex_lock(&rec->lock);
+	rec->done = 1;
+	pthread_cond_signal(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+
+	pthread_join(writer, NULL);
+
+	rec_report(args, rec);
+}
+
+static void record_to_file(struct arguments *args,
+			   struct dvb_open_descriptor *in_fd, int out_fd)
+{
+	struct recorder rec = { .out_fd = out_fd, .in_fd = in_fd };
+	struct timespec start, *elapsed;
+	unsigned char *block, discard[BUFLEN];
+	unsigned long long used;
+	unsigned map_bufs;
+	size_t fill = 0;
+	pthread_t writer;
+	int r, first = 1;
+
+	rec.n_blocks = (args->rec_buffer ? args->rec_buffer : REC_RING_SIZE) *
+		       1024 * 1024 / REC_BLOCK_SIZE;
+	if (rec.n_blocks < 2)
+		rec.n_blocks = 2;
+
+	rec_setup_output(args, out_fd);
+
+	/* The Kernel may give less buffers than that */
+	map_bufs = rec.n_blocks * (REC_BLOCK_SIZE / DVB_DEV_STREAM_SIZE);
+	rec.bufs = args->mmap ? calloc(map_bufs, sizeof(*rec.bufs)) : NULL;
+	if (rec.bufs) {
+		r = dvb_dev_stream_start(in_fd, map_bufs, DVB_DEV_STREAM_SIZE);
+		if (r > 0) {
+			if (r < map_bufs && args->silent < 2)
+				fprintf(stderr, _("recording buffer reduced to %u KBytes of memory-mapped buffers\n"),
+					r * (DVB_DEV_STREAM_SIZE / 1024));
+			rec.n_blocks = r;
+			pthread_mutex_init(&rec.lock, NULL);
+			pthread_cond_init(&rec.cond, NULL);
+
+			record_mapped(args, &rec);
+
+			pthread_cond_destroy(&rec.cond);
+			pthread_mutex_destroy(&rec.lock);
+			free(rec.bufs);
+			return;
+		}
+		free(rec.bufs);
+		rec.bufs = NULL;
+	}
+
+	rec.len = calloc(rec.n_blocks, sizeof(*rec.len));
+	if (!rec.len ||
+	    posix_memalign((void **)&rec.ring, 4096,
+			   (size_t)rec.n_blocks * REC_BLOCK_SIZE)) {
+		free(rec.len);
+		ERROR("not enough memory for the recording buffer. Recording without it");
+		copy_to_file(in_fd, out_fd, args->timeout, args->silent);
+		return;
+	}
+
+	pthread_mutex_init(&rec.lock, NULL);
+	pthread_cond_init(&rec.cond, NULL);
+
+	dvb_dev_set_bufsize(in_fd, DVB_BUF_SIZE);
+
+	if (pthread_create(&writer, NULL, rec_writer, &rec)) {
+		PERROR(_("pthread_create failed. Recording without a buffer"));
+		copy_to_file(in_fd, out_fd, args->timeout, args->silent);
+		goto err;
+	}
+
+	/* Initialize start time, due to -EOVERFLOW with first == 1 */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	block = rec.ring;
+	while (timeout_flag == 0) {
+		r = dvb_dev_read(in_fd, block ? block + fill : discard,
+				 block ? REC_BLOCK_SIZE - fill : sizeof(discard));
+		if (r < 0) {
+			if (r == -EOVERFLOW) {
+				rec.overruns++;
+				elapsed = elapsed_time(&start);
+				if (!elapsed)
+					fprintf(stderr, _("buffer overrun at %lld\n"), rec.bytes);
+				else
+					fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
+						(long long)elapsed->tv_sec,
+						elapsed->tv_nsec / 10000000);
+				continue;
+			}
+			ERROR("Read failed");
+			break;
+		}
+
+		/* See copy_to_file() */
+		if (first) {
+			if (args->timeout > 0)
+				alarm(args->timeout);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			first = 0;
+		}
+
+		rec.bytes += r;
+		if (!block) {
+			rec.dropped += r;
+		} else {
+			fill += r;
+			if (fill < REC_BLOCK_SIZE)
+				continue;
+		}
+
+		/* Hands the block to the writer and gets a free one */
+		pthread_mutex_lock(&rec.lock);
+		if (block) {
+			rec.len[rec.head % rec.n_blocks] = fill;
+			rec.head++;
+			fill = 0;
+			pthread_cond_signal(&rec.cond);
+		}
+
+		used = rec.head - rec.tail;
+		if (used > rec.max_used)
+			rec.max_used = used;
+
+		if (rec.error) {
+			pthread_mutex_unlock(&rec.lock);
+			break;
+		}
+		if (used < rec.n_blocks)
+			block = &rec.ring[(rec.head % rec.n_blocks) * REC_BLOCK_SIZE];
+		else
+			block = NULL;
+		pthread_mutex_unlock(&rec.lock);
+	}
+
+	pthread_mutex_lock(&rec.lock);
+	if (block && fill) {
+		rec.len[rec.head % rec.n_blocks] = fill;
+		rec.head++;
+	}
+	rec.done = 1;
+	pthread_cond_signal(&rec.cond);
+	pthread_mutex_unlock(&rec.lock);
+
+	pthread_join(writer, NULL);
+
+	rec_report(args, &rec);
+
+err:
+	pthread_cond_destroy(&rec.cond);
+	pthread_mutex_destroy(&rec.lock);
+	free(rec.ring);
+	free(rec.len);
+}
+#else
+static void record_to_file(struct arguments *args,
+			   struct dvb_open_descriptor *in_fd, int out_fd)
+{
+	copy_to_file(in_fd, out_fd, args->timeout, args->silent);
+}
+#endif
+
 static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 {
 	struct arguments *args = state->input;
@@ -644,6 +1060,18 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'p':
 		args->rec_psi = 1;
 		break;
+	case 'B':
+		args->rec_buffer = strtoul(optarg, NULL, 0);
+		break;
+	case 'O':
+		args->direct_io = 1;
+		break;
+	case 'M':
+		args->mmap = 1;
+		break;
+	case 'F':
+		args->preallocate = strtoul(optarg, NULL, 0);
+		break;
 	case 'x':
 		args->exit_after_tuning = 1;
 		break;
@@ -697,6 +1125,14 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'm':
 		args->traffic_monitor = 1;
 		break;
+	case 'y':
+		args->traffic_monitor = 1;
+		args->analyze = 1;
+		break;
+	case 'R':
+		args->replay = strdup(optarg);
+		args->analyze = 1;
+		break;
 	case 'N':
 		args->non_human = 1;
 		break;
@@ -762,12 +1198,104 @@ static char *print_bytes(float val)
 	return buf;
 }
 
+static const char *ts_pid_type[] = {
+	[DVB_TS_PID_UNKNOWN]	= "",
+	[DVB_TS_PID_PAT]	= "PAT",
+	[DVB_TS_PID_CAT]	= "CAT",
+	[DVB_TS_PID_PMT]	= "PMT",
+	[DVB_TS_PID_ES]		= "ES",
+	[DVB_TS_PID_NULL]	= "NULL",
+};
+
+static void ts_analyzer_error(struct dvb_ts_analyzer *an,
+			      enum dvb_ts_check check, uint16_t pid,
+			      void *priv)
+{
+	const struct dvb_ts_stats *st = dvb_ts_analyzer_get_stats(an);
+	struct arguments *args = priv;
+
+	if (args->silent)
+		return;
+
+	if (pid == 0x1fff)
+		fprintf(stderr, _("%.3fs: %s\n"),
+			st->time / 1000000., dvb_ts_check_name[check]);
+	else
+		fprintf(stderr, _("%.3fs: %s on pid %d\n"),
+			st->time / 1000000., dvb_ts_check_name[check], pid);
+}
+
+static void print_ts_analysis(struct arguments *args,
+			      struct dvb_ts_analyzer *an, int summary)
+{
+	const struct dvb_ts_stats *st = dvb_ts_analyzer_get_stats(an);
+	unsigned long long errors;
+	unsigned pid, i;
+
+	printf(_(" PID TYPE     BITRATE          MIN          MAX          AVG      ERRORS  PCR JITTER\n"));
+	for (pid = 0; pid < 0x2000; pid++) {
+		const struct dvb_ts_pid_stats *ps;
+
+		ps = dvb_ts_analyzer_get_pid(an, pid);
+		if (!ps || !ps->packets)
+			continue;
+
+		errors = 0;
+		for (i = 0; i < DVB_TS_NUM_CHECKS; i++)
+			errors += ps->errors[i];
+
+		printf("%5d %-4s ", pid, ts_pid_type[ps->type]);
+		printf("%sbps ", print_bytes(ps->bitrate));
+		printf("%sbps ", print_bytes(ps->min_bitrate));
+		printf("%sbps ", print_bytes(ps->max_bitrate));
+		printf("%sbps ", print_bytes(ps->avg_bitrate));
+		printf("%8llu", errors);
+		if (ps->has_pcr)
+			printf("  %d..%d ns", ps->pcr_jitter_min,
+			       ps->pcr_jitter_max);
+		printf("\n");
+
+		if (!summary || !args->verbose)
+			continue;
+
+		for (i = 0; i < DVB_TS_NUM_CHECKS; i++) {
+			if (ps->errors[i])
+				printf("\t%s: %llu\n", dvb_ts_check_name[i],
+				       (unsigned long long)ps->errors[i]);
+		}
+		for (i = 0; i < DVB_TS_HISTOGRAM_SIZE; i++) {
+			if (!ps->histogram[i])
+				continue;
+			if (!i)
+				printf(_("\t< 1 kbps: %u s\n"),
+				       ps->histogram[i]);
+			else
+				printf(_("\t%u to %u kbps: %u s\n"),
+				       1 << (i - 1), 1 << i, ps->histogram[i]);
+		}
+	}
+
+	printf(_("TOT       %sbps, %.2f s of stream"),
+	       print_bytes(st->bitrate), st->time / 1000000.);
+	if (st->skipped)
+		printf(_(", %llu bytes out of sync"),
+		       (unsigned long long)st->skipped);
+	printf("\n");
+
+	for (i = 0; i < DVB_TS_NUM_CHECKS; i++) {
+		if (st->errors[i])
+			printf("%s: %llu\n", dvb_ts_check_name[i],
+			       (unsigned long long)st->errors[i]);
+	}
+}
+
 int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 		       int out_fd, int timeout)
 {
 	struct dvb_open_descriptor *fd, *dvr_fd;
 	struct timespec startt;
 	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
+	struct dvb_ts_analyzer *an = NULL;
 	unsigned long long pidt[0x2001], wait, cont_err = 0;
 	unsigned long long err_cnt[0x2000];
 	signed char pid_cont[0x2000];
@@ -807,6 +1335,15 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
                 return -1;
 	}
 
+	if (args->analyze) {
+		an = dvb_ts_analyzer_alloc(parms, 1000, ts_analyzer_error, args);
+		if (!an) {
+			dvb_dev_close(dvr_fd);
+			dvb_dev_close(fd);
+			return -1;
+		}
+	}
+
 	wait = 1000;
 
 	monitor_log(_("%.2fs: Starting capture\n"));
@@ -851,7 +1388,11 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 			break;
 		}
 
-		for (i = 0; i < BUFLEN; i += 188) {
+		if (an)
+			dvb_ts_analyzer_feed(an, buffer, r);
+
+		/* The analyzer does its own per-packet parsing */
+		for (i = 0; !an && i < BUFLEN; i += 188) {
 			struct dvb_ts_packet_header *h = (void *)&buffer[i];
 			if (h->sync_byte != 0x47) {
 				monitor_log(_("%.2fs: invalid sync byte. Discarding %zd bytes\n"), r);
@@ -950,7 +1491,16 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 			diff = (unsigned long long)elapsed->tv_sec * 1000
 				+ elapsed->tv_nsec * 1000 / NANO_SECONDS_IN_SEC;
 
-		if (diff > wait) {
+		if (an && diff > wait) {
+			if (isatty(STDOUT_FILENO))
+				printf("\x1b[1H\x1b[2J");
+
+			args->n_status_lines = 0;
+			print_ts_analysis(args, an, 0);
+			printf("\n");
+			get_show_stats(stdout, args, parms, 0);
+			wait += 1000;
+		} else if (diff > wait) {
 			unsigned long long other_pidt = 0, other_err_cnt = 0;
 
 			if (isatty(STDOUT_FILENO))
@@ -1009,6 +1559,10 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 		}
 	}
 	monitor_log(_("%.2fs: Stopping capture\n"));
+	if (an) {
+		print_ts_analysis(args, an, 1);
+		dvb_ts_analyzer_free(an);
+	}
 	dvb_dev_close(dvr_fd);
 	dvb_dev_close(fd);
 	return 0;
@@ -1024,6 +1578,62 @@ static void set_signals(struct arguments *args)
 	}
 }
 
+static int do_ts_replay(struct arguments *args)
+{
+	struct dvb_v5_fe_parms *parms;
+	struct dvb_ts_analyzer *an;
+	struct timespec startt, *elapsed;
+	unsigned char *buffer;
+	ssize_t r;
+	int fd, ret = 0;
+
+	fd = open(args->replay, O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		PERROR(_("open of '%s' failed"), args->replay);
+		return -1;
+	}
+
+	/* Only used for logging */
+	parms = dvb_fe_dummy();
+	buffer = malloc(DVB_BUF_SIZE);
+	an = dvb_ts_analyzer_alloc(parms, 1000, ts_analyzer_error, args);
+	if (!parms || !buffer || !an) {
+		ERROR("not enough memory");
+		ret = -1;
+		goto err;
+	}
+
+	set_signals(args);
+	clock_gettime(CLOCK_MONOTONIC, &startt);
+
+	while (!timeout_flag) {
+		r = read(fd, buffer, DVB_BUF_SIZE);
+		if (r <= 0) {
+			if (r < 0) {
+				PERROR(_("read failed"));
+				ret = -1;
+			}
+			break;
+		}
+		dvb_ts_analyzer_feed(an, buffer, r);
+	}
+
+	print_ts_analysis(args, an, 1);
+
+	elapsed = elapsed_time(&startt);
+	if (elapsed && args->silent < 2)
+		fprintf(stderr, _("analyzed in %.2f s\n"),
+			elapsed->tv_sec + elapsed->tv_nsec * 1. / NANO_SECONDS_IN_SEC);
+
+err:
+	dvb_ts_analyzer_free(an);
+	free(buffer);
+	if (parms)
+		dvb_fe_close(parms);
+	close(fd);
+	return ret;
+}
+
 static char *default_dvr_pipe = "/tmp/dvr-pipe";
 
 int main(int argc, char **argv)
@@ -1068,6 +1678,12 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	if (args.replay) {
+		err = do_ts_replay(&args);
+		free(args.replay);
+		return err;
+	}
+
 	if (idx < argc)
 		channel = argv[idx];
 
@@ -1344,7 +1960,7 @@ int main(int argc, char **argv)
 			}
 			if (!timeout_flag)
 				fprintf(stderr, _("Record to file '%s' started\n"), args.filename);
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			record_to_file(&args, dvr_fd, file_fd);
 		} else if (args.server && args.port) {
 			struct stat st;
 			if (stat(args.dvr_pipe, &st) == -1) {
@@ -1383,7 +1999,7 @@ int main(int argc, char **argv)
 				err = -1;
 				goto err;
 			}
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			record_to_file(&args, dvr_fd, file_fd);
 		} else {
 			if (!timeout_flag)
 				fprintf(stderr, _("DVR interface '%s' can now be opened\n"), args.dvr_fname);
@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -31,6 +33,7 @@
 #include <linux/lirc.h>
 
 #include "ir-encode.h"
+#include "ir-decode.h"
 #include "keymap.h"
 #include "bpf_encoder.h"
 
@@ -62,6 +65,8 @@
 #define UNSET UINT32_MAX
 /* Maximum number of columns per line */
 #define LINE_SIZE 8192
+/* Time between starting a batch and sending the first message */
+#define BATCH_START_DELAY 10000
 
 const char *argp_program_version = "IR ctl version " V4L_UTILS_VERSION;
 const char *argp_program_bug_address = "Sean Young <sean@mess.org>";
@@ -101,6 +106,10 @@ struct arguments {
 	bool receive;
 	bool verbose;
 	bool mode2;
+	bool decode;
+	char **decode_files;
+	unsigned decode_files_count;
+	char *batch;
 	struct keymap *keymap;
 	struct send *send;
 	bool oneshot;
@@ -127,6 +136,8 @@ static const struct argp_option options[] = {
 		{ .doc = N_("Receiving options:") },
 	{ "one-shot",	'1',	0,		0,	N_("end receiving after first message") },
 	{ "mode2",	2,	0,		0,	N_("output in mode2 format") },
+	{ "decode",	3,	0,		0,	N_("decode received IR and output scancodes") },
+	{ "decode-file", 4,	N_("FILE"),	0,	N_("decode IR in pulse and space or mode2 file") },
 	{ "wideband",	'w',	0,		0,	N_("use wideband receiver aka learning mode") },
 	{ "narrowband",	'n',	0,		0,	N_("use narrowband receiver, disable learning mode") },
 	{ "carrier-range", 'R', N_("RANGE"),	0,	N_("set receiver carrier range") },
@@ -139,6 +150,7 @@ static const struct argp_option options[] = {
 	{ "duty-cycle",	'D',	N_("DUTY"),	0,	N_("set send duty cycle") },
 	{ "emitters",	'e',	N_("EMITTERS"),	0,	N_("set send emitters") },
 	{ "gap",	'g',	N_("GAP"),	0,	N_("set gap between files or scancodes") },
+	{ "batch",	5,	N_("FILE"),	0,	N_("send IR listed in batch file with precise timing") },
 	{ }
 };
 
@@ -148,6 +160,7 @@ static const char args_doc[] = N_(
 	"--send [file to send]\n"
 	"--scancode [scancode to send]\n"
 	"--keycode [keycode to send]\n"
+	"--batch [batch file to send]\n"
 	"[to set lirc option]");
 
 static const char doc[] = N_(
@@ -612,6 +625,24 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 2:
 		arguments->mode2 = true;
 		break;
+	case 3:
+		arguments->decode = true;
+		break;
+	case 4: {
+		char **files = realloc(arguments->decode_files,
+				       (arguments->decode_files_count + 1) * sizeof(*files));
+
+		if (files == NULL)
+			exit(EX_OSERR);
+		files[arguments->decode_files_count++] = arg;
+		arguments->decode_files = files;
+		break;
+	}
+	case 5:
+		if (arguments->batch)
+			argp_error(state, _("batch file already set"));
+		arguments->batch = arg;
+		break;
 	case 'v':
 		arguments->verbose = true;
 		break;
@@ -729,12 +760,21 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		if (!arguments->work_to_do)
 			argp_usage(state);
 
+		if (arguments->decode_files_count &&
+		    (arguments->receive || arguments->send || arguments->features))
+			argp_error(state, _("decode-file can not be combined with receive, send or features option"));
+
+		if (arguments->batch &&
+		    (arguments->receive || arguments->send || arguments->features ||
+		     arguments->decode_files_count))
+			argp_error(state, _("batch can not be combined with receive, send, decode-file or features option"));
+
 		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
 
-	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2)
+	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2 && k != 3)
 		arguments->work_to_do = true;
 
 	return 0;
@@ -1120,6 +1160,483 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 	return 0;
 }
 
+/*
+ * A batch file has one message per line:
+ *
+ *	EMITTERS MESSAGE [GAP [REPEAT]]
+ *
+ * All messages are encoded before sending starts. Each message is written
+ * at an absolute deadline, the deadline of the previous message plus its
+ * length and gap, so that scheduling errors do not accumulate.
+ */
+struct batch_entry {
+	char *msg;
+	/* 0 if the emitters should not be changed */
+	unsigned emitters;
+	unsigned gap;
+	unsigned repeat;
+	/* length of the IR in microseconds */
+	unsigned duration;
+	struct send *send;
+};
+
+static bool keymap_has_keycode(struct keymap *map, const char *keycode)
+{
+	for (; map; map = map->next) {
+		struct scancode_entry *se;
+		struct raw_entry *re;
+
+		for (re = map->raw; re; re = re->next) {
+			if (!strcmp(re->keycode, keycode))
+				return true;
+		}
+
+		for (se = map->scancode; se; se = se->next) {
+			if (!strcmp(se->keycode, keycode))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * The message is a protocol:scancode, a keycode from the keymap or a file
+ * with pulses and spaces. It is returned encoded as pulses and spaces.
+ */
+static struct send *batch_message(struct arguments *args, const char *msg)
+{
+	char *p = strchr(msg, ':');
+	struct send *s = NULL;
+	enum rc_proto proto;
+	unsigned scancode;
+
+	if (p) {
+		char *pstr = strndup(msg, p - msg);
+		bool match = protocol_match(pstr, &proto);
+
+		free(pstr);
+		if (match)
+			s = read_scancode(msg);
+		else
+			s = read_file(args, msg);
+	} else if (keymap_has_keycode(args->keymap, msg)) {
+		s = convert_keycode(args->keymap, msg);
+	} else {
+		s = read_file(args, msg);
+	}
+
+	if (!s || s->ty != SEND_SCANCODE)
+		return s;
+
+	// scancode and carrier share storage
+	proto = s->protocol;
+	scancode = s->scancode;
+
+	if (!protocol_encoder_available(proto)) {
+		fprintf(stderr, _("error: no encoder available for `%s'\n"),
+			protocol_name(proto));
+		free(s);
+		return NULL;
+	}
+
+	s->len = protocol_encode(proto, scancode, s->buf);
+	s->carrier = protocol_carrier(proto);
+	s->ty = SEND_RAW;
+
+	return s;
+}
+
+static void free_batch(struct batch_entry *entries, unsigned count)
+{
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		free(entries[i].msg);
+		free(entries[i].send);
+	}
+	free(entries);
+}
+
+static struct batch_entry *read_batch(struct arguments *args, const char *fname,
+				      unsigned *count)
+{
+	static const char whitespace[] = " \n\r\t";
+	struct batch_entry *entries = NULL, *e;
+	char line[LINE_SIZE];
+	unsigned i, n = 0;
+	int lineno = 0;
+	FILE *input;
+
+	input = fopen(fname, "r");
+	if (!input) {
+		fprintf(stderr, _("%s: could not open: %m\n"), fname);
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), input)) {
+		char *emitters, *msg, *p, *saveptr;
+
+		lineno++;
+		emitters = strtok_r(line, whitespace, &saveptr);
+		if (emitters == NULL || *emitters == '#' ||
+		    (emitters[0] == '/' && emitters[1] == '/'))
+			continue;
+
+		msg = strtok_r(NULL, whitespace, &saveptr);
+		if (msg == NULL) {
+			fprintf(stderr, _("error: %s:%d: missing message\n"), fname, lineno);
+			goto error;
+		}
+
+		e = realloc(entries, (n + 1) * sizeof(*e));
+		if (e == NULL) {
+			fprintf(stderr, _("Failed to allocate memory\n"));
+			goto error;
+		}
+		entries = e;
+		e = &entries[n];
+		memset(e, 0, sizeof(*e));
+		e->gap = args->gap;
+		e->repeat = 1;
+
+		if (strcmp(emitters, "-")) {
+			e->emitters = parse_emitters(emitters);
+			if (e->emitters == 0) {
+				fprintf(stderr, _("error: %s:%d: cannot parse emitters\n"), fname, lineno);
+				goto error;
+			}
+		}
+
+		p = strtok_r(NULL, whitespace, &saveptr);
+		if (p && !strtoint(p, "", &e->gap)) {
+			fprintf(stderr, _("error: %s:%d: cannot parse gap `%s'\n"), fname, lineno, p);
+			goto error;
+		}
+
+		p = p ? strtok_r(NULL, whitespace, &saveptr) : NULL;
+		if (p && (!strtoint(p, "", &e->repeat) || e->repeat == 0)) {
+			fprintf(stderr, _("error: %s:%d: cannot parse repeat `%s'\n"), fname, lineno, p);
+			goto error;
+		}
+
+		e->msg = strdup(msg);
+		n++;
+		if (e->msg == NULL) {
+			fprintf(stderr, _("Failed to allocate memory\n"));
+			goto error;
+		}
+
+		e->send = batch_message(args, e->msg);
+		if (e->send == NULL) {
+			fprintf(stderr, _("error: %s:%d: cannot send `%s'\n"), fname, lineno, msg);
+			goto error;
+		}
+
+		for (i = 0; i < e->send->len; i++)
+			e->duration += e->send->buf[i];
+	}
+
+	fclose(input);
+
+	if (n == 0) {
+		fprintf(stderr, _("%s: file is empty\n"), fname);
+		return NULL;
+	}
+
+	*count = n;
+	return entries;
+error:
+	fclose(input);
+	free_batch(entries, n);
+	return NULL;
+}
+
+static void timespec_add_us(struct timespec *ts, unsigned long us)
+{
+	ts->tv_nsec += (us % 1000000) * 1000;
+	ts->tv_sec += us / 1000000 + ts->tv_nsec / 1000000000;
+	ts->tv_nsec %= 1000000000;
+}
+
+static int64_t timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000000LL + a->tv_nsec - b->tv_nsec;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_batch_stats(int64_t *errs, unsigned count, unsigned late,
+			      int64_t elapsed)
+{
+	int64_t sum = 0;
+	unsigned i;
+
+	for (i = 0; i < count; i++)
+		sum += errs[i];
+
+	qsort(errs, count, sizeof(*errs), cmp_int64);
+
+	printf(_("Sent %u messages in %.3f seconds\n"), count, elapsed / 1e9);
+	printf(_("Start time error: min %.1f us, median %.1f us, 99%% %.1f us, max %.1f us, mean %.1f us\n"),
+	       errs[0] / 1e3, errs[count / 2] / 1e3,
+	       errs[(count * 99ULL) / 100] / 1e3, errs[count - 1] / 1e3,
+	       (double)sum / count / 1e3);
+	printf(_("Messages which could not start on time: %u\n"), late);
+}
+
+static int lirc_send_batch(struct arguments *args, int fd, unsigned features,
+			   struct batch_entry *entries, unsigned count)
+{
+	unsigned i, r, sent = 0, total = 0, late = 0;
+	unsigned emitters = args->emitters;
+	unsigned carrier = args->carrier;
+	const char *dev = args->device;
+	struct timespec start, deadline, now;
+	int64_t *errs;
+	int rc, mode;
+	ssize_t ret;
+
+	if (!(features & LIRC_CAN_SEND_PULSE)) {
+		fprintf(stderr, _("%s: device cannot send\n"), dev);
+		return EX_UNAVAILABLE;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (entries[i].emitters &&
+		    !(features & LIRC_CAN_SET_TRANSMITTER_MASK)) {
+			fprintf(stderr, _("%s: does not support setting send transmitters\n"), dev);
+			return EX_UNAVAILABLE;
+		}
+		total += entries[i].repeat;
+	}
+
+	mode = LIRC_MODE_PULSE;
+	rc = ioctl(fd, LIRC_SET_SEND_MODE, &mode);
+	if (rc) {
+		fprintf(stderr, _("%s: cannot set send mode\n"), dev);
+		return EX_UNAVAILABLE;
+	}
+
+	errs = malloc(total * sizeof(*errs));
+	if (errs == NULL) {
+		fprintf(stderr, _("Failed to allocate memory\n"));
+		return EX_OSERR;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	deadline = start;
+	timespec_add_us(&deadline, BATCH_START_DELAY);
+
+	for (i = 0; i < count; i++) {
+		struct batch_entry *e = &entries[i];
+		struct send *s = e->send;
+		size_t size = s->len * sizeof(unsigned);
+
+		for (r = 0; r < e->repeat; r++) {
+			// Change settings before the deadline, not after
+			if (e->emitters && e->emitters != emitters) {
+				rc = ioctl(fd, LIRC_SET_TRANSMITTER_MASK, &e->emitters);
+				if (rc) {
+					fprintf(stderr, _("%s: failed to set send transmitters for `%s'\n"), dev, e->msg);
+					free(errs);
+					return EX_IOERR;
+				}
+				emitters = e->emitters;
+			}
+
+			if (args->carrier == UNSET && s->carrier != UNSET &&
+			    s->carrier != carrier) {
+				lirc_set_send_carrier(fd, dev, features, s->carrier);
+				carrier = s->carrier;
+			}
+
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &deadline, NULL) == EINTR)
+				;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			errs[sent] = timespec_diff_ns(&now, &deadline);
+
+			ret = TEMP_FAILURE_RETRY(write(fd, s->buf, size));
+			if (ret < 0) {
+				fprintf(stderr, _("%s: failed to send `%s': %m\n"), dev, e->msg);
+				free(errs);
+				return EX_IOERR;
+			}
+
+			if (args->verbose)
+				printf(_("%.6f: sent %s, %.1f us late\n"),
+				       timespec_diff_ns(&now, &start) / 1e9,
+				       e->msg, errs[sent] / 1e3);
+
+			sent++;
+
+			// The write returns when the IR has been sent
+			timespec_add_us(&deadline, e->duration + e->gap);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (sent < total && timespec_diff_ns(&now, &deadline) > 0)
+				late++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	print_batch_stats(errs, sent, late, timespec_diff_ns(&now, &start));
+	free(errs);
+
+	return 0;
+}
+
+static bool protocol_has_toggle(enum rc_proto proto)
+{
+	switch (proto) {
+	case RC_PROTO_RC5:
+	case RC_PROTO_RC5X_20:
+	case RC_PROTO_RC5_SZ:
+	case RC_PROTO_RC6_0:
+	case RC_PROTO_RC6_MCE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+struct decode_output {
+	FILE *out;
+	const char *fname;
+};
+
+static void print_scancode(void *priv, const struct ir_scancode *sc)
+{
+	struct decode_output *output = priv;
+
+	if (output->fname)
+		fprintf(output->out, "%s: ", output->fname);
+
+	fprintf(output->out, "%llu.%06llu %s:0x%x",
+		(unsigned long long)sc->timestamp / 1000000,
+		(unsigned long long)sc->timestamp % 1000000,
+		protocol_name(sc->proto), sc->scancode);
+	if (protocol_has_toggle(sc->proto))
+		fprintf(output->out, " toggle=%d", sc->toggle);
+	if (sc->repeat)
+		fprintf(output->out, " repeat");
+	fprintf(output->out, "\n");
+}
+
+static uint64_t monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Decode a file as written by --receive, with or without --mode2. Unlike
+ * read_file() there is no limit on the length of the file.
+ */
+static int decode_file(struct ir_decoder *dec, const char *fname)
+{
+	static const char whitespace[] = " \n\r\t";
+	FILE *input = fopen(fname, "r");
+	char line[LINE_SIZE];
+	bool expect_pulse = true;
+	int lineno = 0;
+
+	if (!input) {
+		fprintf(stderr, _("%s: could not open: %m\n"), fname);
+		return EX_NOINPUT;
+	}
+
+	ir_decode_reset(dec);
+	ir_decode_set_time(dec, 0);
+
+	while (fgets(line, sizeof(line), input)) {
+		char *p, *saveptr;
+
+		lineno++;
+		p = strchr(line, '#');
+		if (p)
+			*p = 0;
+
+		for (p = strtok_r(line, whitespace, &saveptr); p;
+		     p = strtok_r(NULL, whitespace, &saveptr)) {
+			bool pulse = expect_pulse;
+			unsigned val;
+
+			if (p[0] == '/' && p[1] == '/')
+				break;
+
+			if (!strcmp(p, "overflow")) {
+				ir_decode_reset(dec);
+				expect_pulse = true;
+				continue;
+			}
+
+			if (!strcmp(p, "pulse") || !strcmp(p, "space") ||
+			    !strcmp(p, "timeout") || !strcmp(p, "carrier")) {
+				char *keyword = p;
+
+				p = strtok_r(NULL, whitespace, &saveptr);
+				if (!p || !strtoint(p, "", &val)) {
+					fprintf(stderr, _("warning: %s:%d: invalid argument to %s\n"), fname, lineno, keyword);
+					break;
+				}
+				if (keyword[0] == 'c')
+					continue;
+				pulse = keyword[0] == 'p';
+			} else if (p[0] == '+' || p[0] == '-') {
+				pulse = p[0] == '+';
+				if (!strtoint(p + 1, "", &val)) {
+					fprintf(stderr, _("warning: %s:%d: invalid value '%s'\n"), fname, lineno, p);
+					break;
+				}
+			} else if (isdigit(p[0]) && strtoint(p, "", &val)) {
+				pulse = expect_pulse;
+			} else {
+				fprintf(stderr, _("warning: %s:%d: unexpected '%s'\n"), fname, lineno, p);
+				break;
+			}
+
+			ir_decode_add(dec, pulse, val);
+			expect_pulse = !pulse;
+		}
+	}
+
+	ir_decode_flush(dec);
+	fclose(input);
+
+	return 0;
+}
+
+static int decode_files(struct arguments *args)
+{
+	struct decode_output output = { .out = stdout };
+	struct ir_decoder *dec;
+	unsigned i;
+	int rc = 0;
+
+	dec = ir_decode_alloc(print_scancode, &output);
+	if (!dec)
+		return EX_OSERR;
+
+	for (i = 0; i < args->decode_files_count && !rc; i++) {
+		if (args->decode_files_count > 1)
+			output.fname = args->decode_files[i];
+		rc = decode_file(dec, args->decode_files[i]);
+	}
+
+	ir_decode_free(dec);
+
+	return rc;
+}
+
 int lirc_receive(struct arguments *args, int fd, unsigned features)
 {
 	char *dev = args->device;
@@ -1150,6 +1667,17 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 	bool keep_reading = true;
 	bool leading_space = true;
 	unsigned carrier = 0;
+	struct decode_output output = { .out = out };
+	struct ir_decoder *dec = NULL;
+	uint64_t start = monotonic_us();
+
+	if (args->decode) {
+		dec = ir_decode_alloc(print_scancode, &output);
+		if (!dec) {
+			rc = EX_OSERR;
+			goto err;
+		}
+	}
 
 	while (keep_reading) {
 		ssize_t ret = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)));
@@ -1174,6 +1702,11 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 			if (leading_space && msg == LIRC_MODE2_SPACE)
 				continue;
 
+			// the length of the idle period is unknown, so
+			// resynchronize the decoder timestamps
+			if (dec && leading_space && msg == LIRC_MODE2_PULSE)
+				ir_decode_set_time(dec, monotonic_us() - start);
+
 			leading_space = false;
 			if (args->oneshot &&
 				(msg == LIRC_MODE2_TIMEOUT ||
@@ -1182,7 +1715,23 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 				break;
 			}
 
-			if (args->mode2) {
+			if (dec) {
+				switch (msg) {
+				case LIRC_MODE2_TIMEOUT:
+					ir_decode_add(dec, false, val);
+					ir_decode_flush(dec);
+					leading_space = true;
+					break;
+				case LIRC_MODE2_PULSE:
+				case LIRC_MODE2_SPACE:
+					ir_decode_add(dec, msg == LIRC_MODE2_PULSE, val);
+					break;
+				case LIRC_MODE2_OVERFLOW:
+					ir_decode_reset(dec);
+					leading_space = true;
+					break;
+				}
+			} else if (args->mode2) {
 				switch (msg) {
 				case LIRC_MODE2_TIMEOUT:
 					fprintf(out, "timeout %u\n", val);
@@ -1236,8 +1785,12 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 		}
 	}
 
+	if (dec)
+		ir_decode_flush(dec);
+
 	rc = 0;
 err:
+	ir_decode_free(dec);
 	if (args->savetofile)
 		fclose(out);
 
@@ -1260,6 +1813,13 @@ int main(int argc, char *argv[])
 
 	argp_parse(&argp, argc, argv, 0, 0, &args);
 
+	if (args.decode_files_count) {
+		int ret = decode_files(&args);
+
+		free(args.decode_files);
+		exit(ret);
+	}
+
 	if (args.device == NULL)
 		args.device = "/dev/lirc0";
 
@@ -1274,6 +1834,23 @@ int main(int argc, char *argv[])
 	if (rc)
 		exit(EX_IOERR);
 
+	if (args.batch) {
+		struct batch_entry *entries;
+		unsigned count;
+
+		entries = read_batch(&args, args.batch, &count);
+		if (!entries) {
+			close(fd);
+			exit(EX_DATAERR);
+		}
+
+		rc = lirc_send_batch(&args, fd, features, entries, count);
+		free_batch(entries, count);
+		free_keymap(args.keymap);
+		close(fd);
+		exit(rc);
+	}
+
 	struct send *s = args.send;
 	while (s) {
 		struct send *next = s->next;
@@ -2,7 +2,11 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/file.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <glob.h>
 #include <libelf.h>
 #include <gelf.h>
 #include <errno.h>
@@ -12,6 +16,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <linux/bpf.h>
+#include <linux/magic.h>
 #include <bpf/bpf.h>
 #include <assert.h>
 #include <argp.h>
@@ -30,6 +35,10 @@
 
 #define LOG_BUF_SIZE (256 * 1024)
 
+#define BPF_FS_DIR	"/sys/fs/bpf"
+#define BPF_PIN_DIR	BPF_FS_DIR "/ir-keytable"
+#define MAX_LIRC_PROGS	(MAX_PROGS * 4)
+
 // This should match the struct in the raw BPF decoder
 struct raw_pattern {
 	unsigned int scancode;
@@ -61,10 +70,10 @@ struct bpf_file {
 	char name[128];
 };
 
-static int load_and_attach(int lirc_fd, struct bpf_file *bpf_file, struct bpf_insn *prog, int size)
+static int load_prog(struct bpf_file *bpf_file, struct bpf_insn *prog, int size)
 {
 	LIBBPF_OPTS(bpf_prog_load_opts, opts);
-	int fd, err, insn_cnt;
+	int fd, insn_cnt;
 
 	insn_cnt = size / sizeof(struct bpf_insn);
 
@@ -79,8 +88,12 @@ static int load_and_attach(int lirc_fd, struct bpf_file *bpf_file, struct bpf_in
 		return -1;
 	}
 
-	err = bpf_prog_attach(fd, lirc_fd, BPF_LIRC_MODE2, 0);
-	if (err) {
+	return fd;
+}
+
+static int attach_prog(int prog_fd, int lirc_fd)
+{
+	if (bpf_prog_attach(prog_fd, lirc_fd, BPF_LIRC_MODE2, 0)) {
 		printf("bpf_prog_attach: err=%m\n");
 		return -1;
 	}
@@ -442,11 +455,421 @@ static int load_elf_maps_section(struct bpf_file *bpf_file)
 	return nr_maps;
 }
 
+/*
+ * Decoders are pinned in bpffs once loaded, so that the next ir-keytable
+ * run does not have to parse the object file and go through the verifier
+ * again. The protocol parameters and raw patterns are patched into the
+ * program and its maps at load time, so the pins are keyed on a hash of
+ * the object file, the parameters and the raw patterns.
+ *
+ * A decoder keeps its state in a map, so a program can only be attached
+ * to one lirc device at a time. Every key has numbered instances, and an
+ * instance which is not attached to any lirc device gets reused.
+ */
+static uint64_t fnv1a(uint64_t hash, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static int bpf_file_hash(int fd, struct protocol_param *param,
+			 struct raw_entry *raw, uint64_t *hash)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned char buf[4096];
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		h = fnv1a(h, buf, n);
+	if (n < 0 || lseek(fd, 0, SEEK_SET))
+		return -1;
+
+	for (; param; param = param->next) {
+		h = fnv1a(h, param->name, strlen(param->name) + 1);
+		h = fnv1a(h, &param->value, sizeof(param->value));
+	}
+
+	for (; raw; raw = raw->next) {
+		h = fnv1a(h, &raw->scancode, sizeof(raw->scancode));
+		h = fnv1a(h, &raw->raw_length, sizeof(raw->raw_length));
+		h = fnv1a(h, raw->raw, raw->raw_length * sizeof(raw->raw[0]));
+	}
+
+	*hash = h;
+	return 0;
+}
+
+/*
+ * Create and lock the pin directory for this decoder. The lock is held
+ * until the program is attached, so concurrent ir-keytable runs (e.g. from
+ * udev) never pick the same instance.
+ */
+static int open_pin_dir(const char *path, uint64_t hash, char *dir, size_t size)
+{
+	const char *base;
+	struct statfs st;
+	int len, fd;
+	char *p;
+
+	if (statfs(BPF_FS_DIR, &st) || st.f_type != BPF_FS_MAGIC)
+		return -1;
+
+	if (mkdir(BPF_PIN_DIR, 0700) && errno != EEXIST)
+		return -1;
+
+	base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+
+	// bpffs does not allow dots in names
+	len = snprintf(dir, size, "%s/", BPF_PIN_DIR);
+	snprintf(dir + len, size - len, "%s", base);
+	p = strrchr(dir + len, '.');
+	if (p)
+		*p = '\0';
+	for (p = dir + len; *p; p++) {
+		if (*p == '.')
+			*p = '_';
+	}
+	len = strlen(dir);
+	snprintf(dir + len, size - len, "-%016llx", (unsigned long long)hash);
+
+	if (mkdir(dir, 0700) && errno != EEXIST)
+		return -1;
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+
+	if (flock(fd, LOCK_EX)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static unsigned int lirc_attached_progs(unsigned int *ids, unsigned int max)
+{
+	unsigned int n = 0, count;
+	glob_t g;
+	size_t i;
+	int fd;
+
+	if (glob("/dev/lirc*", 0, NULL, &g))
+		return 0;
+
+	for (i = 0; i < g.gl_pathc && n < max; i++) {
+		fd = open(g.gl_pathv[i], O_RDONLY | O_NONBLOCK);
+		if (fd < 0)
+			continue;
+
+		count = max - n;
+		if (!bpf_prog_query(fd, BPF_LIRC_MODE2, 0, NULL, ids + n, &count))
+			n += count;
+		close(fd);
+	}
+
+	globfree(&g);
+	return n;
+}
+
+// The decoders only use array maps for their state
+static void reset_pinned_maps(const char *dir)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	unsigned int key;
+	void *value;
+	DIR *d;
+	int fd;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	while ((de = readdir(d))) {
+		struct bpf_map_info info = {};
+		__u32 info_len = sizeof(info);
+
+		if (de->d_name[0] == '.' || !strcmp(de->d_name, "prog") ||
+		    !strcmp(de->d_name, "raw_map"))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		fd = bpf_obj_get(path);
+		if (fd < 0)
+			continue;
+
+		if (!bpf_obj_get_info_by_fd(fd, &info, &info_len) &&
+		    info.type == BPF_MAP_TYPE_ARRAY) {
+			value = calloc(1, info.value_size);
+			for (key = 0; value && key < info.max_entries; key++)
+				bpf_map_update_elem(fd, &key, value, BPF_ANY);
+			free(value);
+		}
+		close(fd);
+	}
+
+	closedir(d);
+}
+
+/*
+ * Attach a free pinned instance of the decoder. Returns 0 if it was
+ * attached, 1 if there is no free instance, in which case the number for
+ * a new instance is returned in instance, and -1 on error.
+ */
+static int attach_pinned(const char *dir, int lirc_fd, unsigned int *instance)
+{
+	unsigned int ids[MAX_LIRC_PROGS], n_ids, i, n;
+	char path[PATH_MAX];
+	int fd, ret;
+
+	n_ids = lirc_attached_progs(ids, MAX_LIRC_PROGS);
+
+	for (n = 0; ; n++) {
+		struct bpf_prog_info info = {};
+		__u32 info_len = sizeof(info);
+
+		snprintf(path, sizeof(path), "%s/%u/prog", dir, n);
+		fd = bpf_obj_get(path);
+		if (fd < 0)
+			break;
+
+		if (bpf_obj_get_info_by_fd(fd, &info, &info_len)) {
+			close(fd);
+			continue;
+		}
+
+		for (i = 0; i < n_ids && ids[i] != info.id; i++)
+			;
+		if (i < n_ids) {
+			close(fd);
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/%u", dir, n);
+		reset_pinned_maps(path);
+
+		ret = attach_prog(fd, lirc_fd);
+		close(fd);
+		if (!ret && debug)
+			printf(_("reusing BPF decoder pinned in %s\n"), path);
+
+		return ret;
+	}
+
+	*instance = n;
+	return 1;
+}
+
+// Remove the pins of a directory and the directory itself
+static void remove_pins(int dir_fd, const char *name)
+{
+	struct dirent *de;
+	DIR *d;
+	int fd;
+
+	fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+
+	d = fdopendir(fd);
+	if (!d) {
+		close(fd);
+		return;
+	}
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+		unlinkat(fd, de->d_name, 0);
+	}
+
+	closedir(d);
+	unlinkat(dir_fd, name, AT_REMOVEDIR);
+}
+
+static bool pin_dir_in_use(const char *name, const unsigned int *ids,
+			   unsigned int n_ids)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	bool in_use = false;
+	unsigned int i;
+	DIR *d;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", BPF_PIN_DIR, name);
+	d = opendir(path);
+	if (!d)
+		return true;
+
+	while (!in_use && (de = readdir(d))) {
+		struct bpf_prog_info info = {};
+		__u32 info_len = sizeof(info);
+
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/%s/prog", BPF_PIN_DIR, name,
+			 de->d_name);
+		fd = bpf_obj_get(path);
+		if (fd < 0)
+			continue;
+
+		if (bpf_obj_get_info_by_fd(fd, &info, &info_len))
+			in_use = true;
+		for (i = 0; !in_use && i < n_ids; i++)
+			in_use = ids[i] == info.id;
+		close(fd);
+	}
+
+	closedir(d);
+	return in_use;
+}
+
+/*
+ * A pin directory name is the decoder name followed by a dash and the
+ * 16 digit hash. If name is NULL, any decoder matches.
+ */
+static bool pin_dir_matches(const char *entry, const char *name, size_t len)
+{
+	size_t n = strlen(entry);
+
+	if (n < 18 || entry[n - 17] != '-' ||
+	    strspn(entry + n - 16, "0123456789abcdef") != 16)
+		return false;
+
+	return !name || (n - 17 == len && !strncmp(entry, name, len));
+}
+
+/*
+ * Remove the pin directories that have no instance attached to a lirc
+ * device, e.g. those of a decoder that was loaded with other parameters
+ * before. With keep set, only the other directories of the same decoder
+ * are removed. Directories locked by a concurrent run are left alone.
+ */
+static void remove_stale_pins(const char *keep)
+{
+	unsigned int ids[MAX_LIRC_PROGS], n_ids;
+	const char *name = NULL;
+	char dir[PATH_MAX];
+	struct dirent *de, *ide;
+	size_t len = 0;
+	DIR *d, *id;
+	int fd;
+
+	if (keep) {
+		name = keep + strlen(BPF_PIN_DIR "/");
+		len = strlen(name) - 17;
+	}
+
+	d = opendir(BPF_PIN_DIR);
+	if (!d)
+		return;
+
+	n_ids = lirc_attached_progs(ids, MAX_LIRC_PROGS);
+
+	while ((de = readdir(d))) {
+		if (!pin_dir_matches(de->d_name, name, len))
+			continue;
+
+		snprintf(dir, sizeof(dir), "%s/%s", BPF_PIN_DIR, de->d_name);
+		if (keep && !strcmp(dir, keep))
+			continue;
+
+		fd = open(dir, O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
+			continue;
+
+		if (flock(fd, LOCK_EX | LOCK_NB) ||
+		    pin_dir_in_use(de->d_name, ids, n_ids)) {
+			close(fd);
+			continue;
+		}
+
+		// The instances, and temporary directories of crashed runs
+		id = opendir(dir);
+		while (id && (ide = readdir(id))) {
+			if (ide->d_name[0] != '.')
+				remove_pins(fd, ide->d_name);
+		}
+		if (id)
+			closedir(id);
+		if (!rmdir(dir) && debug)
+			printf(_("removed stale BPF decoder pins in %s\n"), dir);
+		close(fd);
+	}
+
+	closedir(d);
+}
+
+void bpf_remove_stale_pins(void)
+{
+	remove_stale_pins(NULL);
+}
+
+// Pins are created in a temporary directory first, so an instance is complete or absent
+static void pin_instance(const char *dir, unsigned int instance, int prog_fd,
+			 struct bpf_file *bpf_file)
+{
+	char tmp[PATH_MAX - NAME_MAX], path[PATH_MAX];
+	int i, err;
+
+	snprintf(tmp, sizeof(tmp), "%s/tmp-%d", dir, getpid());
+	if (mkdir(tmp, 0700)) {
+		err = errno;
+		goto error;
+	}
+
+	for (i = 0; i < bpf_file->nr_maps; i++) {
+		snprintf(path, sizeof(path), "%s/%s", tmp,
+			 bpf_file->map_data[i].name);
+		if (bpf_obj_pin(bpf_file->map_fd[i], path))
+			goto unpin;
+	}
+
+	snprintf(path, sizeof(path), "%s/prog", tmp);
+	if (bpf_obj_pin(prog_fd, path))
+		goto unpin;
+
+	snprintf(path, sizeof(path), "%s/%u", dir, instance);
+	if (!rename(tmp, path)) {
+		if (debug)
+			printf(_("pinned BPF decoder in %s\n"), path);
+		return;
+	}
+
+unpin:
+	err = errno;
+	for (i = 0; i < bpf_file->nr_maps; i++) {
+		snprintf(path, sizeof(path), "%s/%s", tmp,
+			 bpf_file->map_data[i].name);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/prog", tmp);
+	unlink(path);
+	rmdir(tmp);
+error:
+	if (debug)
+		printf(_("failed to pin BPF decoder in %s: %s\n"), dir,
+		       strerror(err));
+}
+
 int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
-		  struct raw_entry *raw)
+		  struct raw_entry *raw, bool pin)
 {
 	struct bpf_file bpf_file = { .param = param };
-	int fd, i, ret;
+	int fd, i, ret, prog_fd, pin_fd = -1;
+	unsigned int instance = 0;
+	char pin_dir[PATH_MAX];
+	uint64_t hash;
 	Elf *elf;
 	GElf_Ehdr ehdr;
 	GElf_Shdr shdr, shdr_prog;
@@ -461,13 +884,26 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 	if (fd < 0)
 		return 1;
 
+	if (pin && !bpf_file_hash(fd, param, raw, &hash))
+		pin_fd = open_pin_dir(path, hash, pin_dir, sizeof(pin_dir));
+
+	if (pin_fd >= 0) {
+		ret = attach_pinned(pin_dir, lirc_fd, &instance);
+		if (ret <= 0) {
+			ret = ret ? 1 : 0;
+			goto done;
+		}
+	}
+
+	ret = 1;
+
 	elf = elf_begin(fd, ELF_C_READ, NULL);
 
 	if (!elf)
-		return 1;
+		goto done;
 
 	if (gelf_getehdr(elf, &ehdr) != &ehdr)
-		return 1;
+		goto done;
 
 	bpf_file.elf = elf;
 
@@ -504,8 +940,6 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 		}
 	}
 
-	ret = 1;
-
 	if (!bpf_file.symbols) {
 		printf(_("missing SHT_SYMTAB section\n"));
 		goto done;
@@ -572,11 +1006,23 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 		    !(shdr.sh_flags & SHF_EXECINSTR))
 			continue;
 
-		ret = load_and_attach(lirc_fd, &bpf_file, data->d_buf, data->d_size);
+		prog_fd = load_prog(&bpf_file, data->d_buf, data->d_size);
+		if (prog_fd < 0)
+			break;
+
+		ret = attach_prog(prog_fd, lirc_fd) ? 1 : 0;
+		if (!ret && pin_fd >= 0) {
+			pin_instance(pin_dir, instance, prog_fd, &bpf_file);
+			// The first instance of a new hash replaces the old ones
+			if (!instance)
+				remove_stale_pins(pin_dir);
+		}
 		break;
 	}
 
 done:
+	if (pin_fd >= 0)
+		close(pin_fd);
 	close(fd);
 	return ret;
 }
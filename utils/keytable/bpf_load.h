@@ -32,9 +32,20 @@ struct bpf_map_data {
  * One ELF file can contain multiple BPF programs which will be loaded
  * and their FDs stored stored in prog_fd array
  *
+ * If pin is set, a decoder previously loaded with the same parameters and
+ * raw patterns is reused from /sys/fs/bpf/ir-keytable, and newly loaded
+ * decoders are pinned there.
+ *
  * returns zero on success
  */
-int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param, struct raw_entry *raw);
+int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
+		  struct raw_entry *raw, bool pin);
+
+/*
+ * Remove the decoders pinned in /sys/fs/bpf/ir-keytable that are not
+ * attached to any lirc device.
+ */
+void bpf_remove_stale_pins(void);
 
 int bpf_param(struct protocol_param *param, const char *name, int *val);
 
@@ -0,0 +1,767 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+// Binary cache of the keymaps referenced by rc_maps.cfg, see keymap-cache.h
+
+#include <config.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <argp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "keymap-cache.h"
+
+#ifdef ENABLE_NLS
+# define _(string) gettext(string)
+# include "gettext.h"
+# include <locale.h>
+# include <langinfo.h>
+# include <iconv.h>
+#else
+# define _(string) string
+#endif
+
+#define CACHE_MAGIC	0x434b5249	/* "IRKC" */
+#define CACHE_VERSION	1
+#define CACHE_NONE	0xffffffffU
+
+/* struct cache_file flags */
+#define CACHE_FILE_MISSING	(1 << 0)	/* not found, name is the system keymap */
+#define CACHE_FILE_BROKEN	(1 << 1)	/* failed to parse */
+
+/*
+ * File layout: the header followed by the sections, each aligned to
+ * 8 bytes. All values are in host byte order, the cache is not meant to
+ * be shared between machines. Strings are referenced by their offset in
+ * the string section.
+ */
+enum cache_sect {
+	SECT_BUCKETS,	/* uint32_t: first rule of each hash chain */
+	SECT_RULES,	/* struct cache_rule */
+	SECT_FILES,	/* struct cache_file */
+	SECT_MAPS,	/* struct cache_map */
+	SECT_PARAMS,	/* struct cache_param */
+	SECT_KEYS,	/* struct cache_key */
+	SECT_RAWS,	/* struct cache_raw */
+	SECT_RAW_DATA,	/* uint32_t */
+	SECT_STRINGS,	/* char */
+	SECT_MAX
+};
+
+struct cache_stamp {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t size;
+	uint64_t ino;
+};
+
+struct cache_section {
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	struct cache_stamp cfg;
+	struct cache_stamp user_dir;
+	uint32_t cfg_name;
+	/* first rule with table "*", these can't be hashed */
+	uint32_t wildcard;
+	struct cache_section sect[SECT_MAX];
+};
+
+struct cache_rule {
+	uint32_t driver;
+	uint32_t table;
+	uint32_t file;
+	/* next rule in the same hash chain, always a higher index */
+	uint32_t next;
+};
+
+struct cache_file {
+	struct cache_stamp stamp;
+	uint32_t name;
+	uint32_t map;
+	uint32_t n_maps;
+	uint32_t flags;
+};
+
+struct cache_map {
+	uint32_t protocol;
+	uint32_t param;
+	uint32_t n_params;
+	uint32_t key;
+	uint32_t n_keys;
+	uint32_t raw;
+	uint32_t n_raws;
+};
+
+struct cache_param {
+	uint32_t name;
+	uint32_t pad;
+	int64_t value;
+};
+
+struct cache_key {
+	uint64_t scancode;
+	uint32_t keycode;
+	uint32_t pad;
+};
+
+struct cache_raw {
+	uint32_t keycode;
+	uint32_t length;
+	uint32_t data;
+};
+
+static const size_t sect_elem_size[SECT_MAX] = {
+	[SECT_BUCKETS] = sizeof(uint32_t),
+	[SECT_RULES] = sizeof(struct cache_rule),
+	[SECT_FILES] = sizeof(struct cache_file),
+	[SECT_MAPS] = sizeof(struct cache_map),
+	[SECT_PARAMS] = sizeof(struct cache_param),
+	[SECT_KEYS] = sizeof(struct cache_key),
+	[SECT_RAWS] = sizeof(struct cache_raw),
+	[SECT_RAW_DATA] = sizeof(uint32_t),
+	[SECT_STRINGS] = 1,
+};
+
+struct keymap_cache {
+	void *base;
+	size_t size;
+	const struct cache_hdr *hdr;
+	const uint32_t *buckets;
+	const struct cache_rule *rules;
+	const struct cache_file *files;
+	const struct cache_map *maps;
+	const struct cache_param *params;
+	const struct cache_key *keys;
+	const struct cache_raw *raws;
+	const uint32_t *raw_data;
+	const char *strings;
+};
+
+static uint32_t table_hash(const char *table)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; *table; table++) {
+		hash ^= (unsigned char)tolower((unsigned char)*table);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void get_stamp(const char *fname, struct cache_stamp *stamp)
+{
+	struct stat st;
+
+	memset(stamp, 0, sizeof(*stamp));
+	if (stat(fname, &st))
+		return;
+	stamp->mtime_sec = st.st_mtim.tv_sec;
+	stamp->mtime_nsec = st.st_mtim.tv_nsec;
+	stamp->size = st.st_size;
+	stamp->ino = st.st_ino;
+}
+
+static bool stamp_changed(const char *fname, const struct cache_stamp *stamp)
+{
+	struct cache_stamp cur;
+
+	get_stamp(fname, &cur);
+	return memcmp(&cur, stamp, sizeof(cur)) != 0;
+}
+
+/*
+ * Building the cache
+ */
+
+struct cache_builder {
+	struct cache_hdr hdr;
+	char *data[SECT_MAX];
+	size_t size[SECT_MAX];
+};
+
+static uint32_t sect_add(struct cache_builder *b, enum cache_sect sect,
+			 const void *elem, size_t count)
+{
+	size_t esize = sect_elem_size[sect];
+	uint32_t idx = b->hdr.sect[sect].count;
+	size_t need = (idx + count) * esize;
+
+	if (need > b->size[sect]) {
+		size_t size = b->size[sect] ? b->size[sect] : 256;
+		char *data;
+
+		while (size < need)
+			size *= 2;
+		data = realloc(b->data[sect], size);
+		if (!data)
+			return CACHE_NONE;
+		b->data[sect] = data;
+		b->size[sect] = size;
+	}
+	memcpy(b->data[sect] + idx * esize, elem, count * esize);
+	b->hdr.sect[sect].count += count;
+	return idx;
+}
+
+static uint32_t add_string(struct cache_builder *b, const char *s)
+{
+	return sect_add(b, SECT_STRINGS, s ? s : "", strlen(s ? s : "") + 1);
+}
+
+static int resolve_keycode(int (*keycode)(const char *name),
+			   const char *fname, const char *name)
+{
+	int value = keycode(name);
+	char *p;
+
+	if (value != -1)
+		return value;
+	errno = 0;
+	value = strtol(name, &p, 0);
+	if (errno || *p) {
+		fprintf(stderr, _("%s: keycode `%s' not recognised, no mapping\n"),
+			fname, name);
+		return -1;
+	}
+	return value;
+}
+
+/*
+ * Keymaps that are missing or fail to parse are stored without maps, with
+ * the stamp of the missing or broken file so a fixed keymap is noticed.
+ */
+static uint32_t add_file(struct cache_builder *b, const char *fname,
+			 bool missing, int (*keycode)(const char *name),
+			 bool verbose)
+{
+	struct cache_file file = {};
+	struct keymap *keymap = NULL, *map;
+
+	get_stamp(fname, &file.stamp);
+	file.name = add_string(b, fname);
+	file.map = b->hdr.sect[SECT_MAPS].count;
+	if (missing) {
+		file.flags = CACHE_FILE_MISSING;
+		return sect_add(b, SECT_FILES, &file, 1);
+	}
+	if (parse_keymap((char *)fname, &keymap, verbose)) {
+		if (verbose)
+			fprintf(stderr, _("Can't load %s keymap\n"), fname);
+		file.flags = CACHE_FILE_BROKEN;
+		return sect_add(b, SECT_FILES, &file, 1);
+	}
+
+	for (map = keymap; map; map = map->next) {
+		struct cache_map cmap = {};
+		struct protocol_param *param;
+		struct scancode_entry *se;
+		struct raw_entry *re;
+
+		cmap.protocol = add_string(b, map->protocol);
+		cmap.param = b->hdr.sect[SECT_PARAMS].count;
+		for (param = map->param; param; param = param->next) {
+			struct cache_param cparam = {
+				.name = add_string(b, param->name),
+				.value = param->value,
+			};
+
+			sect_add(b, SECT_PARAMS, &cparam, 1);
+			cmap.n_params++;
+		}
+		cmap.key = b->hdr.sect[SECT_KEYS].count;
+		for (se = map->scancode; se; se = se->next) {
+			struct cache_key ckey = { .scancode = se->scancode };
+			int value = resolve_keycode(keycode, fname, se->keycode);
+
+			if (value == -1)
+				continue;
+			ckey.keycode = value;
+			sect_add(b, SECT_KEYS, &ckey, 1);
+			cmap.n_keys++;
+		}
+		cmap.raw = b->hdr.sect[SECT_RAWS].count;
+		for (re = map->raw; re; re = re->next) {
+			struct cache_raw craw = { .length = re->raw_length };
+			int value = resolve_keycode(keycode, fname, re->keycode);
+
+			if (value == -1)
+				continue;
+			craw.keycode = value;
+			craw.data = sect_add(b, SECT_RAW_DATA, re->raw, re->raw_length);
+			sect_add(b, SECT_RAWS, &craw, 1);
+			cmap.n_raws++;
+		}
+		sect_add(b, SECT_MAPS, &cmap, 1);
+		file.n_maps++;
+	}
+	free_keymap(keymap);
+	return sect_add(b, SECT_FILES, &file, 1);
+}
+
+static int write_cache(struct cache_builder *b, const char *fname)
+{
+	static const char zeros[8];
+	char *tmp_fname, *dir;
+	size_t offset;
+	FILE *fout;
+	int fd, i;
+
+	dir = strdup(fname);
+	if (dir) {
+		/* Best effort, only the last component is created */
+		mkdir(dirname(dir), 0755);
+		free(dir);
+	}
+	if (asprintf(&tmp_fname, "%s.XXXXXX", fname) < 0)
+		return -ENOMEM;
+	fd = mkstemp(tmp_fname);
+	if (fd < 0 || !(fout = fdopen(fd, "w"))) {
+		int err = -errno;
+
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_fname);
+		}
+		free(tmp_fname);
+		return err;
+	}
+	fchmod(fd, 0644);
+
+	offset = (sizeof(b->hdr) + 7) & ~7;
+	for (i = 0; i < SECT_MAX; i++) {
+		b->hdr.sect[i].offset = offset;
+		offset += (b->hdr.sect[i].count * sect_elem_size[i] + 7) & ~7;
+	}
+	b->hdr.size = offset;
+
+	fwrite(&b->hdr, sizeof(b->hdr), 1, fout);
+	fwrite(zeros, ((sizeof(b->hdr) + 7) & ~7) - sizeof(b->hdr), 1, fout);
+	for (i = 0; i < SECT_MAX; i++) {
+		size_t len = b->hdr.sect[i].count * sect_elem_size[i];
+
+		fwrite(b->data[i], len, 1, fout);
+		fwrite(zeros, ((len + 7) & ~7) - len, 1, fout);
+	}
+	if (fflush(fout) || ferror(fout) || fsync(fd)) {
+		int err = -errno;
+
+		fclose(fout);
+		unlink(tmp_fname);
+		free(tmp_fname);
+		return err;
+	}
+	fclose(fout);
+	if (rename(tmp_fname, fname)) {
+		int err = -errno;
+
+		unlink(tmp_fname);
+		free(tmp_fname);
+		return err;
+	}
+	free(tmp_fname);
+	return 0;
+}
+
+int keymap_cache_build(const char *fname, const char *cfg_fname,
+		       const struct keymap_cache_rule *rules, unsigned n_rules,
+		       int (*keycode)(const char *name), bool verbose)
+{
+	struct cache_builder b = {};
+	uint32_t *tails = NULL, wildcard_tail = CACHE_NONE;
+	char **fnames = NULL;
+	unsigned n_buckets = 16;
+	unsigned i, j;
+	int ret = -ENOMEM;
+
+	b.hdr.magic = CACHE_MAGIC;
+	b.hdr.version = CACHE_VERSION;
+	get_stamp(cfg_fname, &b.hdr.cfg);
+	get_stamp(IR_KEYTABLE_USER_DIR, &b.hdr.user_dir);
+	b.hdr.cfg_name = add_string(&b, cfg_fname);
+	b.hdr.wildcard = CACHE_NONE;
+
+	while (n_buckets < n_rules)
+		n_buckets *= 2;
+	tails = malloc(n_buckets * sizeof(*tails));
+	if (!tails)
+		goto out;
+	for (i = 0; i < n_buckets; i++) {
+		tails[i] = CACHE_NONE;
+		if (sect_add(&b, SECT_BUCKETS, &tails[i], 1) == CACHE_NONE)
+			goto out;
+	}
+
+	fnames = calloc(n_rules + 1, sizeof(*fnames));
+	if (!fnames)
+		goto out;
+
+	for (i = 0; i < n_rules; i++) {
+		struct cache_rule rule = {
+			.driver = add_string(&b, rules[i].driver),
+			.table = add_string(&b, rules[i].table),
+			.file = CACHE_NONE,
+			.next = CACHE_NONE,
+		};
+		uint32_t *buckets, *prev;
+
+		/*
+		 * A missing keymap is recorded by its system keymap file name,
+		 * a new user keymap changes the user directory stamp.
+		 */
+		if (rules[i].fname)
+			fnames[i] = strdup(rules[i].fname);
+		else if (asprintf(&fnames[i], IR_KEYTABLE_SYSTEM_DIR "/%s",
+				  rules[i].name) < 0)
+			fnames[i] = NULL;
+		if (!fnames[i])
+			goto out;
+
+		/* Each keymap file is stored only once */
+		for (j = 0; j < i; j++) {
+			if (!strcmp(fnames[i], fnames[j])) {
+				const struct cache_rule *r =
+					(struct cache_rule *)b.data[SECT_RULES] + j;
+
+				rule.file = r->file;
+				break;
+			}
+		}
+		if (j == i)
+			rule.file = add_file(&b, fnames[i], !rules[i].fname,
+					     keycode, verbose);
+
+		if (rule.file == CACHE_NONE ||
+		    sect_add(&b, SECT_RULES, &rule, 1) == CACHE_NONE)
+			goto out;
+
+		/* Append to the hash chain, so the chains are in rc_maps.cfg order */
+		buckets = (uint32_t *)b.data[SECT_BUCKETS];
+		if (!strcmp(rules[i].table, "*")) {
+			prev = wildcard_tail == CACHE_NONE ? &b.hdr.wildcard :
+				&((struct cache_rule *)b.data[SECT_RULES])[wildcard_tail].next;
+			wildcard_tail = i;
+		} else {
+			uint32_t h = table_hash(rules[i].table) & (n_buckets - 1);
+
+			prev = tails[h] == CACHE_NONE ? &buckets[h] :
+				&((struct cache_rule *)b.data[SECT_RULES])[tails[h]].next;
+			tails[h] = i;
+		}
+		*prev = i;
+	}
+
+	/* Make sure the string section is never empty and ends with a NUL */
+	add_string(&b, "");
+	for (i = 0; i < SECT_MAX; i++)
+		if (b.hdr.sect[i].count && !b.data[i])
+			goto out;
+
+	ret = write_cache(&b, fname);
+	if (verbose && !ret)
+		fprintf(stderr, _("Wrote keymap cache %s with %u rules and %u keymaps\n"),
+			fname, n_rules, b.hdr.sect[SECT_FILES].count);
+
+out:
+	if (fnames)
+		for (i = 0; i < n_rules; i++)
+			free(fnames[i]);
+	free(fnames);
+	free(tails);
+	for (i = 0; i < SECT_MAX; i++)
+		free(b.data[i]);
+	return ret;
+}
+
+/*
+ * Using the cache
+ */
+
+static bool valid_string(const struct keymap_cache *cache, uint32_t s)
+{
+	return s < cache->hdr->sect[SECT_STRINGS].count;
+}
+
+static bool valid_range(const struct keymap_cache *cache, enum cache_sect sect,
+			uint32_t first, uint32_t count)
+{
+	uint32_t max = cache->hdr->sect[sect].count;
+
+	return first <= max && count <= max - first;
+}
+
+/* Check all indices once, so they can be used without checks later */
+static bool cache_validate(const struct keymap_cache *cache)
+{
+	const struct cache_hdr *hdr = cache->hdr;
+	uint32_t n_rules = hdr->sect[SECT_RULES].count;
+	uint32_t i, j;
+
+	if (!hdr->sect[SECT_STRINGS].count ||
+	    cache->strings[hdr->sect[SECT_STRINGS].count - 1] ||
+	    !valid_string(cache, hdr->cfg_name) ||
+	    (hdr->wildcard != CACHE_NONE && hdr->wildcard >= n_rules) ||
+	    !hdr->sect[SECT_BUCKETS].count ||
+	    (hdr->sect[SECT_BUCKETS].count & (hdr->sect[SECT_BUCKETS].count - 1)))
+		return false;
+
+	for (i = 0; i < hdr->sect[SECT_BUCKETS].count; i++)
+		if (cache->buckets[i] != CACHE_NONE && cache->buckets[i] >= n_rules)
+			return false;
+
+	for (i = 0; i < n_rules; i++) {
+		const struct cache_rule *rule = &cache->rules[i];
+
+		if (!valid_string(cache, rule->driver) ||
+		    !valid_string(cache, rule->table) ||
+		    (rule->file != CACHE_NONE &&
+		     rule->file >= hdr->sect[SECT_FILES].count) ||
+		    (rule->next != CACHE_NONE &&
+		     (rule->next <= i || rule->next >= n_rules)))
+			return false;
+	}
+
+	for (i = 0; i < hdr->sect[SECT_FILES].count; i++) {
+		const struct cache_file *file = &cache->files[i];
+
+		if (!valid_string(cache, file->name) ||
+		    !valid_range(cache, SECT_MAPS, file->map, file->n_maps))
+			return false;
+	}
+
+	for (i = 0; i < hdr->sect[SECT_MAPS].count; i++) {
+		const struct cache_map *map = &cache->maps[i];
+
+		if (!valid_string(cache, map->protocol) ||
+		    !valid_range(cache, SECT_PARAMS, map->param, map->n_params) ||
+		    !valid_range(cache, SECT_KEYS, map->key, map->n_keys) ||
+		    !valid_range(cache, SECT_RAWS, map->raw, map->n_raws))
+			return false;
+		for (j = 0; j < map->n_params; j++)
+			if (!valid_string(cache, cache->params[map->param + j].name))
+				return false;
+	}
+
+	for (i = 0; i < hdr->sect[SECT_RAWS].count; i++) {
+		const struct cache_raw *raw = &cache->raws[i];
+
+		if (!raw->length ||
+		    !valid_range(cache, SECT_RAW_DATA, raw->data, raw->length))
+			return false;
+	}
+	return true;
+}
+
+struct keymap_cache *keymap_cache_open(const char *fname, const char *cfg_fname)
+{
+	struct keymap_cache *cache;
+	const struct cache_hdr *hdr;
+	struct stat st;
+	int fd, i;
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*hdr)) {
+		close(fd);
+		errno = ESTALE;
+		return NULL;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	cache->size = st.st_size;
+	cache->base = mmap(NULL, cache->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (cache->base == MAP_FAILED) {
+		free(cache);
+		errno = ESTALE;
+		return NULL;
+	}
+
+	hdr = cache->hdr = cache->base;
+	if (hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION ||
+	    hdr->size != cache->size)
+		goto stale;
+	for (i = 0; i < SECT_MAX; i++) {
+		uint64_t end = hdr->sect[i].offset +
+			(uint64_t)hdr->sect[i].count * sect_elem_size[i];
+
+		if ((hdr->sect[i].offset & 7) || end > cache->size)
+			goto stale;
+	}
+
+#define SECT_PTR(s) ((const void *)((const char *)cache->base + hdr->sect[s].offset))
+	cache->buckets = SECT_PTR(SECT_BUCKETS);
+	cache->rules = SECT_PTR(SECT_RULES);
+	cache->files = SECT_PTR(SECT_FILES);
+	cache->maps = SECT_PTR(SECT_MAPS);
+	cache->params = SECT_PTR(SECT_PARAMS);
+	cache->keys = SECT_PTR(SECT_KEYS);
+	cache->raws = SECT_PTR(SECT_RAWS);
+	cache->raw_data = SECT_PTR(SECT_RAW_DATA);
+	cache->strings = SECT_PTR(SECT_STRINGS);
+#undef SECT_PTR
+
+	if (!cache_validate(cache) ||
+	    strcmp(cache->strings + hdr->cfg_name, cfg_fname) ||
+	    stamp_changed(cfg_fname, &hdr->cfg) ||
+	    stamp_changed(IR_KEYTABLE_USER_DIR, &hdr->user_dir))
+		goto stale;
+	return cache;
+
+stale:
+	keymap_cache_close(cache);
+	errno = ESTALE;
+	return NULL;
+}
+
+void keymap_cache_close(struct keymap_cache *cache)
+{
+	if (!cache)
+		return;
+	munmap(cache->base, cache->size);
+	free(cache);
+}
+
+static bool rule_matches(const struct keymap_cache *cache,
+			 const struct cache_rule *rule,
+			 const char *driver, const char *table)
+{
+	const char *rdriver = cache->strings + rule->driver;
+	const char *rtable = cache->strings + rule->table;
+
+	if ((!driver || strcasecmp(rdriver, driver)) && strcmp(rdriver, "*"))
+		return false;
+	if ((!table || strcasecmp(rtable, table)) && strcmp(rtable, "*"))
+		return false;
+	return true;
+}
+
+/*
+ * Find the rules matching driver and table, in rc_maps.cfg order. That is
+ * the merge of the hash chain of table and the chain of wildcard tables.
+ * Returns the number of matches, or -ESTALE if one of the keymap files
+ * changed since the cache was built.
+ */
+static int find_rules(const struct keymap_cache *cache, const char *driver,
+		      const char *table, uint32_t *matches)
+{
+	uint32_t n_buckets = cache->hdr->sect[SECT_BUCKETS].count;
+	uint32_t a = CACHE_NONE, w = cache->hdr->wildcard;
+	int n = 0;
+
+	if (table)
+		a = cache->buckets[table_hash(table) & (n_buckets - 1)];
+
+	while (a != CACHE_NONE || w != CACHE_NONE) {
+		const struct cache_rule *rule;
+		uint32_t i;
+
+		if (w == CACHE_NONE || (a != CACHE_NONE && a < w)) {
+			i = a;
+			a = cache->rules[a].next;
+		} else {
+			i = w;
+			w = cache->rules[w].next;
+		}
+		rule = &cache->rules[i];
+		if (!rule_matches(cache, rule, driver, table))
+			continue;
+		if (rule->file == CACHE_NONE ||
+		    stamp_changed(cache->strings + cache->files[rule->file].name,
+				  &cache->files[rule->file].stamp))
+			return -ESTALE;
+		matches[n++] = i;
+	}
+	return n;
+}
+
+static struct protocol_param *load_params(const struct keymap_cache *cache,
+					  const struct cache_map *map)
+{
+	struct protocol_param *list = NULL;
+	uint32_t i;
+
+	for (i = map->n_params; i > 0; i--) {
+		const struct cache_param *cparam = &cache->params[map->param + i - 1];
+		struct protocol_param *param = malloc(sizeof(*param));
+
+		if (!param)
+			break;
+		param->name = strdup(cache->strings + cparam->name);
+		param->value = cparam->value;
+		param->next = list;
+		list = param;
+	}
+	return list;
+}
+
+int keymap_cache_load(struct keymap_cache *cache, const char *driver,
+		      const char *table, const struct keymap_cache_ops *ops)
+{
+	uint32_t *matches;
+	int n, i;
+
+	matches = malloc(cache->hdr->sect[SECT_RULES].count * sizeof(*matches) + 1);
+	if (!matches)
+		return -ENOMEM;
+
+	/* Check all keymaps first, so nothing is loaded if the cache is stale */
+	n = find_rules(cache, driver, table, matches);
+	for (i = 0; i < n; i++) {
+		const struct cache_file *file = &cache->files[cache->rules[matches[i]].file];
+		const char *fname = cache->strings + file->name;
+
+		if (file->flags & CACHE_FILE_MISSING) {
+			fprintf(stderr, _("error: Unable to find keymap %s in %s or %s\n"),
+				fname + strlen(IR_KEYTABLE_SYSTEM_DIR "/"),
+				IR_KEYTABLE_USER_DIR, IR_KEYTABLE_SYSTEM_DIR);
+			n = -EINVAL;
+		} else if (file->flags & CACHE_FILE_BROKEN) {
+			fprintf(stderr, _("Can't load %s keymap\n"), fname);
+			n = -EINVAL;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		const struct cache_file *file = &cache->files[cache->rules[matches[i]].file];
+		uint32_t m, j;
+
+		for (m = file->map; m < file->map + file->n_maps; m++) {
+			const struct cache_map *map = &cache->maps[m];
+
+			ops->add_protocol(cache->strings + map->protocol,
+					  load_params(cache, map));
+			for (j = 0; j < map->n_keys; j++) {
+				const struct cache_key *key = &cache->keys[map->key + j];
+
+				ops->add_key(key->scancode, key->keycode);
+			}
+			for (j = 0; j < map->n_raws; j++) {
+				const struct cache_raw *raw = &cache->raws[map->raw + j];
+
+				ops->add_raw(cache->raw_data + raw->data,
+					     raw->length, raw->keycode);
+			}
+		}
+	}
+	free(matches);
+	return n;
+}
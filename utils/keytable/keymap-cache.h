@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __KEYMAP_CACHE_H
+#define __KEYMAP_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "keymap.h"
+
+/*
+ * Binary cache of all keymaps referenced by a rc_maps.cfg file, so
+ * ir-keytable --auto-load doesn't have to parse the configuration file
+ * and the keymaps at every boot.
+ *
+ * The cache is mmap()ed and indexed by table name. It stores the keycodes
+ * already resolved to numbers. It is considered stale if the configuration
+ * file, the user keymap directory or any of the keymaps used changed since
+ * it was built. Keymaps that are missing or can't be parsed are recorded as
+ * such, loading them fails until they show up or change.
+ */
+
+struct keymap_cache;
+
+/* A driver/table => keymap file line of rc_maps.cfg */
+struct keymap_cache_rule {
+	const char *driver;
+	const char *table;
+	/* keymap file name as written in rc_maps.cfg */
+	const char *name;
+	/* resolved keymap file name, NULL if it wasn't found */
+	const char *fname;
+};
+
+/* Called for each keymap section of the matching keymap files */
+struct keymap_cache_ops {
+	/* ownership of the param list is passed on */
+	void (*add_protocol)(const char *protocol, struct protocol_param *param);
+	void (*add_key)(uint64_t scancode, uint32_t keycode);
+	void (*add_raw)(const uint32_t *raw, uint32_t raw_length, uint32_t keycode);
+};
+
+int keymap_cache_build(const char *fname, const char *cfg_fname,
+		       const struct keymap_cache_rule *rules, unsigned n_rules,
+		       int (*keycode)(const char *name), bool verbose);
+
+struct keymap_cache *keymap_cache_open(const char *fname, const char *cfg_fname);
+void keymap_cache_close(struct keymap_cache *cache);
+int keymap_cache_load(struct keymap_cache *cache, const char *driver,
+		      const char *table, const struct keymap_cache_ops *ops);
+
+#endif
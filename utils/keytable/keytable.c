@@ -35,6 +35,7 @@
 #include "ir-encode.h"
 #include "parse.h"
 #include "keymap.h"
+#include "keymap-cache.h"
 
 #ifdef HAVE_BPF
 #include <bpf/bpf.h>
@@ -53,6 +54,8 @@
 
 # define N_(string) string
 
+#define KEYMAP_CACHE_FILE	IR_KEYTABLE_CACHE_DIR "/keymaps.cache"
+
 struct input_keymap_entry_v2 {
 #define KEYMAP_BY_INDEX	(1 << 0)
 	uint8_t  flags;
@@ -275,6 +278,9 @@ static const struct argp_option options[] = {
 	{"period",	'P',	N_("PERIOD"),	0,	N_("Sets the period to repeat a keystroke"), 0},
 	{"auto-load",	'a',	N_("CFGFILE"),	0,	N_("Auto-load keymaps, based on a configuration file. Only works with --sysdev."), 0},
 	{"test-keymap",	1,	N_("KEYMAP"),	0,	N_("Test if keymap is valid"), 0},
+	{"build-cache",	2,	N_("CFGFILE"),	0,	N_("Build the keymap cache used by --auto-load for a configuration file"), 0},
+	{"no-cache",	3,	0,		0,	N_("Don't use the keymap cache with --auto-load"), 0},
+	{"no-pin",	4,	0,		0,	N_("Don't reuse or pin BPF protocols in bpffs"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -292,6 +298,10 @@ static int test = 0;
 static int delay = -1;
 static int period = -1;
 static int test_keymap = 0;
+static char *cfg_fname = NULL;
+static char *build_cache = NULL;
+static int no_cache = 0;
+static int no_pin = 0;
 static enum sysfs_protocols ch_proto = 0;
 
 struct bpf_protocol {
@@ -372,82 +382,126 @@ static void add_bpf_protocol(struct bpf_protocol *new)
 	bpf_protocol = new;
 }
 
+static void free_protocol_params(struct protocol_param *param)
+{
+	while (param) {
+		struct protocol_param *next = param->next;
+
+		free(param->name);
+		free(param);
+		param = next;
+	}
+}
+
+static void add_protocol(const char *name, struct protocol_param *param)
+{
+	enum sysfs_protocols protocol;
+
+	protocol = parse_sysfs_protocol(name, false);
+	if (protocol == SYSFS_INVALID) {
+		if (strcmp(name, "none")) {
+			struct bpf_protocol *b;
+
+			b = malloc(sizeof(*b));
+			b->name = strdup(name);
+			b->param = param;
+			add_bpf_protocol(b);
+			return;
+		}
+	} else {
+		ch_proto |= protocol;
+	}
+	free_protocol_params(param);
+}
+
+static void add_key(uint64_t scancode, uint32_t keycode)
+{
+	struct keytable_entry *ke;
+
+	ke = malloc(sizeof(*ke));
+	ke->scancode = scancode;
+	ke->keycode = keycode;
+	ke->next = keytable;
+
+	keytable = ke;
+}
+
+static void add_raw_entry(struct raw_entry *re, uint32_t keycode)
+{
+	add_key(raw_scancode, keycode);
+
+	re->scancode = raw_scancode++;
+	re->next = rawtable;
+	rawtable = re;
+}
+
+static void add_raw(const uint32_t *raw, uint32_t raw_length, uint32_t keycode)
+{
+	struct raw_entry *re;
+
+	re = calloc(1, sizeof(*re) + sizeof(re->raw[0]) * raw_length);
+	if (!re) {
+		perror("add_raw");
+		return;
+	}
+	re->raw_length = raw_length;
+	memcpy(re->raw, raw, sizeof(re->raw[0]) * raw_length);
+	add_raw_entry(re, keycode);
+}
+
+static const struct keymap_cache_ops cache_ops = {
+	.add_protocol = add_protocol,
+	.add_key = add_key,
+	.add_raw = add_raw,
+};
+
+static int parse_keycode(const char *keycode)
+{
+	int value;
+	char *p;
+
+	value = parse_code(keycode);
+	if (debug)
+		fprintf(stderr, _("\tvalue=%d\n"), value);
+
+	if (value == -1) {
+		errno = 0;
+		value = strtol(keycode, &p, 0);
+		if (errno || *p)
+			return -1;
+	}
+	return value;
+}
+
 static int add_keymap(struct keymap *map, const char *fname)
 {
 	for (; map; map = map->next) {
-		enum sysfs_protocols protocol;
-		struct keytable_entry *ke;
 		struct scancode_entry *se;
 		struct raw_entry *re, *re_next;
 
-		protocol = parse_sysfs_protocol(map->protocol, false);
-		if (protocol == SYSFS_INVALID) {
-			if (strcmp(map->protocol, "none")) {
-				struct bpf_protocol *b;
-
-				b = malloc(sizeof(*b));
-				b->name = strdup(map->protocol);
-				b->param = map->param;
-				/* steal param */
-				map->param = NULL;
-				add_bpf_protocol(b);
-			}
-		} else {
-			ch_proto |= protocol;
-		}
+		/* steal param */
+		add_protocol(map->protocol, map->param);
+		map->param = NULL;
 
 		for (se = map->scancode; se; se = se->next) {
-			int value;
-			char *p;
-
-			value = parse_code(se->keycode);
-			if (debug)
-				fprintf(stderr, _("\tvalue=%d\n"), value);
+			int value = parse_keycode(se->keycode);
 
 			if (value == -1) {
-				value = strtol(se->keycode, &p, 0);
-				if (errno || *p) {
-					fprintf(stderr, _("%s: keycode `%s' not recognised, no mapping for scancode 0x04%llx\n"), fname, se->keycode, (unsigned long long)se->scancode);
-					continue;
-				}
+				fprintf(stderr, _("%s: keycode `%s' not recognised, no mapping for scancode 0x04%llx\n"), fname, se->keycode, (unsigned long long)se->scancode);
+				continue;
 			}
-
-			ke = malloc(sizeof(*ke));
-			ke->scancode = se->scancode;
-			ke->keycode = value;
-			ke->next = keytable;
-
-			keytable = ke;
+			add_key(se->scancode, value);
 		}
 
 		for (re = map->raw; re; re = re_next) {
-			int value;
-			char *p;
+			int value = parse_keycode(re->keycode);
 
 			re_next = re->next;
-
-			value = parse_code(re->keycode);
-			if (debug)
-				fprintf(stderr, _("\tvalue=%d\n"), value);
-
 			if (value == -1) {
-				value = strtol(re->keycode, &p, 0);
-				if (errno || *p) {
-					fprintf(stderr, _("%s: keycode `%s' not recognised, no mapping\n"), fname, re->keycode);
-					continue;
-				}
+				fprintf(stderr, _("%s: keycode `%s' not recognised, no mapping\n"), fname, re->keycode);
+				continue;
 			}
-
-			ke = malloc(sizeof(*ke));
-			ke->scancode = raw_scancode;
-			ke->keycode = value;
-			ke->next = keytable;
-
-			keytable = ke;
-
-			re->scancode = raw_scancode++;
-			re->next = rawtable;
-			rawtable = re;
+			add_raw_entry(re, value);
 		}
 
 		/* Steal the raw entries */
@@ -574,12 +628,9 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		free_keymap(map);
 		break;
 	}
-	case 'a': {
-		rc = parse_cfgfile(arg);
-		if (rc)
-			argp_error(state, _("Failed to read config file %s"), arg);
+	case 'a':
+		cfg_fname = arg;
 		break;
-	}
 	case 'k':
 		p = strtok(arg, ":=");
 		do {
@@ -703,6 +754,15 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		add_keymap(map, arg);
 		free_keymap(map);
 		break;
+	case 2:
+		build_cache = arg;
+		break;
+	case 3:
+		no_cache++;
+		break;
+	case 4:
+		no_pin++;
+		break;
 	case '?':
 		argp_state_help(state, state->out_stream,
 				ARGP_HELP_SHORT_USAGE | ARGP_HELP_LONG
@@ -1779,7 +1839,7 @@ static bool attach_bpf(const char *lirc_name, const char *bpf_prog, struct proto
 	rl.rlim_cur = rl.rlim_max = HIGH_RLIMIT_MEMLOCK;
 	(void) setrlimit(RLIMIT_MEMLOCK, &rl);
 
-	ret = load_bpf_file(bpf_prog, fd, param, rawtable);
+	ret = load_bpf_file(bpf_prog, fd, param, rawtable, !no_pin);
 	close(fd);
 
 	return ret == 0;
@@ -1888,6 +1948,15 @@ static void clear_bpf(const char *lirc_name)
 	if (debug)
 		fprintf(stderr, _("BPF protocols removed\n"));
 }
+
+/*
+ * Only called once the new protocols are attached, so the decoders that
+ * were detached by clear_bpf() and loaded again are reused
+ */
+static void remove_stale_bpf(void)
+{
+	bpf_remove_stale_pins();
+}
 #else
 static bool attach_bpf(const char *lirc_name, const char *bpf_prog, struct protocol_param *param)
 {
@@ -1896,6 +1965,7 @@ static bool attach_bpf(const char *lirc_name, const char *bpf_prog, struct proto
 }
 static void show_bpf(const char *lirc_name) {}
 static void clear_bpf(const char *lirc_name) {}
+static void remove_stale_bpf(void) {}
 #endif
 
 static int show_sysfs_attribs(struct rc_device *rc_dev, char *name)
@@ -2030,6 +2100,127 @@ char* keymap_to_filename(const char *fname)
 	return NULL;
 }
 
+static int build_keymap_cache(const char *fname)
+{
+	struct keymap_cache_rule *rules;
+	struct cfgfile *cur;
+	unsigned n_rules = 0, i;
+	int rc;
+
+	for (cur = &cfg; cur->next; cur = cur->next)
+		n_rules++;
+
+	rules = calloc(n_rules + 1, sizeof(*rules));
+	if (!rules)
+		return -ENOMEM;
+
+	for (cur = &cfg, i = 0; cur->next; cur = cur->next, i++) {
+		rules[i].driver = cur->driver;
+		rules[i].table = cur->table;
+		rules[i].name = cur->fname;
+		rules[i].fname = keymap_to_filename(cur->fname);
+	}
+
+	rc = keymap_cache_build(KEYMAP_CACHE_FILE, fname, rules, n_rules,
+				parse_code, debug);
+
+	for (i = 0; i < n_rules; i++)
+		free((char *)rules[i].fname);
+	free(rules);
+
+	return rc;
+}
+
+/*
+ * Loads the keymaps matching the device, preferably from the keymap cache.
+ * If the cache is missing or stale, the configuration file is parsed and the
+ * cache is rebuilt. Returns the number of matching keymaps, or -1 on error.
+ */
+static int auto_load(struct rc_device *rc_dev)
+{
+	struct keymap_cache *cache = NULL;
+	struct cfgfile *cur;
+	struct keymap *map;
+	bool stale = false;
+	char *fname;
+	int matches = 0;
+	int rc;
+
+	if (!no_cache) {
+		cache = keymap_cache_open(KEYMAP_CACHE_FILE, cfg_fname);
+		if (!cache)
+			stale = errno == ESTALE || errno == ENOENT;
+	}
+
+	if (cache) {
+		matches = keymap_cache_load(cache, rc_dev->drv_name,
+					    rc_dev->keytable_name, &cache_ops);
+		keymap_cache_close(cache);
+		if (matches >= 0) {
+			if (debug)
+				fprintf(stderr, _("Loaded %d keymap(s) from %s\n"),
+					matches, KEYMAP_CACHE_FILE);
+			return matches;
+		}
+		/* A missing or broken keymap, as recorded in the cache */
+		if (matches == -EINVAL)
+			return -1;
+		stale = true;
+		matches = 0;
+	}
+
+	if (debug && stale)
+		fprintf(stderr, _("Keymap cache %s is stale\n"), KEYMAP_CACHE_FILE);
+
+	if (parse_cfgfile(cfg_fname)) {
+		fprintf(stderr, _("Failed to read config file %s\n"), cfg_fname);
+		return -1;
+	}
+
+	for (cur = &cfg; cur->next; cur = cur->next) {
+		if ((!rc_dev->drv_name || strcasecmp(cur->driver, rc_dev->drv_name)) && strcasecmp(cur->driver, "*"))
+			continue;
+		if ((!rc_dev->keytable_name || strcasecmp(cur->table, rc_dev->keytable_name)) && strcasecmp(cur->table, "*"))
+			continue;
+
+		if (debug)
+			fprintf(stderr, _("Keymap for %s, %s is on %s file.\n"),
+				rc_dev->drv_name, rc_dev->keytable_name,
+				cur->fname);
+
+		fname = keymap_to_filename(cur->fname);
+		if (!fname) {
+			matches = -1;
+			break;
+		}
+
+		rc = parse_keymap(fname, &map, debug);
+		if (rc) {
+			fprintf(stderr, _("Can't load %s keymap\n"), fname);
+			free(fname);
+			matches = -1;
+			break;
+		}
+		add_keymap(map, fname);
+		free_keymap(map);
+		free(fname);
+		matches++;
+	}
+
+	/*
+	 * Best effort, the keymaps are loaded anyway. Missing and broken
+	 * keymaps are recorded, so the cache is used on the next boot too.
+	 */
+	if (stale) {
+		rc = build_keymap_cache(cfg_fname);
+		if (rc && debug)
+			fprintf(stderr, _("Failed to write keymap cache %s: %s\n"),
+				KEYMAP_CACHE_FILE, strerror(-rc));
+	}
+
+	return matches;
+}
+
 int main(int argc, char *argv[])
 {
 	int dev_from_class = 0, write_cnt;
@@ -2048,8 +2239,24 @@ int main(int argc, char *argv[])
 	if (test_keymap)
 		return 0;
 
+	if (build_cache) {
+		int rc;
+
+		if (parse_cfgfile(build_cache)) {
+			fprintf(stderr, _("Failed to read config file %s\n"), build_cache);
+			return -1;
+		}
+		rc = build_keymap_cache(build_cache);
+		if (rc) {
+			fprintf(stderr, _("Failed to write keymap cache %s: %s\n"),
+				KEYMAP_CACHE_FILE, strerror(-rc));
+			return -1;
+		}
+		return 0;
+	}
+
 	/* Just list all devices */
-	if (!clear && !readtable && !keytable && !ch_proto && !cfg.next && !test && delay < 0 && period < 0 && !bpf_protocol) {
+	if (!clear && !readtable && !keytable && !ch_proto && !cfg_fname && !test && delay < 0 && period < 0 && !bpf_protocol) {
 		if (show_sysfs_attribs(&rc_dev, devclass))
 			return -1;
 
@@ -2059,7 +2266,7 @@ int main(int argc, char *argv[])
 	if (!devclass)
 		devclass = "rc0";
 
-	if (cfg.next && (clear || keytable || ch_proto)) {
+	if (cfg_fname && (clear || keytable || ch_proto)) {
 		fprintf (stderr, _("Auto-mode can be used only with --read, --verbose and --sysdev options\n"));
 		return -1;
 	}
@@ -2077,47 +2284,18 @@ int main(int argc, char *argv[])
 
 	dev_from_class++;
 
-	if (cfg.next) {
-		struct cfgfile *cur;
-		struct keymap *map;
-		char *fname;
-		int rc;
-		int matches = 0;
-
-		for (cur = &cfg; cur->next; cur = cur->next) {
-			if ((!rc_dev.drv_name || strcasecmp(cur->driver, rc_dev.drv_name)) && strcasecmp(cur->driver, "*"))
-				continue;
-			if ((!rc_dev.keytable_name || strcasecmp(cur->table, rc_dev.keytable_name)) && strcasecmp(cur->table, "*"))
-				continue;
-
-			if (debug)
-				fprintf(stderr, _("Keymap for %s, %s is on %s file.\n"),
-					rc_dev.drv_name, rc_dev.keytable_name,
-					cur->fname);
-
-			fname = keymap_to_filename(cur->fname);
-			if (!fname)
-				return -1;
-
-			rc = parse_keymap(fname, &map, debug);
-			if (rc < 0) {
-				fprintf(stderr, _("Can't load %s keymap\n"), fname);
-				free(fname);
-				return -1;
-			}
-			add_keymap(map, fname);
-			free_keymap(map);
-			free(fname);
-			clear = 1;
-			matches++;
-		}
+	if (cfg_fname) {
+		int matches = auto_load(&rc_dev);
 
+		if (matches < 0)
+			return -1;
 		if (!matches) {
 			if (debug)
 				fprintf(stderr, _("Keymap for %s, %s not found. Keep as-is\n"),
 				       rc_dev.drv_name, rc_dev.keytable_name);
 			return 0;
 		}
+		clear = 1;
 	}
 
 	if (debug)
@@ -2181,6 +2359,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (ch_proto || bpf_protocol)
+		remove_stale_bpf();
+
 	/*
 	 * Fourth step: display current keytable
 	 */
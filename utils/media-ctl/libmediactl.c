@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -66,11 +67,103 @@ struct media_pad *media_entity_remote_source(struct media_pad *pad)
 	return NULL;
 }
 
+static unsigned int media_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	/* FNV-1a */
+	for (; *name; ++name) {
+		hash ^= (unsigned char)*name;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static unsigned int media_hash_id(__u32 id)
+{
+	return id * 2654435761U;
+}
+
+static void media_invalidate_index(struct media_device *media)
+{
+	free(media->name_index);
+	free(media->id_index);
+	media->name_index = NULL;
+	media->id_index = NULL;
+	media->index_size = 0;
+	media->index_count = 0;
+}
+
+/*
+ * Build the entity lookup hash tables if needed. Entities are inserted in
+ * order with linear probing, so that a lookup finds the first of several
+ * entities sharing a name or id, just like a linear scan would.
+ */
+static bool media_build_index(struct media_device *media)
+{
+	unsigned int size;
+	unsigned int mask;
+	unsigned int i;
+
+	if (media->name_index && media->index_count == media->entities_count)
+		return true;
+
+	media_invalidate_index(media);
+
+	for (size = 16; size < media->entities_count * 2; size <<= 1);
+
+	media->name_index = calloc(size, sizeof(*media->name_index));
+	media->id_index = calloc(size, sizeof(*media->id_index));
+	if (media->name_index == NULL || media->id_index == NULL) {
+		media_invalidate_index(media);
+		return false;
+	}
+
+	mask = size - 1;
+
+	for (i = 0; i < media->entities_count; ++i) {
+		const struct media_entity *entity = &media->entities[i];
+		unsigned int h;
+
+		h = media_hash_name(entity->info.name) & mask;
+		while (media->name_index[h])
+			h = (h + 1) & mask;
+		media->name_index[h] = i + 1;
+
+		h = media_hash_id(entity->info.id) & mask;
+		while (media->id_index[h])
+			h = (h + 1) & mask;
+		media->id_index[h] = i + 1;
+	}
+
+	media->index_size = size;
+	media->index_count = media->entities_count;
+	return true;
+}
+
 struct media_entity *media_get_entity_by_name(struct media_device *media,
 					      const char *name)
 {
+	unsigned int mask;
+	unsigned int h;
 	unsigned int i;
 
+	if (media_build_index(media)) {
+		mask = media->index_size - 1;
+
+		for (h = media_hash_name(name) & mask; media->name_index[h];
+		     h = (h + 1) & mask) {
+			struct media_entity *entity =
+				&media->entities[media->name_index[h] - 1];
+
+			if (strcmp(entity->info.name, name) == 0)
+				return entity;
+		}
+
+		return NULL;
+	}
+
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
 
@@ -85,10 +178,27 @@ struct media_entity *media_get_entity_by_id(struct media_device *media,
 					    __u32 id)
 {
 	bool next = id & MEDIA_ENT_ID_FLAG_NEXT;
+	unsigned int mask;
+	unsigned int h;
 	unsigned int i;
 
 	id &= ~MEDIA_ENT_ID_FLAG_NEXT;
 
+	if (!next && media_build_index(media)) {
+		mask = media->index_size - 1;
+
+		for (h = media_hash_id(id) & mask; media->id_index[h];
+		     h = (h + 1) & mask) {
+			struct media_entity *entity =
+				&media->entities[media->id_index[h] - 1];
+
+			if (entity->info.id == id)
+				return entity;
+		}
+
+		return NULL;
+	}
+
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
 
@@ -207,12 +317,43 @@ static void media_device_close(struct media_device *media)
  * Link setup
  */
 
+static int __media_setup_link(struct media_device *media,
+			      struct media_link *link, __u32 flags)
+{
+	struct media_link_desc ulink = { { 0 } };
+	int ret;
+
+	/* source pad */
+	ulink.source.entity = link->source->entity->info.id;
+	ulink.source.index = link->source->index;
+	ulink.source.flags = MEDIA_PAD_FL_SOURCE;
+
+	/* sink pad */
+	ulink.sink.entity = link->sink->entity->info.id;
+	ulink.sink.index = link->sink->index;
+	ulink.sink.flags = MEDIA_PAD_FL_SINK;
+
+	ulink.flags = flags | (link->flags & MEDIA_LNK_FL_IMMUTABLE);
+
+	ret = ioctl(media->fd, MEDIA_IOC_SETUP_LINK, &ulink);
+	if (ret == -1) {
+		ret = -errno;
+		media_dbg(media, "%s: Unable to setup link (%s)\n",
+			  __func__, strerror(errno));
+		return ret;
+	}
+
+	link->flags = ulink.flags;
+	link->twin->flags = ulink.flags;
+
+	return 0;
+}
+
 int media_setup_link(struct media_device *media,
 		     struct media_pad *source,
 		     struct media_pad *sink,
 		     __u32 flags)
 {
-	struct media_link_desc ulink = { { 0 } };
 	struct media_link *link;
 	unsigned int i;
 	int ret;
@@ -237,30 +378,7 @@ int media_setup_link(struct media_device *media,
 		goto done;
 	}
 
-	/* source pad */
-	ulink.source.entity = source->entity->info.id;
-	ulink.source.index = source->index;
-	ulink.source.flags = MEDIA_PAD_FL_SOURCE;
-
-	/* sink pad */
-	ulink.sink.entity = sink->entity->info.id;
-	ulink.sink.index = sink->index;
-	ulink.sink.flags = MEDIA_PAD_FL_SINK;
-
-	ulink.flags = flags | (link->flags & MEDIA_LNK_FL_IMMUTABLE);
-
-	ret = ioctl(media->fd, MEDIA_IOC_SETUP_LINK, &ulink);
-	if (ret == -1) {
-		ret = -errno;
-		media_dbg(media, "%s: Unable to setup link (%s)\n",
-			  __func__, strerror(errno));
-		goto done;
-	}
-
-	link->flags = ulink.flags;
-	link->twin->flags = ulink.flags;
-
-	ret = 0;
+	ret = __media_setup_link(media, link, flags);
 
 done:
 	media_device_close(media);
@@ -501,6 +619,421 @@ static int media_get_devname_sysfs(struct media_entity *entity)
 	return 0;
 }
 
+static void media_entity_set_default(struct media_device *media,
+				     struct media_entity *entity)
+{
+	if (!(entity->info.flags & MEDIA_ENT_FL_DEFAULT))
+		return;
+
+	switch (entity->info.type) {
+	case MEDIA_ENT_T_DEVNODE_V4L:
+		media->def.v4l = entity;
+		break;
+	case MEDIA_ENT_T_DEVNODE_FB:
+		media->def.fb = entity;
+		break;
+	case MEDIA_ENT_T_DEVNODE_ALSA:
+		media->def.alsa = entity;
+		break;
+	case MEDIA_ENT_T_DEVNODE_DVB:
+		media->def.dvb = entity;
+		break;
+	}
+}
+
+static void media_entity_lookup_devname(struct udev *udev,
+					struct media_entity *entity)
+{
+	/* Find the corresponding device name. */
+	if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
+	    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
+		return;
+
+	/* Don't try to parse empty major,minor */
+	if (!entity->info.dev.major && !entity->info.dev.minor)
+		return;
+
+	/* Try to get the device name via udev */
+	if (!media_get_devname_udev(udev, entity))
+		return;
+
+	/* Fall back to get the device name via sysfs */
+	media_get_devname_sysfs(entity);
+}
+
+/* -----------------------------------------------------------------------------
+ * Topology enumeration
+ *
+ * MEDIA_IOC_G_TOPOLOGY returns all entities, interfaces, pads and links in a
+ * single call (two, as the first one only retrieves the number of objects).
+ * This is much cheaper than the legacy MEDIA_IOC_ENUM_ENTITIES and
+ * MEDIA_IOC_ENUM_LINKS calls for every entity on devices with large graphs.
+ * The topology is converted to the legacy media_entity_desc based structures
+ * the rest of the library and its users expect.
+ */
+
+struct media_topology {
+	struct media_v2_topology topo;
+	struct media_v2_entity *entities;
+	struct media_v2_interface *interfaces;
+	struct media_v2_pad *pads;
+	struct media_v2_link *links;
+};
+
+static void media_topology_free(struct media_topology *topology)
+{
+	free(topology->entities);
+	free(topology->interfaces);
+	free(topology->pads);
+	free(topology->links);
+	memset(topology, 0, sizeof(*topology));
+}
+
+static int media_topology_get(struct media_device *media,
+			      struct media_topology *topology)
+{
+	struct media_v2_topology *topo = &topology->topo;
+	unsigned int retries;
+	int ret;
+
+	for (retries = 0; retries < 3; retries++) {
+		memset(topology, 0, sizeof(*topology));
+
+		if (ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, topo) < 0)
+			return -errno;
+
+		topology->entities = calloc(topo->num_entities + 1,
+					    sizeof(*topology->entities));
+		topology->interfaces = calloc(topo->num_interfaces + 1,
+					      sizeof(*topology->interfaces));
+		topology->pads = calloc(topo->num_pads + 1,
+					sizeof(*topology->pads));
+		topology->links = calloc(topo->num_links + 1,
+					 sizeof(*topology->links));
+		if (topology->entities == NULL || topology->interfaces == NULL ||
+		    topology->pads == NULL || topology->links == NULL) {
+			media_topology_free(topology);
+			return -ENOMEM;
+		}
+
+		topo->ptr_entities = (uintptr_t)topology->entities;
+		topo->ptr_interfaces = (uintptr_t)topology->interfaces;
+		topo->ptr_pads = (uintptr_t)topology->pads;
+		topo->ptr_links = (uintptr_t)topology->links;
+
+		if (ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, topo) == 0)
+			return 0;
+
+		ret = -errno;
+		media_topology_free(topology);
+
+		/* The graph grew between the two calls, try again. */
+		if (ret != -ENOSPC)
+			return ret;
+	}
+
+	return -ENOSPC;
+}
+
+/* All topology objects start with their __u32 id. */
+static int media_topology_id_cmp(const void *a, const void *b)
+{
+	__u32 id_a = *(const __u32 *)a;
+	__u32 id_b = *(const __u32 *)b;
+
+	return id_a < id_b ? -1 : id_a > id_b;
+}
+
+#define media_topology_find(array, num, id) \
+	bsearch(&(id), array, num, sizeof(*(array)), media_topology_id_cmp)
+
+static struct media_entity *
+media_topology_entity(struct media_device *media,
+		      const struct media_topology *topology, __u32 id)
+{
+	const struct media_v2_entity *ent;
+
+	ent = media_topology_find(topology->entities,
+				  topology->topo.num_entities, id);
+	return ent ? &media->entities[ent - topology->entities] : NULL;
+}
+
+static struct media_pad *
+media_topology_pad(struct media_device *media,
+		   const struct media_topology *topology, __u32 id)
+{
+	const struct media_v2_pad *pad;
+	struct media_entity *entity;
+
+	pad = media_topology_find(topology->pads, topology->topo.num_pads, id);
+	if (pad == NULL)
+		return NULL;
+
+	entity = media_topology_entity(media, topology, pad->entity_id);
+	if (entity == NULL || pad->index >= entity->info.pads)
+		return NULL;
+
+	return &entity->pads[pad->index];
+}
+
+/*
+ * Compute the entity type MEDIA_IOC_ENUM_ENTITIES would report. The kernel
+ * maps functions outside of the legacy ranges to MEDIA_ENT_T_V4L2_SUBDEV or
+ * MEDIA_ENT_T_DEVNODE_UNKNOWN depending on whether the entity is a V4L2
+ * subdev, which G_TOPOLOGY doesn't report directly. Use the type of the
+ * interface the entity is bound to instead, and for entities without an
+ * interface assume that processing, bridge and decoder functions are subdevs.
+ */
+static __u32 media_topology_legacy_type(const struct media_v2_entity *ent,
+					const struct media_v2_interface *intf)
+{
+	__u32 function = ent->function;
+
+	if (function >= MEDIA_ENT_F_OLD_BASE && function <= MEDIA_ENT_F_TUNER)
+		return function;
+
+	if (intf != NULL) {
+		if (intf->intf_type == MEDIA_INTF_T_V4L_SUBDEV)
+			return MEDIA_ENT_T_V4L2_SUBDEV;
+	} else if (function >= MEDIA_ENT_F_IF_VID_DECODER &&
+		   function < MEDIA_ENT_F_OLD_BASE &&
+		   (function < MEDIA_ENT_F_AUDIO_CAPTURE ||
+		    function > MEDIA_ENT_F_AUDIO_MIXER)) {
+		return MEDIA_ENT_T_V4L2_SUBDEV;
+	}
+
+	return MEDIA_ENT_T_DEVNODE_UNKNOWN;
+}
+
+static int media_enum_topology(struct media_device *media)
+{
+	struct media_topology topology;
+	struct media_v2_interface **entity_intf = NULL;
+	struct media_entity **intf_entity = NULL;
+	struct media_entity *entity;
+	struct udev *udev;
+	unsigned int i;
+	int ret;
+
+	/*
+	 * Pad indices and entity flags are only reported since v4.19, without
+	 * them the legacy API is needed anyway.
+	 */
+	if (!MEDIA_V2_PAD_HAS_INDEX(media->info.media_version) ||
+	    !MEDIA_V2_ENTITY_HAS_FLAGS(media->info.media_version))
+		return -ENOTTY;
+
+	ret = media_topology_get(media, &topology);
+	if (ret < 0)
+		return ret;
+
+	qsort(topology.entities, topology.topo.num_entities,
+	      sizeof(*topology.entities), media_topology_id_cmp);
+	qsort(topology.interfaces, topology.topo.num_interfaces,
+	      sizeof(*topology.interfaces), media_topology_id_cmp);
+	qsort(topology.pads, topology.topo.num_pads,
+	      sizeof(*topology.pads), media_topology_id_cmp);
+
+	media->entities = calloc(topology.topo.num_entities + 1,
+				 sizeof(*media->entities));
+	entity_intf = calloc(topology.topo.num_entities + 1,
+			     sizeof(*entity_intf));
+	intf_entity = calloc(topology.topo.num_interfaces + 1,
+			     sizeof(*intf_entity));
+	if (media->entities == NULL || entity_intf == NULL ||
+	    intf_entity == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	for (i = 0; i < topology.topo.num_entities; ++i) {
+		const struct media_v2_entity *ent = &topology.entities[i];
+
+		entity = &media->entities[i];
+		entity->media = media;
+		entity->fd = -1;
+		entity->info.id = ent->id;
+		snprintf(entity->info.name, sizeof(entity->info.name), "%.*s",
+			 (int)sizeof(entity->info.name) - 1, ent->name);
+		entity->info.flags = ent->flags;
+	}
+	media->entities_count = topology.topo.num_entities;
+
+	/* Count the pads and links of every entity. */
+	for (i = 0; i < topology.topo.num_pads; ++i) {
+		entity = media_topology_entity(media, &topology,
+					       topology.pads[i].entity_id);
+		if (entity)
+			entity->info.pads++;
+	}
+
+	for (i = 0; i < topology.topo.num_links; ++i) {
+		const struct media_v2_link *link = &topology.links[i];
+		struct media_v2_interface *intf;
+		const struct media_v2_pad *pad;
+
+		switch (link->flags & MEDIA_LNK_FL_LINK_TYPE) {
+		case MEDIA_LNK_FL_DATA_LINK:
+			pad = media_topology_find(topology.pads,
+						  topology.topo.num_pads,
+						  link->source_id);
+			entity = pad ? media_topology_entity(media, &topology,
+							     pad->entity_id) : NULL;
+			if (entity) {
+				entity->info.links++;
+				entity->max_links++;
+			}
+
+			pad = media_topology_find(topology.pads,
+						  topology.topo.num_pads,
+						  link->sink_id);
+			entity = pad ? media_topology_entity(media, &topology,
+							     pad->entity_id) : NULL;
+			if (entity)
+				entity->max_links++;
+			break;
+
+		case MEDIA_LNK_FL_INTERFACE_LINK:
+			intf = media_topology_find(topology.interfaces,
+						   topology.topo.num_interfaces,
+						   link->source_id);
+			entity = media_topology_entity(media, &topology,
+						       link->sink_id);
+			if (intf == NULL || entity == NULL)
+				break;
+
+			/* Use the first interface, as the legacy API does. */
+			if (entity_intf[entity - media->entities] == NULL) {
+				entity_intf[entity - media->entities] = intf;
+				entity->info.dev.major = intf->devnode.major;
+				entity->info.dev.minor = intf->devnode.minor;
+			}
+			break;
+		}
+	}
+
+	for (i = 0; i < media->entities_count; ++i) {
+		entity = &media->entities[i];
+
+		entity->info.type =
+			media_topology_legacy_type(&topology.entities[i],
+						   entity_intf[i]);
+
+		/* Spare entries avoid zero-sized allocations. */
+		entity->max_links++;
+		entity->pads = calloc(entity->info.pads + 1,
+				      sizeof(*entity->pads));
+		entity->links = calloc(entity->max_links,
+				       sizeof(*entity->links));
+		if (entity->pads == NULL || entity->links == NULL) {
+			ret = -ENOMEM;
+			goto error;
+		}
+	}
+
+	for (i = 0; i < topology.topo.num_pads; ++i) {
+		const struct media_v2_pad *pad = &topology.pads[i];
+
+		entity = media_topology_entity(media, &topology,
+					       pad->entity_id);
+		if (entity == NULL || pad->index >= entity->info.pads) {
+			media_dbg(media, "%s: pad %u of entity %u is invalid\n",
+				  __func__, pad->id, pad->entity_id);
+			ret = -EINVAL;
+			goto error;
+		}
+
+		entity->pads[pad->index].entity = entity;
+		entity->pads[pad->index].index = pad->index;
+		entity->pads[pad->index].flags = pad->flags;
+	}
+
+	for (i = 0; i < topology.topo.num_links; ++i) {
+		const struct media_v2_link *link = &topology.links[i];
+		struct media_link *fwdlink;
+		struct media_link *backlink;
+		struct media_pad *source;
+		struct media_pad *sink;
+
+		if ((link->flags & MEDIA_LNK_FL_LINK_TYPE) !=
+		    MEDIA_LNK_FL_DATA_LINK)
+			continue;
+
+		source = media_topology_pad(media, &topology, link->source_id);
+		sink = media_topology_pad(media, &topology, link->sink_id);
+		if (source == NULL || sink == NULL) {
+			media_dbg(media,
+				  "WARNING link %u from pad %u to pad %u is invalid!\n",
+				  link->id, link->source_id, link->sink_id);
+			ret = -EINVAL;
+			goto error;
+		}
+
+		fwdlink = media_entity_add_link(source->entity);
+		fwdlink->source = source;
+		fwdlink->sink = sink;
+		fwdlink->flags = link->flags;
+
+		backlink = media_entity_add_link(sink->entity);
+		backlink->source = source;
+		backlink->sink = sink;
+		backlink->flags = link->flags;
+
+		fwdlink->twin = backlink;
+		backlink->twin = fwdlink;
+	}
+
+	/*
+	 * Resolve the device node names. Several entities can share an
+	 * interface, look up every interface only once.
+	 */
+	ret = media_udev_open(&udev);
+	if (ret < 0)
+		media_dbg(media, "Can't get udev context\n");
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *owner;
+
+		entity = &media->entities[i];
+		media_entity_set_default(media, entity);
+
+		if (entity_intf[i] == NULL) {
+			media_entity_lookup_devname(udev, entity);
+			continue;
+		}
+
+		owner = intf_entity[entity_intf[i] - topology.interfaces];
+		if (owner != NULL) {
+			strcpy(entity->devname, owner->devname);
+			continue;
+		}
+
+		media_entity_lookup_devname(udev, entity);
+		intf_entity[entity_intf[i] - topology.interfaces] = entity;
+	}
+
+	media_udev_close(udev);
+	ret = 0;
+	goto done;
+
+error:
+	for (i = 0; i < media->entities_count; ++i) {
+		free(media->entities[i].pads);
+		free(media->entities[i].links);
+	}
+	free(media->entities);
+	media->entities = NULL;
+	media->entities_count = 0;
+	memset(&media->def, 0, sizeof(media->def));
+	media_invalidate_index(media);
+
+done:
+	free(entity_intf);
+	free(intf_entity);
+	media_topology_free(&topology);
+	return ret;
+}
+
 static int media_enum_entities(struct media_device *media)
 {
 	struct media_entity *entity;
@@ -544,38 +1077,8 @@ static int media_enum_entities(struct media_device *media)
 
 		media->entities_count++;
 
-		if (entity->info.flags & MEDIA_ENT_FL_DEFAULT) {
-			switch (entity->info.type) {
-			case MEDIA_ENT_T_DEVNODE_V4L:
-				media->def.v4l = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_FB:
-				media->def.fb = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_ALSA:
-				media->def.alsa = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_DVB:
-				media->def.dvb = entity;
-				break;
-			}
-		}
-
-		/* Find the corresponding device name. */
-		if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
-		    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
-			continue;
-
-		/* Don't try to parse empty major,minor */
-		if (!entity->info.dev.major && !entity->info.dev.minor)
-			continue;
-
-		/* Try to get the device name via udev */
-		if (!media_get_devname_udev(udev, entity))
-			continue;
-
-		/* Fall back to get the device name via sysfs */
-		media_get_devname_sysfs(entity);
+		media_entity_set_default(media, entity);
+		media_entity_lookup_devname(udev, entity);
 	}
 
 	media_udev_close(udev);
@@ -604,6 +1107,17 @@ int media_device_enumerate(struct media_device *media)
 		goto done;
 	}
 
+	media_dbg(media, "Enumerating topology\n");
+
+	ret = media_enum_topology(media);
+	if (ret == 0) {
+		media_dbg(media, "Found %u entities\n", media->entities_count);
+		goto done;
+	}
+
+	media_dbg(media, "%s: Unable to get topology for device %s (%s), "
+		  "falling back to legacy enumeration\n", __func__,
+		  media->devnode, strerror(-ret));
 	media_dbg(media, "Enumerating entities\n");
 
 	ret = media_enum_entities(media);
@@ -724,6 +1238,7 @@ void media_device_unref(struct media_device *media)
 
 	free(media->entities);
 	free(media->devnode);
+	media_invalidate_index(media);
 	free(media);
 }
 
@@ -742,6 +1257,7 @@ int media_device_add_entity(struct media_device *media,
 
 	media->entities = entity;
 	media->entities_count++;
+	media_invalidate_index(media);
 
 	entity = &media->entities[media->entities_count - 1];
 	memset(entity, 0, sizeof *entity);
@@ -920,11 +1436,11 @@ struct media_link *media_parse_link(struct media_device *media,
 	return NULL;
 }
 
-int media_parse_setup_link(struct media_device *media,
-			   const char *p, char **endp)
+static struct media_link *media_parse_link_flags(struct media_device *media,
+						 const char *p, __u32 *flags,
+						 char **endp)
 {
 	struct media_link *link;
-	__u32 flags;
 	char *end;
 
 	link = media_parse_link(media, p, &end);
@@ -932,27 +1448,40 @@ int media_parse_setup_link(struct media_device *media,
 		media_dbg(media,
 			  "%s: Unable to parse link\n", __func__);
 		*endp = end;
-		return -EINVAL;
+		return NULL;
 	}
 
 	p = end;
 	if (*p++ != '[') {
 		media_dbg(media, "Unable to parse link flags: expected '['.\n");
 		*endp = (char *)p - 1;
-		return -EINVAL;
+		return NULL;
 	}
 
-	flags = strtoul(p, &end, 10);
+	*flags = strtoul(p, &end, 10);
 	for (p = end; isspace(*p); p++);
 	if (*p++ != ']') {
 		media_dbg(media, "Unable to parse link flags: expected ']'.\n");
 		*endp = (char *)p - 1;
-		return -EINVAL;
+		return NULL;
 	}
 
 	for (; isspace(*p); p++);
 	*endp = (char *)p;
 
+	return link;
+}
+
+int media_parse_setup_link(struct media_device *media,
+			   const char *p, char **endp)
+{
+	struct media_link *link;
+	__u32 flags;
+
+	link = media_parse_link_flags(media, p, &flags, endp);
+	if (link == NULL)
+		return -EINVAL;
+
 	media_dbg(media,
 		  "Setting up link %u:%u -> %u:%u [%u]\n",
 		  link->source->entity->info.id, link->source->index,
@@ -996,3 +1525,261 @@ int media_parse_setup_links(struct media_device *media, const char *p)
 
 	return *end ? -EINVAL : 0;
 }
+
+/* -----------------------------------------------------------------------------
+ * Compiled links
+ */
+
+/*
+ * Links are referenced by the index of the entity that stores them and their
+ * index in that entity's links array, as both arrays are reallocated when
+ * entities or links are added to the media device.
+ */
+struct media_links_plan_entry {
+	unsigned int entity;
+	unsigned int link;
+	__u32 flags;
+};
+
+struct media_links_plan {
+	struct media_device *media;
+	unsigned int count;
+	unsigned int size;
+	struct media_links_plan_entry *links;
+};
+
+static struct media_link *
+media_links_plan_link(const struct media_links_plan *plan, unsigned int index)
+{
+	const struct media_links_plan_entry *entry = &plan->links[index];
+
+	return &plan->media->entities[entry->entity].links[entry->link];
+}
+
+static int media_links_plan_add(struct media_links_plan *plan,
+				struct media_link *link, __u32 flags)
+{
+	struct media_entity *entity = link->source->entity;
+
+	if (link < entity->links || link >= entity->links + entity->num_links)
+		entity = link->sink->entity;
+
+	if (plan->count == plan->size) {
+		unsigned int size = plan->size ? plan->size * 2 : 8;
+		void *links;
+
+		links = realloc(plan->links, size * sizeof(*plan->links));
+		if (links == NULL)
+			return -ENOMEM;
+
+		plan->links = links;
+		plan->size = size;
+	}
+
+	plan->links[plan->count].entity = entity - plan->media->entities;
+	plan->links[plan->count].link = link - entity->links;
+	plan->links[plan->count].flags = flags;
+	plan->count++;
+
+	return 0;
+}
+
+static bool media_links_plan_has(const struct media_links_plan *plan,
+				 const struct media_link *link)
+{
+	unsigned int i;
+
+	for (i = 0; i < plan->count; ++i) {
+		const struct media_link *planned = media_links_plan_link(plan, i);
+
+		if (planned == link || planned == link->twin)
+			return true;
+	}
+
+	return false;
+}
+
+int media_compile_setup_links(struct media_device *media, const char *p,
+			      struct media_links_plan **plan)
+{
+	struct media_links_plan *lp;
+	char *end;
+	int ret;
+
+	lp = calloc(1, sizeof(*lp));
+	if (lp == NULL)
+		return -ENOMEM;
+
+	lp->media = media;
+
+	do {
+		struct media_link *link;
+		__u32 flags;
+
+		link = media_parse_link_flags(media, p, &flags, &end);
+		if (link == NULL) {
+			media_print_streampos(media, p, end);
+			media_free_setup_links(lp);
+			return -EINVAL;
+		}
+
+		ret = media_links_plan_add(lp, link, flags);
+		if (ret < 0) {
+			media_free_setup_links(lp);
+			return ret;
+		}
+
+		p = end + 1;
+	} while (*end == ',');
+
+	if (*end) {
+		media_free_setup_links(lp);
+		return -EINVAL;
+	}
+
+	*plan = lp;
+	return 0;
+}
+
+/*
+ * Append all the non-immutable links of the media device that are not part
+ * of the plan yet. Disabled links are added to the front of the plan, as
+ * links sharing a pad can usually not be enabled at the same time: they must
+ * be disabled before the new ones get enabled.
+ */
+static int media_links_plan_add_all(struct media_links_plan *plan,
+				    bool reset)
+{
+	struct media_device *media = plan->media;
+	unsigned int listed = plan->count;
+	unsigned int disabled = 0;
+	unsigned int i, j;
+	int ret;
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		for (j = 0; j < entity->num_links; j++) {
+			struct media_link *link = &entity->links[j];
+			__u32 flags = link->flags;
+
+			if (link->flags & MEDIA_LNK_FL_IMMUTABLE ||
+			    link->source->entity != entity)
+				continue;
+
+			if (media_links_plan_has(plan, link))
+				continue;
+
+			if (reset)
+				flags &= ~MEDIA_LNK_FL_ENABLED;
+
+			ret = media_links_plan_add(plan, link, flags);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	/* Move the disabled links in front of the previously listed ones. */
+	for (i = listed; i < plan->count; ++i) {
+		struct media_links_plan_entry entry = plan->links[i];
+
+		if (entry.flags & MEDIA_LNK_FL_ENABLED)
+			continue;
+
+		memmove(&plan->links[disabled + 1], &plan->links[disabled],
+			(i - disabled) * sizeof(*plan->links));
+		plan->links[disabled++] = entry;
+	}
+
+	return 0;
+}
+
+int media_compile_reset_links(struct media_device *media, const char *p,
+			      struct media_links_plan **plan)
+{
+	struct media_links_plan *lp;
+	int ret;
+
+	if (p && *p) {
+		ret = media_compile_setup_links(media, p, &lp);
+		if (ret < 0)
+			return ret;
+	} else {
+		lp = calloc(1, sizeof(*lp));
+		if (lp == NULL)
+			return -ENOMEM;
+		lp->media = media;
+	}
+
+	ret = media_links_plan_add_all(lp, true);
+	if (ret < 0) {
+		media_free_setup_links(lp);
+		return ret;
+	}
+
+	*plan = lp;
+	return 0;
+}
+
+int media_save_links(struct media_device *media,
+		     struct media_links_plan **plan)
+{
+	struct media_links_plan *lp;
+	int ret;
+
+	lp = calloc(1, sizeof(*lp));
+	if (lp == NULL)
+		return -ENOMEM;
+
+	lp->media = media;
+
+	ret = media_links_plan_add_all(lp, false);
+	if (ret < 0) {
+		media_free_setup_links(lp);
+		return ret;
+	}
+
+	*plan = lp;
+	return 0;
+}
+
+int media_apply_setup_links(struct media_links_plan *plan)
+{
+	struct media_device *media = plan->media;
+	unsigned int i;
+	int ret;
+
+	ret = media_device_open(media);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < plan->count; ++i) {
+		struct media_link *link = media_links_plan_link(plan, i);
+		__u32 flags = plan->links[i].flags;
+
+		if (!((link->flags ^ flags) & MEDIA_LNK_FL_ENABLED))
+			continue;
+
+		media_dbg(media,
+			  "Setting up link %u:%u -> %u:%u [%u]\n",
+			  link->source->entity->info.id, link->source->index,
+			  link->sink->entity->info.id, link->sink->index,
+			  flags);
+
+		ret = __media_setup_link(media, link, flags);
+		if (ret < 0)
+			break;
+	}
+
+	media_device_close(media);
+	return ret;
+}
+
+void media_free_setup_links(struct media_links_plan *plan)
+{
+	if (plan == NULL)
+		return;
+
+	free(plan->links);
+	free(plan);
+}
@@ -674,14 +674,52 @@ static struct media_pad *v4l2_subdev_parse_pad_format(
 	return pad;
 }
 
+/*
+ * Check whether the current active format of a pad already matches the
+ * requested one. Fields left to 0 in the request are chosen by the driver
+ * and thus not compared.
+ */
+static bool format_unchanged(struct media_pad *pad,
+			     struct v4l2_mbus_framefmt *format)
+{
+	struct v4l2_mbus_framefmt current;
+
+	if (v4l2_subdev_get_format(pad->entity, &current, pad->index,
+				   V4L2_SUBDEV_FORMAT_ACTIVE) < 0)
+		return false;
+
+	if (current.width != format->width ||
+	    current.height != format->height ||
+	    current.code != format->code ||
+	    (format->field && current.field != format->field) ||
+	    (format->colorspace && current.colorspace != format->colorspace) ||
+	    (format->xfer_func && current.xfer_func != format->xfer_func) ||
+	    (format->ycbcr_enc && current.ycbcr_enc != format->ycbcr_enc) ||
+	    (format->quantization &&
+	     current.quantization != format->quantization))
+		return false;
+
+	*format = current;
+	return true;
+}
+
 static int set_format(struct media_pad *pad,
-		      struct v4l2_mbus_framefmt *format)
+		      struct v4l2_mbus_framefmt *format, bool lazy)
 {
 	int ret;
 
 	if (format->width == 0 || format->height == 0)
 		return 0;
 
+	if (lazy && format_unchanged(pad, format)) {
+		media_dbg(pad->entity->media,
+			  "Format %s %ux%u on pad %s/%u unchanged\n",
+			  v4l2_subdev_pixelcode_to_string(format->code),
+			  format->width, format->height,
+			  pad->entity->info.name, pad->index);
+		return 0;
+	}
+
 	media_dbg(pad->entity->media,
 		  "Setting up format %s %ux%u on pad %s/%u\n",
 		  v4l2_subdev_pixelcode_to_string(format->code),
@@ -706,13 +744,24 @@ static int set_format(struct media_pad *pad,
 }
 
 static int set_selection(struct media_pad *pad, unsigned int target,
-			 struct v4l2_rect *rect)
+			 struct v4l2_rect *rect, bool lazy)
 {
+	struct v4l2_rect current;
 	int ret;
 
 	if (rect->left == -1 || rect->top == -1)
 		return 0;
 
+	if (lazy &&
+	    v4l2_subdev_get_selection(pad->entity, &current, pad->index,
+				      target, V4L2_SUBDEV_FORMAT_ACTIVE) == 0 &&
+	    !memcmp(&current, rect, sizeof(current))) {
+		media_dbg(pad->entity->media,
+			  "Selection target %u on pad %s/%u unchanged\n",
+			  target, pad->entity->info.name, pad->index);
+		return 0;
+	}
+
 	media_dbg(pad->entity->media,
 		  "Setting up selection target %u rectangle (%u,%u)/%ux%u on pad %s/%u\n",
 		  target, rect->left, rect->top, rect->width, rect->height,
@@ -735,13 +784,25 @@ static int set_selection(struct media_pad *pad, unsigned int target,
 }
 
 static int set_frame_interval(struct media_pad *pad,
-			      struct v4l2_fract *interval)
+			      struct v4l2_fract *interval, bool lazy)
 {
+	struct v4l2_fract current;
 	int ret;
 
 	if (interval->numerator == 0)
 		return 0;
 
+	if (lazy &&
+	    v4l2_subdev_get_frame_interval(pad->entity, &current,
+					   pad->index) == 0 &&
+	    current.numerator == interval->numerator &&
+	    current.denominator == interval->denominator) {
+		media_dbg(pad->entity->media,
+			  "Frame interval on pad %s/%u unchanged\n",
+			  pad->entity->info.name, pad->index);
+		return 0;
+	}
+
 	media_dbg(pad->entity->media,
 		  "Setting up frame interval %u/%u on pad %s/%u\n",
 		  interval->numerator, interval->denominator,
@@ -761,48 +822,127 @@ static int set_frame_interval(struct media_pad *pad,
 	return 0;
 }
 
+/*
+ * Settings for one pad, as parsed from a format description. The pad is
+ * referenced by its entity and pad indices, as the entities array of the
+ * media device is reallocated when entities are added.
+ */
+struct v4l2_subdev_pad_setup {
+	unsigned int entity;
+	unsigned int pad;
+	struct v4l2_mbus_framefmt format;
+	struct v4l2_rect crop;
+	struct v4l2_rect compose;
+	struct v4l2_fract interval;
+};
 
-static int v4l2_subdev_parse_setup_format(struct media_device *media,
-					  const char *p, char **endp)
+struct v4l2_subdev_formats_plan {
+	struct media_device *media;
+	unsigned int count;
+	unsigned int size;
+	struct v4l2_subdev_pad_setup *setups;
+	/* Created by v4l2_subdev_save_formats() */
+	bool restore;
+};
+
+static struct v4l2_subdev_pad_setup *
+v4l2_subdev_plan_add(struct v4l2_subdev_formats_plan *plan)
+{
+	struct v4l2_subdev_pad_setup *setup;
+
+	if (plan->count == plan->size) {
+		unsigned int size = plan->size ? plan->size * 2 : 8;
+
+		setup = realloc(plan->setups, size * sizeof(*plan->setups));
+		if (setup == NULL)
+			return NULL;
+
+		plan->setups = setup;
+		plan->size = size;
+	}
+
+	setup = &plan->setups[plan->count++];
+	memset(setup, 0, sizeof(*setup));
+	return setup;
+}
+
+static struct media_pad *
+v4l2_subdev_setup_get_pad(struct media_device *media,
+			  const struct v4l2_subdev_pad_setup *setup)
+{
+	return &media->entities[setup->entity].pads[setup->pad];
+}
+
+static void v4l2_subdev_setup_set_pad(struct v4l2_subdev_pad_setup *setup,
+				      struct media_pad *pad)
+{
+	setup->entity = pad->entity - pad->entity->media->entities;
+	setup->pad = pad - pad->entity->pads;
+}
+
+static int v4l2_subdev_parse_pad_setup(struct media_device *media,
+				       struct v4l2_subdev_pad_setup *setup,
+				       const char *p, char **endp)
 {
-	struct v4l2_mbus_framefmt format = { 0, 0, 0 };
 	struct media_pad *pad;
-	struct v4l2_rect crop = { -1, -1, -1, -1 };
-	struct v4l2_rect compose = crop;
-	struct v4l2_fract interval = { 0, 0 };
-	unsigned int i;
-	char *end;
-	int ret;
 
-	pad = v4l2_subdev_parse_pad_format(media, &format, &crop, &compose,
-					   &interval, p, &end);
+	memset(&setup->format, 0, sizeof(setup->format));
+	setup->crop = (struct v4l2_rect){ -1, -1, -1, -1 };
+	setup->compose = setup->crop;
+	setup->interval = (struct v4l2_fract){ 0, 0 };
+
+	pad = v4l2_subdev_parse_pad_format(media, &setup->format,
+					   &setup->crop, &setup->compose,
+					   &setup->interval, p, endp);
 	if (pad == NULL) {
-		media_print_streampos(media, p, end);
+		media_print_streampos(media, p, *endp);
 		media_dbg(media, "Unable to parse format\n");
 		return -EINVAL;
 	}
 
+	v4l2_subdev_setup_set_pad(setup, pad);
+	return 0;
+}
+
+/*
+ * Apply the settings to a pad. With lazy set, settings that already match
+ * the current active configuration are skipped. With propagate set, the
+ * format and frame interval of a source pad are also applied to the sink
+ * pads connected to it.
+ */
+static int v4l2_subdev_setup_pad(struct media_device *media,
+				 const struct v4l2_subdev_pad_setup *setup,
+				 bool lazy, bool propagate)
+{
+	struct v4l2_mbus_framefmt format = setup->format;
+	struct v4l2_rect crop = setup->crop;
+	struct v4l2_rect compose = setup->compose;
+	struct v4l2_fract interval = setup->interval;
+	struct media_pad *pad = v4l2_subdev_setup_get_pad(media, setup);
+	unsigned int i;
+	int ret;
+
 	if (pad->flags & MEDIA_PAD_FL_SINK) {
-		ret = set_format(pad, &format);
+		ret = set_format(pad, &format, lazy);
 		if (ret < 0)
 			return ret;
 	}
 
-	ret = set_selection(pad, V4L2_SEL_TGT_CROP, &crop);
+	ret = set_selection(pad, V4L2_SEL_TGT_CROP, &crop, lazy);
 	if (ret < 0)
 		return ret;
 
-	ret = set_selection(pad, V4L2_SEL_TGT_COMPOSE, &compose);
+	ret = set_selection(pad, V4L2_SEL_TGT_COMPOSE, &compose, lazy);
 	if (ret < 0)
 		return ret;
 
 	if (pad->flags & MEDIA_PAD_FL_SOURCE) {
-		ret = set_format(pad, &format);
+		ret = set_format(pad, &format, lazy);
 		if (ret < 0)
 			return ret;
 	}
 
-	ret = set_frame_interval(pad, &interval);
+	ret = set_frame_interval(pad, &interval, lazy);
 	if (ret < 0)
 		return ret;
 
@@ -810,7 +950,7 @@ static int v4l2_subdev_parse_setup_format(struct media_device *media,
 	/* If the pad is an output pad, automatically set the same format and
 	 * frame interval on the remote subdev input pads, if any.
 	 */
-	if (pad->flags & MEDIA_PAD_FL_SOURCE) {
+	if (propagate && pad->flags & MEDIA_PAD_FL_SOURCE) {
 		for (i = 0; i < pad->entity->num_links; ++i) {
 			struct media_link *link = &pad->entity->links[i];
 			struct v4l2_mbus_framefmt remote_format;
@@ -821,15 +961,34 @@ static int v4l2_subdev_parse_setup_format(struct media_device *media,
 			if (link->source == pad &&
 			    link->sink->entity->info.type == MEDIA_ENT_T_V4L2_SUBDEV) {
 				remote_format = format;
-				set_format(link->sink, &remote_format);
+				set_format(link->sink, &remote_format, lazy);
 
-				ret = set_frame_interval(link->sink, &interval);
+				ret = set_frame_interval(link->sink, &interval,
+							 lazy);
 				if (ret < 0 && ret != -EINVAL && ret != -ENOTTY)
 					return ret;
 			}
 		}
 	}
 
+	return 0;
+}
+
+static int v4l2_subdev_parse_setup_format(struct media_device *media,
+					  const char *p, char **endp)
+{
+	struct v4l2_subdev_pad_setup setup;
+	char *end;
+	int ret;
+
+	ret = v4l2_subdev_parse_pad_setup(media, &setup, p, &end);
+	if (ret < 0)
+		return ret;
+
+	ret = v4l2_subdev_setup_pad(media, &setup, false, true);
+	if (ret < 0)
+		return ret;
+
 	*endp = end;
 	return 0;
 }
@@ -851,6 +1010,167 @@ int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p)
 	return *end ? -EINVAL : 0;
 }
 
+int v4l2_subdev_compile_setup_formats(struct media_device *media,
+				      const char *p,
+				      struct v4l2_subdev_formats_plan **plan)
+{
+	struct v4l2_subdev_formats_plan *fp;
+	char *end;
+	int ret;
+
+	fp = calloc(1, sizeof(*fp));
+	if (fp == NULL)
+		return -ENOMEM;
+
+	fp->media = media;
+
+	do {
+		struct v4l2_subdev_pad_setup *setup;
+
+		setup = v4l2_subdev_plan_add(fp);
+		if (setup == NULL) {
+			v4l2_subdev_free_setup_formats(fp);
+			return -ENOMEM;
+		}
+
+		ret = v4l2_subdev_parse_pad_setup(media, setup, p, &end);
+		if (ret < 0) {
+			v4l2_subdev_free_setup_formats(fp);
+			return ret;
+		}
+
+		for (; isspace(*end); end++);
+		p = end + 1;
+	} while (*end == ',');
+
+	if (*end) {
+		v4l2_subdev_free_setup_formats(fp);
+		return -EINVAL;
+	}
+
+	*plan = fp;
+	return 0;
+}
+
+/* Record the current configuration of a pad, unless already recorded. */
+static int v4l2_subdev_save_pad(struct v4l2_subdev_formats_plan *saved,
+				struct media_pad *pad)
+{
+	struct v4l2_subdev_pad_setup *setup;
+	unsigned int i;
+
+	for (i = 0; i < saved->count; ++i) {
+		if (v4l2_subdev_setup_get_pad(saved->media,
+					      &saved->setups[i]) == pad)
+			return 0;
+	}
+
+	setup = v4l2_subdev_plan_add(saved);
+	if (setup == NULL)
+		return -ENOMEM;
+
+	v4l2_subdev_setup_set_pad(setup, pad);
+
+	/*
+	 * Not all subdevs implement all the operations, what can't be read
+	 * is left alone when restoring.
+	 */
+	if (v4l2_subdev_get_format(pad->entity, &setup->format, pad->index,
+				   V4L2_SUBDEV_FORMAT_ACTIVE) < 0)
+		memset(&setup->format, 0, sizeof(setup->format));
+
+	if (v4l2_subdev_get_selection(pad->entity, &setup->crop, pad->index,
+				      V4L2_SEL_TGT_CROP,
+				      V4L2_SUBDEV_FORMAT_ACTIVE) < 0)
+		setup->crop = (struct v4l2_rect){ -1, -1, -1, -1 };
+
+	if (v4l2_subdev_get_selection(pad->entity, &setup->compose, pad->index,
+				      V4L2_SEL_TGT_COMPOSE,
+				      V4L2_SUBDEV_FORMAT_ACTIVE) < 0)
+		setup->compose = (struct v4l2_rect){ -1, -1, -1, -1 };
+
+	if (v4l2_subdev_get_frame_interval(pad->entity, &setup->interval,
+					   pad->index) < 0)
+		setup->interval = (struct v4l2_fract){ 0, 0 };
+
+	return 0;
+}
+
+int v4l2_subdev_save_formats(struct v4l2_subdev_formats_plan *plan,
+			     struct v4l2_subdev_formats_plan **saved)
+{
+	struct v4l2_subdev_formats_plan *sp;
+	unsigned int i, j;
+	int ret = 0;
+
+	sp = calloc(1, sizeof(*sp));
+	if (sp == NULL)
+		return -ENOMEM;
+
+	sp->media = plan->media;
+	sp->restore = true;
+
+	/*
+	 * Save the pads touched by the plan, including the subdev sink pads
+	 * formats get propagated to, whether their link is enabled now or not.
+	 */
+	for (i = 0; i < plan->count && !ret; ++i) {
+		struct media_pad *pad;
+
+		pad = v4l2_subdev_setup_get_pad(plan->media, &plan->setups[i]);
+
+		ret = v4l2_subdev_save_pad(sp, pad);
+		if (ret < 0 || !(pad->flags & MEDIA_PAD_FL_SOURCE))
+			continue;
+
+		for (j = 0; j < pad->entity->num_links && !ret; ++j) {
+			struct media_link *link = &pad->entity->links[j];
+
+			if (link->source == pad &&
+			    link->sink->entity->info.type == MEDIA_ENT_T_V4L2_SUBDEV)
+				ret = v4l2_subdev_save_pad(sp, link->sink);
+		}
+	}
+
+	if (ret < 0) {
+		v4l2_subdev_free_setup_formats(sp);
+		return ret;
+	}
+
+	*saved = sp;
+	return 0;
+}
+
+int v4l2_subdev_apply_setup_formats(struct v4l2_subdev_formats_plan *plan)
+{
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < plan->count; ++i) {
+		int err;
+
+		err = v4l2_subdev_setup_pad(plan->media, &plan->setups[i], true,
+					    !plan->restore);
+		if (err < 0 && !plan->restore)
+			return err;
+
+		/* Restore as much as possible, report the first error. */
+		if (err < 0 && !ret)
+			ret = err;
+	}
+
+	return ret;
+}
+
+void v4l2_subdev_free_setup_formats(struct v4l2_subdev_formats_plan *plan)
+{
+	if (plan == NULL)
+		return;
+
+	free(plan->setups);
+	free(plan);
+}
+
 static const struct {
 	const char *name;
 	enum v4l2_mbus_pixelcode code;
@@ -535,6 +535,90 @@ static void media_print_topology_text(struct media_device *media)
 			media, media_get_entity(media, i));
 }
 
+/*
+ * Compute the difference between the current configuration and the requested
+ * one and only apply that, optionally restoring the previous configuration if
+ * anything fails.
+ */
+static int media_setup_diff(struct media_device *media)
+{
+	struct v4l2_subdev_formats_plan *saved_formats = NULL;
+	struct v4l2_subdev_formats_plan *formats = NULL;
+	struct media_links_plan *saved_links = NULL;
+	struct media_links_plan *links = NULL;
+	int ret = 0;
+
+	/* Parse everything before touching the device. */
+	if (media_opts.reset)
+		ret = media_compile_reset_links(media, media_opts.links, &links);
+	else if (media_opts.links)
+		ret = media_compile_setup_links(media, media_opts.links, &links);
+	if (ret) {
+		printf("Unable to parse link: %s (%d)\n", strerror(-ret), -ret);
+		goto done;
+	}
+
+	if (media_opts.formats) {
+		ret = v4l2_subdev_compile_setup_formats(media, media_opts.formats,
+							&formats);
+		if (ret) {
+			printf("Unable to parse formats: %s (%d)\n",
+			       strerror(-ret), -ret);
+			goto done;
+		}
+	}
+
+	if (media_opts.rollback) {
+		ret = media_save_links(media, &saved_links);
+		if (!ret && formats)
+			ret = v4l2_subdev_save_formats(formats, &saved_formats);
+		if (ret) {
+			printf("Unable to save the current configuration: %s (%d)\n",
+			       strerror(-ret), -ret);
+			goto done;
+		}
+	}
+
+	if (links) {
+		ret = media_apply_setup_links(links);
+		if (ret)
+			printf("Unable to setup links: %s (%d)\n",
+			       strerror(-ret), -ret);
+	}
+
+	if (!ret && formats) {
+		ret = v4l2_subdev_apply_setup_formats(formats);
+		if (ret)
+			printf("Unable to setup formats: %s (%d)\n",
+			       strerror(-ret), -ret);
+	}
+
+	if (ret && media_opts.rollback) {
+		int err;
+
+		printf("Restoring the previous configuration\n");
+
+		err = media_apply_setup_links(saved_links);
+		if (err)
+			printf("Unable to restore links: %s (%d)\n",
+			       strerror(-err), -err);
+
+		if (saved_formats) {
+			err = v4l2_subdev_apply_setup_formats(saved_formats);
+			if (err)
+				printf("Unable to restore formats: %s (%d)\n",
+				       strerror(-err), -err);
+		}
+	}
+
+done:
+	v4l2_subdev_free_setup_formats(saved_formats);
+	v4l2_subdev_free_setup_formats(formats);
+	media_free_setup_links(saved_links);
+	media_free_setup_links(links);
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	struct media_device *media;
@@ -655,7 +739,13 @@ int main(int argc, char **argv)
 			printf("%s\n", devname);
 	}
 
-	if (media_opts.reset) {
+	if (media_opts.diff) {
+		ret = media_setup_diff(media);
+		if (ret)
+			goto out;
+	}
+
+	if (media_opts.reset && !media_opts.diff) {
 		if (media_opts.verbose)
 			printf("Resetting all links to inactive\n");
 		ret = media_reset_links(media);
@@ -666,7 +756,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (media_opts.links) {
+	if (media_opts.links && !media_opts.diff) {
 		ret = media_parse_setup_links(media, media_opts.links);
 		if (ret) {
 			printf("Unable to parse link: %s (%d)\n",
@@ -675,7 +765,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (media_opts.formats) {
+	if (media_opts.formats && !media_opts.diff) {
 		ret = v4l2_subdev_parse_setup_formats(media,
 						      media_opts.formats);
 		if (ret) {
@@ -47,6 +47,16 @@ struct media_device {
 	struct media_entity *entities;
 	unsigned int entities_count;
 
+	/*
+	 * Open addressing hash tables of entity indices (plus one, zero marks
+	 * an empty slot) by name and by id. They are built on demand and
+	 * rebuilt when the number of entities changes.
+	 */
+	unsigned int *name_index;
+	unsigned int *id_index;
+	unsigned int index_size;
+	unsigned int index_count;
+
 	void (*debug_handler)(void *, ...);
 	void *debug_priv;
 
@@ -41,6 +41,7 @@ struct media_pad {
 
 struct media_device;
 struct media_entity;
+struct media_links_plan;
 
 /**
  * @brief Create a new media device.
@@ -433,4 +434,74 @@ int media_parse_setup_link(struct media_device *media,
  */
 int media_parse_setup_links(struct media_device *media, const char *p);
 
+/**
+ * @brief Compile a links description for repeated use.
+ * @param media - media device.
+ * @param p - input string
+ * @param plan - pointer to the compiled plan
+ *
+ * Parse NULL terminated string p describing link(s) separated by commas (,),
+ * using the same syntax as media_parse_setup_links(), and resolve the links
+ * once. The resulting plan can then be applied any number of times with
+ * media_apply_setup_links() without parsing the description again, for
+ * instance to switch between sensor modes at runtime.
+ *
+ * The plan references the entities of the media device and must be freed
+ * with media_free_setup_links() before the media device is destroyed.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int media_compile_setup_links(struct media_device *media, const char *p,
+			      struct media_links_plan **plan);
+
+/**
+ * @brief Compile a links description that also resets all other links.
+ * @param media - media device.
+ * @param p - input string, can be NULL
+ * @param plan - pointer to the compiled plan
+ *
+ * Like media_compile_setup_links(), but the plan additionally disables all
+ * links that are neither immutable nor listed in @a p. Applying it has the
+ * same result as media_reset_links() followed by media_parse_setup_links(),
+ * but only the links whose state changes are touched. Links to be disabled
+ * are configured first.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int media_compile_reset_links(struct media_device *media, const char *p,
+			      struct media_links_plan **plan);
+
+/**
+ * @brief Save the current state of all links.
+ * @param media - media device.
+ * @param plan - pointer to the plan
+ *
+ * Create a plan that restores all the non-immutable links of @a media to
+ * their current state when applied with media_apply_setup_links(). This can
+ * be used to roll back a failed reconfiguration.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int media_save_links(struct media_device *media,
+		     struct media_links_plan **plan);
+
+/**
+ * @brief Configure the links of a compiled links description.
+ * @param plan - compiled plan.
+ *
+ * Configure all links of @a plan. Links whose enabled state already matches
+ * the plan, according to the link state cached in the media device, are
+ * skipped, so only the MEDIA_IOC_SETUP_LINK calls that change the pipeline
+ * are issued.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int media_apply_setup_links(struct media_links_plan *plan);
+
+/**
+ * @brief Free a compiled links description.
+ * @param plan - compiled plan, can be NULL.
+ */
+void media_free_setup_links(struct media_links_plan *plan);
+
 #endif
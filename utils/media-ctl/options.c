@@ -72,6 +72,11 @@ static void usage(const char *argv0)
 	printf("			information for that entity only.\n");
 	printf("    --print-dot		Print the device topology as a dot graph\n");
 	printf("-r, --reset		Reset all links to inactive\n");
+	printf("    --diff		Only apply the links and formats that differ from the\n");
+	printf("			current configuration. With -r, only the links that\n");
+	printf("			are not set up by -l are disabled.\n");
+	printf("    --rollback		With --diff, restore the previous links and formats\n");
+	printf("			if the new configuration can't be applied\n");
 	printf("-v, --verbose		Be verbose\n");
 	printf("    --version		Show version information\n");
 	printf("\n");
@@ -142,6 +147,8 @@ static void usage(const char *argv0)
 #define OPT_LIST_KNOWN_MBUS_FMTS	259
 #define OPT_GET_DV			260
 #define OPT_VERSION			261
+#define OPT_DIFF			262
+#define OPT_ROLLBACK			263
 
 static struct option opts[] = {
 	{"device", 1, 0, 'd'},
@@ -159,6 +166,8 @@ static struct option opts[] = {
 	{"print-dot", 0, 0, OPT_PRINT_DOT},
 	{"print-topology", 0, 0, 'p'},
 	{"reset", 0, 0, 'r'},
+	{"diff", 0, 0, OPT_DIFF},
+	{"rollback", 0, 0, OPT_ROLLBACK},
 	{"verbose", 0, 0, 'v'},
 	{"version", 0, 0, OPT_VERSION},
 	{ },
@@ -283,6 +292,14 @@ int parse_cmdline(int argc, char **argv)
 			media_opts.verbose = 1;
 			break;
 
+		case OPT_DIFF:
+			media_opts.diff = 1;
+			break;
+
+		case OPT_ROLLBACK:
+			media_opts.rollback = 1;
+			break;
+
 		case OPT_PRINT_DOT:
 			media_opts.print_dot = 1;
 			break;
@@ -314,6 +331,11 @@ int parse_cmdline(int argc, char **argv)
 		}
 	}
 
+	if (media_opts.rollback && !media_opts.diff) {
+		printf("--rollback requires --diff\n");
+		return 1;
+	}
+
 	return 0;
 }
 
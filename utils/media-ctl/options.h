@@ -31,6 +31,8 @@ struct media_options
 		     print:1,
 		     print_dot:1,
 		     reset:1,
+		     diff:1,
+		     rollback:1,
 		     verbose:1;
 	const char *entity;
 	const char *formats;
@@ -26,6 +26,7 @@
 
 struct media_device;
 struct media_entity;
+struct v4l2_subdev_formats_plan;
 
 /**
  * @brief Open a sub-device.
@@ -235,6 +236,60 @@ int v4l2_subdev_set_frame_interval(struct media_entity *entity,
  */
 int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p);
 
+/**
+ * @brief Compile a format description for repeated use.
+ * @param media - media device.
+ * @param p - input string
+ * @param plan - pointer to the compiled plan
+ *
+ * Parse string @a p, using the same syntax as
+ * v4l2_subdev_parse_setup_formats(), and resolve the pads it refers to once.
+ * The resulting plan can then be applied any number of times with
+ * v4l2_subdev_apply_setup_formats() without parsing the description again.
+ *
+ * The plan references the entities of the media device and must be freed
+ * with v4l2_subdev_free_setup_formats() before the media device is destroyed.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_compile_setup_formats(struct media_device *media,
+	const char *p, struct v4l2_subdev_formats_plan **plan);
+
+/**
+ * @brief Save the configuration of the pads of a compiled format description.
+ * @param plan - compiled plan.
+ * @param saved - pointer to the plan restoring the current configuration
+ *
+ * Read the active format, crop and compose rectangles and frame interval of
+ * all pads configured by @a plan, as well as of the subdev sink pads formats
+ * would be propagated to. The resulting plan restores that configuration when
+ * applied with v4l2_subdev_apply_setup_formats(), which can be used to roll
+ * back a failed reconfiguration. Restoring doesn't stop at the first error.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_save_formats(struct v4l2_subdev_formats_plan *plan,
+	struct v4l2_subdev_formats_plan **saved);
+
+/**
+ * @brief Apply the settings of a compiled format description.
+ * @param plan - compiled plan.
+ *
+ * Apply the format, crop, compose and frame interval settings of @a plan in
+ * the same order as v4l2_subdev_parse_setup_formats() would. Settings that
+ * already match the active configuration of a pad are skipped, so that only
+ * the set ioctls that change the configuration are issued.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_apply_setup_formats(struct v4l2_subdev_formats_plan *plan);
+
+/**
+ * @brief Free a compiled format description.
+ * @param plan - compiled plan, can be NULL.
+ */
+void v4l2_subdev_free_setup_formats(struct v4l2_subdev_formats_plan *plan);
+
 /**
  * @brief Convert media bus pixel code to string.
  * @param code - input string
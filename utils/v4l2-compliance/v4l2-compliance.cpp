@@ -50,6 +50,7 @@ enum Option {
 	OptExitOnFail = 'E',
 	OptStreamAllFormats = 'f',
 	OptHelp = 'h',
+	OptParallel = 'j',
 	OptSetMediaDevice = 'm',
 	OptSetMediaDeviceOnly = 'M',
 	OptNoWarnings = 'n',
@@ -67,6 +68,7 @@ enum Option {
 	OptMediaBusInfo = 'z',
 	OptStreamFrom = 128,
 	OptStreamFromHdr,
+	OptStreamThroughput,
 	OptVersion,
 	OptLast = 256
 };
@@ -89,10 +91,14 @@ bool is_uvcvideo;
 int media_fd = -1;
 unsigned warnings;
 bool has_mmu = true;
+unsigned parallel_jobs = 1;
 
 static unsigned color_component;
 static unsigned color_skip;
 static unsigned color_perc = 90;
+static unsigned throughput_count = 300;
+static double throughput_min_fps;
+static int throughput_max_drops = -1;
 
 struct dev_state {
 	struct node *node;
@@ -144,6 +150,8 @@ static struct option long_options[] = {
 	{"stream-all-formats", optional_argument, nullptr, OptStreamAllFormats},
 	{"stream-all-io", no_argument, nullptr, OptStreamAllIO},
 	{"stream-all-color", required_argument, nullptr, OptStreamAllColorTest},
+	{"stream-throughput", optional_argument, nullptr, OptStreamThroughput},
+	{"parallel", required_argument, nullptr, OptParallel},
 	{"version", no_argument, nullptr, OptVersion},
 	{nullptr, 0, nullptr, 0}
 };
@@ -253,6 +261,17 @@ static void usage()
 	printf("                     signal is present on the input(s). If <skip> is not specified,\n");
 	printf("                     then just capture the first frame. If <perc> is not specified,\n");
 	printf("                     then this defaults to 90%%.\n");
+	printf("  --stream-throughput [count=<frames>,min-fps=<fps>,max-drops=<drops>]\n");
+	printf("                     For all formats of a capture device stream <frames> frames\n");
+	printf("                     (default 300) using MMAP and report the achieved frame rate,\n");
+	printf("                     the DQBUF latency percentiles and the number of dropped frames.\n");
+	printf("                     Fail if the frame rate is below <fps> or if more than <drops>\n");
+	printf("                     frames were dropped. By default neither is checked.\n");
+	printf("  -j, --parallel <jobs>\n");
+	printf("                     When used with -m, test up to <jobs> independent parts of the\n");
+	printf("                     media topology at the same time. Interfaces whose entities\n");
+	printf("                     are connected by data links are always tested together.\n");
+	printf("                     If <jobs> is 0, then use the number of online CPUs.\n");
 	printf("  -E, --exit-on-fail Exit on the first fail.\n");
 	printf("  -h, --help         Display this help message.\n");
 	printf("  -C, --color <when> Highlight OK/warn/fail/FAIL strings with colors\n");
@@ -290,6 +309,23 @@ const char *ok(int res)
 	return buf;
 }
 
+void get_test_totals(test_totals &totals)
+{
+	totals.total = grand_total;
+	totals.ok = grand_ok;
+	totals.warnings = grand_warnings;
+	totals.result = app_result;
+}
+
+void add_test_totals(const test_totals &totals)
+{
+	grand_total += totals.total;
+	grand_ok += totals.ok;
+	grand_warnings += totals.warnings;
+	if (totals.result)
+		app_result = totals.result;
+}
+
 int check_string(const char *s, size_t len)
 {
 	size_t sz = strnlen(s, len);
@@ -1387,7 +1423,8 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 			break;
 
 		if (options[OptStreaming] || (node.is_video && options[OptStreamAllFormats]) ||
-		    (node.is_video && node.can_capture && options[OptStreamAllColorTest]))
+		    (node.is_video && node.can_capture &&
+		     (options[OptStreamAllColorTest] || options[OptStreamThroughput])))
 			printf("Test %s %d:\n\n",
 				node.can_capture ? "input" : "output", io);
 
@@ -1459,6 +1496,19 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 			}
 		}
 
+		if (node.is_video && node.can_capture && options[OptStreamThroughput]) {
+			printf("Stream throughput:\n");
+
+			if (node.is_m2m) {
+				printf("\tNot supported for M2M devices\n");
+			} else {
+				streamingSetup(&node);
+				streamThroughputAllFormats(&node, throughput_count,
+							   throughput_min_fps,
+							   throughput_max_drops);
+			}
+		}
+
 		if (node.is_video && node.can_capture && options[OptStreamAllColorTest]) {
 			printf("Stream using all formats and do a color check:\n");
 
@@ -1675,6 +1725,42 @@ int main(int argc, char **argv)
 				}
 			}
 			break;
+		case OptStreamThroughput:
+			subs = optarg;
+			while (subs && *subs != '\0') {
+				static constexpr const char *subopts[] = {
+					"count",
+					"min-fps",
+					"max-drops",
+					nullptr
+				};
+
+				switch (parse_subopt(&subs, subopts, &value)) {
+				case 0:
+					throughput_count = strtoul(value, nullptr, 0);
+					if (throughput_count == 0)
+						throughput_count = 300;
+					break;
+				case 1:
+					throughput_min_fps = strtod(value, nullptr);
+					break;
+				case 2:
+					throughput_max_drops = strtol(value, nullptr, 0);
+					break;
+				default:
+					usage();
+					std::exit(EXIT_FAILURE);
+				}
+			}
+			break;
+		case OptParallel:
+			parallel_jobs = strtoul(optarg, nullptr, 0);
+			if (parallel_jobs == 0) {
+				long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+				parallel_jobs = cpus > 0 ? cpus : 1;
+			}
+			break;
 		case OptColor:
 			if (!strcmp(optarg, "always"))
 				show_colors = true;
@@ -59,6 +59,7 @@ extern int kernel_version;
 extern int media_fd;
 extern unsigned warnings;
 extern bool has_mmu;
+extern unsigned parallel_jobs;
 
 enum poll_mode {
 	POLL_MODE_NONE,
@@ -309,6 +310,17 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 	      unsigned frame_count, unsigned all_fmt_frame_count);
 std::string stream_from(const std::string &pixelformat, bool &use_hdr);
 
+// Grand totals, used to merge the results of parallel workers
+struct test_totals {
+	int total;
+	int ok;
+	int warnings;
+	int result;
+};
+
+void get_test_totals(test_totals &totals);
+void add_test_totals(const test_totals &totals);
+
 // Media Controller ioctl tests
 int testMediaDeviceInfo(struct node *node);
 int testMediaTopology(struct node *node);
@@ -405,6 +417,8 @@ int testDmaBuf(struct node *expbuf_node, struct node *node,
 int testRequests(struct node *node, bool test_streaming);
 void streamAllFormats(struct node *node, unsigned frame_count);
 void streamM2MAllFormats(struct node *node, unsigned frame_count);
+void streamThroughputAllFormats(struct node *node, unsigned frame_count,
+				double min_fps, int max_drops);
 
 // Color tests
 int testColorsAllFormats(struct node *node, unsigned component,
@@ -3405,6 +3405,144 @@ void streamAllFormats(struct node *node, unsigned frame_count)
 	} while (!node->enum_fmt(fmtdesc));
 }
 
+static double monotonic_now()
+{
+	timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct throughput_stats {
+	double fps;
+	std::vector<double> latencies;
+	unsigned drops;
+};
+
+static double latencyPerc(const throughput_stats &stats, unsigned perc)
+{
+	unsigned idx = stats.latencies.size() * perc / 100;
+
+	if (idx >= stats.latencies.size())
+		idx = stats.latencies.size() - 1;
+	return stats.latencies[idx] * 1000.0;
+}
+
+/*
+ * Stream frame_count frames using MMAP and collect the achieved frame rate,
+ * the DQBUF latencies and the number of frames that were dropped, based on
+ * the gaps in the sequence numbers.
+ *
+ * For monotonic timestamps the latency is the time between the capture
+ * timestamp and the moment DQBUF returns, otherwise it is just the time
+ * spent waiting in DQBUF.
+ */
+static int testThroughput(struct node *node, unsigned frame_count,
+			  throughput_stats &stats)
+{
+	cv4l_queue q(node->g_type(), V4L2_MEMORY_MMAP);
+	cv4l_buffer buf(q);
+	double start = 0;
+	__u32 last_seq = 0;
+
+	stats.fps = 0;
+	stats.drops = 0;
+	stats.latencies.clear();
+	stats.latencies.reserve(frame_count);
+
+	fail_on_test(q.reqbufs(node, 4));
+	fail_on_test(q.obtain_bufs(node));
+	fail_on_test(q.queue_all(node));
+	fail_on_test(node->streamon());
+
+	for (unsigned i = 0; i < frame_count; i++) {
+		double before = monotonic_now();
+
+		fail_on_test(node->dqbuf(buf));
+
+		double after = monotonic_now();
+
+		if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+		    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+			timeval ts = buf.g_timestamp();
+
+			stats.latencies.push_back(after - ts.tv_sec - ts.tv_usec / 1e6);
+		} else {
+			stats.latencies.push_back(after - before);
+		}
+		if (i == 0)
+			start = after;
+		else if (buf.g_sequence() > last_seq + 1)
+			stats.drops += buf.g_sequence() - last_seq - 1;
+		last_seq = buf.g_sequence();
+		if (!no_progress)
+			printf("\r\t\t%u/%u", i + 1, frame_count);
+		fail_on_test(node->qbuf(buf));
+	}
+	if (frame_count > 1)
+		stats.fps = (frame_count - 1) / (monotonic_now() - start);
+
+	fail_on_test(node->streamoff());
+	fail_on_test(q.reqbufs(node, 0));
+	return 0;
+}
+
+static int checkThroughput(const throughput_stats &stats,
+			   double min_fps, int max_drops)
+{
+	if (min_fps > 0 && stats.fps < min_fps)
+		return fail("%.2f fps is below the minimum of %.2f fps\n",
+			    stats.fps, min_fps);
+	if (max_drops >= 0 && stats.drops > static_cast<unsigned>(max_drops))
+		return fail("%u dropped frames, at most %d allowed\n",
+			    stats.drops, max_drops);
+	return 0;
+}
+
+void streamThroughputAllFormats(struct node *node, unsigned frame_count,
+				double min_fps, int max_drops)
+{
+	v4l2_fmtdesc fmtdesc;
+
+	if (!(node->g_caps() & V4L2_CAP_STREAMING)) {
+		printf("\tNot supported for devices without streaming I/O\n");
+		return;
+	}
+	if (node->enum_fmt(fmtdesc, true))
+		return;
+	do {
+		throughput_stats stats;
+		cv4l_fmt fmt;
+		int ret;
+
+		restoreFormat(node);
+		node->g_fmt(fmt);
+		fmt.s_pixelformat(fmtdesc.pixelformat);
+		node->s_fmt(fmt);
+		if (fmt.g_pixelformat() != fmtdesc.pixelformat)
+			continue;
+
+		printf("\ttest throughput for Format %s, Frame Size %ux%u:\n",
+		       fcc2s(fmtdesc.pixelformat).c_str(),
+		       fmt.g_width(), fmt.g_frame_height());
+		ret = testThroughput(node, frame_count, stats);
+		std::sort(stats.latencies.begin(), stats.latencies.end());
+		if (!ret)
+			ret = checkThroughput(stats, min_fps, max_drops);
+		if (stats.latencies.empty()) {
+			printf("\r\t\t%s   \n", ok(ret));
+		} else {
+			printf("\r\t\t%.2f fps, DQBUF latency p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms, %u dropped: %s\n",
+			       stats.fps, latencyPerc(stats, 50), latencyPerc(stats, 90),
+			       latencyPerc(stats, 99), stats.latencies.back() * 1000.0,
+			       stats.drops, ok(ret));
+		}
+		// Reopen to reset the streaming state in case of errors
+		node->reopen();
+	} while (!node->enum_fmt(fmtdesc));
+	restoreFormat(node);
+}
+
 static void streamM2MRun(struct node *node, unsigned frame_count)
 {
 	cv4l_fmt cap_fmt, out_fmt;
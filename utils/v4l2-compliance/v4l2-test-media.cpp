@@ -18,12 +18,16 @@
     Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
  */
 
+#include <csignal>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <dirent.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "v4l2-compliance.h"
 
@@ -535,84 +539,409 @@ int testMediaSetupLink(struct node *node)
 	return 0;
 }
 
-void walkTopology(struct node &node, struct node &expbuf_node,
-		  unsigned frame_count, unsigned all_fmt_frame_count)
+static void testInterface(struct node &node, struct node &expbuf_node,
+			  const std::string &dev, unsigned frame_count,
+			  unsigned all_fmt_frame_count)
 {
-	media_v2_topology topology;
+	printf("--------------------------------------------------------------------------------\n");
 
-	memset(&topology, 0, sizeof(topology));
-	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+	media_type type = mi_media_detect_type(dev.c_str());
+	if (type == MEDIA_TYPE_CANT_STAT) {
+		fprintf(stderr, "\nCannot open device %s, skipping.\n\n",
+			dev.c_str());
 		return;
+	}
 
-	media_v2_interface v2_ifaces[topology.num_interfaces];
+	switch (type) {
+	// For now we can only handle V4L2 devices
+	case MEDIA_TYPE_VIDEO:
+	case MEDIA_TYPE_VBI:
+	case MEDIA_TYPE_RADIO:
+	case MEDIA_TYPE_SDR:
+	case MEDIA_TYPE_TOUCH:
+	case MEDIA_TYPE_SUBDEV:
+		break;
+	default:
+		type = MEDIA_TYPE_UNKNOWN;
+		break;
+	}
 
-	topology.ptr_interfaces = (uintptr_t)v2_ifaces;
-	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+	if (type == MEDIA_TYPE_UNKNOWN) {
+		fprintf(stderr, "\nUnable to detect what device %s is, skipping.\n\n",
+			dev.c_str());
+		return;
+	}
+
+	struct node test_node;
+	int fd = -1;
+
+	test_node.device = dev.c_str();
+	test_node.s_trace(node.g_trace());
+	switch (type) {
+	case MEDIA_TYPE_MEDIA:
+		test_node.s_direct(true);
+		fd = test_node.media_open(dev.c_str(), false);
+		break;
+	case MEDIA_TYPE_SUBDEV:
+		test_node.s_direct(true);
+		fd = test_node.subdev_open(dev.c_str(), false);
+		break;
+	default:
+		test_node.s_direct(node.g_direct());
+		fd = test_node.open(dev.c_str(), false);
+		break;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "\nFailed to open device %s, skipping\n\n",
+			dev.c_str());
 		return;
+	}
+
+	testNode(test_node, test_node, expbuf_node, type,
+		 frame_count, all_fmt_frame_count);
+	test_node.close();
+}
+
+static __u32 topologyRoot(std::map<__u32, __u32> &parent, __u32 id)
+{
+	while (parent[id] != id) {
+		parent[id] = parent[parent[id]];
+		id = parent[id];
+	}
+	return id;
+}
+
+/*
+ * Split the interfaces into groups that can be tested independently:
+ * interfaces whose entities are connected through data links (directly
+ * or through other entities) end up in the same group, since streaming
+ * on one of them may depend on or interfere with the others.
+ *
+ * order gets the group and the index within the group of each interface,
+ * in topology order.
+ */
+static void groupInterfaces(const media_v2_topology &topology,
+			    std::vector<std::vector<std::string>> &groups,
+			    std::vector<std::pair<unsigned, unsigned>> &order)
+{
+	const auto *ents = reinterpret_cast<const media_v2_entity *>(topology.ptr_entities);
+	const auto *ifaces = reinterpret_cast<const media_v2_interface *>(topology.ptr_interfaces);
+	const auto *pads = reinterpret_cast<const media_v2_pad *>(topology.ptr_pads);
+	const auto *links = reinterpret_cast<const media_v2_link *>(topology.ptr_links);
+	std::map<__u32, __u32> parent;
+	std::map<__u32, __u32> pad_entity;
+	std::map<__u32, __u32> iface_entity;
+	std::map<__u32, unsigned> group_of_root;
+
+	for (unsigned i = 0; i < topology.num_entities; i++)
+		parent[ents[i].id] = ents[i].id;
+	for (unsigned i = 0; i < topology.num_pads; i++)
+		pad_entity[pads[i].id] = pads[i].entity_id;
+
+	for (unsigned i = 0; i < topology.num_links; i++) {
+		const media_v2_link &link = links[i];
+
+		switch (link.flags & MEDIA_LNK_FL_LINK_TYPE) {
+		case MEDIA_LNK_FL_DATA_LINK: {
+			auto src = pad_entity.find(link.source_id);
+			auto sink = pad_entity.find(link.sink_id);
+
+			if (src == pad_entity.end() || sink == pad_entity.end() ||
+			    !parent.count(src->second) || !parent.count(sink->second))
+				break;
+			parent[topologyRoot(parent, src->second)] =
+				topologyRoot(parent, sink->second);
+			break;
+		}
+		case MEDIA_LNK_FL_ANCILLARY_LINK:
+			/* Ancillary links connect entities, not pads */
+			if (!parent.count(link.source_id) ||
+			    !parent.count(link.sink_id))
+				break;
+			parent[topologyRoot(parent, link.source_id)] =
+				topologyRoot(parent, link.sink_id);
+			break;
+		case MEDIA_LNK_FL_INTERFACE_LINK:
+			if (parent.count(link.sink_id) &&
+			    !iface_entity.count(link.source_id))
+				iface_entity[link.source_id] = link.sink_id;
+			break;
+		}
+	}
 
 	for (unsigned i = 0; i < topology.num_interfaces; i++) {
-		media_v2_interface &iface = v2_ifaces[i];
+		const media_v2_interface &iface = ifaces[i];
 		std::string dev = mi_media_get_device(iface.devnode.major,
 						      iface.devnode.minor);
 		if (dev.empty())
 			continue;
 
-		printf("--------------------------------------------------------------------------------\n");
+		auto ent = iface_entity.find(iface.id);
 
-		media_type type = mi_media_detect_type(dev.c_str());
-		if (type == MEDIA_TYPE_CANT_STAT) {
-			fprintf(stderr, "\nCannot open device %s, skipping.\n\n",
-				dev.c_str());
+		if (ent == iface_entity.end()) {
+			order.push_back({ groups.size(), 0 });
+			groups.push_back({ dev });
 			continue;
 		}
 
-		switch (type) {
-		// For now we can only handle V4L2 devices
-		case MEDIA_TYPE_VIDEO:
-		case MEDIA_TYPE_VBI:
-		case MEDIA_TYPE_RADIO:
-		case MEDIA_TYPE_SDR:
-		case MEDIA_TYPE_TOUCH:
-		case MEDIA_TYPE_SUBDEV:
-			break;
-		default:
-			type = MEDIA_TYPE_UNKNOWN;
-			break;
+		__u32 root = topologyRoot(parent, ent->second);
+		auto grp = group_of_root.find(root);
+
+		if (grp == group_of_root.end()) {
+			group_of_root[root] = groups.size();
+			order.push_back({ groups.size(), 0 });
+			groups.push_back({ dev });
+		} else {
+			order.push_back({ grp->second, groups[grp->second].size() });
+			groups[grp->second].push_back(dev);
 		}
+	}
+}
 
-		if (type == MEDIA_TYPE_UNKNOWN) {
-			fprintf(stderr, "\nUnable to detect what device %s is, skipping.\n\n",
-				dev.c_str());
-			continue;
+struct topology_worker {
+	pid_t pid;
+	/* The output of each interface of the group */
+	std::vector<FILE *> outputs;
+	int result_fd;
+	bool done;
+};
+
+static void closeOutputs(topology_worker &worker)
+{
+	for (auto output : worker.outputs)
+		if (output)
+			fclose(output);
+	worker.outputs.clear();
+}
+
+static void printOutput(FILE *output)
+{
+	char buf[4096];
+	size_t n;
+
+	rewind(output);
+	while ((n = fread(buf, 1, sizeof(buf), output)))
+		fwrite(buf, 1, n, stdout);
+	fclose(output);
+	fflush(stdout);
+}
+
+static bool startWorker(struct node &node, struct node &expbuf_node,
+			const std::vector<std::string> &group,
+			topology_worker &worker,
+			unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	int fds[2];
+
+	worker.done = false;
+	for (unsigned i = 0; i < group.size(); i++) {
+		FILE *output = tmpfile();
+
+		if (!output) {
+			closeOutputs(worker);
+			return false;
+		}
+		worker.outputs.push_back(output);
+	}
+	if (pipe(fds)) {
+		closeOutputs(worker);
+		return false;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	worker.pid = fork();
+	if (worker.pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		closeOutputs(worker);
+		return false;
+	}
+
+	if (worker.pid == 0) {
+		test_totals before, after;
+
+		close(fds[0]);
+		no_progress = true;
+
+		get_test_totals(before);
+		for (unsigned i = 0; i < group.size(); i++) {
+			dup2(fileno(worker.outputs[i]), STDOUT_FILENO);
+			dup2(fileno(worker.outputs[i]), STDERR_FILENO);
+			testInterface(node, expbuf_node, group[i],
+				      frame_count, all_fmt_frame_count);
+			fflush(stdout);
+			fflush(stderr);
 		}
+		get_test_totals(after);
+		after.total -= before.total;
+		after.ok -= before.ok;
+		after.warnings -= before.warnings;
+		if (write(fds[1], &after, sizeof(after)) != sizeof(after))
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	worker.result_fd = fds[0];
+	return true;
+}
 
-		struct node test_node;
-		int fd = -1;
+static bool finishWorker(const std::vector<std::string> &group,
+			 topology_worker &worker)
+{
+	test_totals totals;
 
-		test_node.device = dev.c_str();
-		test_node.s_trace(node.g_trace());
-		switch (type) {
-		case MEDIA_TYPE_MEDIA:
-			test_node.s_direct(true);
-			fd = test_node.media_open(dev.c_str(), false);
-			break;
-		case MEDIA_TYPE_SUBDEV:
-			test_node.s_direct(true);
-			fd = test_node.subdev_open(dev.c_str(), false);
-			break;
-		default:
-			test_node.s_direct(node.g_direct());
-			fd = test_node.open(dev.c_str(), false);
-			break;
+	worker.outputs.clear();
+	if (read(worker.result_fd, &totals, sizeof(totals)) == sizeof(totals)) {
+		add_test_totals(totals);
+	} else {
+		fprintf(stderr, "\nTesting of %s", group[0].c_str());
+		for (unsigned i = 1; i < group.size(); i++)
+			fprintf(stderr, ", %s", group[i].c_str());
+		fprintf(stderr, " ended prematurely.\n\n");
+		totals = { 0, 0, 0, -1 };
+		add_test_totals(totals);
+		close(worker.result_fd);
+		return false;
+	}
+	close(worker.result_fd);
+	return true;
+}
+
+/*
+ * Test the groups in up to parallel_jobs forked worker processes. The
+ * output of each interface is buffered and printed in topology order, so
+ * it is identical to that of a sequential run. Only a group that can't be
+ * forked is tested, and printed, right away.
+ */
+static void testParallel(struct node &node, struct node &expbuf_node,
+			 const std::vector<std::vector<std::string>> &groups,
+			 const std::vector<std::pair<unsigned, unsigned>> &order,
+			 unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	std::vector<topology_worker> workers(groups.size());
+	unsigned next = 0, printed = 0, running = 0;
+
+	while (printed < order.size()) {
+		while (next < groups.size() && running < parallel_jobs) {
+			if (startWorker(node, expbuf_node, groups[next], workers[next],
+					frame_count, all_fmt_frame_count)) {
+				running++;
+			} else {
+				/* Can't fork, test this group in this process */
+				for (const auto &dev : groups[next])
+					testInterface(node, expbuf_node, dev,
+						      frame_count, all_fmt_frame_count);
+				workers[next].pid = 0;
+				workers[next].done = true;
+			}
+			next++;
 		}
-		if (fd < 0) {
-			fprintf(stderr, "\nFailed to open device %s, skipping\n\n",
-				dev.c_str());
+
+		while (printed < order.size()) {
+			unsigned grp = order[printed].first;
+			unsigned idx = order[printed].second;
+			topology_worker &worker = workers[grp];
+
+			if (grp >= next || !worker.done)
+				break;
+			printed++;
+			if (!worker.pid)
+				continue;
+
+			printOutput(worker.outputs[idx]);
+			worker.outputs[idx] = nullptr;
+			if (idx + 1 == groups[grp].size() &&
+			    !finishWorker(groups[grp], worker) &&
+			    (exit_on_fail || exit_on_warn)) {
+				// A worker exited on the first fail or warning,
+				// so stop the others as well.
+				for (unsigned i = 0; i < next; i++)
+					if (workers[i].pid && !workers[i].done)
+						kill(workers[i].pid, SIGTERM);
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		if (!running)
 			continue;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			// The workers can't be waited for (e.g. SIGCHLD is
+			// ignored), but reading their result pipe in
+			// finishWorker() blocks until they are done, so
+			// still print the output of all groups.
+			for (unsigned i = 0; i < next; i++)
+				workers[i].done = true;
+			running = 0;
+			continue;
+		}
+		for (unsigned i = 0; i < next; i++) {
+			if (workers[i].pid == pid && !workers[i].done) {
+				workers[i].done = true;
+				running--;
+				break;
+			}
 		}
+	}
+}
+
+void walkTopology(struct node &node, struct node &expbuf_node,
+		  unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	media_v2_topology topology;
+
+	memset(&topology, 0, sizeof(topology));
+	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+		return;
+
+	media_v2_interface v2_ifaces[topology.num_interfaces];
+
+	topology.ptr_interfaces = (uintptr_t)v2_ifaces;
+
+	// Testing the expbuf device from several processes at once is not
+	// supported, so fall back to testing all interfaces sequentially.
+	if (parallel_jobs > 1 && expbuf_node.g_fd() < 0) {
+		// The topology may have changed between the two ioctls, so
+		// allocate a bit more than reported.
+		std::vector<media_v2_entity> ents(topology.num_entities + 16);
+		std::vector<media_v2_pad> pads(topology.num_pads + 64);
+		std::vector<media_v2_link> links(topology.num_links + 64);
+		std::vector<std::vector<std::string>> groups;
+		std::vector<std::pair<unsigned, unsigned>> order;
+		unsigned num_interfaces = topology.num_interfaces;
+
+		topology.num_entities = ents.size();
+		topology.num_pads = pads.size();
+		topology.num_links = links.size();
+		topology.ptr_entities = (uintptr_t)ents.data();
+		topology.ptr_pads = (uintptr_t)pads.data();
+		topology.ptr_links = (uintptr_t)links.data();
+		if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology) ||
+		    topology.num_interfaces > num_interfaces)
+			return;
+		groupInterfaces(topology, groups, order);
+		testParallel(node, expbuf_node, groups, order,
+			     frame_count, all_fmt_frame_count);
+		return;
+	}
+
+	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+		return;
+
+	for (unsigned i = 0; i < topology.num_interfaces; i++) {
+		media_v2_interface &iface = v2_ifaces[i];
+		std::string dev = mi_media_get_device(iface.devnode.major,
+						      iface.devnode.minor);
+		if (dev.empty())
+			continue;
 
-		testNode(test_node, test_node, expbuf_node, type,
-			 frame_count, all_fmt_frame_count);
-		test_node.close();
+		testInterface(node, expbuf_node, dev,
+			      frame_count, all_fmt_frame_count);
 	}
 }
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <deque>
+#include <vector>
 
 #include <netdb.h>
 #include <sys/types.h>
@@ -32,11 +36,15 @@ static u8 stream_out_alpha;
 static bool stream_out_alpha_red_only;
 static bool stream_out_rgb_lim_range;
 static unsigned stream_out_perc_fill = 100;
+static unsigned stream_out_threads = 1;
+static struct tpg_pool *tpg_pool;
+static struct tpg_cache *tpg_cache;
 static v4l2_std_id stream_out_std;
 static bool stream_out_refresh;
 static tpg_move_mode stream_out_hor_mode = TPG_MOVE_NONE;
 static tpg_move_mode stream_out_vert_mode = TPG_MOVE_NONE;
 static unsigned reqbufs_count_cap = 4;
+static unsigned stream_grow_max;
 static unsigned reqbufs_count_out = 4;
 static char *file_to;
 static bool to_with_hdr;
@@ -47,6 +55,14 @@ static unsigned bpl_cap[VIDEO_MAX_PLANES];
 #endif
 static bool host_lossless;
 static int host_fd_to = -1;
+static bool host_udp_to;
+#ifndef NO_STREAM_TO
+static struct sockaddr_in udp_addr_to;
+static __u32 udp_seq_to;
+static std::vector<__u8> udp_hdr_to;
+static char *udp_msg_to;
+static size_t udp_msg_to_size;
+#endif
 static unsigned comp_perc;
 static unsigned comp_perc_count;
 static char *file_from;
@@ -54,12 +70,26 @@ static bool from_with_hdr;
 static char *host_from;
 static unsigned host_port_from = V4L_STREAM_PORT;
 static int host_fd_from = -1;
+static bool host_udp_from;
+static struct v4l_stream_udp_rx udp_rx;
+static std::vector<__u8> udp_hdr_from;
+static FILE *udp_msg_fin;
+static bool udp_msg_pending;
 static struct tpg_data tpg;
 static unsigned output_field = V4L2_FIELD_NONE;
 static bool output_field_alt;
 static unsigned bpl_out[VIDEO_MAX_PLANES];
 static bool last_buffer = false;
 static codec_ctx *ctx;
+static char *stats_csv_file;
+
+/* State of the --stream-grow policy */
+#define GROW_IDLE_BUFS 300
+static bool grow_active;
+static unsigned grow_min_bufs;
+static unsigned grow_idle;
+static bool grow_have_seq;
+static __u32 grow_last_seq;
 
 static unsigned int cropped_width;
 static unsigned int cropped_height;
@@ -245,6 +275,366 @@ double fps_timestamps::fps()
 	return fps;
 };
 
+/*
+ * Log-linear histogram in the style of HdrHistogram: values below 128 are
+ * counted exactly, larger values in 64 sub-buckets per power of two. So
+ * the percentiles have a relative error of at most 1/64 over the whole
+ * range, while recording a value is just a few instructions.
+ */
+class stats_histogram {
+private:
+	static constexpr unsigned SUB_BITS = 6;
+	static constexpr unsigned SUB_COUNT = 1 << SUB_BITS;
+	static constexpr unsigned BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+	__u64 counts[BUCKETS];
+	__u64 total;
+	__u64 max_val;
+
+	static unsigned index(__u64 val)
+	{
+		if (val < 2 * SUB_COUNT)
+			return val;
+
+		unsigned shift = 63 - __builtin_clzll(val) - SUB_BITS;
+
+		return (shift + 1) * SUB_COUNT + (val >> shift) - SUB_COUNT;
+	}
+
+	static __u64 value(unsigned idx)
+	{
+		if (idx < 2 * SUB_COUNT)
+			return idx;
+
+		unsigned shift = idx / SUB_COUNT - 1;
+		__u64 sub = idx % SUB_COUNT + SUB_COUNT;
+
+		/* Report the middle of the bucket */
+		return (sub << shift) + (1ULL << (shift - 1));
+	}
+
+public:
+	stats_histogram()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		memset(counts, 0, sizeof(counts));
+		total = max_val = 0;
+	}
+
+	void add(__u64 val)
+	{
+		counts[index(val)]++;
+		total++;
+		if (val > max_val)
+			max_val = val;
+	}
+
+	__u64 count() const { return total; }
+	__u64 max() const { return max_val; }
+
+	__u64 percentile(double perc) const
+	{
+		__u64 target = static_cast<__u64>(total * perc / 100.0 + 0.5);
+		__u64 sum = 0;
+
+		if (target == 0)
+			target = 1;
+		for (unsigned i = 0; i < BUCKETS; i++) {
+			sum += counts[i];
+			if (sum >= target)
+				return std::min(value(i), max_val);
+		}
+		return max_val;
+	}
+};
+
+/*
+ * Per-buffer statistics of the capture queue for --stream-stats:
+ *
+ * latency:  buffer timestamp to DQBUF returning, monotonic timestamps only
+ * interval: time between the timestamps of consecutive buffers
+ * jitter:   difference between consecutive intervals
+ * hold:     time between DQBUF returning and the buffer being requeued
+ *
+ * and the number of buffers queued to the driver and the number of buffers
+ * that were ready to be dequeued at each DQBUF. All times are in ns.
+ *
+ * The buffers queued to the driver are tracked in queueing order, so only
+ * the ready buffers at the head of that list and the first buffer that is
+ * not ready yet need a QUERYBUF. The list is rebuilt from QUERYBUF of all
+ * buffers at the first DQBUF and whenever the buffers were queued or
+ * reallocated behind the back of the statistics.
+ */
+class stream_stats {
+private:
+	stats_histogram latency;
+	stats_histogram interval;
+	stats_histogram jitter;
+	stats_histogram hold;
+	unsigned samples;
+	double last_ts;
+	double last_interval;
+	unsigned min_queued;
+	unsigned max_queued;
+	unsigned max_ready;
+	__u64 sum_queued;
+	__u64 sum_ready;
+	FILE *csv;
+
+	/* indices of the buffers owned by the driver, in queueing order */
+	std::deque<unsigned> driver_bufs;
+	unsigned num_bufs;
+
+	/* row of the last dequeued buffer, written once it is requeued */
+	bool pending;
+	__u32 seq;
+	double ts;
+	double dq;
+	double lat;
+	double ival;
+	unsigned queued;
+	unsigned ready;
+
+	void write_row(double q)
+	{
+		if (!pending)
+			return;
+		pending = false;
+		if (!csv)
+			return;
+		fprintf(csv, "%u,%.6f,%.6f,", seq, ts, dq);
+		if (q > 0)
+			fprintf(csv, "%.6f", q);
+		fprintf(csv, ",");
+		if (lat >= 0)
+			fprintf(csv, "%.1f", lat * 1e6);
+		fprintf(csv, ",");
+		if (ival >= 0)
+			fprintf(csv, "%.1f", ival * 1e6);
+		fprintf(csv, ",");
+		if (q > 0)
+			fprintf(csv, "%.1f", (q - dq) * 1e6);
+		fprintf(csv, ",%u,%u\n", queued, ready);
+	}
+
+	unsigned sync_bufs(cv4l_fd &fd, cv4l_queue &q);
+	unsigned count_ready(cv4l_fd &fd, cv4l_queue &q);
+
+	static __u64 to_ns(double secs)
+	{
+		return secs > 0 ? static_cast<__u64>(secs * 1e9 + 0.5) : 0;
+	}
+
+public:
+	stream_stats() : csv(nullptr)
+	{
+		reset();
+	}
+
+	~stream_stats()
+	{
+		close_csv();
+	}
+
+	void reset()
+	{
+		latency.reset();
+		interval.reset();
+		jitter.reset();
+		hold.reset();
+		samples = 0;
+		last_ts = last_interval = -1;
+		min_queued = ~0U;
+		max_queued = max_ready = 0;
+		sum_queued = sum_ready = 0;
+		pending = false;
+		driver_bufs.clear();
+		num_bufs = 0;
+	}
+
+	bool open_csv(const char *name);
+	void close_csv();
+	void dqbuf(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf, double now);
+	void requeue(unsigned index);
+	void qbuf(unsigned index, double now);
+	void report(FILE *f);
+};
+
+bool stream_stats::open_csv(const char *name)
+{
+	close_csv();
+	csv = fopen(name, "w");
+	if (!csv) {
+		fprintf(stderr, "could not open %s for writing: %s\n",
+			name, strerror(errno));
+		return false;
+	}
+	fprintf(csv, "sequence,timestamp,dqbuf,qbuf,latency_us,interval_us,hold_us,queued,ready\n");
+	return true;
+}
+
+void stream_stats::close_csv()
+{
+	write_row(-1);
+	if (csv)
+		fclose(csv);
+	csv = nullptr;
+}
+
+/* Rebuild the list of driver owned buffers, returns the number of ready ones */
+unsigned stream_stats::sync_bufs(cv4l_fd &fd, cv4l_queue &q)
+{
+	cv4l_buffer qbuf(q);
+	unsigned ready = 0;
+
+	driver_bufs.clear();
+	num_bufs = q.g_buffers();
+	for (unsigned i = 0; i < num_bufs; i++) {
+		if (fd.querybuf(qbuf, i))
+			continue;
+		if (qbuf.g_flags() & V4L2_BUF_FLAG_DONE)
+			ready++;
+		else if (!(qbuf.g_flags() & V4L2_BUF_FLAG_QUEUED))
+			continue;
+		driver_bufs.push_back(i);
+	}
+	return ready;
+}
+
+/*
+ * Drivers complete buffers in the order they were queued, so the ready
+ * buffers are at the head of the list.
+ */
+unsigned stream_stats::count_ready(cv4l_fd &fd, cv4l_queue &q)
+{
+	cv4l_buffer qbuf(q);
+	unsigned ready = 0;
+
+	for (unsigned index : driver_bufs) {
+		if (fd.querybuf(qbuf, index))
+			return sync_bufs(fd, q);
+		if (qbuf.g_flags() & V4L2_BUF_FLAG_DONE)
+			ready++;
+		else if (qbuf.g_flags() & V4L2_BUF_FLAG_QUEUED)
+			break;
+		else
+			return sync_bufs(fd, q);
+	}
+	return ready;
+}
+
+void stream_stats::dqbuf(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf, double now)
+{
+	cv4l_disable_trace dt(fd);
+	double buf_ts = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1e6;
+
+	write_row(-1);
+	pending = true;
+	samples++;
+	seq = buf.g_sequence();
+	ts = buf_ts;
+	dq = now;
+
+	lat = -1;
+	if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+	    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC && buf_ts > 0) {
+		lat = now - buf_ts;
+		latency.add(to_ns(lat));
+	}
+
+	/* Fall back to the DQBUF time if the driver doesn't set timestamps */
+	if (buf_ts <= 0)
+		buf_ts = now;
+	ival = -1;
+	if (last_ts >= 0) {
+		ival = buf_ts - last_ts;
+		interval.add(to_ns(ival));
+		if (last_interval >= 0)
+			jitter.add(to_ns(std::abs(ival - last_interval)));
+		last_interval = ival;
+	}
+	last_ts = buf_ts;
+
+	auto it = std::find(driver_bufs.begin(), driver_bufs.end(), buf.g_index());
+
+	if (num_bufs != q.g_buffers() || it == driver_bufs.end()) {
+		ready = sync_bufs(fd, q);
+	} else {
+		driver_bufs.erase(it);
+		ready = count_ready(fd, q);
+	}
+	queued = driver_bufs.size() - ready;
+	min_queued = std::min(min_queued, queued);
+	max_queued = std::max(max_queued, queued);
+	max_ready = std::max(max_ready, ready);
+	sum_queued += queued;
+	sum_ready += ready;
+}
+
+/* A buffer was queued without going through dqbuf(), e.g. an error frame */
+void stream_stats::requeue(unsigned index)
+{
+	if (!num_bufs)
+		return;
+	auto it = std::find(driver_bufs.begin(), driver_bufs.end(), index);
+
+	if (it != driver_bufs.end())
+		driver_bufs.erase(it);
+	driver_bufs.push_back(index);
+}
+
+void stream_stats::qbuf(unsigned index, double now)
+{
+	requeue(index);
+	if (!pending)
+		return;
+	hold.add(to_ns(now - dq));
+	write_row(now);
+}
+
+static void report_histogram(FILE *f, const char *name, const stats_histogram &h)
+{
+	if (!h.count()) {
+		fprintf(f, "\t%-9s n/a\n", name);
+		return;
+	}
+	fprintf(f, "\t%-9s p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n",
+		name, h.percentile(50) / 1e6, h.percentile(99) / 1e6,
+		h.percentile(99.9) / 1e6, h.max() / 1e6);
+}
+
+void stream_stats::report(FILE *f)
+{
+	write_row(-1);
+	if (csv)
+		fflush(csv);
+	if (!samples)
+		return;
+	fprintf(f, "Stream statistics (%u buffers):\n", samples);
+	report_histogram(f, "latency:", latency);
+	report_histogram(f, "interval:", interval);
+	report_histogram(f, "jitter:", jitter);
+	report_histogram(f, "hold:", hold);
+	fprintf(f, "\tqueued:   min %u, avg %.2f, max %u\n",
+		min_queued, static_cast<double>(sum_queued) / samples, max_queued);
+	fprintf(f, "\tready:    avg %.2f, max %u\n",
+		static_cast<double>(sum_ready) / samples, max_ready);
+}
+
+static stream_stats cap_stats;
+
+static double monotonic_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
 void streaming_usage()
 {
 	printf("\nVideo Streaming options:\n"
@@ -266,6 +656,9 @@ void streaming_usage()
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
 	       "  --stream-to-host <hostname[:port]>\n"
                "                     stream to this host. The default port is %d.\n"
+	       "  --stream-to-udp <hostname[:port]>\n"
+	       "                     stream to this host or multicast group over UDP.\n"
+	       "                     The default port is %d.\n"
 	       "  --stream-lossless  always use lossless video compression.\n"
 #endif
 	       "  --stream-poll      use non-blocking mode and select() to stream.\n"
@@ -274,9 +667,20 @@ void streaming_usage()
 	       "                     output the difference between the buffer timestamp and current\n"
 	       "                     clock, if the buffer timestamp source is the monotonic clock.\n"
 	       "                     Requires --verbose as well.\n"
+	       "  --stream-stats [<file>]\n"
+	       "                     report the latency, interval, jitter and hold time of the\n"
+	       "                     capture buffers and the capture queue depth when streaming\n"
+	       "                     ends. If <file> is given, also write one CSV row per buffer\n"
+	       "                     to that file.\n"
 	       "  --stream-mmap <count>\n"
 	       "                     capture video using mmap() [VIDIOC_(D)QBUF]\n"
 	       "                     count: the number of buffers to allocate. The default is 3.\n"
+	       "  --stream-grow <max>\n"
+	       "                     when capture frames are dropped, add buffers to the queue\n"
+	       "                     with VIDIOC_CREATE_BUFS, up to <max> buffers in total. Once no\n"
+	       "                     frames were dropped for %d buffers, remove one of the added\n"
+	       "                     buffers again if the driver supports VIDIOC_REMOVE_BUFS.\n"
+	       "                     Not supported in combination with --stream-dmabuf.\n"
 	       "  --stream-user <count>\n"
 	       "                     capture video using user pointers [VIDIOC_(D)QBUF]\n"
 	       "                     count: the number of buffers to allocate. The default is 3.\n"
@@ -289,6 +693,9 @@ void streaming_usage()
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
 	       "  --stream-from-host <hostname[:port]>\n"
 	       "                     stream from this host. The default port is %d.\n"
+	       "  --stream-from-udp <[group][:port]>\n"
+	       "                     stream from UDP port <port>, optionally joining multicast\n"
+	       "                     group <group>. The default port is %d.\n"
 	       "  --stream-no-query  Do not query and set the DV timings or standard before streaming.\n"
 	       "  --stream-loop      loop when the end of the file we are streaming from is reached.\n"
 	       "                     The default is to stop.\n"
@@ -321,6 +728,9 @@ void streaming_usage()
 	       "                     and the range is [-3...3].\n"
 	       "  --stream-out-perc-fill <percentage>\n"
 	       "                     percentage of the frame to actually fill. The default is 100%%.\n"
+	       "  --stream-out-threads <count>\n"
+	       "                     use <count> threads to generate the test pattern. If <count>\n"
+	       "                     is 0, then one thread per CPU is used. The default is 1.\n"
 	       "  --stream-out-buf-caps\n"
 	       "                     show output buffer capabilities\n"
 	       "  --stream-out-mmap <count>\n"
@@ -349,9 +759,9 @@ void streaming_usage()
 	       "  --list-buffers-meta\n"
 	       "                     list all Meta RX buffers [VIDIOC_QUERYBUF]\n",
 #ifndef NO_STREAM_TO
-		V4L_STREAM_PORT,
+		V4L_STREAM_PORT, V4L_STREAM_PORT,
 #endif
-	       	V4L_STREAM_PORT);
+		GROW_IDLE_BUFS, V4L_STREAM_PORT, V4L_STREAM_PORT);
 }
 
 static void get_codec_type(cv4l_fd &fd)
@@ -660,6 +1070,9 @@ void streaming_cmd(int ch, char *optarg)
 	case OptStreamNoQuery:
 		stream_no_query = true;
 		break;
+	case OptStreamStats:
+		stats_csv_file = optarg;
+		break;
 	case OptStreamLoop:
 		stream_loop = true;
 		break;
@@ -731,6 +1144,9 @@ void streaming_cmd(int ch, char *optarg)
 		if (stream_out_perc_fill < 1)
 			stream_out_perc_fill = 1;
 		break;
+	case OptStreamOutThreads:
+		stream_out_threads = strtoul(optarg, nullptr, 0);
+		break;
 	case OptStreamTo:
 		file_to = optarg;
 		to_with_hdr = false;
@@ -745,6 +1161,11 @@ void streaming_cmd(int ch, char *optarg)
 		break;
 	case OptStreamToHost:
 		host_to = optarg;
+		host_udp_to = false;
+		break;
+	case OptStreamToUdp:
+		host_to = optarg;
+		host_udp_to = true;
 		break;
 	case OptStreamLossless:
 		host_lossless = true;
@@ -759,6 +1180,11 @@ void streaming_cmd(int ch, char *optarg)
 		break;
 	case OptStreamFromHost:
 		host_from = optarg;
+		host_udp_from = false;
+		break;
+	case OptStreamFromUdp:
+		host_from = optarg;
+		host_udp_from = true;
 		break;
 	case OptStreamUser:
 		memory = V4L2_MEMORY_USERPTR;
@@ -770,6 +1196,9 @@ void streaming_cmd(int ch, char *optarg)
 				reqbufs_count_cap = 3;
 		}
 		break;
+	case OptStreamGrow:
+		stream_grow_max = strtoul(optarg, nullptr, 0);
+		break;
 	case OptStreamDmaBuf:
 		memory = V4L2_MEMORY_DMABUF;
 		break;
@@ -972,6 +1401,61 @@ static bool read_write_padded_frame(cv4l_fmt &fmt, unsigned char *buf,
 	return true;
 }
 
+/*
+ * Wait for the next complete UDP message and make it available through
+ * udp_msg_fin. If skip_hdr is true, then the stream and format headers at
+ * the start of the message are skipped as well, so udp_msg_fin is positioned
+ * at the FRAME_VIDEO or END packet.
+ */
+static bool read_udp_msg(bool skip_hdr)
+{
+	__u8 dgram[V4L_STREAM_UDP_MAX_DGRAM_SIZE];
+	struct sockaddr_in src_addr;
+	int ret;
+
+	do {
+		socklen_t addr_len = sizeof(src_addr);
+		ssize_t n = recvfrom(host_fd_from, dgram, sizeof(dgram), 0,
+				     reinterpret_cast<struct sockaddr *>(&src_addr), &addr_len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "could not receive datagram: %s\n", strerror(errno));
+			return false;
+		}
+		ret = v4l_stream_udp_rx_add(&udp_rx, dgram, n);
+		if (ret == -ENOMEM) {
+			fprintf(stderr, "could not allocate UDP message buffer\n");
+			return false;
+		}
+		if (udp_rx.refresh) {
+			v4l_stream_udp_send_refresh(host_fd_from,
+						    reinterpret_cast<struct sockaddr *>(&src_addr),
+						    addr_len, udp_rx.next_seq - 1);
+			udp_rx.refresh = false;
+		}
+	} while (ret != V4L_STREAM_UDP_RX_MSG);
+
+	if (udp_msg_fin)
+		fclose(udp_msg_fin);
+	udp_msg_fin = fmemopen(udp_rx.buf, udp_rx.size, "r");
+	if (!udp_msg_fin) {
+		fprintf(stderr, "could not open UDP message\n");
+		return false;
+	}
+	if (!skip_hdr)
+		return true;
+
+	if (udp_rx.size < udp_hdr_from.size() ||
+	    memcmp(udp_rx.buf, udp_hdr_from.data(), udp_hdr_from.size())) {
+		fprintf(stderr, "the format of the UDP stream changed\n");
+		return false;
+	}
+	fseek(udp_msg_fin, udp_hdr_from.size(), SEEK_SET);
+	return true;
+}
+
 static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 				  cv4l_fmt &fmt, FILE *fin)
 {
@@ -979,6 +1463,13 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 	static bool is_fwht = false;
 
 	if (host_fd_from >= 0) {
+		if (host_udp_from) {
+			if (udp_msg_pending)
+				udp_msg_pending = false;
+			else if (!read_udp_msg(true))
+				return false;
+			fin = udp_msg_fin;
+		}
 		for (;;) {
 			unsigned packet = read_u32(fin);
 
@@ -1188,6 +1679,11 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 			V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP;
 
 	if (is_video) {
+		if (stream_out_threads != 1 && !tpg_pool)
+			tpg_pool = tpg_pool_alloc(stream_out_threads);
+		if (!tpg_cache)
+			tpg_cache = tpg_cache_alloc();
+		tpg_cache_invalidate(tpg_cache);
 		tpg_init(&tpg, 640, 360);
 		tpg_alloc(&tpg, fmt.g_width());
 		can_fill = tpg_s_fourcc(&tpg, fmt.g_pixelformat());
@@ -1221,7 +1717,11 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 			break;
 		}
 		field = output_field;
-		if (can_fill && ((V4L2_FIELD_HAS_T_OR_B(field) && (stream_count & 1)) ||
+		/*
+		 * Refilling is cheap for static patterns: tpg_cache skips
+		 * buffers that already contain the right frame.
+		 */
+		if (can_fill && (tpg_cache || (V4L2_FIELD_HAS_T_OR_B(field) && (stream_count & 1)) ||
 				 !tpg_pattern_is_static(&tpg)))
 			stream_out_refresh = true;
 	}
@@ -1249,7 +1749,9 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 
 			if (can_fill) {
 				for (unsigned j = 0; j < q.g_num_planes(); j++)
-					tpg_fillbuffer(&tpg, stream_out_std, j, static_cast<u8 *>(q.g_dataptr(i, j)));
+					tpg_fillbuffer_cached(&tpg, tpg_cache, tpg_pool,
+							      stream_out_std, j,
+							      static_cast<u8 *>(q.g_dataptr(i, j)));
 			}
 		}
 		if (is_meta)
@@ -1310,6 +1812,28 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 	return 0;
 }
 
+#ifndef NO_STREAM_TO
+/*
+ * Send everything written to fout since the previous call as a single
+ * UDP message, prefixed by the stream and format headers.
+ */
+static void send_udp_msg(FILE *fout, bool key)
+{
+	int ret;
+
+	fflush(fout);
+	ret = v4l_stream_udp_send(host_fd_to,
+				  reinterpret_cast<struct sockaddr *>(&udp_addr_to),
+				  sizeof(udp_addr_to), udp_seq_to++,
+				  key ? V4L_STREAM_UDP_FL_KEY : 0,
+				  udp_hdr_to.data(), udp_hdr_to.size(),
+				  reinterpret_cast<__u8 *>(udp_msg_to), udp_msg_to_size);
+	if (ret < 0)
+		fprintf(stderr, "could not send UDP message: %s\n", strerror(-ret));
+	rewind(fout);
+}
+#endif
+
 static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
 				 cv4l_fmt &fmt, FILE *fout)
 {
@@ -1321,6 +1845,8 @@ static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
 		unsigned tot_comp_size = 0;
 		unsigned tot_used = 0;
 
+		if (host_udp_to && ctx && v4l_stream_udp_refresh_requested(host_fd_to))
+			ctx->state.gop_cnt = 0;
 		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
 			__u32 used = buf.g_bytesused(j);
 			unsigned offset = buf.g_data_offset(j);
@@ -1380,11 +1906,82 @@ static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
 		if (sz != used)
 			fprintf(stderr, "%u != %u\n", sz, used);
 	}
-	if (host_fd_to >= 0)
+	if (host_udp_to) {
+		bool key = true;
+
+		for (unsigned j = 0; ctx && j < buf.g_num_planes(); j++)
+			key = key && fwht_is_i_frame(comp_ptr[j]);
+		send_udp_msg(fout, key);
+	} else if (host_fd_to >= 0) {
 		fflush(fout);
+	}
 #endif
 }
 
+static void stream_grow_init(cv4l_queue &q)
+{
+	grow_active = stream_grow_max > q.g_buffers();
+	grow_min_bufs = q.g_buffers();
+	grow_idle = 0;
+	grow_have_seq = false;
+}
+
+/*
+ * Policy for --stream-grow: frames dropped by the driver mean that it ran
+ * out of buffers because we fell behind, so add buffers to absorb the
+ * burst. Once we've kept up for a while, remove the added buffers again,
+ * one at a time, when they come back from the driver.
+ *
+ * Returns true if buf was removed, so it must not be requeued.
+ */
+static bool stream_grow_adjust(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf)
+{
+	__u32 seq = buf.g_sequence();
+	unsigned dropped = grow_have_seq && seq > grow_last_seq + 1 ?
+		seq - grow_last_seq - 1 : 0;
+
+	grow_have_seq = true;
+	grow_last_seq = seq;
+
+	if (dropped) {
+		unsigned from = q.g_buffers();
+		unsigned count = std::min(dropped, stream_grow_max - std::min(from, stream_grow_max));
+
+		grow_idle = 0;
+		if (!count)
+			return false;
+		if (q.create_bufs(&fd, count) || q.obtain_bufs(&fd, from)) {
+			fprintf(stderr, "could not add buffers, disabling --stream-grow\n");
+			grow_active = false;
+			return false;
+		}
+		for (unsigned i = from; i < q.g_buffers(); i++) {
+			cv4l_buffer new_buf(q, i);
+
+			if (fd.qbuf(new_buf)) {
+				fprintf(stderr, "could not queue added buffer %u\n", i);
+				grow_active = false;
+				return false;
+			}
+		}
+		if (verbose)
+			fprintf(stderr, "\nincreased capture queue to %u buffers\n",
+				q.g_buffers());
+		return false;
+	}
+
+	if (++grow_idle < GROW_IDLE_BUFS || q.g_buffers() <= grow_min_bufs ||
+	    buf.g_index() != q.g_buffers() - 1 || !q.has_remove_bufs())
+		return false;
+	if (q.remove_bufs(&fd, 1))
+		return false;
+	grow_idle = 0;
+	if (verbose)
+		fprintf(stderr, "\ndecreased capture queue to %u buffers\n",
+			q.g_buffers());
+	return true;
+}
+
 static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
 			 bool ignore_count_skip)
@@ -1413,8 +2010,13 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
 		if (fd.qbuf(buf))
 			return QUEUE_ERROR;
+		if (options[OptStreamStats])
+			cap_stats.requeue(buf.g_index());
 	}
 
+	if (options[OptStreamStats])
+		cap_stats.dqbuf(fd, q, buf, monotonic_now());
+
 	bool is_empty_frame = !buf.g_bytesused(0);
 	bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
 
@@ -1436,7 +2038,8 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 				     host_fd_to >= 0 ? 100 - comp_perc / comp_perc_count : -1);
 		comp_perc_count = comp_perc = 0;
 	}
-	if (!last_buffer && index == nullptr) {
+	if (!last_buffer && index == nullptr &&
+	    !(grow_active && stream_grow_adjust(fd, q, buf))) {
 		/*
 		 * EINVAL in qbuf can happen if this is the last buffer before
 		 * a dynamic resolution change sequence. In this case the buffer
@@ -1447,6 +2050,8 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 			fprintf(stderr, "%s: qbuf error\n", __func__);
 			return QUEUE_ERROR;
 		}
+		if (options[OptStreamStats])
+			cap_stats.qbuf(buf.g_index(), monotonic_now());
 	}
 	if (index)
 		*index = buf.g_index();
@@ -1571,8 +2176,8 @@ static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap
 
 	if (!fin && stream_out_refresh) {
 		for (unsigned j = 0; j < buf.g_num_planes(); j++)
-			tpg_fillbuffer(&tpg, stream_out_std, j,
-				       static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)));
+			tpg_fillbuffer_cached(&tpg, tpg_cache, tpg_pool, stream_out_std, j,
+					      static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)));
 	}
 	if (is_meta)
 		meta_fillbuffer(buf, fmt, q);
@@ -1694,7 +2299,7 @@ static FILE *open_output_file(cv4l_fd &fd)
 		host_port_to = strtoul(p + 1, nullptr, 0);
 		*p = '\0';
 	}
-	host_fd_to = socket(AF_INET, SOCK_STREAM, 0);
+	host_fd_to = socket(AF_INET, host_udp_to ? SOCK_DGRAM : SOCK_STREAM, 0);
 	if (host_fd_to < 0) {
 		fprintf(stderr, "cannot open socket");
 		std::exit(EXIT_SUCCESS);
@@ -1710,11 +2315,25 @@ static FILE *open_output_file(cv4l_fd &fd)
 	       server->h_addr,
 	       server->h_length);
 	serv_addr.sin_port = htons(host_port_to);
-	if (connect(host_fd_to, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
-		fprintf(stderr, "could not connect\n");
-		std::exit(EXIT_SUCCESS);
+	if (host_udp_to) {
+		/*
+		 * The socket is not connected so REFRESH datagrams from
+		 * the multicast receivers can be received.
+		 */
+		if (IN_MULTICAST(ntohl(serv_addr.sin_addr.s_addr))) {
+			unsigned char ttl = 8;
+
+			setsockopt(host_fd_to, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+		}
+		udp_addr_to = serv_addr;
+		fout = open_memstream(&udp_msg_to, &udp_msg_to_size);
+	} else {
+		if (connect(host_fd_to, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
+			fprintf(stderr, "could not connect\n");
+			std::exit(EXIT_SUCCESS);
+		}
+		fout = fdopen(host_fd_to, "a");
 	}
-	fout = fdopen(host_fd_to, "a");
 	write_u32(fout, V4L_STREAM_ID);
 	write_u32(fout, V4L_STREAM_VERSION);
 	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO);
@@ -1748,6 +2367,10 @@ static FILE *open_output_file(cv4l_fd &fd)
 				 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
 	}
 	fflush(fout);
+	if (host_udp_to) {
+		udp_hdr_to.assign(udp_msg_to, udp_msg_to + udp_msg_to_size);
+		rewind(fout);
+	}
 #endif
 	return fout;
 }
@@ -1842,6 +2465,8 @@ recover:
 		goto done;
 
 	fps_ts.determine_field(fd.g_fd(), q.g_type());
+	if (!options[OptStreamDmaBuf])
+		stream_grow_init(q);
 
 	if (fd.streamon())
 		goto done;
@@ -1926,10 +2551,72 @@ done:
 	if (fout && fout != stdout) {
 		if (host_fd_to >= 0)
 			write_u32(fout, V4L_STREAM_PACKET_END);
+#ifndef NO_STREAM_TO
+		if (host_udp_to) {
+			send_udp_msg(fout, true);
+			close(host_fd_to);
+		}
+#endif
 		fclose(fout);
+#ifndef NO_STREAM_TO
+		if (host_udp_to)
+			free(udp_msg_to);
+#endif
 	}
 }
 
+static FILE *open_udp_input()
+{
+	struct sockaddr_in serv_addr = {};
+	int reuse = 1;
+
+	host_fd_from = socket(AF_INET, SOCK_DGRAM, 0);
+	if (host_fd_from < 0) {
+		fprintf(stderr, "could not opening socket\n");
+		std::exit(EXIT_FAILURE);
+	}
+	// Allow multiple receivers of the same multicast group on this host
+	setsockopt(host_fd_from, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = INADDR_ANY;
+	serv_addr.sin_port = htons(host_port_from);
+	if (bind(host_fd_from, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
+		fprintf(stderr, "could not bind\n");
+		std::exit(EXIT_FAILURE);
+	}
+	if (host_from[0]) {
+		struct ip_mreq mreq = {};
+
+		if (!inet_aton(host_from, &mreq.imr_multiaddr) ||
+		    !IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr))) {
+			fprintf(stderr, "%s is not a multicast group address\n", host_from);
+			std::exit(EXIT_FAILURE);
+		}
+		mreq.imr_interface.s_addr = INADDR_ANY;
+		if (setsockopt(host_fd_from, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+			       &mreq, sizeof(mreq)) < 0) {
+			fprintf(stderr, "could not join multicast group %s\n", host_from);
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	v4l_stream_udp_rx_init(&udp_rx);
+	if (!read_udp_msg(false))
+		std::exit(EXIT_FAILURE);
+	return udp_msg_fin;
+}
+
+static void close_udp_input()
+{
+	if (!host_udp_from || host_fd_from < 0)
+		return;
+	fprintf(stderr, "UDP: %u frames, %u lost, %u skipped waiting for a key frame\n",
+		udp_rx.msgs, udp_rx.lost_msgs, udp_rx.skipped_msgs);
+	if (udp_msg_fin)
+		fclose(udp_msg_fin);
+	udp_msg_fin = nullptr;
+	v4l_stream_udp_rx_free(&udp_rx);
+}
+
 static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 {
 	FILE *fin = nullptr;
@@ -1954,6 +2641,10 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 		host_port_from = strtoul(p + 1, nullptr, 0);
 		*p = '\0';
 	}
+	if (host_udp_from) {
+		fin = open_udp_input();
+		goto parse_hdr;
+	}
 	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (listen_fd < 0) {
 		fprintf(stderr, "could not opening socket\n");
@@ -1974,6 +2665,8 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 		std::exit(EXIT_FAILURE);
 	}
 	fin = fdopen(host_fd_from, "r");
+
+parse_hdr:
 	if (read_u32(fin) != V4L_STREAM_ID) {
 		fprintf(stderr, "unknown protocol ID\n");
 		std::exit(EXIT_FAILURE);
@@ -2053,6 +2746,17 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 		fprintf(stderr, "failed to set new format\n");
 		std::exit(EXIT_FAILURE);
 	}
+	if (host_udp_from) {
+		/*
+		 * Remember the headers to check that later messages use the
+		 * same format, and keep the FRAME_VIDEO packet of this first
+		 * message for the first buffer. The returned FILE is only used
+		 * to close the socket when done.
+		 */
+		udp_hdr_from.assign(udp_rx.buf, udp_rx.buf + ftell(fin));
+		udp_msg_pending = true;
+		fin = fdopen(host_fd_from, "r");
+	}
 	return fin;
 }
 
@@ -2187,6 +2891,7 @@ done:
 		exp_q.close_exported_fds();
 	if (fin && fin != stdin)
 		fclose(fin);
+	close_udp_input();
 }
 
 enum stream_type {
@@ -2871,6 +3576,13 @@ void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd)
 	get_out_crop_rect(fd);
 	get_codec_type(fd);
 
+	grow_active = false;
+	if (options[OptStreamStats]) {
+		cap_stats.reset();
+		if (stats_csv_file && !cap_stats.open_csv(stats_csv_file))
+			return;
+	}
+
 	if (do_cap && do_out && out_fd.g_fd() < 0)
 		streaming_set_m2m(fd, exp_fd);
 	else if (do_cap && do_out)
@@ -2880,6 +3592,16 @@ void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd)
 	else if (do_out)
 		streaming_set_out(fd, exp_fd);
 
+	if (options[OptStreamStats]) {
+		cap_stats.report(stderr);
+		cap_stats.close_csv();
+	}
+
+	tpg_cache_free(tpg_cache);
+	tpg_cache = nullptr;
+	tpg_pool_free(tpg_pool);
+	tpg_pool = nullptr;
+
 	fd.s_trace(old_trace_fd);
 	out_fd.s_trace(old_trace_out_fd);
 	exp_fd.s_trace(old_trace_exp_fd);
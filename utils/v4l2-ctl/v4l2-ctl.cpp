@@ -242,15 +242,19 @@ static struct option long_options[] = {
 	{"stream-to-hdr", required_argument, nullptr, OptStreamToHdr},
 	{"stream-lossless", no_argument, nullptr, OptStreamLossless},
 	{"stream-to-host", required_argument, nullptr, OptStreamToHost},
+	{"stream-to-udp", required_argument, nullptr, OptStreamToUdp},
 #endif
 	{"stream-buf-caps", no_argument, nullptr, OptStreamBufCaps},
 	{"stream-show-delta-now", no_argument, nullptr, OptStreamShowDeltaNow},
+	{"stream-stats", optional_argument, nullptr, OptStreamStats},
 	{"stream-mmap", optional_argument, nullptr, OptStreamMmap},
+	{"stream-grow", required_argument, nullptr, OptStreamGrow},
 	{"stream-user", optional_argument, nullptr, OptStreamUser},
 	{"stream-dmabuf", no_argument, nullptr, OptStreamDmaBuf},
 	{"stream-from", required_argument, nullptr, OptStreamFrom},
 	{"stream-from-hdr", required_argument, nullptr, OptStreamFromHdr},
 	{"stream-from-host", required_argument, nullptr, OptStreamFromHost},
+	{"stream-from-udp", required_argument, nullptr, OptStreamFromUdp},
 	{"stream-out-pattern", required_argument, nullptr, OptStreamOutPattern},
 	{"stream-out-square", no_argument, nullptr, OptStreamOutSquare},
 	{"stream-out-border", no_argument, nullptr, OptStreamOutBorder},
@@ -264,6 +268,7 @@ static struct option long_options[] = {
 	{"stream-out-hor-speed", required_argument, nullptr, OptStreamOutHorSpeed},
 	{"stream-out-vert-speed", required_argument, nullptr, OptStreamOutVertSpeed},
 	{"stream-out-perc-fill", required_argument, nullptr, OptStreamOutPercFill},
+	{"stream-out-threads", required_argument, nullptr, OptStreamOutThreads},
 	{"stream-out-buf-caps", no_argument, nullptr, OptStreamOutBufCaps},
 	{"stream-out-mmap", optional_argument, nullptr, OptStreamOutMmap},
 	{"stream-out-user", optional_argument, nullptr, OptStreamOutUser},
@@ -222,15 +222,19 @@ enum Option {
 	OptStreamTo,
 	OptStreamToHdr,
 	OptStreamToHost,
+	OptStreamToUdp,
 	OptStreamLossless,
 	OptStreamShowDeltaNow,
+	OptStreamStats,
 	OptStreamBufCaps,
 	OptStreamMmap,
+	OptStreamGrow,
 	OptStreamUser,
 	OptStreamDmaBuf,
 	OptStreamFrom,
 	OptStreamFromHdr,
 	OptStreamFromHost,
+	OptStreamFromUdp,
 	OptStreamOutPattern,
 	OptStreamOutSquare,
 	OptStreamOutBorder,
@@ -239,6 +243,7 @@ enum Option {
 	OptStreamOutHorSpeed,
 	OptStreamOutVertSpeed,
 	OptStreamOutPercFill,
+	OptStreamOutThreads,
 	OptStreamOutAlphaComponent,
 	OptStreamOutAlphaRedOnly,
 	OptStreamOutRGBLimitedRange,